@@ -0,0 +1,94 @@
+/*
+ * String churn: a window of live strings where the oldest is freed as each
+ * new one is made, like the temporaries of string concatenation. Every string
+ * is a header plus a buffer, allocated either from the pool or with realloc
+ * as before. Each allocator runs in its own process so the peak RSS of one
+ * does not hide the other's.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "gc.h"
+#include "object.h"
+#include "pool.h"
+
+#define STRINGS 20000000
+#define WINDOW 100000
+
+typedef struct Churned {
+  ObjString *string;
+  int length;
+} Churned;
+
+static Churned window[WINDOW];
+
+static void churn(bool pooled) {
+  GC gc;
+  initGC(&gc);
+  uint32_t seed = 12345;
+
+  for (int i = 0; i < STRINGS; i++) {
+    Churned *slot = &window[i % WINDOW];
+    if (slot->string != NULL) {
+      if (pooled) {
+        POOL_FREE_ARRAY(&gc, MEM_OBJ_STRING, char, slot->string->chars,
+                        slot->length + 1);
+        POOL_FREE(&gc, MEM_OBJ_STRING, ObjString, slot->string);
+      } else {
+        FREE_ARRAY(&gc, MEM_OBJ_STRING, char, slot->string->chars,
+                   slot->length + 1);
+        FREE(&gc, MEM_OBJ_STRING, ObjString, slot->string);
+      }
+    }
+
+    // Mostly short names and words, occasionally a longer line.
+    seed = seed * 1103515245 + 12345;
+    int length = (seed >> 16) % 100 < 95 ? (seed >> 8) % 24 + 1
+                                         : (seed >> 8) % 200 + 24;
+
+    ObjString *string;
+    if (pooled) {
+      string = POOL_ALLOCATE(&gc, MEM_OBJ_STRING, ObjString, 1);
+      string->chars = POOL_ALLOCATE(&gc, MEM_OBJ_STRING, char, length + 1);
+    } else {
+      string = ALLOCATE(&gc, MEM_OBJ_STRING, ObjString, 1);
+      string->chars = ALLOCATE(&gc, MEM_OBJ_STRING, char, length + 1);
+    }
+    memset(string->chars, 'a', length);
+    string->chars[length] = '\0';
+    string->length = length;
+
+    slot->string = string;
+    slot->length = length;
+  }
+  // The process exits straight after, which releases what is left.
+}
+
+static void run(const char *name, bool pooled) {
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    double start = benchNow();
+    churn(pooled);
+    double seconds = benchNow() - start;
+    fprintf(stderr, "alloc: %-7s %.1f M strings/s", name,
+            STRINGS / seconds / 1e6);
+    _exit(0);
+  }
+
+  int status;
+  struct rusage usage;
+  wait4(pid, &status, 0, &usage);
+  fprintf(stderr, ", peak RSS %ld KB\n", usage.ru_maxrss);
+}
+
+int main(void) {
+  run("realloc", false);
+  run("pool", true);
+  return 0;
+}
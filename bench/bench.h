@@ -0,0 +1,58 @@
+#ifndef HYDRO_BENCH_H
+#define HYDRO_BENCH_H
+
+/*
+ * Minimal helpers shared by the benchmarks. Each benchmark is its own program
+ * built by `make bench`, with the interpreter compiled at -O2 and without the
+ * debug tracing macros so the numbers reflect a release build.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Seconds on a monotonic clock, for measuring elapsed wall time.
+static inline double benchNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// A growable, NUL-terminated string used to build synthetic sources.
+typedef struct BenchBuffer {
+  char *chars;
+  size_t length;
+  size_t capacity;
+} BenchBuffer;
+
+static inline void benchAppend(BenchBuffer *buffer, const char *str) {
+  size_t n = 0;
+  while (str[n] != '\0')
+    n++;
+
+  if (buffer->length + n + 1 > buffer->capacity) {
+    size_t capacity = buffer->capacity < 4096 ? 4096 : buffer->capacity;
+    while (buffer->length + n + 1 > capacity)
+      capacity *= 2;
+
+    buffer->chars = realloc(buffer->chars, capacity);
+    if (buffer->chars == NULL) {
+      fprintf(stderr, "Benchmark ran out of memory.\n");
+      exit(EXIT_FAILURE);
+    }
+    buffer->capacity = capacity;
+  }
+
+  for (size_t i = 0; i < n; i++)
+    buffer->chars[buffer->length++] = str[i];
+  buffer->chars[buffer->length] = '\0';
+}
+
+static inline void benchFree(BenchBuffer *buffer) {
+  free(buffer->chars);
+  buffer->chars = NULL;
+  buffer->length = buffer->capacity = 0;
+}
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Calls to functions defined with `fun`. Recursive fib counts the calls made
+ * and reports the calls per second and the time per call. Then a loop calling
+ * a function returning its argument, and one calling a native doing the same,
+ * against the same loop using the argument directly, to give the cost of a
+ * call and return alone. Last, recursion counting down in tail calls, which
+ * reuse the frame, against the same recursion keeping its frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define FIB_N 30
+#define ITERATIONS 5000000
+#define RUNS 3
+#define DEPTH 50 // Of the recursion counting down, within FRAMES_MAX.
+
+static Value nativeIdentity(__attribute__((unused)) int argCount,
+                            Value *args) {
+  return args[0];
+}
+
+static double bestRun(const char *source) {
+  VM vm;
+  initVM(&vm);
+  defineNative(&vm, "identity", nativeIdentity, 1);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk, &vm.gc, &vm.strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = benchNow();
+    if (interpretChunk(&vm, &chunk) != INTERPRET_OK) {
+      fprintf(stderr, "Benchmark script failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    double seconds = benchNow() - start;
+    if (run == 0 || seconds < best)
+      best = seconds;
+  }
+
+  freeChunk(&vm.gc, &chunk);
+  freeVM(&vm);
+  return best;
+}
+
+// Calls made by fib(n), including the first.
+static double fibCalls(int n) {
+  double a = 1, b = 1; // Calls of fib(0) and fib(1).
+  for (int i = 2; i <= n; i++) {
+    double c = a + b + 1;
+    a = b;
+    b = c;
+  }
+  return n == 0 ? a : b;
+}
+
+int main(void) {
+  char source[256];
+
+  snprintf(source, sizeof(source),
+           "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+           " fib(%d);",
+           FIB_N);
+  double seconds = bestRun(source);
+  double calls = fibCalls(FIB_N);
+  printf("call: fib(%d) %.0f calls %.1f M calls/s, %.1f ns/call\n", FIB_N,
+         calls, calls / seconds / 1e6, seconds / calls * 1e9);
+
+  snprintf(source, sizeof(source),
+           "fun f(x) { return x; }"
+           " { var sum = 0; for (var i = 0; i < %d; i = i + 1)"
+           " sum = sum + f(i); }",
+           ITERATIONS);
+  double callSeconds = bestRun(source);
+  snprintf(source, sizeof(source),
+           "{ var sum = 0; for (var i = 0; i < %d; i = i + 1)"
+           " sum = sum + identity(i); }",
+           ITERATIONS);
+  double nativeSeconds = bestRun(source);
+  snprintf(source, sizeof(source),
+           "{ var sum = 0; for (var i = 0; i < %d; i = i + 1) sum = sum + i; }",
+           ITERATIONS);
+  double inlineSeconds = bestRun(source);
+  printf("call: f(i) %.1f M/s, inline i %.1f M/s, %.1f ns/call\n",
+         ITERATIONS / callSeconds / 1e6, ITERATIONS / inlineSeconds / 1e6,
+         (callSeconds - inlineSeconds) / ITERATIONS * 1e9);
+  printf("call: native identity(i) %.1f M/s, %.1f ns/call\n",
+         ITERATIONS / nativeSeconds / 1e6,
+         (nativeSeconds - inlineSeconds) / ITERATIONS * 1e9);
+
+  // The frames kept are returned through, each handing on a local.
+  snprintf(source, sizeof(source),
+           "fun down(n) { if (n == 0) return 0; return down(n - 1); }"
+           " for (var i = 0; i < %d; i = i + 1) down(%d);",
+           ITERATIONS / DEPTH, DEPTH);
+  double tailSeconds = bestRun(source);
+  snprintf(source, sizeof(source),
+           "fun down(n) { if (n == 0) return 0;"
+           " var r = down(n - 1); return r; }"
+           " for (var i = 0; i < %d; i = i + 1) down(%d);",
+           ITERATIONS / DEPTH, DEPTH);
+  double frameSeconds = bestRun(source);
+  calls = (double)(ITERATIONS / DEPTH) * (DEPTH + 1);
+  printf("call: tail calls %.1f M calls/s, %.1f ns/call, "
+         "keeping frames %.1f M calls/s, %.1f ns/call\n",
+         calls / tailSeconds / 1e6, tailSeconds / calls * 1e9,
+         calls / frameSeconds / 1e6, frameSeconds / calls * 1e9);
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * Calls of functions declared inside others, counting the heap's allocations
+ * per call, young ones included. A function capturing nothing is called
+ * without making a closure, and a closure made once is called without
+ * allocating, while one capturing a local of each call makes a closure and
+ * an upvalue for it. A function with no inner function is the baseline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define ITERATIONS 2000000
+#define RUNS 3
+
+typedef struct Result {
+  double seconds;     // Of the fastest run.
+  double allocations; // Per call, on average over every run.
+} Result;
+
+static size_t allocations(VM *vm) {
+  return vm->gc.stats.allocations + vm->gc.gcStats.youngAllocations;
+}
+
+static Result bestRun(const char *source) {
+  VM vm;
+  initVM(&vm);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk, &vm.gc, &vm.strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  Result result = {0, 0};
+  size_t before = allocations(&vm);
+  for (int run = 0; run < RUNS; run++) {
+    double start = benchNow();
+    if (interpretChunk(&vm, &chunk) != INTERPRET_OK) {
+      fprintf(stderr, "Benchmark script failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    double seconds = benchNow() - start;
+    if (run == 0 || seconds < result.seconds)
+      result.seconds = seconds;
+  }
+  result.allocations =
+      (double)(allocations(&vm) - before) / ((double)ITERATIONS * RUNS);
+
+  freeChunk(&vm.gc, &chunk);
+  freeVM(&vm);
+  return result;
+}
+
+static void report(const char *name, const char *format) {
+  char source[512];
+  snprintf(source, sizeof(source), format, ITERATIONS);
+  Result result = bestRun(source);
+  printf("closure: %-22s %5.1f M calls/s, %.2f allocations/call\n", name,
+         ITERATIONS / result.seconds / 1e6, result.allocations);
+}
+
+int main(void) {
+  report("no inner function",
+         "fun f(x) { var y = x; return y; }"
+         " { var sum = 0; for (var i = 0; i < %d; i = i + 1)"
+         " sum = sum + f(i); }");
+  report("inner capturing none",
+         "fun f(x) { fun g(y) { return y; } return g(x); }"
+         " { var sum = 0; for (var i = 0; i < %d; i = i + 1)"
+         " sum = sum + f(i); }");
+  report("closure made once",
+         "fun counter() { var n = 0; fun next() { n = n + 1; return n; }"
+         " return next; }"
+         " { var next = counter(); var sum = 0;"
+         " for (var i = 0; i < %d; i = i + 1) sum = sum + next(); }");
+  report("closure made each call",
+         "fun f(x) { fun g() { return x; } return g(); }"
+         " { var sum = 0; for (var i = 0; i < %d; i = i + 1)"
+         " sum = sum + f(i); }");
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Compile throughput on a multi-MB source, comparing scanning tokens as the
+ * parser needs them, scanning the whole source up front, and scanning on a
+ * thread running ahead of the parser. Also reports the calls made to the
+ * heap's allocator by compiling a large script, whose repeated names and
+ * literals share constants.
+ */
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "gc.h"
+#include "scanner.h"
+#include "table.h"
+
+#define SOURCE_BYTES (8 * 1024 * 1024)
+#define RUNS 3
+
+// Statements without constants, so the whole source fits in a single chunk.
+static const char *statements[] = {
+    "{ var alpha = true; var beta = !alpha; alpha = beta == alpha; }\n",
+    "// Padding comment, as generated sources tend to carry plenty of them.\n",
+    "{ var gamma = nil; print gamma != nil == !(gamma == false); }\n",
+};
+
+// A script using the same names and literals over and over.
+static const char *script[] = {
+    "var total = 0; var count = 1; var label = \"row\";\n",
+    "{ var price = 19.99; var tax = price * 0.2; total = total + price + tax; "
+    "}\n",
+    "{ var name = label + \": \"; count = count + 1; print name; }\n",
+    "total = total - 0.5 * count; print total >= 100;\n",
+};
+
+// Allocations made by the last run of compileSeconds.
+static size_t lastAllocations;
+
+static double compileSeconds(const char *source, ScanMode mode) {
+  double best = 0;
+
+  for (int run = 0; run < RUNS; run++) {
+    Chunk chunk;
+    GC gc;
+    Table strings;
+    initChunk(&chunk);
+    initGC(&gc);
+    initTable(&strings);
+
+    double start = benchNow();
+    if (!compileWithScanMode(source, &chunk, &gc, &strings, mode)) {
+      fprintf(stderr, "Benchmark source failed to compile.\n");
+      exit(EXIT_FAILURE);
+    }
+    double elapsed = benchNow() - start;
+
+    if (run == 0 || elapsed < best)
+      best = elapsed;
+    lastAllocations = gc.stats.allocations;
+
+    freeTable(&gc, &strings);
+    freeChunk(&gc, &chunk);
+    freeGC(&gc);
+  }
+
+  return best;
+}
+
+int main(void) {
+  BenchBuffer source = {0};
+  int n = sizeof(statements) / sizeof(statements[0]);
+  for (int i = 0; source.length < SOURCE_BYTES; i++)
+    benchAppend(&source, statements[i % n]);
+
+  double mb = source.length / (1024.0 * 1024.0);
+
+  double start = benchNow();
+  Scanner scanner;
+  initScanner(&scanner, source.chars);
+  while (scanToken(&scanner).type != TOKEN_EOF)
+    ;
+  double scanOnly = benchNow() - start;
+
+  double streaming = compileSeconds(source.chars, SCAN_STREAMING);
+  double upfront = compileSeconds(source.chars, SCAN_UPFRONT);
+  double threaded = compileSeconds(source.chars, SCAN_THREADED);
+
+  BenchBuffer scriptSource = {0};
+  n = sizeof(script) / sizeof(script[0]);
+  for (int i = 0; scriptSource.length < SOURCE_BYTES; i++)
+    benchAppend(&scriptSource, script[i % n]);
+  double scriptMb = scriptSource.length / (1024.0 * 1024.0);
+  double scriptSeconds = compileSeconds(scriptSource.chars, SCAN_STREAMING);
+
+  printf("compile: %.1f MB source, scan only %.1f MB/s\n", mb, mb / scanOnly);
+  printf("compile: streaming %.1f MB/s, up front %.1f MB/s, threaded %.1f "
+         "MB/s\n",
+         mb / streaming, mb / upfront, mb / threaded);
+  printf("compile: %.1f MB script in %.0f ms, %zu allocator calls\n",
+         scriptMb, scriptSeconds * 1e3, lastAllocations);
+
+  benchFree(&source);
+  benchFree(&scriptSource);
+  return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * Garbage collection on a string-churn script: each statement concatenates a
+ * string that is dead by the next one, while some results are kept alive in a
+ * window of globals for a while. Compares the generational heap against plain
+ * mark-sweep of every object, each collecting the old generation at once or
+ * incrementally, reporting throughput and a histogram of pause times.
+ *
+ * Then the pause of collecting a heap of millions of dead strings, swept by
+ * the program or on a helper thread, and of marking a heap of live ones with
+ * a gray stack that can grow, or that is too small and rescans the heap.
+ *
+ * Last, a heap where every eighth string of mixed sizes survives, before and
+ * after compacting it: the memory resident, and the time to collect it.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+#define STATEMENTS 400000
+#define WORDS 32
+#define KEPT 64
+#define DEAD_STRINGS 2000000
+#define LIVE_GLOBALS 500000
+#define FRAGMENTED_STRINGS 2000000
+#define FRAGMENTED_KEPT 8
+
+static char *churnScript(void) {
+  BenchBuffer source = {0};
+  char line[128];
+
+  for (int i = 0; i < WORDS; i++) {
+    snprintf(line, sizeof(line), "var w%d = \"word%02d\";\n", i, i);
+    benchAppend(&source, line);
+  }
+  for (int i = 0; i < KEPT; i++) {
+    snprintf(line, sizeof(line), "var k%d = w0;\n", i);
+    benchAppend(&source, line);
+  }
+  benchAppend(&source, "var t = w0;\n");
+
+  uint32_t seed = 1;
+  for (int i = 0; i < STATEMENTS; i++) {
+    seed = seed * 1103515245 + 12345;
+    int a = (seed >> 16) % WORDS, b = (seed >> 8) % WORDS;
+
+    if (i % 16 == 0) {
+      snprintf(line, sizeof(line), "t = w%d + w%d;\n", a, b);
+    } else if (i % 16 == 15) {
+      snprintf(line, sizeof(line), "k%d = t + w%d;\n", (seed >> 4) % KEPT, a);
+    } else {
+      snprintf(line, sizeof(line), "t = t + w%d;\n", a);
+    }
+    benchAppend(&source, line);
+  }
+
+  return source.chars;
+}
+
+static void printHistogram(GCStats *stats) {
+  printf("    pauses:");
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+    if (stats->pauseHistogram[i] == 0)
+      continue;
+    if (i == GC_PAUSE_BUCKETS - 1) {
+      printf(" >=%dus:%zu", 1 << (i - 1), stats->pauseHistogram[i]);
+    } else {
+      printf(" <%dus:%zu", 1 << i, stats->pauseHistogram[i]);
+    }
+  }
+  printf("\n");
+}
+
+static void run(const char *name, const Chunk *chunk, bool generational,
+                bool incremental) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.generational = generational;
+  vm.gc.incremental = incremental;
+
+  double start = benchNow();
+  InterpretResult result = interpretChunk(&vm, chunk);
+  double seconds = benchNow() - start;
+
+  GCStats *stats = &vm.gc.gcStats;
+  size_t pauses = 0;
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    pauses += stats->pauseHistogram[i];
+  printf("gc: %-25s %s %.2f M statements/s, %zu minor + %zu major in %zu "
+         "slices, pauses %.1f ms total, %.3f ms mean, %.3f ms max\n",
+         name, result == INTERPRET_OK ? "ok" : "failed",
+         STATEMENTS / seconds / 1e6, stats->minorCollections,
+         stats->majorCollections, stats->slices, stats->pauseSeconds * 1e3,
+         pauses > 0 ? stats->pauseSeconds * 1e3 / pauses : 0,
+         stats->maxPauseSeconds * 1e3);
+  printHistogram(stats);
+  freeVM(&vm);
+}
+
+static void runSweep(const char *name, bool background, bool incremental) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.backgroundSweep = background;
+  vm.gc.incremental = incremental;
+
+  vm.gc.pretenure = true;
+  char chars[32];
+  for (int i = 0; i < DEAD_STRINGS; i++) {
+    int length = snprintf(chars, sizeof(chars), "dead string %d", i);
+    copyString(&vm.gc, &vm.strings, chars, length);
+  }
+  vm.gc.pretenure = false;
+  size_t heap = vm.gc.stats.bytesAllocated;
+
+  // Slices, or checks for the helper thread being done, back to back.
+  vm.gc.nextCollection = 0;
+  double start = benchNow();
+  do {
+    collectGarbage(&vm.gc);
+  } while (vm.gc.phase != GC_IDLE);
+  double seconds = benchNow() - start;
+
+  printf("sweep: %-23s %d dead strings (%.0f MB), max pause %.2f ms, done "
+         "after %.1f ms\n",
+         name, DEAD_STRINGS, heap / 1e6, vm.gc.gcStats.maxPauseSeconds * 1e3,
+         seconds * 1e3);
+  freeVM(&vm);
+}
+
+static void runMark(const char *name, int grayLimit) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.grayLimit = grayLimit;
+
+  vm.gc.pretenure = true;
+  char chars[32];
+  for (int i = 0; i < LIVE_GLOBALS; i++) {
+    int length = snprintf(chars, sizeof(chars), "global %d", i);
+    ObjString *key = copyString(&vm.gc, &vm.strings, chars, length);
+    length = snprintf(chars, sizeof(chars), "value %d", i);
+    Value value = OBJ_VAL(copyString(&vm.gc, &vm.strings, chars, length));
+    tableSet(&vm.gc, &vm.globals, key, value);
+  }
+  vm.gc.pretenure = false;
+
+  double start = benchNow();
+  collectAllGarbage(&vm.gc);
+  double seconds = benchNow() - start;
+
+  printf("mark: %-23s %d live strings, collected in %.1f ms, %zu rescans, "
+         "%zu KB gray stack\n",
+         name, 2 * LIVE_GLOBALS, seconds * 1e3, vm.gc.gcStats.rescans,
+         vm.gc.stats.markStackBytes / 1024);
+  freeVM(&vm);
+}
+
+// Memory resident in the process, in MB.
+static double residentMB(void) {
+  FILE *file = fopen("/proc/self/statm", "r");
+  long pages = 0, resident = 0;
+  if (file != NULL) {
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(file);
+  }
+  return resident * (double)sysconf(_SC_PAGESIZE) / 1e6;
+}
+
+static double timeCollection(VM *vm) {
+  double start = benchNow();
+  collectAllGarbage(&vm->gc);
+  return benchNow() - start;
+}
+
+static void runCompact(void) {
+  VM vm;
+  initVM(&vm);
+
+  // Strings of 16 to 136 characters, so several size classes are left with
+  // a few survivors in each page.
+  vm.gc.pretenure = true;
+  char chars[160];
+  for (int i = 0; i < FRAGMENTED_STRINGS; i++) {
+    int length = snprintf(chars, sizeof(chars), "%-*d", 16 + i % 121, i);
+    ObjString *string = copyString(&vm.gc, &vm.strings, chars, length);
+    if (i % FRAGMENTED_KEPT == 0)
+      tableSet(&vm.gc, &vm.globals, string, NIL_VAL);
+  }
+  vm.gc.pretenure = false;
+  collectAllGarbage(&vm.gc);
+  size_t heap = vm.gc.stats.bytesAllocated;
+
+  double resident = residentMB(), pool = vm.gc.stats.poolBytes / 1e6;
+  double collection = timeCollection(&vm);
+  double start = benchNow();
+  compactHeap(&vm.gc);
+  double compaction = benchNow() - start;
+
+  printf("compact: %d of %d strings live, %.0f MB heap, compacted in %.1f ms\n",
+         FRAGMENTED_STRINGS / FRAGMENTED_KEPT, FRAGMENTED_STRINGS, heap / 1e6,
+         compaction * 1e3);
+  printf("    before: %.0f MB resident, %.0f MB pool, collected in %.1f ms\n",
+         resident, pool, collection * 1e3);
+  printf("    after:  %.0f MB resident, %.0f MB pool, collected in %.1f ms\n",
+         residentMB(), vm.gc.stats.poolBytes / 1e6, timeCollection(&vm) * 1e3);
+  freeVM(&vm);
+}
+
+int main(void) {
+  char *source = churnScript();
+
+  // Compiled once by its own heap, which outlives the VMs running it.
+  GC gc;
+  Table strings;
+  initGC(&gc);
+  initTable(&strings);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk, &gc, &strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    return EXIT_FAILURE;
+  }
+
+  run("mark-sweep", &chunk, false, false);
+  run("incremental mark-sweep", &chunk, false, true);
+  run("generational", &chunk, true, false);
+  run("incremental generational", &chunk, true, true);
+  runSweep("program", false, false);
+  runSweep("background", true, false);
+  runSweep("incremental background", true, true);
+  runMark("growable gray stack", GC_GRAY_LIMIT);
+  runMark("1024 entry gray stack", 1024);
+  runCompact();
+
+  freeChunk(&gc, &chunk);
+  freeTable(&gc, &strings);
+  freeGC(&gc);
+  free(source);
+  return 0;
+}
@@ -0,0 +1,198 @@
+/*
+ * Loops whose test is a comparison, compiled with the comparison fused into
+ * the loop's jump, against the same chunk with every fused jump split back
+ * into the comparison and a jump on its result, as compiling used to. Then
+ * counting for loops, compiled to OP_FOR_RANGE, against the same loops written
+ * with while. Reports the instructions dispatched per iteration and the
+ * iterations per second.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define ITERATIONS 10000000
+#define RUNS 3
+
+static bool isJump(uint8_t instruction) {
+  return (instruction >= OP_JUMP && instruction <= OP_LOOP) ||
+         instruction == OP_FOR_RANGE;
+}
+
+static bool isBackwardJump(uint8_t instruction) {
+  return instruction == OP_LOOP || instruction == OP_FOR_RANGE;
+}
+
+static bool isFused(uint8_t instruction) {
+  return instruction >= OP_JUMP_IF_NOT_LT && instruction <= OP_JUMP_IF_NOT_GTE;
+}
+
+// Jumps end with their offset from the next instruction.
+static int jumpTarget(const uint8_t *code, int offset) {
+  int next = offset + instructionLength(&code[offset]);
+  int jump = (code[next - 2] << 8) | code[next - 1];
+  return isBackwardJump(code[offset]) ? next - jump : next + jump;
+}
+
+// Copies the chunk with each fused jump split in two, moving every jump's
+// target along with the code. The copy shares the chunk's constants.
+static Chunk unfuse(const Chunk *chunk) {
+  int *moved = malloc(sizeof(int) * (chunk->count + 1));
+  int count = 0;
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    moved[offset] = count;
+    count += instructionLength(&chunk->code[offset]) + isFused(instruction);
+    offset += instructionLength(&chunk->code[offset]);
+  }
+  moved[chunk->count] = count;
+
+  Chunk copy = *chunk;
+  copy.count = copy.capacity = count;
+  copy.code = malloc(count);
+  copy.lines = malloc(sizeof(int) * count);
+  copy.finalized = false;
+
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    int length = instructionLength(&chunk->code[offset]);
+    int to = moved[offset];
+    for (int i = 0; i < length + isFused(instruction); i++)
+      copy.lines[to + i] = chunk->lines[offset];
+
+    if (isFused(instruction)) {
+      // Comparisons are in the same order as their fused jumps.
+      copy.code[to++] = OP_LT + (instruction - OP_JUMP_IF_NOT_LT);
+      instruction = OP_JUMP_IF_FALSE_POP;
+    }
+    copy.code[to] = instruction;
+    for (int i = 1; i < length; i++)
+      copy.code[to + i] = chunk->code[offset + i];
+
+    if (isJump(instruction)) {
+      int next = to + length, target = moved[jumpTarget(chunk->code, offset)];
+      int jump = isBackwardJump(instruction) ? next - target : target - next;
+      copy.code[next - 2] = (jump >> 8) & 0xff;
+      copy.code[next - 1] = jump & 0xff;
+    }
+    offset += length;
+  }
+
+  free(moved);
+  return copy;
+}
+
+// Instructions from the start of the chunk's loop to its jump back, which is
+// every instruction of an iteration when the body has no branches.
+static int loopInstructions(const Chunk *chunk) {
+  int loop = 0;
+  for (int offset = 0; offset < chunk->count;
+       offset += instructionLength(&chunk->code[offset])) {
+    if (isBackwardJump(chunk->code[offset]))
+      loop = offset;
+  }
+
+  int instructions = 0;
+  for (int offset = jumpTarget(chunk->code, loop); offset <= loop;
+       offset += instructionLength(&chunk->code[offset]))
+    instructions++;
+  return instructions;
+}
+
+static double bestRun(VM *vm, const Chunk *chunk) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = benchNow();
+    if (interpretChunk(vm, chunk) != INTERPRET_OK) {
+      fprintf(stderr, "Benchmark script failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    double seconds = benchNow() - start;
+    if (run == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+static void compileOrExit(VM *vm, const char *source, Chunk *chunk) {
+  initChunk(chunk);
+  if (!compile(source, chunk, &vm->gc, &vm->strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void run(const char *name, const char *source) {
+  VM vm;
+  initVM(&vm);
+
+  Chunk fused;
+  compileOrExit(&vm, source, &fused);
+  Chunk split = unfuse(&fused);
+
+  double fusedSeconds = bestRun(&vm, &fused);
+  double splitSeconds = bestRun(&vm, &split);
+  printf("loop: %-16s fused %d instructions/iteration %.0f M/s, unfused %d "
+         "instructions/iteration %.0f M/s\n",
+         name, loopInstructions(&fused), ITERATIONS / fusedSeconds / 1e6,
+         loopInstructions(&split), ITERATIONS / splitSeconds / 1e6);
+
+  free(split.code);
+  free(split.lines);
+  freeChunk(&vm.gc, &fused);
+  freeVM(&vm);
+}
+
+static void runRange(const char *name, const char *body) {
+  VM vm;
+  initVM(&vm);
+
+  char source[256];
+  Chunk range, loop;
+  snprintf(source, sizeof(source),
+           "{ var sum = 0; for (var i = 0; i < %d; i = i + 1) %s }", ITERATIONS,
+           body);
+  compileOrExit(&vm, source, &range);
+  snprintf(source, sizeof(source),
+           "{ var sum = 0; var i = 0; while (i < %d) { %s i = i + 1; } }",
+           ITERATIONS, body);
+  compileOrExit(&vm, source, &loop);
+
+  double rangeSeconds = bestRun(&vm, &range);
+  double loopSeconds = bestRun(&vm, &loop);
+  printf("range: %-15s for %d instructions/iteration %.0f M/s, while %d "
+         "instructions/iteration %.0f M/s\n",
+         name, loopInstructions(&range), ITERATIONS / rangeSeconds / 1e6,
+         loopInstructions(&loop), ITERATIONS / loopSeconds / 1e6);
+
+  freeChunk(&vm.gc, &range);
+  freeChunk(&vm.gc, &loop);
+  freeVM(&vm);
+}
+
+int main(void) {
+  char source[256];
+
+  snprintf(source, sizeof(source),
+           "{ var i = 0; while (i < %d) i = i + 1; }", ITERATIONS);
+  run("count", source);
+
+  snprintf(source, sizeof(source),
+           "{ var i = 0; var sum = 0;"
+           "  while (i != %d) { sum = sum + i; i = i + 1; } }",
+           ITERATIONS);
+  run("sum", source);
+
+  snprintf(source, sizeof(source),
+           "var i = 0; while (i < %d) i = i + 1;", ITERATIONS);
+  run("global count", source);
+
+  runRange("count", "{}");
+  runRange("sum", "sum = sum + i;");
+  return 0;
+}
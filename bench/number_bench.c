@@ -0,0 +1,74 @@
+/*
+ * Number literal conversion: values computed while scanning, against scanning
+ * and then converting each literal's text with strtod as compiling used to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "scanner.h"
+#include "token.h"
+
+#define CORPUS_BYTES (8 * 1024 * 1024)
+#define RUNS 5
+
+int main(void) {
+  BenchBuffer corpus = {0};
+  char literal[64];
+  srand(42);
+
+  // Data-heavy scripts: mostly short integers and decimals.
+  while (corpus.length < CORPUS_BYTES) {
+    switch (rand() % 3) {
+    case 0:
+      snprintf(literal, sizeof(literal), "%d, ", rand() % 100000);
+      break;
+    case 1:
+      snprintf(literal, sizeof(literal), "%d.%02d, ", rand() % 10000,
+               rand() % 100);
+      break;
+    default:
+      snprintf(literal, sizeof(literal), "0.%06d, ", rand() % 1000000);
+    }
+    benchAppend(&corpus, literal);
+  }
+
+  double fused = 0, separate = 0, sum = 0;
+  long numbers = 0;
+
+  for (int run = 0; run < RUNS; run++) {
+    Scanner scanner;
+    Token token;
+
+    initScanner(&scanner, corpus.chars);
+    numbers = 0;
+    double start = benchNow();
+    while ((token = scanToken(&scanner)).type != TOKEN_EOF) {
+      if (token.type == TOKEN_NUMBER) {
+        sum += token.number;
+        numbers++;
+      }
+    }
+    double elapsed = benchNow() - start;
+    if (run == 0 || elapsed < fused)
+      fused = elapsed;
+
+    initScanner(&scanner, corpus.chars);
+    start = benchNow();
+    while ((token = scanToken(&scanner)).type != TOKEN_EOF) {
+      if (token.type == TOKEN_NUMBER)
+        sum -= strtod(token.start, NULL);
+    }
+    elapsed = benchNow() - start;
+    if (run == 0 || elapsed < separate)
+      separate = elapsed;
+  }
+
+  printf("numbers: %ld literals, scan with values %.1f M/s, scan then strtod "
+         "%.1f M/s (checksum %g)\n",
+         numbers, numbers / fused / 1e6, numbers / separate / 1e6, sum);
+
+  benchFree(&corpus);
+  return 0;
+}
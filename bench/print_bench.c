@@ -0,0 +1,80 @@
+/*
+ * Print throughput: the VM's buffered output path against formatting every
+ * value and newline with printf, as OP_PRINT used to. Output goes to
+ * /dev/null so only the cost of producing it is measured.
+ */
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "value.h"
+#include "vm.h"
+
+#define VALUES 2000000
+#define PRINTS 200000
+
+int main(void) {
+  if (freopen("/dev/null", "w", stdout) == NULL) {
+    fprintf(stderr, "Could not redirect stdout.\n");
+    return EXIT_FAILURE;
+  }
+
+  // Typical report values: whole numbers, prices and ratios.
+  static Value values[VALUES];
+  for (int i = 0; i < VALUES; i++) {
+    switch (i % 3) {
+    case 0:
+      values[i] = NUMBER_VAL(i);
+      break;
+    case 1:
+      values[i] = NUMBER_VAL(i % 10000 + 0.25);
+      break;
+    default:
+      values[i] = NUMBER_VAL(1.0 / (i % 97 + 1));
+    }
+  }
+
+  double start = benchNow();
+  for (int i = 0; i < VALUES; i++) {
+    printValue(values[i]);
+    printf("\n");
+  }
+  fflush(stdout);
+  double printfSeconds = benchNow() - start;
+
+  Output output;
+  initOutput(&output, stdout);
+  start = benchNow();
+  for (int i = 0; i < VALUES; i++) {
+    writeValue(&output, values[i]);
+    writeOutput(&output, "\n", 1);
+  }
+  flushOutput(&output);
+  double bufferedSeconds = benchNow() - start;
+
+  // End to end, a script printing a mix of numbers and strings.
+  BenchBuffer source = {0};
+  benchAppend(&source, "{ var total = 1234.5; var label = \"Total: \";\n");
+  for (int i = 0; i < PRINTS / 2; i++)
+    benchAppend(&source, "print label; print total;\n");
+  benchAppend(&source, "}\n");
+
+  VM vm;
+  initVM(&vm);
+  start = benchNow();
+  InterpretResult result = interpret(&vm, source.chars);
+  flushOutput(&vm.output);
+  double scriptSeconds = benchNow() - start;
+  freeVM(&vm);
+
+  fprintf(stderr,
+          "print: %d values, printf %.1f M/s, buffered %.1f M/s; "
+          "script (%s) %.1f M prints/s\n",
+          VALUES, VALUES / printfSeconds / 1e6,
+          VALUES / bufferedSeconds / 1e6,
+          result == INTERPRET_OK ? "ok" : "failed",
+          PRINTS / scriptSeconds / 1e6);
+
+  benchFree(&source);
+  return 0;
+}
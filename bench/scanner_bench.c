@@ -0,0 +1,72 @@
+/*
+ * Scanner throughput over a large synthetic corpus, reported in MB/s.
+ */
+
+#include <stdio.h>
+
+#include "bench.h"
+#include "scanner.h"
+#include "token.h"
+
+#define CORPUS_BYTES (16 * 1024 * 1024)
+#define RUNS 5
+
+static const char *statements[] = {
+    "var total = 0;\n",
+    "{ var counter = 12345.678; counter = counter * 2 + 1; }\n",
+    "print \"The quick brown fox jumps over the lazy dog\";\n",
+    "// A line comment describing what follows in some detail.\n",
+    "if (total >= 100 and !false) print total; else print nil;\n",
+    "while (counter != 0) counter = counter - 1;\n",
+    "\tfor (var i = 0; i <= 10; i = i + 1) total = total + i;\n",
+    "fun returnsTrue() { return true; }\n",
+};
+
+// Generated-style sources: heavily commented, indented and with long strings.
+static const char *generatedStatements[] = {
+    "// ------------------------------------------------------------------\n"
+    "// Generated section. Do not edit by hand, regenerate it instead.\n"
+    "// ------------------------------------------------------------------\n",
+    "        var message = \"A fairly long generated message which spans "
+    "several dozen characters before it is terminated\";\n",
+    "        print \"Multi-line strings are allowed,\n so this one keeps "
+    "on going\n for a few lines of generated text\";\n",
+    "                                        // Trailing padding comment.\n",
+};
+
+static void benchCorpus(const char *name, const char **fragments, int n) {
+  BenchBuffer corpus = {0};
+  for (int i = 0; corpus.length < CORPUS_BYTES; i++)
+    benchAppend(&corpus, fragments[i % n]);
+
+  double best = 0;
+  long tokens = 0;
+
+  for (int run = 0; run < RUNS; run++) {
+    Scanner scanner;
+    initScanner(&scanner, corpus.chars);
+
+    tokens = 0;
+    double start = benchNow();
+    while (scanToken(&scanner).type != TOKEN_EOF)
+      tokens++;
+    double elapsed = benchNow() - start;
+
+    double mbPerSecond = corpus.length / elapsed / (1024 * 1024);
+    if (mbPerSecond > best)
+      best = mbPerSecond;
+  }
+
+  printf("scanner (%s): %zu bytes, %ld tokens, best of %d: %.1f MB/s\n", name,
+         corpus.length, tokens, RUNS, best);
+
+  benchFree(&corpus);
+}
+
+int main(void) {
+  benchCorpus("handwritten", statements,
+              sizeof(statements) / sizeof(statements[0]));
+  benchCorpus("generated", generatedStatements,
+              sizeof(generatedStatements) / sizeof(generatedStatements[0]));
+  return 0;
+}
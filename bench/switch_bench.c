@@ -0,0 +1,107 @@
+/*
+ * Dispatch on a number among a few to a few hundred arms, as a switch against
+ * the same arms as an if-else chain. Consecutive integer cases are found with
+ * OP_JUMP_TABLE, and cases spaced out with OP_JUMP_HASH, which scans the cases
+ * in order when there are only a few. The subject cycles through every arm.
+ * Reports the dispatches per second.
+ */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "vm.h"
+
+#define RUNS 3
+
+// Every number in the sources is a multiple of the stride between cases, so
+// the 256 arms leave no room in the chunk's constants for any other number.
+#define ITERATIONS (255 * 255 * 3)
+
+static void appendf(BenchBuffer *buffer, const char *format, ...) {
+  char chunk[128];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(chunk, sizeof(chunk), format, args);
+  va_end(args);
+  benchAppend(buffer, chunk);
+}
+
+static void buildSource(BenchBuffer *buffer, int arms, int stride,
+                        bool chain) {
+  buffer->length = 0;
+  appendf(buffer, "{ var n = 255 * 255 * 3 * %d;", stride);
+  appendf(buffer, " var limit = %d + %d;", (arms - 1) * stride, stride);
+  benchAppend(buffer, " var subject = 0; var result = 0;");
+  appendf(buffer, " for (var i = 0; i < n; i = i + %d) {", stride);
+  if (!chain)
+    benchAppend(buffer, " switch (subject) {");
+  for (int arm = 0; arm < arms; arm++) {
+    int value = arm * stride;
+    if (chain) {
+      appendf(buffer, "%s if (subject == %d)", arm == 0 ? "" : " else",
+              value);
+      appendf(buffer, " result = %d;", value);
+    } else {
+      appendf(buffer, " case %d: result = %d;", value, value);
+    }
+  }
+  if (!chain)
+    benchAppend(buffer, " }");
+  appendf(buffer, " subject = subject + %d;", stride);
+  benchAppend(buffer, " if (subject == limit) subject = 0; } }");
+}
+
+static double bestRun(const char *source) {
+  VM vm;
+  initVM(&vm);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk, &vm.gc, &vm.strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = benchNow();
+    if (interpretChunk(&vm, &chunk) != INTERPRET_OK) {
+      fprintf(stderr, "Benchmark script failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    double seconds = benchNow() - start;
+    if (run == 0 || seconds < best)
+      best = seconds;
+  }
+
+  freeChunk(&vm.gc, &chunk);
+  freeVM(&vm);
+  return best;
+}
+
+static void run(const char *name, int arms, int stride) {
+  BenchBuffer buffer = {0};
+  buildSource(&buffer, arms, stride, false);
+  double switchSeconds = bestRun(buffer.chars);
+  buildSource(&buffer, arms, stride, true);
+  double chainSeconds = bestRun(buffer.chars);
+  free(buffer.chars);
+
+  printf("switch: %-6s %3d arms  switch %6.1f M/s, if-else %6.1f M/s\n", name,
+         arms, ITERATIONS / switchSeconds / 1e6,
+         ITERATIONS / chainSeconds / 1e6);
+}
+
+int main(void) {
+  int arms[] = {4, 32, 256};
+  for (int i = 0; i < 3; i++)
+    run("dense", arms[i], 1);
+  for (int i = 0; i < 3; i++)
+    run("sparse", arms[i], 3);
+  return 0;
+}
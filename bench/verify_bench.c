@@ -0,0 +1,143 @@
+/*
+ * Cost of verifying bytecode, per KB of it, on a script of many functions
+ * full of loops, branches and switches. Then a loop calling a function, run
+ * from verified code without checks, against the same code not verified, so
+ * run checking each instruction first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "object.h"
+#include "verifier.h"
+#include "vm.h"
+
+#define FUNCTIONS 100
+#define BLOCKS 80 // In each function.
+#define ITERATIONS 5000000
+#define RUNS 3
+
+static const char *block =
+    "  { var s = 0;\n"
+    "    for (var i = 0; i < n; i = i + 1) {\n"
+    "      if (i == 3 and s > 2) s = s - 1; else s = s + i;\n"
+    "    }\n"
+    "    switch (s) { case 0: s = 1; case 1: s = 2; case 2: s = 3;\n"
+    "                 default: s = -s; }\n"
+    "    while (s > 10 or !true) s = s / 2;\n"
+    "    total = total + s; }\n";
+
+// Bytes of code in the chunk, and in the chunks of its functions.
+static int codeBytes(const Chunk *chunk) {
+  int bytes = chunk->count;
+  for (int i = 0; i < chunk->constants.count; i++) {
+    if (IS_FUNCTION(chunk->constants.values[i]))
+      bytes += codeBytes(&AS_FUNCTION(chunk->constants.values[i])->chunk);
+  }
+  return bytes;
+}
+
+static void setVerified(Chunk *chunk, bool verified) {
+  chunk->verified = verified;
+  for (int i = 0; i < chunk->constants.count; i++) {
+    if (IS_FUNCTION(chunk->constants.values[i]))
+      setVerified(&AS_FUNCTION(chunk->constants.values[i])->chunk, verified);
+  }
+}
+
+static void benchVerify(void) {
+  BenchBuffer source = {0};
+  char line[64];
+  benchAppend(&source, "var total = 0;\n");
+  for (int i = 0; i < FUNCTIONS; i++) {
+    snprintf(line, sizeof(line), "fun f%d(n) {\n", i);
+    benchAppend(&source, line);
+    for (int j = 0; j < BLOCKS; j++)
+      benchAppend(&source, block);
+    benchAppend(&source, "}\n");
+  }
+
+  VM vm;
+  initVM(&vm);
+  Chunk chunk;
+  initChunk(&chunk);
+  double start = benchNow();
+  if (!compile(source.chars, &chunk, &vm.gc, &vm.strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(EXIT_FAILURE);
+  }
+  double compileSeconds = benchNow() - start;
+
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    VerifyError error;
+    start = benchNow();
+    if (!verifyChunk(&chunk, &error)) {
+      fprintf(stderr, "Benchmark code failed to verify: %s\n", error.message);
+      exit(EXIT_FAILURE);
+    }
+    double seconds = benchNow() - start;
+    if (run == 0 || seconds < best)
+      best = seconds;
+  }
+
+  double kb = codeBytes(&chunk) / 1024.0;
+  printf("verify: %.0f KB of bytecode in %.2f ms, %.0f ns/KB, "
+         "compiling it %.1f ms\n",
+         kb, best * 1e3, best / kb * 1e9, compileSeconds * 1e3);
+
+  freeChunk(&vm.gc, &chunk);
+  freeVM(&vm);
+  benchFree(&source);
+}
+
+static double bestRun(VM *vm, Chunk *chunk) {
+  double best = 0;
+  for (int run = 0; run < RUNS; run++) {
+    double start = benchNow();
+    if (interpretChunk(vm, chunk) != INTERPRET_OK) {
+      fprintf(stderr, "Benchmark script failed.\n");
+      exit(EXIT_FAILURE);
+    }
+    double seconds = benchNow() - start;
+    if (run == 0 || seconds < best)
+      best = seconds;
+  }
+  return best;
+}
+
+static void benchChecked(void) {
+  char source[256];
+  snprintf(source, sizeof(source),
+           "fun f(x) { return x; }"
+           " { var sum = 0; for (var i = 0; i < %d; i = i + 1)"
+           " sum = sum + f(i); }",
+           ITERATIONS);
+
+  VM vm;
+  initVM(&vm);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(source, &chunk, &vm.gc, &vm.strings)) {
+    fprintf(stderr, "Benchmark source failed to compile.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  double unchecked = bestRun(&vm, &chunk);
+  setVerified(&chunk, false);
+  double checked = bestRun(&vm, &chunk);
+  printf("verify: f(i) loop verified %.1f M/s, not verified %.1f M/s\n",
+         ITERATIONS / unchecked / 1e6, ITERATIONS / checked / 1e6);
+
+  freeChunk(&vm.gc, &chunk);
+  freeVM(&vm);
+}
+
+int main(void) {
+  benchVerify();
+  benchChecked();
+  return 0;
+}
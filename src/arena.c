@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "gc.h"
+#include "memory.h"
+
+// Every allocation is aligned for any type, as malloc's would be.
+#define ARENA_ALIGNMENT 16
+#define ALIGN_UP(size) (((size) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+#define BLOCK_HEADER_SIZE ALIGN_UP(sizeof(ArenaBlock))
+
+void initArena(Arena *arena, GC *gc) {
+  arena->gc = gc;
+  arena->blocks = NULL;
+  arena->next = NULL;
+  arena->end = NULL;
+  arena->last = NULL;
+  arena->blockCount = 0;
+}
+
+void freeArena(Arena *arena) {
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    if (arena->gc != NULL)
+      trackAllocation(arena->gc, MEM_COMPILER, block->size, 0);
+    free(block);
+    block = next;
+  }
+  initArena(arena, arena->gc);
+}
+
+// Starts a new block with room for at least size bytes. Allocations too large
+// for a regular block get a block of their own. Returns false if there is no
+// memory for it, which only returns for an arena without a GC.
+static bool addBlock(Arena *arena, size_t size) {
+  size_t blockSize = BLOCK_HEADER_SIZE + size;
+  if (blockSize < ARENA_BLOCK_SIZE)
+    blockSize = ARENA_BLOCK_SIZE;
+
+  if (arena->gc != NULL)
+    gcCheckLimit(arena->gc, MEM_COMPILER, blockSize);
+  ArenaBlock *block = malloc(blockSize);
+  if (block == NULL && arena->gc != NULL)
+    gcOutOfMemory(arena->gc);
+  if (block == NULL)
+    return false;
+
+  if (arena->gc != NULL)
+    trackAllocation(arena->gc, MEM_COMPILER, 0, blockSize);
+
+  block->size = blockSize;
+  block->next = arena->blocks;
+  arena->blocks = block;
+  arena->blockCount++;
+  arena->next = (char *)block + BLOCK_HEADER_SIZE;
+  arena->end = (char *)block + blockSize;
+  return true;
+}
+
+void *arenaAllocate(Arena *arena, size_t size) {
+  size = ALIGN_UP(size);
+  if ((arena->next == NULL || (size_t)(arena->end - arena->next) < size) &&
+      !addBlock(arena, size))
+    return NULL;
+
+  void *result = arena->next;
+  arena->next += size;
+  arena->last = result;
+  return result;
+}
+
+void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize) {
+  if (ptr != NULL && ptr == arena->last &&
+      (size_t)(arena->end - (char *)ptr) >= ALIGN_UP(newSize)) {
+    arena->next = (char *)ptr + ALIGN_UP(newSize);
+    return ptr;
+  }
+
+  void *result = arenaAllocate(arena, newSize);
+  if (ptr != NULL && result != NULL)
+    memcpy(result, ptr, oldSize < newSize ? oldSize : newSize);
+  return result;
+}
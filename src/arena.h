@@ -0,0 +1,49 @@
+#ifndef HYDRO_ARENA_H
+#define HYDRO_ARENA_H
+
+#include <stddef.h>
+
+#include "memory.h"
+
+/*
+ * A bump-pointer allocator for scratch data that lives no longer than a
+ * single task, such as one compilation. Allocations are never freed on their
+ * own. Instead every block of the arena is released at once by freeArena.
+ */
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t size;
+} ArenaBlock;
+
+typedef struct Arena {
+  GC *gc;             // Accounts for the blocks as MEM_COMPILER, unless NULL.
+  ArenaBlock *blocks; // Newest first.
+  char *next;         // Where the next allocation is bumped from.
+  char *end;
+  void *last; // The most recent allocation, which can grow in place.
+  size_t blockCount;
+} Arena;
+
+#define ARENA_ALLOCATE(arena, type, count)                                     \
+  (type *)arenaAllocate(arena, sizeof(type) * (count))
+
+#define ARENA_GROW_ARRAY(arena, type, ptr, oldCount, newCount)                 \
+  (type *)arenaGrow(arena, ptr, sizeof(type) * (oldCount),                     \
+                    sizeof(type) * (newCount))
+
+/* The GC is only used to account for the arena's memory, and must be NULL if
+ * the arena is used from a thread other than the GC's. */
+void initArena(Arena *arena, GC *gc);
+void freeArena(Arena *arena);
+
+/* Running out of memory unwinds as gcOutOfMemory does, or returns NULL for an
+ * arena without a GC. */
+void *arenaAllocate(Arena *arena, size_t size);
+/* Resizes an allocation from the arena. The most recent allocation grows in
+ * place when there is room, otherwise it is copied to a new allocation. */
+void *arenaGrow(Arena *arena, void *ptr, size_t oldSize, size_t newSize);
+
+#endif
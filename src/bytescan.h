@@ -0,0 +1,200 @@
+#ifndef HYDRO_BYTESCAN_H
+#define HYDRO_BYTESCAN_H
+
+/*
+ * Byte searching kernels used by the scanner to skip over whitespace, comment
+ * and string bodies. Each kernel scans a NUL-terminated source, stopping at
+ * the terminator at the latest.
+ *
+ * When built for a target with AVX2 or SSE2, 32 or 16 bytes are examined at a
+ * time. ByteVector loads are aligned so they never cross into an unmapped page,
+ * even though they may read a few bytes either side of the source, which is
+ * why AddressSanitizer is told to leave them be. The scalar
+ * versions are always available, both as the fallback and for testing the
+ * vectorized versions against.
+ *
+ * The kernels are defined here so they inline into the scanner's loop, as most
+ * runs they are called on are only a handful of bytes long.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Returns the first byte which is not whitespace, adding the number of
+// newlines skipped over to `newlines`.
+static inline const char *skipBlanksScalar(const char *p, int *newlines) {
+  while (true) {
+    switch (*p) {
+    case '\n':
+      (*newlines)++;
+      // Fallthrough.
+    case ' ':
+    case '\r':
+    case '\t':
+      p++;
+      break;
+    default:
+      return p;
+    }
+  }
+}
+
+// Returns the first newline or NUL byte.
+static inline const char *findNewlineScalar(const char *p) {
+  while (*p != '\n' && *p != '\0')
+    p++;
+  return p;
+}
+
+// Returns the first double quote or NUL byte, adding the number of newlines
+// skipped over to `newlines`.
+static inline const char *findQuoteScalar(const char *p, int *newlines) {
+  while (*p != '"' && *p != '\0') {
+    if (*p == '\n')
+      (*newlines)++;
+    p++;
+  }
+  return p;
+}
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+#define VECTOR_BYTES 32
+typedef __m256i ByteVector;
+#define LOAD(ptr) _mm256_load_si256((const __m256i *)(ptr))
+#define SPLAT(c) _mm256_set1_epi8(c)
+#define EQ(a, b) _mm256_cmpeq_epi8(a, b)
+#define OR(a, b) _mm256_or_si256(a, b)
+#define MASK(v) ((uint32_t)_mm256_movemask_epi8(v))
+#else
+#define VECTOR_BYTES 16
+typedef __m128i ByteVector;
+#define LOAD(ptr) _mm_load_si128((const __m128i *)(ptr))
+#define SPLAT(c) _mm_set1_epi8(c)
+#define EQ(a, b) _mm_cmpeq_epi8(a, b)
+#define OR(a, b) _mm_or_si128(a, b)
+#define MASK(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+#define ALL_LANES ((uint32_t)((1ull << VECTOR_BYTES) - 1))
+
+// The bytes read either side of the source are never used, see above.
+#define NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+
+// Splits p into the aligned block containing it and the offset within it.
+static inline const char *alignBlock(const char *p, int *offset) {
+  *offset = (uintptr_t)p & (VECTOR_BYTES - 1);
+  return p - *offset;
+}
+
+// Mask of the lanes strictly below `lane`.
+static inline uint32_t lanesBelow(int lane) {
+  return (uint32_t)((1ull << lane) - 1);
+}
+
+// Vectorized versions of the kernels above, with identical results.
+static inline NO_SANITIZE_ADDRESS const char *
+skipBlanks(const char *p, int *newlines) {
+  const ByteVector space = SPLAT(' '), tab = SPLAT('\t'), cr = SPLAT('\r'),
+                   lf = SPLAT('\n');
+
+  int offset;
+  const char *block = alignBlock(p, &offset);
+  uint32_t ignore = lanesBelow(offset); // Lanes before p in the first block.
+
+  while (true) {
+    ByteVector v = LOAD(block);
+    uint32_t nl = MASK(EQ(v, lf));
+    uint32_t blank = MASK(OR(OR(EQ(v, space), EQ(v, tab)), EQ(v, cr))) | nl;
+    uint32_t stop = ~blank & ALL_LANES & ~ignore;
+
+    nl &= ~ignore;
+    if (stop != 0) {
+      int lane = __builtin_ctz(stop);
+      *newlines += __builtin_popcount(nl & lanesBelow(lane));
+      return block + lane;
+    }
+
+    *newlines += __builtin_popcount(nl);
+    block += VECTOR_BYTES;
+    ignore = 0;
+  }
+}
+
+static inline NO_SANITIZE_ADDRESS const char *
+findNewline(const char *p) {
+  const ByteVector lf = SPLAT('\n'), nul = SPLAT('\0');
+
+  int offset;
+  const char *block = alignBlock(p, &offset);
+  uint32_t ignore = lanesBelow(offset);
+
+  while (true) {
+    ByteVector v = LOAD(block);
+    uint32_t stop = MASK(OR(EQ(v, lf), EQ(v, nul))) & ~ignore;
+    if (stop != 0)
+      return block + __builtin_ctz(stop);
+
+    block += VECTOR_BYTES;
+    ignore = 0;
+  }
+}
+
+static inline NO_SANITIZE_ADDRESS const char *
+findQuote(const char *p, int *newlines) {
+  const ByteVector quote = SPLAT('"'), nul = SPLAT('\0'), lf = SPLAT('\n');
+
+  int offset;
+  const char *block = alignBlock(p, &offset);
+  uint32_t ignore = lanesBelow(offset);
+
+  while (true) {
+    ByteVector v = LOAD(block);
+    uint32_t stop = MASK(OR(EQ(v, quote), EQ(v, nul))) & ~ignore;
+    uint32_t nl = MASK(EQ(v, lf)) & ~ignore;
+
+    if (stop != 0) {
+      int lane = __builtin_ctz(stop);
+      *newlines += __builtin_popcount(nl & lanesBelow(lane));
+      return block + lane;
+    }
+
+    *newlines += __builtin_popcount(nl);
+    block += VECTOR_BYTES;
+    ignore = 0;
+  }
+}
+
+#undef VECTOR_BYTES
+#undef LOAD
+#undef SPLAT
+#undef EQ
+#undef OR
+#undef MASK
+#undef ALL_LANES
+#undef NO_SANITIZE_ADDRESS
+
+#else
+
+static inline const char *skipBlanks(const char *p, int *newlines) {
+  return skipBlanksScalar(p, newlines);
+}
+
+static inline const char *findNewline(const char *p) {
+  return findNewlineScalar(p);
+}
+
+static inline const char *findQuote(const char *p, int *newlines) {
+  return findQuoteScalar(p, newlines);
+}
+
+#endif
+
+#endif
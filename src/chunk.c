@@ -1,6 +1,8 @@
+#include <stdalign.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
@@ -11,22 +13,28 @@ void initChunk(Chunk *chunk) {
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->maxStackDepth = 0;
+  chunk->upvalueCount = 0;
+  chunk->finalized = false;
+  chunk->verified = false;
   initValueArray(&chunk->constants);
 }
 
 // Grows the chunk's capacity and memory to allow for more instructions.
-static void growChunk(Chunk *chunk) {
+static void growChunk(GC *gc, Chunk *chunk) {
   int oldCapacity = chunk->capacity;
   int newCapacity = GROW_CAPACITY(oldCapacity);
 
   chunk->capacity = newCapacity;
-  chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, newCapacity);
-  chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, newCapacity);
+  chunk->code = GROW_ARRAY(gc, MEM_CHUNK_CODE, uint8_t, chunk->code,
+                           oldCapacity, newCapacity);
+  chunk->lines = GROW_ARRAY(gc, MEM_CHUNK_LINES, int, chunk->lines,
+                            oldCapacity, newCapacity);
 }
 
-void writeChunk(Chunk *chunk, uint8_t byte, int line) {
+void writeChunk(GC *gc, Chunk *chunk, uint8_t byte, int line) {
   if (chunk->count + 1 > chunk->capacity) {
-    growChunk(chunk);
+    growChunk(gc, chunk);
   }
   chunk->code[chunk->count] = byte;
   chunk->lines[chunk->count] = line;
@@ -34,14 +42,134 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line) {
 }
 
 // Returns the index of the inserted value in the chunk's constants array.
-int addConstant(Chunk *chunk, Value value) {
-  appendValueArray(&chunk->constants, value);
+int addConstant(GC *gc, Chunk *chunk, Value value) {
+  appendValueArray(gc, &chunk->constants, value);
   return chunk->constants.count - 1;
 }
 
-void freeChunk(Chunk *chunk) {
-  freeValueArray(&chunk->constants);
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(int, chunk->lines, chunk->capacity);
+// Offsets of the constants and lines within a finalized chunk's allocation,
+// each aligned for its type.
+typedef struct ChunkLayout {
+  size_t constants;
+  size_t lines;
+  size_t size;
+} ChunkLayout;
+
+#define ALIGN_TO(offset, type)                                                 \
+  (((offset) + alignof(type) - 1) & ~(alignof(type) - 1))
+
+static ChunkLayout chunkLayout(int count, int constantCount) {
+  ChunkLayout layout;
+  layout.constants = ALIGN_TO(sizeof(uint8_t) * count, Value);
+  layout.lines =
+      ALIGN_TO(layout.constants + sizeof(Value) * constantCount, int);
+  layout.size = layout.lines + sizeof(int) * count;
+  return layout;
+}
+
+void finalizeChunk(GC *gc, Chunk *dest, const Chunk *src) {
+  int constantCount = src->constants.count;
+  ChunkLayout layout = chunkLayout(src->count, constantCount);
+
+  // Allocated as bytecode, then the other arrays are charged to their own.
+  char *block = ALLOCATE(gc, MEM_CHUNK_CODE, char, layout.size);
+  moveAllocation(gc, MEM_CHUNK_CODE, MEM_CONSTANTS,
+                 layout.lines - layout.constants);
+  moveAllocation(gc, MEM_CHUNK_CODE, MEM_CHUNK_LINES,
+                 layout.size - layout.lines);
+
+  dest->count = dest->capacity = src->count;
+  dest->code = (uint8_t *)block;
+  dest->lines = (int *)(block + layout.lines);
+  dest->constants.count = dest->constants.capacity = constantCount;
+  dest->constants.values = (Value *)(block + layout.constants);
+  dest->maxStackDepth = src->maxStackDepth;
+  dest->upvalueCount = src->upvalueCount;
+  dest->finalized = true;
+  dest->verified = false;
+
+  memcpy(dest->code, src->code, sizeof(uint8_t) * src->count);
+  memcpy(dest->lines, src->lines, sizeof(int) * src->count);
+  if (constantCount > 0)
+    memcpy(dest->constants.values, src->constants.values,
+           sizeof(Value) * constantCount);
+}
+
+void releaseChunk(Chunk *chunk, size_t *freedBytes) {
+  if (chunk->finalized) {
+    ChunkLayout layout = chunkLayout(chunk->count, chunk->constants.count);
+    freedBytes[MEM_CHUNK_CODE] += layout.constants;
+    freedBytes[MEM_CONSTANTS] += layout.lines - layout.constants;
+    freedBytes[MEM_CHUNK_LINES] += layout.size - layout.lines;
+    free(chunk->code);
+  }
+  initChunk(chunk);
+}
+
+void freeChunk(GC *gc, Chunk *chunk) {
+  if (chunk->finalized) {
+    gcRemoveChunk(gc, chunk);
+    ChunkLayout layout = chunkLayout(chunk->count, chunk->constants.count);
+    moveAllocation(gc, MEM_CONSTANTS, MEM_CHUNK_CODE,
+                   layout.lines - layout.constants);
+    moveAllocation(gc, MEM_CHUNK_LINES, MEM_CHUNK_CODE,
+                   layout.size - layout.lines);
+    FREE_ARRAY(gc, MEM_CHUNK_CODE, char, chunk->code, layout.size);
+    initChunk(chunk);
+    return;
+  }
+
+  freeValueArray(gc, &chunk->constants);
+  FREE_ARRAY(gc, MEM_CHUNK_CODE, uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(gc, MEM_CHUNK_LINES, int, chunk->lines, chunk->capacity);
   initChunk(chunk);
 }
+
+const OpInfo opInfo[OP_COUNT] = {
+    [OP_CONSTANT] = {"OP_CONSTANT", OPERAND_CONSTANT, 0, 1, 2},
+    [OP_NIL] = {"OP_NIL", OPERANDS_NONE, 0, 1, 1},
+    [OP_TRUE] = {"OP_TRUE", OPERANDS_NONE, 0, 1, 1},
+    [OP_FALSE] = {"OP_FALSE", OPERANDS_NONE, 0, 1, 1},
+    [OP_POP] = {"OP_POP", OPERANDS_NONE, 1, 0, 1},
+    [OP_GET_LOCAL] = {"OP_GET_LOCAL", OPERAND_LOCAL, 0, 1, 2},
+    [OP_SET_LOCAL] = {"OP_SET_LOCAL", OPERAND_LOCAL, 1, 1, 2},
+    [OP_GET_GLOBAL] = {"OP_GET_GLOBAL", OPERAND_GLOBAL, 0, 1, 2},
+    [OP_DEFINE_GLOBAL] = {"OP_DEFINE_GLOBAL", OPERAND_GLOBAL, 1, 0, 2},
+    [OP_SET_GLOBAL] = {"OP_SET_GLOBAL", OPERAND_GLOBAL, 1, 1, 2},
+    [OP_ADD] = {"OP_ADD", OPERANDS_NONE, 2, 1, 1},
+    [OP_SUBTRACT] = {"OP_SUBTRACT", OPERANDS_NONE, 2, 1, 1},
+    [OP_MULTIPLY] = {"OP_MULTIPLY", OPERANDS_NONE, 2, 1, 1},
+    [OP_DIVIDE] = {"OP_DIVIDE", OPERANDS_NONE, 2, 1, 1},
+    [OP_LT] = {"OP_LT", OPERANDS_NONE, 2, 1, 1},
+    [OP_LTE] = {"OP_LTE", OPERANDS_NONE, 2, 1, 1},
+    [OP_EQ] = {"OP_EQ", OPERANDS_NONE, 2, 1, 1},
+    [OP_NEQ] = {"OP_NEQ", OPERANDS_NONE, 2, 1, 1},
+    [OP_GT] = {"OP_GT", OPERANDS_NONE, 2, 1, 1},
+    [OP_GTE] = {"OP_GTE", OPERANDS_NONE, 2, 1, 1},
+    [OP_NOT] = {"OP_NOT", OPERANDS_NONE, 1, 1, 1},
+    [OP_NEGATE] = {"OP_NEGATE", OPERANDS_NONE, 1, 1, 1},
+    [OP_PRINT] = {"OP_PRINT", OPERANDS_NONE, 1, 0, 1},
+    [OP_JUMP] = {"OP_JUMP", OPERAND_JUMP, 0, 0, 3},
+    [OP_JUMP_IF_FALSE] = {"OP_JUMP_IF_FALSE", OPERAND_JUMP, 1, 1, 3},
+    [OP_JUMP_IF_TRUE] = {"OP_JUMP_IF_TRUE", OPERAND_JUMP, 1, 1, 3},
+    [OP_JUMP_IF_FALSE_POP] = {"OP_JUMP_IF_FALSE_POP", OPERAND_JUMP, 1, 0, 3},
+    [OP_JUMP_IF_NOT_LT] = {"OP_JUMP_IF_NOT_LT", OPERAND_JUMP, 2, 0, 3},
+    [OP_JUMP_IF_NOT_LTE] = {"OP_JUMP_IF_NOT_LTE", OPERAND_JUMP, 2, 0, 3},
+    [OP_JUMP_IF_NOT_EQ] = {"OP_JUMP_IF_NOT_EQ", OPERAND_JUMP, 2, 0, 3},
+    [OP_JUMP_IF_NOT_NEQ] = {"OP_JUMP_IF_NOT_NEQ", OPERAND_JUMP, 2, 0, 3},
+    [OP_JUMP_IF_NOT_GT] = {"OP_JUMP_IF_NOT_GT", OPERAND_JUMP, 2, 0, 3},
+    [OP_JUMP_IF_NOT_GTE] = {"OP_JUMP_IF_NOT_GTE", OPERAND_JUMP, 2, 0, 3},
+    [OP_LOOP] = {"OP_LOOP", OPERAND_LOOP, 0, 0, 3},
+    [OP_FOR_RANGE] = {"OP_FOR_RANGE", OPERANDS_FOR_RANGE, 0, 0, 7},
+    [OP_JUMP_TABLE] = {"OP_JUMP_TABLE", OPERANDS_JUMP_TABLE, 1, 0, 0},
+    [OP_JUMP_HASH] = {"OP_JUMP_HASH", OPERANDS_JUMP_HASH, 1, 0, 0},
+    [OP_GET_UPVALUE] = {"OP_GET_UPVALUE", OPERAND_UPVALUE, 0, 1, 2},
+    [OP_SET_UPVALUE] = {"OP_SET_UPVALUE", OPERAND_UPVALUE, 1, 1, 2},
+    [OP_CLOSURE] = {"OP_CLOSURE", OPERANDS_CLOSURE, 0, 1, 0},
+    [OP_CLOSE_UPVALUE] = {"OP_CLOSE_UPVALUE", OPERANDS_NONE, 1, 0, 1},
+    [OP_CALL] = {"OP_CALL", OPERAND_ARG_COUNT, 1, 1, 2},
+    // The OP_RETURN following finds the result where an OP_CALL leaves it.
+    [OP_TAIL_CALL] = {"OP_TAIL_CALL", OPERAND_ARG_COUNT, 1, 1, 2},
+    // The script's return pops nothing, as it only ends the script.
+    [OP_RETURN] = {"OP_RETURN", OPERANDS_NONE, 1, 0, 1},
+};
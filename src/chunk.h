@@ -1,8 +1,10 @@
 #ifndef HYDRO_CHUNK_H
 #define HYDRO_CHUNK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+#include "gc.h"
 #include "value.h"
 
 /*
@@ -11,6 +13,11 @@
  *
  * In addition to the array of instructions, there is an array corresponding
  * of the line number for the bytecode instruction.
+ *
+ * A finalized chunk holds its code, constants and lines in one exact-size
+ * allocation, in that order. It is never written to again, so it can be run by
+ * several VMs at once. Only its verified flag may be set, by verifyChunk,
+ * before it is first run.
  */
 typedef struct Chunk {
   int count;
@@ -18,12 +25,32 @@ typedef struct Chunk {
   uint8_t *code;
   ValueArray constants;
   int *lines;
+  // Most values its code has on the stack at once, from where its frame's
+  // slots start. Running it only checks there is room for this many.
+  int maxStackDepth;
+  // Upvalues of the closures of a function's chunk, which its code refers to
+  // by index. Functions with none are called without a closure.
+  int upvalueCount;
+  bool finalized;
+  bool verified; // Passed verifyChunk, so runs without checking its code.
 } Chunk;
 
 void initChunk(Chunk *chunk);
-void writeChunk(Chunk *chunk, uint8_t byte, int line);
-void freeChunk(Chunk *chunk);
-int addConstant(Chunk *chunk, Value value);
+void writeChunk(GC *gc, Chunk *chunk, uint8_t byte, int line);
+void freeChunk(GC *gc, Chunk *chunk);
+int addConstant(GC *gc, Chunk *chunk, Value value);
+
+/* Copies the source chunk into the empty destination chunk, as a finalized
+ * chunk. The source is left as it was. */
+void finalizeChunk(GC *gc, Chunk *dest, const Chunk *src);
+
+/* Frees a finalized chunk without accounting for it, for the sweeper's thread.
+ * The bytes freed are added to freedBytes by category, to account for later. */
+void releaseChunk(Chunk *chunk, size_t *freedBytes);
+
+// Switches with at most this many sparse cases find their case by comparing
+// against each in turn, which is quicker than hashing the subject.
+#define SWITCH_SCAN_MAX 4
 
 typedef enum OpCode {
   OP_CONSTANT,
@@ -49,7 +76,100 @@ typedef enum OpCode {
   OP_NOT,
   OP_NEGATE,
   OP_PRINT,
-  OP_RETURN
+  // Jumps are followed by a 16-bit big-endian offset from the next
+  // instruction, forwards except for OP_LOOP.
+  OP_JUMP,
+  OP_JUMP_IF_FALSE, // Keeps the condition, for and/or to leave as the result.
+  OP_JUMP_IF_TRUE,
+  OP_JUMP_IF_FALSE_POP,
+  // A comparison fused with the OP_JUMP_IF_FALSE_POP after it, see
+  // emitJumpIfFalse. Pops both operands, and jumps when the comparison fails.
+  OP_JUMP_IF_NOT_LT,
+  OP_JUMP_IF_NOT_LTE,
+  OP_JUMP_IF_NOT_EQ,
+  OP_JUMP_IF_NOT_NEQ,
+  OP_JUMP_IF_NOT_GT,
+  OP_JUMP_IF_NOT_GTE,
+  OP_LOOP,
+  // Followed by a local's slot, the bound's slot, a comparison opcode, a
+  // constant step and a jump back. Adds the step to the local, and jumps back
+  // while it compares true against the bound, see rangeLoop.
+  OP_FOR_RANGE,
+  // Pops the subject of a switch and jumps to its case, see switchStatement.
+  // Their 16-bit offsets are from the end of the whole instruction. Followed
+  // by the constant of the lowest case, a 16-bit count, the default's offset,
+  // then count offsets, for the integers from the lowest case up.
+  OP_JUMP_TABLE,
+  // Followed by a 16-bit capacity, the default's offset, then capacity
+  // entries of a 16-bit constant index plus one, zero if empty, and an offset.
+  // Entries are a hash table by hashValue with linear probing, or are scanned
+  // in order when there are at most SWITCH_SCAN_MAX.
+  OP_JUMP_HASH,
+  // Push and assign the variable of the running closure's upvalue of the
+  // index following them.
+  OP_GET_UPVALUE,
+  OP_SET_UPVALUE,
+  // Followed by the constant of a function with upvalues, their count, then a
+  // pair of bytes for each: 1 and a local's slot to capture from the frame, or
+  // 0 and the index of one of the running closure's upvalues to share.
+  OP_CLOSURE,
+  // Pops a captured local, moving it off the stack into its upvalue.
+  OP_CLOSE_UPVALUE,
+  // Followed by the argument count. Calls the function below the arguments.
+  OP_CALL,
+  // Calls like OP_CALL from the tail of a function, and is always followed by
+  // the OP_RETURN of the call's result. A function called takes over the
+  // caller's frame and its slots, rather than pushing another.
+  OP_TAIL_CALL,
+  // Returns the value on top from a function, or ends the script.
+  OP_RETURN,
+  OP_COUNT // Not an instruction, but the number of them.
 } OpCode;
 
+// How the operands following an opcode are laid out.
+typedef enum OperandKind {
+  OPERANDS_NONE,
+  OPERAND_CONSTANT,  // The index of a constant.
+  OPERAND_GLOBAL,    // The index of a constant naming a global.
+  OPERAND_LOCAL,     // A local's slot in the frame.
+  OPERAND_ARG_COUNT, // The number of arguments below it on the stack.
+  OPERAND_UPVALUE,   // The index of an upvalue of the running closure.
+  OPERAND_JUMP,      // A 16-bit offset forwards.
+  OPERAND_LOOP,      // A 16-bit offset backwards.
+  OPERANDS_FOR_RANGE,
+  OPERANDS_JUMP_TABLE,
+  OPERANDS_JUMP_HASH,
+  OPERANDS_CLOSURE,
+} OperandKind;
+
+/*
+ * What an instruction does to the stack and how it is encoded, for every part
+ * of the interpreter that needs to know besides the VM: the compiler tracking
+ * the stack's depth, the disassembler and the verifier.
+ */
+typedef struct OpInfo {
+  const char *name;
+  OperandKind operands;
+  int pops;   // Values read off the top, besides a call's arguments.
+  int pushes; // Values left on top in their place.
+  // With its operands, or 0 for a switch or closure, see instructionLength.
+  int length;
+} OpInfo;
+
+extern const OpInfo opInfo[OP_COUNT];
+
+/* Returns the length of the instruction at the given code, with its operands.
+ * The instruction must be a valid opcode. */
+static inline int instructionLength(const uint8_t *instruction) {
+  if (opInfo[instruction[0]].length > 0)
+    return opInfo[instruction[0]].length;
+  // The captures of a closure, or table of a switch's cases, follow their
+  // operands.
+  if (instruction[0] == OP_CLOSURE)
+    return 3 + instruction[2] * 2;
+  if (instruction[0] == OP_JUMP_TABLE)
+    return 6 + ((instruction[2] << 8) | instruction[3]) * 2;
+  return 5 + ((instruction[1] << 8) | instruction[2]) * 4;
+}
+
 #endif
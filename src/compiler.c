@@ -1,15 +1,22 @@
+#include <setjmp.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "arena.h"
 #include "chunk.h"
 #include "compiler.h"
 #include "debug.h"
+#include "memory.h"
 #include "object.h"
 #include "scanner.h"
 #include "token.h"
+#include "tokenbuffer.h"
+#include "verifier.h"
 
 // A signal that local variable could not be resolved, so assume to be global.
 #define NOT_RESOLVE_LOCAL -1
@@ -49,7 +56,9 @@ static void advance(Parser *parser) {
   parser->previous = parser->current;
 
   while (true) {
-    parser->current = scanToken(&parser->scanner);
+    parser->current = parser->tokens != NULL
+                          ? tokenAt(parser->tokens, parser->nextToken++)
+                          : scanToken(&parser->scanner);
     if (parser->current.type != TOKEN_ERROR)
       break;
 
@@ -58,6 +67,23 @@ static void advance(Parser *parser) {
   }
 }
 
+// Returns the token `distance` tokens ahead of the current token, so a
+// distance of zero is the current token itself.
+static Token lookahead(Parser *parser, int distance) {
+  if (distance == 0)
+    return parser->current;
+
+  if (parser->tokens != NULL)
+    return tokenAt(parser->tokens, parser->nextToken + distance - 1);
+
+  // Scan ahead on a copy, leaving the parser's own scanner where it is.
+  Scanner scanner = parser->scanner;
+  Token token;
+  for (int i = 0; i < distance; i++)
+    token = scanToken(&scanner);
+  return token;
+}
+
 static void consume(Parser *parser, TokenType type, const char *message) {
   if (parser->current.type == type) {
     advance(parser);
@@ -78,17 +104,212 @@ static bool match(Parser *parser, TokenType type) {
   return true;
 }
 
-static void emitByte(Parser *parser, uint8_t byte) {
-  writeChunk(parser->chunk, byte, parser->previous.line);
+// Values an instruction leaves on the stack, less those it takes off. An
+// OP_CALL also takes off its arguments, see call.
+static int stackEffect(uint8_t instruction) {
+  return opInfo[instruction].pushes - opInfo[instruction].pops;
+}
+
+// Tracks the height of the stack as the code emitted so far leaves it, which
+// is the same along every path to the same code, as statements leave the stack
+// as they found it.
+static void adjustStackDepth(Parser *parser, int effect) {
+  parser->stackDepth += effect;
+  if (parser->stackDepth > parser->chunk->maxStackDepth)
+    parser->chunk->maxStackDepth = parser->stackDepth;
+}
+
+// Writes a byte which is not an opcode, such as an operand. The chunk grows in
+// the arena while compiling, and is copied to exact-size storage on the heap
+// once finished.
+static void emitOperand(Parser *parser, uint8_t byte) {
+  Chunk *chunk = parser->chunk;
+  if (chunk->count + 1 > chunk->capacity) {
+    int oldCapacity = chunk->capacity;
+    chunk->capacity = GROW_CAPACITY(oldCapacity);
+    chunk->code = ARENA_GROW_ARRAY(parser->arena, uint8_t, chunk->code,
+                                   oldCapacity, chunk->capacity);
+    chunk->lines = ARENA_GROW_ARRAY(parser->arena, int, chunk->lines,
+                                    oldCapacity, chunk->capacity);
+  }
+
+  chunk->code[chunk->count] = byte;
+  chunk->lines[chunk->count] = parser->previous.line;
+  chunk->count++;
+}
+
+static void emitByte(Parser *parser, uint8_t instruction) {
+  adjustStackDepth(parser, stackEffect(instruction));
+  emitOperand(parser, instruction);
+}
+
+static void emitBytes(Parser *parser, uint8_t instruction, uint8_t operand) {
+  emitByte(parser, instruction);
+  emitOperand(parser, operand);
+}
+
+static void emitShort(Parser *parser, int value) {
+  emitOperand(parser, (value >> 8) & 0xff);
+  emitOperand(parser, value & 0xff);
+}
+
+// Emits a forward jump with a placeholder offset, returning where the offset
+// is to be patched once the target is known.
+static int emitJump(Parser *parser, uint8_t instruction) {
+  emitByte(parser, instruction);
+  emitShort(parser, 0xffff);
+  return parser->chunk->count - 2;
+}
+
+// Points the jump whose offset is at the given index to the next instruction.
+static void patchJump(Parser *parser, int offset) {
+  Chunk *chunk = parser->chunk;
+  // The offset is from after its own two bytes.
+  int jump = chunk->count - offset - 2;
+  if (jump > UINT16_MAX)
+    error(parser, "Too much code to jump over.");
+
+  chunk->code[offset] = (jump >> 8) & 0xff;
+  chunk->code[offset + 1] = jump & 0xff;
+  parser->jumpTarget = chunk->count;
 }
 
-static void emitBytes(Parser *parser, uint8_t byte1, uint8_t byte2) {
-  writeChunk(parser->chunk, byte1, parser->previous.line);
-  writeChunk(parser->chunk, byte2, parser->previous.line);
+static void emitLoop(Parser *parser, int loopStart) {
+  emitByte(parser, OP_LOOP);
+
+  // Jumps back over its own two bytes too.
+  int offset = parser->chunk->count - loopStart + 2;
+  if (offset > UINT16_MAX)
+    error(parser, "Loop body too large.");
+
+  emitShort(parser, offset);
+}
+
+static uint8_t fusedJump(uint8_t comparison) {
+  switch (comparison) {
+  case OP_LT:
+    return OP_JUMP_IF_NOT_LT;
+  case OP_LTE:
+    return OP_JUMP_IF_NOT_LTE;
+  case OP_EQ:
+    return OP_JUMP_IF_NOT_EQ;
+  case OP_NEQ:
+    return OP_JUMP_IF_NOT_NEQ;
+  case OP_GT:
+    return OP_JUMP_IF_NOT_GT;
+  default:
+    return OP_JUMP_IF_NOT_GTE;
+  }
+}
+
+// Emits a jump taken when the condition on the stack is falsy, popping it. A
+// comparison computing the condition is fused into the jump, so a loop test
+// is one instruction, unless a jump lands between the two.
+static int emitJumpIfFalse(Parser *parser) {
+  Chunk *chunk = parser->chunk;
+  if (parser->lastComparison == chunk->count - 1 &&
+      parser->jumpTarget < chunk->count) {
+    chunk->count--;
+    // As the comparison's result is never pushed.
+    parser->stackDepth -= stackEffect(chunk->code[chunk->count]);
+    return emitJump(parser, fusedJump(chunk->code[chunk->count]));
+  }
+  return emitJump(parser, OP_JUMP_IF_FALSE_POP);
+}
+
+// Constants are the same value only when bitwise identical, so 0 and -0 stay
+// distinct. Strings are interned, so are compared by identity.
+static bool sameConstant(Value a, Value b) {
+  if (a.type != b.type)
+    return false;
+
+  switch (a.type) {
+  case VAL_NUMBER:
+    return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+  case VAL_OBJ:
+    return a.as.obj == b.as.obj;
+  default:
+    return valuesEqual(a, b);
+  }
+}
+
+static uint32_t hashConstant(Value value) {
+  uint64_t bits = 0;
+  switch (value.type) {
+  case VAL_NUMBER:
+    memcpy(&bits, &value.as.number, sizeof(double));
+    break;
+  case VAL_OBJ:
+    bits = (uintptr_t)value.as.obj;
+    break;
+  case VAL_BOOL:
+    bits = value.as.boolean;
+    break;
+  case VAL_NIL:
+    break;
+  }
+
+  // Mixes the high bits down, so nearby addresses and round numbers spread.
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdull;
+  bits ^= bits >> 33;
+  return (uint32_t)bits ^ value.type;
+}
+
+static ConstantSlot *findConstantSlot(ConstantSlot *slots, int capacity,
+                                      Value value) {
+  uint32_t index = hashConstant(value) & (capacity - 1);
+  while (slots[index].index != -1 && !sameConstant(slots[index].value, value))
+    index = (index + 1) & (capacity - 1);
+  return &slots[index];
+}
+
+static void growConstantTable(Parser *parser) {
+  ConstantTable *table = &parser->constants;
+  int capacity = GROW_CAPACITY(table->capacity);
+  ConstantSlot *slots = ARENA_ALLOCATE(parser->arena, ConstantSlot, capacity);
+  for (int i = 0; i < capacity; i++)
+    slots[i].index = -1;
+
+  for (int i = 0; i < table->capacity; i++) {
+    ConstantSlot *slot = &table->slots[i];
+    if (slot->index != -1)
+      *findConstantSlot(slots, capacity, slot->value) = *slot;
+  }
+
+  table->slots = slots;
+  table->capacity = capacity;
+}
+
+// Returns the index of the value in the chunk's constants, adding it if it is
+// not there yet.
+static int addConstantOnce(Parser *parser, Value value) {
+  ConstantTable *table = &parser->constants;
+  if (table->count + 1 > table->capacity / 2)
+    growConstantTable(parser);
+
+  ConstantSlot *slot = findConstantSlot(table->slots, table->capacity, value);
+  if (slot->index != -1)
+    return slot->index;
+
+  ValueArray *constants = &parser->chunk->constants;
+  if (constants->count + 1 > constants->capacity) {
+    int oldCapacity = constants->capacity;
+    constants->capacity = GROW_CAPACITY(oldCapacity);
+    constants->values =
+        ARENA_GROW_ARRAY(parser->arena, Value, constants->values, oldCapacity,
+                         constants->capacity);
+  }
+  constants->values[constants->count] = value;
+
+  slot->value = value;
+  slot->index = constants->count++;
+  table->count++;
+  return slot->index;
 }
 
 static uint8_t makeConstant(Parser *parser, Value value) {
-  int constantIndex = addConstant(parser->chunk, value);
+  int constantIndex = addConstantOnce(parser, value);
 
   if (constantIndex > UINT8_MAX) {
     // Each instruction in the chunk's can only be 1 byte, so a chunk can only
@@ -105,27 +326,46 @@ static void emitConstant(Parser *parser, Value value) {
   emitBytes(parser, OP_CONSTANT, constantIndex);
 }
 
-static void endCompiler(Parser *parser) {
+// Functions return nil when their end is reached, and the script just ends.
+static void endCompiler(Parser *parser,
+                        __attribute__((unused)) const char *name) {
+  if (parser->compiler->type == TYPE_FUNCTION)
+    emitByte(parser, OP_NIL);
   emitByte(parser, OP_RETURN);
 #ifdef DEBUG_PRINT_CODE
   if (!parser->hadError) {
-    disassembleChunk(parser->chunk, "code");
+    disassembleChunk(parser->chunk, name);
   }
 #endif
+  parser->compiler = parser->compiler->enclosing;
+}
+
+static void initCompiler(Parser *parser, Compiler *compiler,
+                         FunctionType type) {
+  compiler->enclosing = parser->compiler;
+  compiler->type = type;
+  compiler->localCount = 0;
+  compiler->scopeDepth = GLOBAL_SCOPE_DEPTH;
+  compiler->upvalueCount = 0;
+  parser->compiler = compiler;
 }
 
 static void beginScope(Compiler *compiler) { compiler->scopeDepth++; }
 
 static void endScope(Parser *parser) {
-  Compiler *compiler = &parser->compiler;
+  Compiler *compiler = parser->compiler;
   compiler->scopeDepth--;
 
   // Discard the local variables by decrementing the length of the compiler's
-  // locals array. Also, pop from the stack as slot is no longer needed.
+  // locals array. Also, pop from the stack as slot is no longer needed, after
+  // moving it into its upvalue if a closure captured it.
   while (compiler->localCount > 0 &&
          compiler->locals[compiler->localCount - 1].depth >
              compiler->scopeDepth) {
-    emitByte(parser, OP_POP); // TODO: OP_POPN instruction for VM optimization.
+    // TODO: OP_POPN instruction for VM optimization.
+    emitByte(parser, compiler->locals[compiler->localCount - 1].captured
+                         ? OP_CLOSE_UPVALUE
+                         : OP_POP);
     compiler->localCount--;
   }
 }
@@ -134,9 +374,7 @@ static bool identifiersEqual(Token *a, Token *b) {
   return a->length == b->length && memcmp(a->start, b->start, a->length) == 0;
 }
 
-static int resolveLocal(Parser *parser, Token *name) {
-  Compiler *compiler = &parser->compiler;
-
+static int resolveLocal(Parser *parser, Compiler *compiler, Token *name) {
   // Walk backwards to find last declared variable with identifier. Ensures
   // that inner local variables correctly shadow locals from surrounding scope.
   for (int i = compiler->localCount - 1; i >= 0; i--) {
@@ -152,6 +390,45 @@ static int resolveLocal(Parser *parser, Token *name) {
   return NOT_RESOLVE_LOCAL;
 }
 
+// Returns the index of the function's upvalue capturing the variable, added
+// if it has none yet.
+static int addUpvalue(Parser *parser, Compiler *compiler, uint8_t index,
+                      bool isLocal) {
+  for (int i = 0; i < compiler->upvalueCount; i++) {
+    Upvalue *upvalue = &compiler->upvalues[i];
+    if (upvalue->index == index && upvalue->isLocal == isLocal)
+      return i;
+  }
+
+  // Their count is an operand of OP_CLOSURE, so fits in a byte.
+  if (compiler->upvalueCount == UINT8_MAX) {
+    error(parser, "Too many closure variables in function.");
+    return 0;
+  }
+
+  compiler->upvalues[compiler->upvalueCount] = (Upvalue){index, isLocal};
+  return compiler->upvalueCount++;
+}
+
+// Resolves a local of an enclosing function, capturing it through each
+// function in between.
+static int resolveUpvalue(Parser *parser, Compiler *compiler, Token *name) {
+  if (compiler->enclosing == NULL)
+    return NOT_RESOLVE_LOCAL;
+
+  int local = resolveLocal(parser, compiler->enclosing, name);
+  if (local != NOT_RESOLVE_LOCAL) {
+    compiler->enclosing->locals[local].captured = true;
+    return addUpvalue(parser, compiler, (uint8_t)local, true);
+  }
+
+  int upvalue = resolveUpvalue(parser, compiler->enclosing, name);
+  if (upvalue != NOT_RESOLVE_LOCAL)
+    return addUpvalue(parser, compiler, (uint8_t)upvalue, false);
+
+  return NOT_RESOLVE_LOCAL;
+}
+
 // ----- Rule Parsing -----
 
 static ParseRule *getRule(TokenType type);
@@ -167,7 +444,7 @@ static uint8_t identifierConstant(Parser *parser, Token *name) {
 }
 
 static void addLocal(Parser *parser, Token name) {
-  Compiler *compiler = &parser->compiler;
+  Compiler *compiler = parser->compiler;
 
   if (compiler->localCount == UINT8_COUNT) {
     error(parser, "Too many local variables in function.");
@@ -177,10 +454,12 @@ static void addLocal(Parser *parser, Token name) {
   Local *local = &compiler->locals[compiler->localCount++];
   local->name = name;
   local->depth = UNINITIALIZED_DEPTH;
+  local->assigned = false;
+  local->captured = false;
 }
 
 static void declareVariable(Parser *parser) {
-  Compiler *compiler = &parser->compiler;
+  Compiler *compiler = parser->compiler;
 
   if (compiler->scopeDepth == GLOBAL_SCOPE_DEPTH)
     return;
@@ -210,28 +489,52 @@ static uint8_t parseVariable(Parser *parser, const char *errorMessage) {
   declareVariable(parser);
 
   // Locals are resolved compiled time, not runtime unlike global variables.
-  if (parser->compiler.scopeDepth > GLOBAL_SCOPE_DEPTH)
+  if (parser->compiler->scopeDepth > GLOBAL_SCOPE_DEPTH)
     return 0;
 
   return identifierConstant(parser, &parser->previous);
 }
 
 static void markInitialized(Compiler *compiler) {
+  // A function declared at the top level is a global instead.
+  if (compiler->scopeDepth == GLOBAL_SCOPE_DEPTH)
+    return;
   compiler->locals[compiler->localCount - 1].depth = compiler->scopeDepth;
 }
 
 static void defineVariable(Parser *parser, uint8_t globalIndex) {
-  if (parser->compiler.scopeDepth > GLOBAL_SCOPE_DEPTH) {
-    markInitialized(&parser->compiler);
+  if (parser->compiler->scopeDepth > GLOBAL_SCOPE_DEPTH) {
+    markInitialized(parser->compiler);
     return;
   }
 
   emitBytes(parser, OP_DEFINE_GLOBAL, globalIndex);
 }
 
+static uint8_t argumentList(Parser *parser) {
+  uint8_t argCount = 0;
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {
+    do {
+      expression(parser);
+      if (argCount == UINT8_MAX)
+        error(parser, "Can't have more than 255 arguments.");
+      argCount++;
+    } while (match(parser, TOKEN_COMMA));
+  }
+
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  return argCount;
+}
+
+static void call(Parser *parser, __attribute__((unused)) bool canAssign) {
+  uint8_t argCount = argumentList(parser);
+  emitBytes(parser, OP_CALL, argCount);
+  adjustStackDepth(parser, -argCount);
+  parser->lastCall = parser->chunk->count - 2;
+}
+
 static void number(Parser *parser, __attribute__((unused)) bool canAssign) {
-  double value = strtod(parser->previous.start, NULL);
-  emitConstant(parser, NUMBER_VAL(value));
+  emitConstant(parser, NUMBER_VAL(parser->previous.number));
 }
 
 static void string(Parser *parser, __attribute__((unused)) bool canAssign) {
@@ -244,10 +547,14 @@ static void string(Parser *parser, __attribute__((unused)) bool canAssign) {
 
 static void namedVariable(Parser *parser, Token name, bool canAssign) {
   uint8_t getOp, setOp;
-  int arg = resolveLocal(parser, &name);
+  int arg = resolveLocal(parser, parser->compiler, &name);
   if (arg != NOT_RESOLVE_LOCAL) {
     getOp = OP_GET_LOCAL;
     setOp = OP_SET_LOCAL;
+  } else if ((arg = resolveUpvalue(parser, parser->compiler, &name)) !=
+             NOT_RESOLVE_LOCAL) {
+    getOp = OP_GET_UPVALUE;
+    setOp = OP_SET_UPVALUE;
   } else {
     arg = identifierConstant(parser, &name);
     getOp = OP_GET_GLOBAL;
@@ -258,6 +565,8 @@ static void namedVariable(Parser *parser, Token name, bool canAssign) {
   if (canAssign && match(parser, TOKEN_EQUAL)) {
     expression(parser);
     emitBytes(parser, setOp, (uint8_t)arg);
+    if (setOp == OP_SET_LOCAL)
+      parser->compiler->locals[arg].assigned = true;
   } else {
     emitBytes(parser, getOp, (uint8_t)arg);
   }
@@ -329,6 +638,25 @@ static void binary(Parser *parser, __attribute__((unused)) bool canAssign) {
   default:
     return; // Unreachable.
   }
+
+  if (rule->precedence == PREC_COMPARISON ||
+      rule->precedence == PREC_EQUALITY)
+    parser->lastComparison = parser->chunk->count - 1;
+}
+
+// The left operand is the result when falsy, so is only popped otherwise.
+static void and_(Parser *parser, __attribute__((unused)) bool canAssign) {
+  int endJump = emitJump(parser, OP_JUMP_IF_FALSE);
+  emitByte(parser, OP_POP);
+  parsePrecedence(parser, PREC_AND);
+  patchJump(parser, endJump);
+}
+
+static void or_(Parser *parser, __attribute__((unused)) bool canAssign) {
+  int endJump = emitJump(parser, OP_JUMP_IF_TRUE);
+  emitByte(parser, OP_POP);
+  parsePrecedence(parser, PREC_OR);
+  patchJump(parser, endJump);
 }
 
 static void literal(Parser *parser, __attribute__((unused)) bool canAssign) {
@@ -360,11 +688,12 @@ static void literal(Parser *parser, __attribute__((unused)) bool canAssign) {
  */
 ParseRule rules[] = {
     // Single character
-    [TOKEN_LEFT_PAREN] = {grouping, NULL, PREC_NONE},
+    [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
     [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
     [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
     [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
     [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COLON] = {NULL, NULL, PREC_NONE},
     [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
     [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
     [TOKEN_MINUS] = {unary, binary, PREC_TERM},
@@ -383,18 +712,21 @@ ParseRule rules[] = {
     [TOKEN_LESS_EQUAL] = {NULL, binary, PREC_COMPARISON},
 
     // Keywords
-    [TOKEN_AND] = {NULL, NULL, PREC_NONE},
+    [TOKEN_AND] = {NULL, and_, PREC_AND},
+    [TOKEN_CASE] = {NULL, NULL, PREC_NONE},
     [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DEFAULT] = {NULL, NULL, PREC_NONE},
     [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
     [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
     [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
     [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
     [TOKEN_IF] = {NULL, NULL, PREC_NONE},
     [TOKEN_NIL] = {literal, NULL, PREC_NONE},
-    [TOKEN_OR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_OR] = {NULL, or_, PREC_OR},
     [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
     [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
     [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SWITCH] = {NULL, NULL, PREC_NONE},
     [TOKEN_THIS] = {NULL, NULL, PREC_NONE},
     [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
     [TOKEN_VAR] = {NULL, NULL, PREC_NONE},
@@ -440,6 +772,7 @@ static void synchronize(Parser *parser) {
     case TOKEN_FOR:
     case TOKEN_IF:
     case TOKEN_WHILE:
+    case TOKEN_SWITCH:
     case TOKEN_PRINT:
     case TOKEN_RETURN:
       return;
@@ -465,8 +798,94 @@ static void varDeclaration(Parser *parser) {
   defineVariable(parser, constantIndex);
 }
 
+/*
+ * Compiles the parameters and body of a function into a chunk of its own, as
+ * the state of the enclosing chunk waits, then emits the function as one of
+ * the enclosing chunk's constants. A function capturing variables is emitted
+ * as a closure of them instead, made each time the code runs.
+ */
+static void function(Parser *parser, FunctionType type) {
+  Chunk *enclosingChunk = parser->chunk;
+  ConstantTable enclosingConstants = parser->constants;
+  int lastComparison = parser->lastComparison;
+  int jumpTarget = parser->jumpTarget;
+  int lastCall = parser->lastCall;
+  int stackDepth = parser->stackDepth;
+
+  ObjFunction *function = newFunction(parser->gc);
+  function->name = copyString(parser->gc, parser->strings,
+                              parser->previous.start, parser->previous.length);
+
+  Chunk scratch;
+  initChunk(&scratch);
+  Compiler compiler;
+  initCompiler(parser, &compiler, type);
+  parser->chunk = &scratch;
+  parser->lastComparison = parser->jumpTarget = parser->lastCall = -1;
+  parser->stackDepth = 0;
+  parser->constants.count = 0;
+  parser->constants.capacity = 0;
+  parser->constants.slots = NULL;
+
+  // The body is in the same scope as the parameters, which are the first
+  // locals, and is never closed as returning discards the whole frame.
+  beginScope(&compiler);
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after function name.");
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {
+    do {
+      function->arity++;
+      if (function->arity > UINT8_MAX)
+        errorAtCurrent(parser, "Can't have more than 255 parameters.");
+      uint8_t constant = parseVariable(parser, "Expect parameter name.");
+      defineVariable(parser, constant);
+      adjustStackDepth(parser, 1); // Pushed by the caller.
+    } while (match(parser, TOKEN_COMMA));
+  }
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+  block(parser);
+  scratch.upvalueCount = compiler.upvalueCount;
+  endCompiler(parser, function->name->chars);
+
+  if (!parser->hadError) {
+    finalizeChunk(parser->gc, &function->chunk, &scratch);
+    // Trusted without running the verifier, like the script's own code, see
+    // compileWithScanMode.
+    function->chunk.verified = true;
+    function->constants = function->chunk.constants.values;
+  }
+
+  parser->chunk = enclosingChunk;
+  parser->constants = enclosingConstants;
+  parser->lastComparison = lastComparison;
+  parser->jumpTarget = jumpTarget;
+  parser->lastCall = lastCall;
+  parser->stackDepth = stackDepth;
+  if (compiler.upvalueCount == 0) {
+    emitConstant(parser, OBJ_VAL(function));
+    return;
+  }
+
+  emitBytes(parser, OP_CLOSURE, makeConstant(parser, OBJ_VAL(function)));
+  emitOperand(parser, (uint8_t)compiler.upvalueCount);
+  for (int i = 0; i < compiler.upvalueCount; i++) {
+    emitOperand(parser, compiler.upvalues[i].isLocal ? 1 : 0);
+    emitOperand(parser, compiler.upvalues[i].index);
+  }
+}
+
+static void funDeclaration(Parser *parser) {
+  uint8_t global = parseVariable(parser, "Expect function name.");
+  // A local function may be referred to in its own body.
+  markInitialized(parser->compiler);
+  function(parser, TYPE_FUNCTION);
+  defineVariable(parser, global);
+}
+
 static void declaration(Parser *parser) {
-  if (match(parser, TOKEN_VAR)) {
+  if (match(parser, TOKEN_FUN)) {
+    funDeclaration(parser);
+  } else if (match(parser, TOKEN_VAR)) {
     varDeclaration(parser);
   } else {
     statement(parser);
@@ -482,17 +901,461 @@ static void printStatement(Parser *parser) {
   emitByte(parser, OP_PRINT);
 }
 
+static void returnStatement(Parser *parser) {
+  if (parser->compiler->type == TYPE_SCRIPT)
+    error(parser, "Can't return from top-level code.");
+
+  if (match(parser, TOKEN_SEMICOLON)) {
+    emitByte(parser, OP_NIL);
+    emitByte(parser, OP_RETURN);
+  } else {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
+    // A call computing the whole value is made in the frame returning. The
+    // return is still emitted, for the jumps of an and or or to land on.
+    if (parser->lastCall == parser->chunk->count - 2)
+      parser->chunk->code[parser->lastCall] = OP_TAIL_CALL;
+    emitByte(parser, OP_RETURN);
+  }
+}
+
 static void expressionStatement(Parser *parser) {
   expression(parser);
   consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
   emitByte(parser, OP_POP);
 }
 
+static void ifStatement(Parser *parser) {
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  int thenJump = emitJumpIfFalse(parser);
+  statement(parser);
+
+  if (match(parser, TOKEN_ELSE)) {
+    int elseJump = emitJump(parser, OP_JUMP);
+    patchJump(parser, thenJump);
+    statement(parser);
+    patchJump(parser, elseJump);
+  } else {
+    patchJump(parser, thenJump);
+  }
+}
+
+static void whileStatement(Parser *parser) {
+  int loopStart = parser->chunk->count;
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  int exitJump = emitJumpIfFalse(parser);
+  statement(parser);
+  emitLoop(parser, loopStart);
+  patchJump(parser, exitJump);
+}
+
+static bool isRangeComparison(TokenType type) {
+  return type == TOKEN_LESS || type == TOKEN_LESS_EQUAL ||
+         type == TOKEN_GREATER || type == TOKEN_GREATER_EQUAL;
+}
+
+static uint8_t comparisonOp(TokenType type) {
+  switch (type) {
+  case TOKEN_LESS:
+    return OP_LT;
+  case TOKEN_LESS_EQUAL:
+    return OP_LTE;
+  case TOKEN_GREATER:
+    return OP_GT;
+  default:
+    return OP_GTE;
+  }
+}
+
+static void emitComparison(Parser *parser, uint8_t comparison) {
+  emitByte(parser, comparison);
+  parser->lastComparison = parser->chunk->count - 1;
+}
+
+/*
+ * Compiles the rest of `for (var i = start; i < bound; i = i + step) body`,
+ * with a number or a local for the bound and a number for the step, if the
+ * clauses are of that form. Returns false, having consumed nothing, if not.
+ *
+ * OP_FOR_RANGE compares i against the bound each time it steps it, reading the
+ * bound's own local, or a hidden local after i holding the number, so sees
+ * every assignment to the bound. That needs i to be assigned only by the loop,
+ * which is only known once the body is compiled. If i is assigned or captured
+ * in the body, the loop steps and tests it with generic instructions instead.
+ */
+static bool rangeLoop(Parser *parser) {
+  Compiler *compiler = parser->compiler;
+  Token name = compiler->locals[compiler->localCount - 1].name;
+  Token compare = lookahead(parser, 1), bound = lookahead(parser, 2);
+  Token variable = lookahead(parser, 4), operand = lookahead(parser, 6);
+  Token sign = lookahead(parser, 7), step = lookahead(parser, 8);
+  if (compiler->localCount == UINT8_COUNT || !check(parser, TOKEN_IDENTIFIER) ||
+      !identifiersEqual(&parser->current, &name) ||
+      !isRangeComparison(compare.type) ||
+      (bound.type != TOKEN_NUMBER && bound.type != TOKEN_IDENTIFIER) ||
+      lookahead(parser, 3).type != TOKEN_SEMICOLON ||
+      !identifiersEqual(&variable, &name) ||
+      lookahead(parser, 5).type != TOKEN_EQUAL ||
+      !identifiersEqual(&operand, &name) ||
+      (sign.type != TOKEN_PLUS && sign.type != TOKEN_MINUS) ||
+      step.type != TOKEN_NUMBER ||
+      lookahead(parser, 9).type != TOKEN_RIGHT_PAREN)
+    return false;
+
+  int boundLocal = NOT_RESOLVE_LOCAL;
+  uint8_t boundConstant = 0;
+  if (bound.type == TOKEN_IDENTIFIER) {
+    boundLocal = resolveLocal(parser, compiler, &bound);
+    if (boundLocal == NOT_RESOLVE_LOCAL ||
+        boundLocal == compiler->localCount - 1)
+      return false; // A global may be assigned anywhere.
+  } else {
+    boundConstant = makeConstant(parser, NUMBER_VAL(bound.number));
+  }
+  for (int i = 0; i < 10; i++)
+    advance(parser);
+
+  int slot = compiler->localCount - 1;
+  uint8_t comparison = comparisonOp(compare.type);
+  double delta = sign.type == TOKEN_PLUS ? step.number : -step.number;
+
+  int boundSlot = boundLocal;
+  if (boundLocal == NOT_RESOLVE_LOCAL) {
+    emitBytes(parser, OP_CONSTANT, boundConstant);
+    addLocal(parser, (Token){TOKEN_IDENTIFIER, "for bound", 9, name.line, 0});
+    markInitialized(compiler);
+    boundSlot = slot + 1;
+  }
+
+  emitBytes(parser, OP_GET_LOCAL, (uint8_t)slot);
+  emitBytes(parser, OP_GET_LOCAL, (uint8_t)boundSlot);
+  emitComparison(parser, comparison);
+  int exitJump = emitJumpIfFalse(parser);
+
+  int loopStart = parser->chunk->count;
+  compiler->locals[slot].assigned = false;
+  statement(parser);
+
+  // A closure may assign a captured local whenever it is called.
+  if (compiler->locals[slot].assigned || compiler->locals[slot].captured) {
+    emitBytes(parser, OP_GET_LOCAL, (uint8_t)slot);
+    emitConstant(parser, NUMBER_VAL(step.number));
+    emitByte(parser, sign.type == TOKEN_PLUS ? OP_ADD : OP_SUBTRACT);
+    emitBytes(parser, OP_SET_LOCAL, (uint8_t)slot);
+    emitByte(parser, OP_POP);
+    emitBytes(parser, OP_GET_LOCAL, (uint8_t)slot);
+    emitBytes(parser, OP_GET_LOCAL, (uint8_t)boundSlot);
+    emitComparison(parser, comparison);
+    int doneJump = emitJumpIfFalse(parser);
+    emitLoop(parser, loopStart);
+    patchJump(parser, doneJump);
+  } else {
+    emitBytes(parser, OP_FOR_RANGE, (uint8_t)slot);
+    emitOperand(parser, (uint8_t)boundSlot);
+    emitOperand(parser, comparison);
+    emitOperand(parser, makeConstant(parser, NUMBER_VAL(delta)));
+    int offset = parser->chunk->count - loopStart + 2;
+    if (offset > UINT16_MAX)
+      error(parser, "Loop body too large.");
+    emitShort(parser, offset);
+  }
+
+  patchJump(parser, exitJump);
+  return true;
+}
+
+// The increment clause is compiled before the body but runs after it, so the
+// body jumps back to it, and it jumps back to the condition.
+static void forStatement(Parser *parser) {
+  beginScope(parser->compiler); // Scopes a variable declared in the loop.
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match(parser, TOKEN_SEMICOLON)) {
+    // No initializer.
+  } else if (match(parser, TOKEN_VAR)) {
+    varDeclaration(parser);
+    if (!parser->panicMode && rangeLoop(parser)) {
+      endScope(parser);
+      return;
+    }
+  } else {
+    expressionStatement(parser);
+  }
+
+  int loopStart = parser->chunk->count;
+  int exitJump = -1;
+  if (!match(parser, TOKEN_SEMICOLON)) {
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+    exitJump = emitJumpIfFalse(parser);
+  }
+
+  if (!match(parser, TOKEN_RIGHT_PAREN)) {
+    int bodyJump = emitJump(parser, OP_JUMP);
+    int incrementStart = parser->chunk->count;
+    expression(parser);
+    emitByte(parser, OP_POP);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    emitLoop(parser, loopStart);
+    loopStart = incrementStart;
+    patchJump(parser, bodyJump);
+  }
+
+  statement(parser);
+  emitLoop(parser, loopStart);
+
+  if (exitJump != -1)
+    patchJump(parser, exitJump);
+  endScope(parser);
+}
+
+// Inserts code at the offset, moving the code after it along. Jumps within the
+// moved code are relative, so still land where they did.
+static void insertCode(Parser *parser, int offset, const uint8_t *code,
+                       int length, int line) {
+  Chunk *chunk = parser->chunk;
+  int moved = chunk->count - offset;
+  for (int i = 0; i < length; i++)
+    emitOperand(parser, 0);
+
+  memmove(&chunk->code[offset + length], &chunk->code[offset], moved);
+  memmove(&chunk->lines[offset + length], &chunk->lines[offset],
+          sizeof(int) * moved);
+  memcpy(&chunk->code[offset], code, length);
+  for (int i = 0; i < length; i++)
+    chunk->lines[offset + i] = line;
+}
+
+static uint8_t *writeShort(uint8_t *code, int value) {
+  code[0] = (value >> 8) & 0xff;
+  code[1] = value & 0xff;
+  return code + 2;
+}
+
+// A case label of a switch, and where the statements it runs start.
+typedef struct SwitchCase {
+  Value value;
+  int target;
+} SwitchCase;
+
+// Case labels are constants, so the case of a subject is found in one lookup.
+static Value caseValue(Parser *parser) {
+  bool negate = match(parser, TOKEN_MINUS);
+  if (match(parser, TOKEN_NUMBER))
+    return NUMBER_VAL(negate ? -parser->previous.number
+                             : parser->previous.number);
+
+  if (!negate) {
+    if (match(parser, TOKEN_STRING))
+      return OBJ_VAL(copyString(parser->gc, parser->strings,
+                                parser->previous.start + 1,
+                                parser->previous.length - 2));
+    if (match(parser, TOKEN_TRUE))
+      return BOOL_VAL(true);
+    if (match(parser, TOKEN_FALSE))
+      return BOOL_VAL(false);
+    if (match(parser, TOKEN_NIL))
+      return NIL_VAL;
+  }
+
+  errorAtCurrent(parser, "Expect a constant after 'case'.");
+  return NIL_VAL;
+}
+
+// Whether the cases are integers filling at least half of the range from the
+// lowest to the highest, which is then the size of their OP_JUMP_TABLE.
+static bool denseCases(const SwitchCase *cases, int count, double *lowest,
+                       int *span) {
+  if (count == 0)
+    return false;
+
+  double low = 0, high = 0;
+  for (int i = 0; i < count; i++) {
+    if (!IS_NUMBER(cases[i].value))
+      return false;
+    double number = AS_NUMBER(cases[i].value);
+    if (!(number >= INT32_MIN && number <= INT32_MAX) ||
+        number != (int32_t)number)
+      return false;
+
+    if (i == 0 || number < low)
+      low = number;
+    if (i == 0 || number > high)
+      high = number;
+  }
+
+  *lowest = low;
+  *span = (int)(high - low) + 1;
+  return high - low < UINT16_MAX && *span <= count * 2;
+}
+
+// Offset of a case's statements from the end of the switch's instruction,
+// which is inserted where the statements of the first case started.
+static int caseOffset(Parser *parser, int target, int dispatch) {
+  int offset = target - dispatch;
+  if (offset > UINT16_MAX)
+    error(parser, "Too much code to jump over.");
+  return offset;
+}
+
+static uint8_t *jumpTable(Parser *parser, const SwitchCase *cases, int count,
+                          int defaultTarget, int dispatch, int *length) {
+  double lowest;
+  int span;
+  denseCases(cases, count, &lowest, &span);
+  *length = 6 + span * 2;
+  uint8_t *code = ARENA_ALLOCATE(parser->arena, uint8_t, *length);
+
+  code[0] = OP_JUMP_TABLE;
+  code[1] = makeConstant(parser, NUMBER_VAL(lowest));
+  writeShort(&code[2], span);
+  int defaultOffset = caseOffset(parser, defaultTarget, dispatch);
+  writeShort(&code[4], defaultOffset);
+  for (int i = 0; i < span; i++)
+    writeShort(&code[6 + i * 2], defaultOffset);
+
+  for (int i = 0; i < count; i++) {
+    int index = (int)(AS_NUMBER(cases[i].value) - lowest);
+    writeShort(&code[6 + index * 2],
+               caseOffset(parser, cases[i].target, dispatch));
+  }
+  return code;
+}
+
+static uint8_t *jumpHash(Parser *parser, const SwitchCase *cases, int count,
+                         int defaultTarget, int dispatch, int *length) {
+  // Kept at most half full, so probing always ends at an empty entry.
+  int capacity = count;
+  if (count > SWITCH_SCAN_MAX) {
+    for (capacity = 1; capacity < count * 2;)
+      capacity *= 2;
+  }
+  *length = 5 + capacity * 4;
+  uint8_t *code = ARENA_ALLOCATE(parser->arena, uint8_t, *length);
+  memset(code, 0, *length);
+
+  code[0] = OP_JUMP_HASH;
+  writeShort(&code[1], capacity);
+  writeShort(&code[3], caseOffset(parser, defaultTarget, dispatch));
+  for (int i = 0; i < count; i++) {
+    int index = i;
+    if (count > SWITCH_SCAN_MAX) {
+      index = hashValue(cases[i].value) & (capacity - 1);
+      while (code[5 + index * 4] != 0 || code[6 + index * 4] != 0)
+        index = (index + 1) & (capacity - 1);
+    }
+
+    uint8_t *entry = &code[5 + index * 4];
+    entry = writeShort(entry, makeConstant(parser, cases[i].value) + 1);
+    writeShort(entry, caseOffset(parser, cases[i].target, dispatch));
+  }
+  return code;
+}
+
+/*
+ * Compiles `switch (subject) { case constant: statements default: statements }`
+ * which runs the statements of the case equal to the subject, or those of the
+ * default if any, with no falling through into the next case. Case labels
+ * with no statements between them share the statements after them.
+ *
+ * Only once every case is compiled is it known how to find the right one, so
+ * that instruction is then inserted in front of the cases: OP_JUMP_TABLE for
+ * integers filling at least half their range, and OP_JUMP_HASH otherwise.
+ */
+static void switchStatement(Parser *parser) {
+  int line = parser->previous.line;
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'switch'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after value.");
+  consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before switch cases.");
+  adjustStackDepth(parser, -1); // Popped by the instruction finding the case.
+
+  Chunk *chunk = parser->chunk;
+  int dispatch = chunk->count;
+  SwitchCase *cases = NULL;
+  int count = 0, capacity = 0;
+  int *endJumps = NULL;
+  int endCount = 0, endCapacity = 0;
+  int defaultTarget = -1;
+
+  while (match(parser, TOKEN_CASE) || match(parser, TOKEN_DEFAULT)) {
+    if (parser->previous.type == TOKEN_CASE) {
+      Value value = caseValue(parser);
+      for (int i = 0; i < count; i++) {
+        if (valuesEqual(cases[i].value, value))
+          error(parser, "Duplicate case in switch.");
+      }
+      if (count + 1 > capacity) {
+        int oldCapacity = capacity;
+        capacity = GROW_CAPACITY(oldCapacity);
+        cases = ARENA_GROW_ARRAY(parser->arena, SwitchCase, cases, oldCapacity,
+                                 capacity);
+      }
+      cases[count++] = (SwitchCase){value, chunk->count};
+    } else {
+      if (defaultTarget != -1)
+        error(parser, "Already a default case in switch.");
+      defaultTarget = chunk->count;
+    }
+    consume(parser, TOKEN_COLON, "Expect ':' after case.");
+    parser->jumpTarget = chunk->count;
+    if (check(parser, TOKEN_CASE) || check(parser, TOKEN_DEFAULT))
+      continue;
+
+    beginScope(parser->compiler);
+    while (!check(parser, TOKEN_CASE) && !check(parser, TOKEN_DEFAULT) &&
+           !check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF))
+      declaration(parser);
+    endScope(parser);
+
+    if (check(parser, TOKEN_CASE) || check(parser, TOKEN_DEFAULT)) {
+      if (endCount + 1 > endCapacity) {
+        int oldCapacity = endCapacity;
+        endCapacity = GROW_CAPACITY(oldCapacity);
+        endJumps = ARENA_GROW_ARRAY(parser->arena, int, endJumps, oldCapacity,
+                                    endCapacity);
+      }
+      endJumps[endCount++] = emitJump(parser, OP_JUMP);
+    }
+  }
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect 'case', 'default' or '}'.");
+
+  if (defaultTarget == -1)
+    defaultTarget = chunk->count;
+  double lowest;
+  int span, length;
+  uint8_t *code =
+      denseCases(cases, count, &lowest, &span)
+          ? jumpTable(parser, cases, count, defaultTarget, dispatch, &length)
+          : jumpHash(parser, cases, count, defaultTarget, dispatch, &length);
+  insertCode(parser, dispatch, code, length, line);
+
+  for (int i = 0; i < endCount; i++)
+    patchJump(parser, endJumps[i] + length);
+  parser->jumpTarget = chunk->count;
+}
+
 static void statement(Parser *parser) {
   if (match(parser, TOKEN_PRINT)) {
     printStatement(parser);
+  } else if (match(parser, TOKEN_IF)) {
+    ifStatement(parser);
+  } else if (match(parser, TOKEN_WHILE)) {
+    whileStatement(parser);
+  } else if (match(parser, TOKEN_FOR)) {
+    forStatement(parser);
+  } else if (match(parser, TOKEN_SWITCH)) {
+    switchStatement(parser);
+  } else if (match(parser, TOKEN_RETURN)) {
+    returnStatement(parser);
   } else if (match(parser, TOKEN_LEFT_BRACE)) {
-    beginScope(&parser->compiler);
+    beginScope(parser->compiler);
     block(parser);
     endScope(parser);
   } else {
@@ -524,31 +1387,126 @@ static void parsePrecedence(Parser *parser, Precedence precedence) {
   }
 }
 
-// Returns true if the compilation succeeded.
-bool compile(const char *source, Chunk *chunk, GC *gc, Table *strings) {
-  Scanner scanner;
-  initScanner(&scanner, source);
+/*
+ * Compiles the script into the chunk, unless there is an error. Returns false
+ * if the heap ran out of memory instead, see gcOutOfMemory, which the caller
+ * passes on once the parser's scratch memory is freed.
+ */
+static bool compileScript(Parser *parser, Chunk *chunk) {
+  GC *gc = parser->gc;
+  jmp_buf handler, *outer = gc->outOfMemory;
+  gc->outOfMemory = &handler;
+  if (setjmp(handler) != 0) {
+    gc->outOfMemory = outer;
+    if (chunk->finalized) // Keeping track of it failed.
+      freeChunk(gc, chunk);
+    return false;
+  }
 
   Compiler compiler;
-  compiler.localCount = 0;
-  compiler.scopeDepth = 0;
+  initCompiler(parser, &compiler, TYPE_SCRIPT);
+  advance(parser);
+
+  while (!match(parser, TOKEN_EOF)) {
+    declaration(parser);
+  }
+
+  endCompiler(parser, "code");
+
+  // Only part of the source was scanned.
+  if (parser->tokens != NULL && parser->tokens->outOfMemory)
+    gcOutOfMemory(gc);
+
+  if (!parser->hadError) {
+    finalizeChunk(gc, chunk, parser->chunk);
+    gcAddChunk(gc, chunk);
+    // The compiler's own output is trusted to pass verifyChunk, so runs
+    // unchecked without paying for verifying it. That is only checked when
+    // debugging.
+    chunk->verified = true;
+#ifdef DEBUG_PRINT_CODE
+    VerifyError verifyError;
+    if (!verifyChunk(chunk, &verifyError))
+      fprintf(stderr, "Compiled code failed to verify at %d: %s\n",
+              verifyError.offset, verifyError.message);
+#endif
+  }
+
+  gc->outOfMemory = outer;
+  return true;
+}
+
+// Returns true if the compilation succeeded, in which case the empty chunk
+// given is filled with the bytecode, finalized.
+bool compileWithScanMode(const char *source, Chunk *chunk, GC *gc,
+                         Table *strings, ScanMode mode) {
+  TokenBuffer tokens;
+  if (mode != SCAN_STREAMING)
+    initTokenBuffer(&tokens, source, mode == SCAN_THREADED);
+
+  Arena arena;
+  initArena(&arena, gc);
+
+  // Constants only live in the arena until compiling is done, where the GC
+  // does not see them. The GC never collects during compilation, as there is
+  // no safepoint, but must not put them in the nursery to be moved either.
+  // They tend to live as long as the program anyway.
+  bool pretenure = gc->pretenure;
+  gc->pretenure = true;
+  Chunk scratch;
+  initChunk(&scratch);
 
   Parser parser;
-  parser.scanner = scanner;
-  parser.compiler = compiler;
+  initScanner(&parser.scanner, source);
+  parser.tokens = mode != SCAN_STREAMING ? &tokens : NULL;
+  parser.nextToken = 0;
+  parser.compiler = NULL;
   parser.hadError = false;
   parser.panicMode = false;
-  parser.chunk = chunk;
+  parser.chunk = &scratch;
+  parser.lastComparison = parser.jumpTarget = parser.lastCall = -1;
+  parser.stackDepth = 0;
+  parser.constants.count = 0;
+  parser.constants.capacity = 0;
+  parser.constants.slots = NULL;
+  parser.arena = &arena;
   parser.gc = gc;
   parser.strings = strings;
 
-  advance(&parser);
-
-  while (!match(&parser, TOKEN_EOF)) {
-    declaration(&parser);
-  }
+  bool compiled = compileScript(&parser, chunk);
 
-  endCompiler(&parser);
+  if (parser.tokens != NULL)
+    freeTokenBuffer(parser.tokens);
+  freeArena(&arena);
+  gc->pretenure = pretenure;
 
+  // Objects made so far are unreachable, and left for the caller to collect.
+  if (!compiled)
+    gcOutOfMemory(gc);
   return !parser.hadError;
 }
+
+// Processors online, or 0 until looked up. Compiles on several threads at once
+// may each look it up, and store the same count.
+static atomic_long processors;
+
+static bool canScanOnAnotherProcessor(void) {
+  long count = atomic_load_explicit(&processors, memory_order_relaxed);
+  if (count == 0) {
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+    atomic_store_explicit(&processors, count, memory_order_relaxed);
+  }
+  return count > 1;
+}
+
+// Large sources are scanned on a separate thread which runs ahead of parsing,
+// when there is another processor to run it on. Otherwise tokens are scanned
+// as they are needed, which saves buffering them. Only as much of the source
+// as the threshold is measured.
+bool compile(const char *source, Chunk *chunk, GC *gc, Table *strings) {
+  bool threaded = canScanOnAnotherProcessor() &&
+                  strnlen(source, THREADED_SCAN_MIN_BYTES) ==
+                      THREADED_SCAN_MIN_BYTES;
+  ScanMode mode = threaded ? SCAN_THREADED : SCAN_STREAMING;
+  return compileWithScanMode(source, chunk, gc, strings, mode);
+}
@@ -3,11 +3,13 @@
 
 #include <stdbool.h>
 
+#include "arena.h"
 #include "chunk.h"
 #include "gc.h"
 #include "scanner.h"
 #include "table.h"
 #include "token.h"
+#include "tokenbuffer.h"
 
 // Instruction operand to encode a local is a single byte, so the VM has a hard
 // limit on the number of locals that can be in scope at once.
@@ -17,23 +19,65 @@
 
 typedef struct Local {
   Token name;
-  int depth; // The scope depth of where the local var was declared.
+  int depth;     // The scope depth of where the local var was declared.
+  bool assigned; // Assigned to since this was last cleared, see rangeLoop.
+  // Captured by a closure, so closed rather than popped when its scope ends,
+  // and may be assigned by any call.
+  bool captured;
 } Local;
 
+// A variable of an enclosing function, which a closure captures.
+typedef struct Upvalue {
+  uint8_t index; // The local's slot if isLocal, else the enclosing upvalue's.
+  bool isLocal;  // A local of the function just outside.
+} Upvalue;
+
+typedef enum FunctionType {
+  TYPE_FUNCTION,
+  TYPE_SCRIPT, // The top level of the source, compiled into the given chunk.
+} FunctionType;
+
+// Compiles one function, while the functions it is nested in wait.
 typedef struct Compiler {
+  struct Compiler *enclosing;
+  FunctionType type;
   Local locals[UINT8_COUNT]; // Locals in current scope, code declaration order.
   int localCount;            // Number of locals are in scope.
   int scopeDepth;            // Number of blocks surrounding current code.
+  Upvalue upvalues[UINT8_COUNT];
+  int upvalueCount;
 } Compiler;
 
+typedef struct ConstantSlot {
+  Value value;
+  int index; // Index in the chunk's constants, or -1 for an empty slot.
+} ConstantSlot;
+
+// Finds the existing constant for a value, so each value is stored only once.
+typedef struct ConstantTable {
+  int count;
+  int capacity;
+  ConstantSlot *slots;
+} ConstantTable;
+
 typedef struct Parser {
   Token current;
   Token previous;
-  Scanner scanner;
-  Compiler compiler;
+  Scanner scanner;     // Scans tokens on demand, unless tokens is set.
+  TokenBuffer *tokens; // The source scanned ahead of time into tokens.
+  int nextToken;       // Index of the token following current in tokens.
+  Compiler *compiler;  // Of the innermost function being compiled.
   bool hadError;
   bool panicMode;
-  Chunk *chunk;   // The chunk the bytecode is being written to.
+  // The chunk of the innermost function, written to in the arena, and the
+  // state of compiling it below.
+  Chunk *chunk;
+  int lastComparison; // Offset of the last comparison, see emitJumpIfFalse.
+  int jumpTarget;     // Offset the last patched jump lands on.
+  int lastCall;       // Offset of the last call, see returnStatement.
+  int stackDepth;     // Values on the stack after the code so far.
+  ConstantTable constants;
+  Arena *arena;   // Scratch memory, freed in one go after compiling.
   GC *gc;         // Will add heap-allocated objects to the GC during parsing.
   Table *strings; // String interning pool.
 } Parser;
@@ -62,6 +106,21 @@ typedef struct {
   Precedence precedence;
 } ParseRule;
 
+typedef enum ScanMode {
+  SCAN_STREAMING, // Scan each token as the parser asks for it.
+  SCAN_UPFRONT,   // Scan the whole source into a token buffer before parsing.
+  SCAN_THREADED,  // Fill the token buffer on a thread running ahead of parsing.
+} ScanMode;
+
+// Sources at least this large are scanned on a separate thread by compile().
+#define THREADED_SCAN_MIN_BYTES (1 << 20)
+
+/* Compiles the source into the empty chunk, whose constants the heap keeps
+ * alive until it is freed with freeChunk. The constants of a finalized chunk
+ * must never move, so the GC's nursery must not hold any interned strings,
+ * see collectYoungGarbage. */
 bool compile(const char *source, Chunk *chunk, GC *gc, Table *strings);
+bool compileWithScanMode(const char *source, Chunk *chunk, GC *gc,
+                         Table *strings, ScanMode mode);
 
 #endif
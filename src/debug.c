@@ -9,7 +9,8 @@ static int simpleInstruction(const char *name, int offset) {
   return offset + 1;
 }
 
-static int constantInstruction(const char *name, Chunk *chunk, int offset) {
+static int constantInstruction(const char *name, const Chunk *chunk,
+                               int offset) {
   uint8_t constantIndex = chunk->code[offset + 1];
   printf("%-16s %4d '", name, constantIndex);
   printValue(chunk->constants.values[constantIndex]);
@@ -17,15 +18,93 @@ static int constantInstruction(const char *name, Chunk *chunk, int offset) {
   return offset + 2;
 }
 
-static int byteInstruction(const char *name, Chunk *chunk, int offset) {
+static int byteInstruction(const char *name, const Chunk *chunk,
+                           int offset) {
   uint8_t slot = chunk->code[offset + 1];
   printf("%-16s %4d\n", name, slot);
   return offset + 2;
 }
 
+// Prints a jump with the offset of the instruction it lands on.
+static int jumpInstruction(const char *name, int sign, const Chunk *chunk,
+                           int offset) {
+  uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+  jump |= chunk->code[offset + 2];
+  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
+  return offset + 3;
+}
+
+static int forRangeInstruction(const Chunk *chunk, int offset) {
+  static const char *comparisons[] = {
+      [OP_LT] = "<", [OP_LTE] = "<=", [OP_GT] = ">", [OP_GTE] = ">="};
+  uint8_t slot = chunk->code[offset + 1];
+  uint8_t bound = chunk->code[offset + 2];
+  uint8_t comparison = chunk->code[offset + 3];
+  uint8_t step = chunk->code[offset + 4];
+  uint16_t jump = (uint16_t)(chunk->code[offset + 5] << 8);
+  jump |= chunk->code[offset + 6];
+
+  printf("%-16s %4d %s %d '", opInfo[OP_FOR_RANGE].name, slot,
+         comparisons[comparison], bound);
+  printValue(chunk->constants.values[step]);
+  printf("' -> %d\n", offset + 7 - jump);
+  return offset + 7;
+}
+
+// Prints the function, then what each of its upvalues captures on its own line.
+static int closureInstruction(const Chunk *chunk, int offset) {
+  const uint8_t *code = &chunk->code[offset];
+  printf("%-16s %4d '", opInfo[OP_CLOSURE].name, code[1]);
+  printValue(chunk->constants.values[code[1]]);
+  printf("'\n");
+  for (int i = 0; i < code[2]; i++) {
+    const uint8_t *capture = &code[3 + i * 2];
+    printf("%9s %16s %s %d\n", "|", "", capture[0] ? "local" : "upvalue",
+           capture[1]);
+  }
+  return offset + 3 + code[2] * 2;
+}
+
+static int readOffset(const uint8_t *code) { return (code[0] << 8) | code[1]; }
+
+// Prints the lowest case and the default, then each case on its own line.
+static int jumpTableInstruction(const Chunk *chunk, int offset) {
+  const uint8_t *code = &chunk->code[offset];
+  Value lowest = chunk->constants.values[code[1]];
+  int count = readOffset(&code[2]);
+  int end = offset + 6 + count * 2;
+
+  printf("%-16s %4d '", opInfo[OP_JUMP_TABLE].name, code[1]);
+  printValue(lowest);
+  printf("' default -> %d\n", end + readOffset(&code[4]));
+  for (int i = 0; i < count; i++)
+    printf("%9s %16s %4g -> %d\n", "|", "", AS_NUMBER(lowest) + i,
+           end + readOffset(&code[6 + i * 2]));
+  return end;
+}
+
+static int jumpHashInstruction(const Chunk *chunk, int offset) {
+  const uint8_t *code = &chunk->code[offset];
+  int capacity = readOffset(&code[1]);
+  int end = offset + 5 + capacity * 4;
+
+  printf("%-16s %4d default -> %d\n", opInfo[OP_JUMP_HASH].name, capacity,
+         end + readOffset(&code[3]));
+  for (int i = 0; i < capacity; i++) {
+    const uint8_t *entry = &code[5 + i * 4];
+    int key = readOffset(entry);
+    if (key == 0)
+      continue;
+    printf("%9s %16s %4d '", "|", "", key - 1);
+    printValue(chunk->constants.values[key - 1]);
+    printf("' -> %d\n", end + readOffset(&entry[2]));
+  }
+  return end;
+}
+
 // Disassembles the instruction at the `offset` index of the chunk's array
 // of instructions. Returns the index of the next instruction to disassemble.
-int disassembleInstruction(Chunk *chunk, int offset) {
+int disassembleInstruction(const Chunk *chunk, int offset) {
   printf("%04d ", offset);
 
   if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
@@ -35,63 +114,40 @@ int disassembleInstruction(Chunk *chunk, int offset) {
   }
 
   uint8_t instruction = chunk->code[offset];
-  switch (instruction) {
-  case OP_CONSTANT:
-    return constantInstruction("OP_CONSTANT", chunk, offset);
-  case OP_NIL:
-    return simpleInstruction("OP_NIL", offset);
-  case OP_TRUE:
-    return simpleInstruction("OP_TRUE", offset);
-  case OP_FALSE:
-    return simpleInstruction("OP_FALSE", offset);
-  case OP_POP:
-    return simpleInstruction("OP_POP", offset);
-  case OP_GET_LOCAL:
-    return byteInstruction("OP_GET_LOCAL", chunk, offset);
-  case OP_SET_LOCAL:
-    return byteInstruction("OP_SET_LOCAL", chunk, offset);
-  case OP_DEFINE_GLOBAL:
-    return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-  case OP_GET_GLOBAL:
-    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-  case OP_SET_GLOBAL:
-    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
-  case OP_ADD:
-    return simpleInstruction("OP_ADD", offset);
-  case OP_SUBTRACT:
-    return simpleInstruction("OP_SUBTRACT", offset);
-  case OP_MULTIPLY:
-    return simpleInstruction("OP_MULTIPLY", offset);
-  case OP_DIVIDE:
-    return simpleInstruction("OP_DIVIDE", offset);
-  case OP_LT:
-    return simpleInstruction("OP_LT", offset);
-  case OP_LTE:
-    return simpleInstruction("OP_LTE", offset);
-  case OP_EQ:
-    return simpleInstruction("OP_EQ", offset);
-  case OP_NEQ:
-    return simpleInstruction("OP_NEQ", offset);
-  case OP_GT:
-    return simpleInstruction("OP_GT", offset);
-  case OP_GTE:
-    return simpleInstruction("OP_GTE", offset);
-  case OP_NOT:
-    return simpleInstruction("OP_NOT", offset);
-  case OP_NEGATE:
-    return simpleInstruction("OP_NEGATE", offset);
-  case OP_PRINT:
-    return simpleInstruction("OP_PRINT", offset);
-  case OP_RETURN:
-    return simpleInstruction("OP_RETURN", offset);
-  default:
+  if (instruction >= OP_COUNT) {
     printf("Unknown opcode %d\n", instruction);
     return offset + 1;
   }
+
+  const char *name = opInfo[instruction].name;
+  switch (opInfo[instruction].operands) {
+  case OPERANDS_NONE:
+    return simpleInstruction(name, offset);
+  case OPERAND_CONSTANT:
+  case OPERAND_GLOBAL:
+    return constantInstruction(name, chunk, offset);
+  case OPERAND_LOCAL:
+  case OPERAND_ARG_COUNT:
+  case OPERAND_UPVALUE:
+    return byteInstruction(name, chunk, offset);
+  case OPERAND_JUMP:
+    return jumpInstruction(name, 1, chunk, offset);
+  case OPERAND_LOOP:
+    return jumpInstruction(name, -1, chunk, offset);
+  case OPERANDS_FOR_RANGE:
+    return forRangeInstruction(chunk, offset);
+  case OPERANDS_JUMP_TABLE:
+    return jumpTableInstruction(chunk, offset);
+  case OPERANDS_JUMP_HASH:
+    return jumpHashInstruction(chunk, offset);
+  case OPERANDS_CLOSURE:
+    return closureInstruction(chunk, offset);
+  }
+  return offset + 1; // Unreachable.
 }
 
 // Disassembles the entire chunk to make instructions human-readable.
-void disassembleChunk(Chunk *chunk, const char *name) {
+void disassembleChunk(const Chunk *chunk, const char *name) {
   printf("== %s ==\n", name);
 
   int offset = 0;
@@ -3,7 +3,7 @@
 
 #include "chunk.h"
 
-void disassembleChunk(Chunk *chunk, const char *name);
-int disassembleInstruction(Chunk *chunk, int offset);
+void disassembleChunk(const Chunk *chunk, const char *name);
+int disassembleInstruction(const Chunk *chunk, int offset);
 
 #endif
@@ -1,37 +1,1150 @@
+#include <math.h>
+#include <stdlib.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <string.h>
+#include <time.h>
+
 #include "gc.h"
 #include "memory.h"
 #include "object.h"
+#include "pool.h"
+#include "table.h"
+
+// Nursery allocations keep objects aligned for pointers and doubles.
+#define NURSERY_ALIGN(size) (((size) + 7) & ~(size_t)7)
 
-static void freeObject(Obj *object) {
+// Frees memory of an object, on the sweeper's thread if one is given.
+static void freeCell(GC *gc, Sweeper *sweeper, MemCategory category, void *ptr,
+                     size_t size) {
+  if (sweeper == NULL) {
+    poolFree(gc, category, ptr, size);
+    return;
+  }
+
+  poolRelease(sweeper->pool, ptr, size);
+  sweeper->freedBytes[category] += size;
+  sweeper->frees++;
+}
+
+// Frees memory from reallocate rather than the pool, likewise.
+static void freeBlock(GC *gc, Sweeper *sweeper, MemCategory category, void *ptr,
+                      size_t size) {
+  if (sweeper == NULL) {
+    reallocate(gc, category, ptr, size, 0);
+    return;
+  }
+
+  free(ptr);
+  sweeper->freedBytes[category] += size;
+  sweeper->frees++;
+}
+
+static size_t closureSize(const ObjClosure *closure) {
+  return sizeof(ObjClosure) + sizeof(ObjUpvalue *) * closure->upvalueCount;
+}
+
+static void freeObject(GC *gc, Sweeper *sweeper, Obj *object) {
   switch (object->type) {
   case OBJ_STRING: {
     ObjString *string = (ObjString *)object;
-    FREE_ARRAY(char, string->chars, string->length);
-    FREE(ObjString, object);
+    freeCell(gc, sweeper, MEM_OBJ_STRING, string->chars, string->length + 1);
+    freeCell(gc, sweeper, MEM_OBJ_STRING, object, sizeof(ObjString));
+    break;
+  }
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    if (function->constants != function->chunk.constants.values) {
+      // A copy of another VM's function, see ObjFunction.
+      if (function->constants != NULL)
+        freeBlock(gc, sweeper, MEM_CONSTANTS, function->constants,
+                  sizeof(Value) * function->chunk.constants.count);
+    } else if (sweeper == NULL) {
+      freeChunk(gc, &function->chunk);
+    } else {
+      releaseChunk(&function->chunk, sweeper->freedBytes);
+      sweeper->frees++;
+    }
+    freeCell(gc, sweeper, MEM_OBJ_FUNCTION, object, sizeof(ObjFunction));
     break;
   }
+  case OBJ_NATIVE:
+    freeCell(gc, sweeper, MEM_OBJ_NATIVE, object, sizeof(ObjNative));
+    break;
+  case OBJ_CLOSURE:
+    freeCell(gc, sweeper, MEM_OBJ_CLOSURE, object,
+             closureSize((ObjClosure *)object));
+    break;
+  case OBJ_UPVALUE:
+    freeCell(gc, sweeper, MEM_OBJ_UPVALUE, object, sizeof(ObjUpvalue));
+    break;
   }
 }
 
-// Traverses the intrusive linked list of the VM's objects and frees them.
-static void freeObjects(Obj *objects) {
-  Obj *o = objects;
+// Traverses an intrusive linked list of the VM's objects and frees them.
+static void freeObjects(GC *gc, Obj *o) {
   while (o != NULL) {
     Obj *next = o->next;
-    freeObject(o);
+    freeObject(gc, NULL, o);
     o = next;
   }
 }
 
-void initGC(GC *gc) { gc->objects = NULL; }
+static void finishSweeper(GC *gc);
 
+void initGC(GC *gc) {
+  gc->objects = NULL;
+  initMemoryStats(&gc->stats);
+  initPool(&gc->pool);
+
+  gc->nursery.start = gc->nursery.top = gc->nursery.end = NULL;
+  gc->nurseryFull = false;
+  gc->generational = true;
+  gc->pretenure = false;
+  gc->nextCollection = GC_MIN_HEAP;
+  gc->heapLimit = SIZE_MAX;
+  gc->outOfMemory = NULL;
+  gc->collecting = false;
+
+  gc->visitRoots = NULL;
+  gc->rootContext = NULL;
+  gc->strings = NULL;
+  gc->chunks = NULL;
+  gc->chunkCount = gc->chunkCapacity = 0;
+
+  gc->remembered = NULL;
+  gc->rememberedCount = gc->rememberedCapacity = 0;
+  gc->rememberedObjects = NULL;
+  gc->rememberedObjectCount = gc->rememberedObjectCapacity = 0;
+  gc->youngStrings = NULL;
+  gc->youngStringCount = gc->youngStringCapacity = 0;
+  gc->grayStack = NULL;
+  gc->grayCount = gc->grayCapacity = 0;
+  gc->grayLimit = GC_GRAY_LIMIT;
+  gc->grayOverflow = false;
+  gc->phase = GC_IDLE;
+  gc->markValue = true;
+  gc->markTables = false;
+  gc->incremental = false;
+  gc->sliceMicros = GC_SLICE_MICROS;
+  gc->sliceDebt = 0;
+  gc->unswept = NULL;
+  gc->backgroundSweep = false;
+  gc->sweeper.running = false;
+  gc->clearedStrings = 0;
+  gc->clearedCapacity = -1;
+  gc->compact = false;
+  gc->compacting = false;
+  gc->compactPending = false;
+
+  gc->gcStats.minorCollections = gc->gcStats.majorCollections = 0;
+  gc->gcStats.slices = 0;
+  gc->gcStats.rescans = 0;
+  gc->gcStats.compactions = 0;
+  gc->gcStats.promotedBytes = 0;
+  gc->gcStats.youngAllocations = 0;
+  gc->gcStats.pauseSeconds = gc->gcStats.maxPauseSeconds = 0;
+  for (int i = 0; i < GC_PAUSE_BUCKETS; i++)
+    gc->gcStats.pauseHistogram[i] = 0;
+}
+
+// Frees all objects. The stats are kept, to account for memory still held by
+// anything else allocated from the heap.
 void freeGC(GC *gc) {
-  freeObjects(gc->objects);
-  initGC(gc);
+  if (gc->sweeper.running)
+    finishSweeper(gc);
+  freeObjects(gc, gc->objects);
+  freeObjects(gc, gc->unswept);
+  gc->objects = gc->unswept = NULL;
+  gc->phase = GC_IDLE;
+  freePool(gc, &gc->pool);
+
+  if (gc->nursery.start != NULL) {
+    free(gc->nursery.start);
+    gc->stats.nurseryBytes -= NURSERY_SIZE;
+  }
+  gc->nursery.start = gc->nursery.top = gc->nursery.end = NULL;
+
+  FREE_ARRAY(gc, MEM_GC, const Chunk *, gc->chunks, gc->chunkCapacity);
+  FREE_ARRAY(gc, MEM_GC, RememberedEntry, gc->remembered,
+             gc->rememberedCapacity);
+  FREE_ARRAY(gc, MEM_GC, Obj *, gc->rememberedObjects,
+             gc->rememberedObjectCapacity);
+  FREE_ARRAY(gc, MEM_GC, ObjString *, gc->youngStrings,
+             gc->youngStringCapacity);
+  free(gc->grayStack);
+  gc->stats.markStackBytes -= sizeof(Obj *) * gc->grayCapacity;
+  gc->chunks = NULL;
+  gc->remembered = NULL;
+  gc->rememberedObjects = NULL;
+  gc->youngStrings = NULL;
+  gc->grayStack = NULL;
+  gc->chunkCount = gc->chunkCapacity = 0;
+  gc->rememberedCount = gc->rememberedCapacity = 0;
+  gc->rememberedObjectCount = gc->rememberedObjectCapacity = 0;
+  gc->youngStringCount = gc->youngStringCapacity = 0;
+  gc->grayCount = gc->grayCapacity = 0;
 }
 
-// Inserts at the head of the GC's intrusive linked list of objects.
+// Inserts at the head of the GC's intrusive linked list of objects. Objects
+// added while marking start unmarked. Others are marked like the survivors of
+// the last collection, which become unmarked at once when the next starts.
 void gcAddObject(GC *gc, Obj *object) {
+  object->mark = gc->phase == GC_MARKING ? !gc->markValue : gc->markValue;
   object->next = gc->objects;
   gc->objects = object;
 }
+
+void gcAddChunk(GC *gc, const Chunk *chunk) {
+  if (gc->chunkCount + 1 > gc->chunkCapacity) {
+    int oldCapacity = gc->chunkCapacity;
+    gc->chunkCapacity = GROW_CAPACITY(oldCapacity);
+    gc->chunks = GROW_ARRAY(gc, MEM_GC, const Chunk *, gc->chunks,
+                            oldCapacity, gc->chunkCapacity);
+  }
+  gc->chunks[gc->chunkCount++] = chunk;
+}
+
+// Chunks are usually freed in the reverse order they were added in.
+void gcRemoveChunk(GC *gc, const Chunk *chunk) {
+  for (int i = gc->chunkCount - 1; i >= 0; i--) {
+    if (gc->chunks[i] == chunk) {
+      gc->chunks[i] = gc->chunks[--gc->chunkCount];
+      return;
+    }
+  }
+}
+
+void gcReviveString(GC *gc, ObjString *string) {
+  // Only written when unmarked, as the helper thread may be reading the marks
+  // of the strings left in the table. Young strings are not swept.
+  if (gc->phase == GC_SWEEPING && !gcInNursery(gc, string) &&
+      string->obj.mark != gc->markValue)
+    string->obj.mark = gc->markValue;
+}
+
+void gcOutOfMemory(GC *gc) {
+  if (gc->outOfMemory == NULL || gc->collecting) {
+    fprintf(stderr, "Out of memory.\n");
+    exit(EXIT_FAILURE);
+  }
+  longjmp(*gc->outOfMemory, 1);
+}
+
+void *nurseryAllocate(GC *gc, size_t size) {
+  if (!gc->generational || gc->pretenure || size > NURSERY_MAX_OBJECT)
+    return NULL;
+
+  Nursery *nursery = &gc->nursery;
+  if (nursery->start == NULL) {
+    nursery->start = malloc(NURSERY_SIZE);
+    if (nursery->start == NULL) {
+      // Everything is allocated old instead, which can fail on its own.
+      gc->generational = false;
+      return NULL;
+    }
+    nursery->top = nursery->start;
+    nursery->end = nursery->start + NURSERY_SIZE;
+    gc->stats.nurseryBytes += NURSERY_SIZE;
+  }
+
+  size = NURSERY_ALIGN(size);
+  if ((size_t)(nursery->end - nursery->top) < size) {
+    gc->nurseryFull = true;
+    return NULL;
+  }
+
+  void *result = nursery->top;
+  nursery->top += size;
+  gc->gcStats.youngAllocations++;
+  return result;
+}
+
+void gcRememberYoungString(GC *gc, ObjString *string) {
+  if (gc->youngStringCount + 1 > gc->youngStringCapacity) {
+    int oldCapacity = gc->youngStringCapacity;
+    gc->youngStringCapacity = GROW_CAPACITY(oldCapacity);
+    gc->youngStrings = GROW_ARRAY(gc, MEM_GC, ObjString *, gc->youngStrings,
+                                  oldCapacity, gc->youngStringCapacity);
+  }
+  gc->youngStrings[gc->youngStringCount++] = string;
+}
+
+void gcRememberEntry(GC *gc, Table *table, ObjString *key) {
+  // A global assigned in a loop is remembered once, not every iteration.
+  if (gc->rememberedCount > 0) {
+    RememberedEntry *last = &gc->remembered[gc->rememberedCount - 1];
+    if (last->table == table && last->key == key)
+      return;
+  }
+
+  if (gc->rememberedCount + 1 > gc->rememberedCapacity) {
+    int oldCapacity = gc->rememberedCapacity;
+    gc->rememberedCapacity = GROW_CAPACITY(oldCapacity);
+    gc->remembered = GROW_ARRAY(gc, MEM_GC, RememberedEntry, gc->remembered,
+                                oldCapacity, gc->rememberedCapacity);
+  }
+  gc->remembered[gc->rememberedCount++] = (RememberedEntry){table, key};
+}
+
+// Each object is remembered once until the next collection, however often it
+// is written.
+void gcRememberObject(GC *gc, Obj *object) {
+  if (object->remembered)
+    return;
+  object->remembered = true;
+
+  if (gc->rememberedObjectCount + 1 > gc->rememberedObjectCapacity) {
+    int oldCapacity = gc->rememberedObjectCapacity;
+    gc->rememberedObjectCapacity = GROW_CAPACITY(oldCapacity);
+    gc->rememberedObjects =
+        GROW_ARRAY(gc, MEM_GC, Obj *, gc->rememberedObjects, oldCapacity,
+                   gc->rememberedObjectCapacity);
+  }
+  gc->rememberedObjects[gc->rememberedObjectCount++] = object;
+}
+
+// The gray stack is allocated outside the heap, so marking never needs the
+// heap to grow, nor exits when it cannot.
+static bool growGrayStack(GC *gc) {
+  if (gc->grayCapacity >= gc->grayLimit)
+    return false;
+
+  int capacity = GROW_CAPACITY(gc->grayCapacity);
+  if (capacity > gc->grayLimit)
+    capacity = gc->grayLimit;
+  Obj **stack = realloc(gc->grayStack, sizeof(Obj *) * capacity);
+  if (stack == NULL)
+    return false;
+
+  gc->stats.markStackBytes += sizeof(Obj *) * (capacity - gc->grayCapacity);
+  gc->grayStack = stack;
+  gc->grayCapacity = capacity;
+  return true;
+}
+
+// Marks an object and pushes it on the gray stack to be traced. If the stack
+// is full and cannot grow, the object is left marked but untraced, for
+// rescanHeap to find.
+static void markObject(GC *gc, Obj *object) {
+  if (object->mark == gc->markValue)
+    return;
+  object->mark = gc->markValue;
+
+  if (gc->grayCount == gc->grayCapacity && !growGrayStack(gc)) {
+    gc->grayOverflow = true;
+    return;
+  }
+  gc->grayStack[gc->grayCount++] = object;
+}
+
+void gcMarkEntry(GC *gc, ObjString *key, Value value) {
+  markObject(gc, (Obj *)key);
+  if (IS_OBJ(value))
+    markObject(gc, AS_OBJ(value));
+}
+
+void gcMarkValue(GC *gc, Value value) { markObject(gc, AS_OBJ(value)); }
+
+// ----- Nursery Collection -----
+
+// A young object's next field is unused, until it is set to the address the
+// object was copied to.
+static bool isForwarded(Obj *object) { return object->next != NULL; }
+
+// While compacting, an old object left unmarked has its next field set to the
+// address it was copied to, see compactHeap.
+static Obj *compacted(GC *gc, Obj *object) {
+  return object->mark == gc->markValue ? object : object->next;
+}
+
+// Copies an object into the pool, along with the memory it owns. Large
+// buffers are only copied out of the nursery, and are kept otherwise.
+static Obj *copyObject(GC *gc, Obj *object) {
+  Obj *copy = NULL;
+  switch (object->type) {
+  case OBJ_STRING: {
+    ObjString *string = (ObjString *)object;
+    ObjString *moved = POOL_ALLOCATE(gc, MEM_OBJ_STRING, ObjString, 1);
+    *moved = *string;
+    int size = string->length + 1;
+    if (size <= POOL_MAX_SIZE || gcInNursery(gc, string->chars)) {
+      moved->chars = POOL_ALLOCATE(gc, MEM_OBJ_STRING, char, size);
+      memcpy(moved->chars, string->chars, size);
+    }
+    copy = (Obj *)moved;
+    break;
+  }
+  case OBJ_FUNCTION: {
+    // The chunk and constants are not in the pool, so are kept.
+    ObjFunction *moved = POOL_ALLOCATE(gc, MEM_OBJ_FUNCTION, ObjFunction, 1);
+    *moved = *(ObjFunction *)object;
+    copy = (Obj *)moved;
+    break;
+  }
+  case OBJ_NATIVE: {
+    ObjNative *moved = POOL_ALLOCATE(gc, MEM_OBJ_NATIVE, ObjNative, 1);
+    *moved = *(ObjNative *)object;
+    copy = (Obj *)moved;
+    break;
+  }
+  case OBJ_CLOSURE: {
+    size_t size = closureSize((ObjClosure *)object);
+    copy = poolAllocate(gc, MEM_OBJ_CLOSURE, size);
+    memcpy(copy, object, size);
+    break;
+  }
+  case OBJ_UPVALUE: {
+    ObjUpvalue *upvalue = (ObjUpvalue *)object;
+    ObjUpvalue *moved = POOL_ALLOCATE(gc, MEM_OBJ_UPVALUE, ObjUpvalue, 1);
+    *moved = *upvalue;
+    // An open upvalue points into the stack, which stays where it is.
+    if (upvalue->location == &upvalue->closed)
+      moved->location = &moved->closed;
+    copy = (Obj *)moved;
+    break;
+  }
+  }
+  return copy;
+}
+
+// Copies a young object into the old generation, once, returning its new
+// address.
+static Obj *promote(GC *gc, Obj *object) {
+  if (isForwarded(object))
+    return object->next;
+
+  size_t before = gc->stats.bytesAllocated;
+  Obj *copy = copyObject(gc, object);
+  gc->gcStats.promotedBytes += gc->stats.bytesAllocated - before;
+
+  // Whatever is promoted while the old generation is being marked was
+  // reached, so must survive it.
+  gcAddObject(gc, copy);
+  if (gc->phase == GC_MARKING)
+    markObject(gc, copy);
+  object->next = copy;
+  return copy;
+}
+
+void gcVisitValue(GC *gc, Value *slot) {
+  if (!IS_OBJ(*slot))
+    return;
+
+  Obj *object = AS_OBJ(*slot);
+  if (gc->compacting) {
+    *slot = OBJ_VAL(compacted(gc, object));
+    return;
+  }
+
+  if (gcInNursery(gc, object)) {
+    object = promote(gc, object);
+    *slot = OBJ_VAL(object);
+  }
+
+  if (gc->phase == GC_MARKING)
+    markObject(gc, object);
+}
+
+static Obj *visitObject(GC *gc, Obj *object) {
+  Value value = OBJ_VAL(object);
+  gcVisitValue(gc, &value);
+  return AS_OBJ(value);
+}
+
+// Visits what an object points at which may be young. Only closures and
+// upvalues point at objects made after them.
+static void visitYoungFields(GC *gc, Obj *object) {
+  switch (object->type) {
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    for (int i = 0; i < closure->upvalueCount; i++)
+      closure->upvalues[i] =
+          (ObjUpvalue *)visitObject(gc, (Obj *)closure->upvalues[i]);
+    break;
+  }
+  case OBJ_UPVALUE:
+    gcVisitValue(gc, &((ObjUpvalue *)object)->closed);
+    break;
+  default:
+    break;
+  }
+}
+
+// Moves the young key and value of a remembered entry out of the nursery.
+static void promoteEntry(GC *gc, RememberedEntry *remembered) {
+  Value value;
+  if (!tableGet(remembered->table, remembered->key, &value))
+    return; // Since deleted, or already moved by an earlier entry.
+
+  gcVisitValue(gc, &value);
+
+  ObjString *key = remembered->key;
+  if (gcInNursery(gc, key)) {
+    tableDelete(remembered->table, key);
+    key = (ObjString *)promote(gc, (Obj *)key);
+  } else if (gc->phase == GC_MARKING) {
+    markObject(gc, (Obj *)key); // The entry may be newer than the marking.
+  }
+  tableSet(gc, remembered->table, key, value);
+}
+
+// Interned strings are weak references: young strings which were not promoted
+// are removed from the table, and the others are replaced by their copies.
+static void updateYoungStrings(GC *gc) {
+  for (int i = 0; i < gc->youngStringCount; i++) {
+    ObjString *string = gc->youngStrings[i];
+    tableDelete(gc->strings, string);
+    if (isForwarded((Obj *)string))
+      tableSet(gc, gc->strings, (ObjString *)string->obj.next, NIL_VAL);
+  }
+  gc->youngStringCount = 0;
+}
+
+static void collectNursery(GC *gc) {
+  gc->gcStats.minorCollections++;
+  Obj *scanned = gc->objects;
+
+  // Old objects only point at young ones from the stack, remembered entries
+  // and remembered objects, so the rest of the old generation is not scanned.
+  // While the old generation is being marked, roots are marked as well.
+  if (gc->visitRoots != NULL)
+    gc->visitRoots(gc, gc->rootContext);
+  if (gc->phase == GC_MARKING) {
+    // The constants of finalized chunks are never young, so are only marked.
+    for (int i = 0; i < gc->chunkCount; i++) {
+      const ValueArray *constants = &gc->chunks[i]->constants;
+      for (int j = 0; j < constants->count; j++) {
+        if (IS_OBJ(constants->values[j]))
+          markObject(gc, AS_OBJ(constants->values[j]));
+      }
+    }
+  }
+  for (int i = 0; i < gc->rememberedCount; i++)
+    promoteEntry(gc, &gc->remembered[i]);
+  gc->rememberedCount = 0;
+  for (int i = 0; i < gc->rememberedObjectCount; i++) {
+    Obj *object = gc->rememberedObjects[i];
+    object->remembered = false;
+    visitYoungFields(gc, object);
+  }
+  gc->rememberedObjectCount = 0;
+
+  // Promoted objects are added to the head of the list, ahead of those there
+  // before, and are scanned in turn for the young objects they point at,
+  // until scanning promotes nothing more.
+  while (gc->objects != scanned) {
+    Obj *head = gc->objects;
+    for (Obj *object = head; object != scanned; object = object->next)
+      visitYoungFields(gc, object);
+    scanned = head;
+  }
+
+  if (gc->strings != NULL)
+    updateYoungStrings(gc);
+
+  // Everything left in the nursery is garbage.
+  gc->nursery.top = gc->nursery.start;
+  gc->nurseryFull = false;
+}
+
+// ----- Old Generation Collection -----
+
+// Objects traced or swept by a slice between checks of the clock.
+#define SLICE_CHECK_INTERVAL 64
+// Entries ahead of the one cleared whose key is prefetched.
+#define CLEAR_PREFETCH_DISTANCE 16
+// Gray objects below the one traced which are prefetched.
+#define GRAY_PREFETCH_DISTANCE 4
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Keys are hashed by their characters, so stay in their entries when moved.
+static void compactTable(GC *gc, Table *table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+    entry->key = (ObjString *)compacted(gc, (Obj *)entry->key);
+    gcVisitValue(gc, &entry->value);
+  }
+}
+
+void gcVisitTable(GC *gc, Table *table) {
+  if (gc->compacting) {
+    compactTable(gc, table);
+    return;
+  }
+
+  // Young objects in tables are found through the remembered entries, and
+  // old ones stored while marking are marked by tableWriteBarrier.
+  if (!gc->markTables)
+    return;
+
+  for (int i = 0; i < table->capacity; i++) {
+    Entry *entry = &table->entries[i];
+    if (entry->key == NULL)
+      continue;
+
+    // Young keys are remembered, and promoted with their entries.
+    if (gcInNursery(gc, entry->key))
+      continue;
+
+    markObject(gc, (Obj *)entry->key);
+    gcVisitValue(gc, &entry->value);
+  }
+}
+
+// Young objects an old one points at are remembered, and marked as they are
+// promoted instead.
+static void markOld(GC *gc, Obj *object) {
+  if (!gcInNursery(gc, object))
+    markObject(gc, object);
+}
+
+static void blackenObject(GC *gc, Obj *object) {
+  switch (object->type) {
+  case OBJ_STRING:
+    break; // Strings reference no other objects.
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    markObject(gc, (Obj *)function->name);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+      if (IS_OBJ(function->constants[i]))
+        markObject(gc, AS_OBJ(function->constants[i]));
+    }
+    break;
+  }
+  case OBJ_NATIVE:
+    markObject(gc, (Obj *)((ObjNative *)object)->name);
+    break;
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    markObject(gc, (Obj *)closure->function);
+    for (int i = 0; i < closure->upvalueCount; i++)
+      markOld(gc, (Obj *)closure->upvalues[i]);
+    break;
+  }
+  case OBJ_UPVALUE: {
+    Value closed = ((ObjUpvalue *)object)->closed;
+    if (IS_OBJ(closed))
+      markOld(gc, AS_OBJ(closed));
+    break;
+  }
+  }
+}
+
+// Traces every marked object again, as some could not be pushed on the gray
+// stack. Tracing those already traced only finds marked objects.
+static void rescanHeap(GC *gc) {
+  gc->gcStats.rescans++;
+  gc->grayOverflow = false;
+  for (Obj *object = gc->objects; object != NULL; object = object->next) {
+    if (object->mark == gc->markValue)
+      blackenObject(gc, object);
+  }
+}
+
+// Traces gray objects until there are none left, returning false if the
+// deadline passed first.
+static bool traceReferences(GC *gc, double deadline) {
+  int work = 0;
+  while (gc->grayCount > 0 || gc->grayOverflow) {
+    if (gc->grayCount == 0) {
+      rescanHeap(gc);
+      continue;
+    }
+
+    // Objects were marked long before they are traced, so the next ones are
+    // fetched again while this one is traced.
+    if (gc->grayCount > GRAY_PREFETCH_DISTANCE)
+      __builtin_prefetch(
+          gc->grayStack[gc->grayCount - 1 - GRAY_PREFETCH_DISTANCE]);
+
+    blackenObject(gc, gc->grayStack[--gc->grayCount]);
+    if (++work % SLICE_CHECK_INTERVAL == 0 && gc->grayCount > 0 &&
+        now() > deadline)
+      return false;
+  }
+  return true;
+}
+
+// Starts a collection of the old generation, marking its roots.
+static void markRoots(GC *gc) {
+  gc->gcStats.majorCollections++;
+  gc->phase = GC_MARKING;
+  gc->markValue = !gc->markValue; // Unmarks every object.
+
+  // Emptying the nursery visits the roots, which marks them as it goes.
+  gc->markTables = true;
+  collectNursery(gc);
+  gc->markTables = false;
+
+  // The collection is finished at once if the heap outgrows it.
+  gc->nextCollection = gc->stats.bytesAllocated * GC_HEAP_GROW_FACTOR;
+}
+
+// Ends marking once every marked object is traced.
+static void finishMarking(GC *gc) {
+  // Objects allocated from now on are left out of this collection.
+  gc->unswept = gc->objects;
+  gc->objects = NULL;
+  gc->phase = GC_SWEEPING;
+  gc->clearedStrings = 0;
+  gc->clearedCapacity = -1;
+}
+
+static void finishSweep(GC *gc) {
+  gc->phase = GC_IDLE;
+  gc->compactPending = gc->compact;
+  gc->nextCollection = gc->stats.bytesAllocated * GC_HEAP_GROW_FACTOR;
+  if (gc->nextCollection < GC_MIN_HEAP)
+    gc->nextCollection = GC_MIN_HEAP;
+}
+
+// Frees unmarked objects until all are swept, returning false if the deadline
+// passed first.
+static bool sweep(GC *gc, double deadline) {
+  int work = 0;
+  while (gc->unswept != NULL) {
+    Obj *object = gc->unswept;
+    gc->unswept = object->next;
+
+    if (object->mark == gc->markValue) {
+      gcAddObject(gc, object);
+    } else {
+      // Interned strings are weak references, so go with the string.
+      if (object->type == OBJ_STRING && gc->strings != NULL)
+        tableDelete(gc->strings, (ObjString *)object);
+      freeObject(gc, NULL, object);
+    }
+
+    if (++work % SLICE_CHECK_INTERVAL == 0 && gc->unswept != NULL &&
+        now() > deadline)
+      return false;
+  }
+
+  finishSweep(gc);
+  return true;
+}
+
+// ----- Background Sweeping -----
+
+static void *sweepThread(void *context) {
+  Sweeper *sweeper = context;
+
+  Obj *object = sweeper->unswept;
+  while (object != NULL) {
+    Obj *next = object->next;
+    if (object->mark == sweeper->markValue) {
+      if (sweeper->survivors == NULL)
+        sweeper->lastSurvivor = object;
+      object->next = sweeper->survivors;
+      sweeper->survivors = object;
+    } else {
+      freeObject(NULL, sweeper, object);
+    }
+    object = next;
+  }
+
+  atomic_store_explicit(&sweeper->done, true, memory_order_release);
+  return NULL;
+}
+
+// Removes the unmarked strings from the interned strings, returning false if
+// the deadline passed first. The thread cannot, as the table is in use.
+static bool clearUnmarkedStrings(GC *gc, double deadline) {
+  Table *table = gc->strings;
+  if (table == NULL)
+    return true;
+
+  // Entries move when the table grows, so it is cleared from the start again.
+  if (table->capacity != gc->clearedCapacity) {
+    gc->clearedStrings = 0;
+    gc->clearedCapacity = table->capacity;
+  }
+
+  while (gc->clearedStrings < table->capacity) {
+    // Keys are in hash order, so are fetched well before they are needed.
+    if (gc->clearedStrings + CLEAR_PREFETCH_DISTANCE < table->capacity)
+      __builtin_prefetch(
+          table->entries[gc->clearedStrings + CLEAR_PREFETCH_DISTANCE].key);
+
+    Entry *entry = &table->entries[gc->clearedStrings++];
+    ObjString *key = entry->key;
+    if (key != NULL && !gcInNursery(gc, key) &&
+        key->obj.mark != gc->markValue) {
+      entry->key = NULL; // Left as a tombstone, see tableDelete.
+      entry->value = BOOL_VAL(true);
+    }
+
+    if (gc->clearedStrings % SLICE_CHECK_INTERVAL == 0 && now() > deadline)
+      return false;
+  }
+  return true;
+}
+
+static void startSweeper(GC *gc) {
+  Sweeper *sweeper = &gc->sweeper;
+  sweeper->pool = &gc->pool;
+  sweeper->unswept = gc->unswept;
+  sweeper->markValue = gc->markValue;
+  sweeper->survivors = sweeper->lastSurvivor = NULL;
+  for (int i = 0; i < MEM_CATEGORY_COUNT; i++)
+    sweeper->freedBytes[i] = 0;
+  sweeper->frees = 0;
+  atomic_init(&sweeper->done, false);
+
+  if (pthread_create(&sweeper->thread, NULL, sweepThread, sweeper) != 0) {
+    // Sweeping on this thread is always a correct fallback.
+    gc->backgroundSweep = false;
+    return;
+  }
+
+  gc->unswept = NULL;
+  sweeper->running = true;
+}
+
+static void finishSweeper(GC *gc) {
+  Sweeper *sweeper = &gc->sweeper;
+  pthread_join(sweeper->thread, NULL);
+  sweeper->running = false;
+
+  if (sweeper->survivors != NULL) {
+    sweeper->lastSurvivor->next = gc->objects;
+    gc->objects = sweeper->survivors;
+  }
+
+  // Accounted for only now, as the stats are not shared with the thread.
+  for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+    gc->stats.bytes[i] -= sweeper->freedBytes[i];
+    gc->stats.bytesAllocated -= sweeper->freedBytes[i];
+  }
+  gc->stats.frees += sweeper->frees;
+
+  finishSweep(gc);
+}
+
+// Sweeps until the deadline, on the helper thread when in the background. That
+// is only waited for when finishing.
+static void continueSweep(GC *gc, double deadline, bool finish) {
+  // A thread just started is left to run until the next slice, however
+  // quickly it is done.
+  bool started = false;
+  if (gc->backgroundSweep && !gc->sweeper.running) {
+    if (!clearUnmarkedStrings(gc, deadline))
+      return;
+    startSweeper(gc);
+    started = gc->sweeper.running;
+  }
+
+  if (!gc->sweeper.running) {
+    sweep(gc, deadline);
+  } else if (finish ||
+             (!started && atomic_load_explicit(&gc->sweeper.done,
+                                               memory_order_acquire))) {
+    finishSweeper(gc);
+  }
+}
+
+// ----- Compaction -----
+
+// Updates what a copied object points at to the copies.
+static void compactObject(GC *gc, Obj *object) {
+  switch (object->type) {
+  case OBJ_STRING:
+    break;
+  case OBJ_FUNCTION: {
+    ObjFunction *function = (ObjFunction *)object;
+    function->name = (ObjString *)compacted(gc, (Obj *)function->name);
+    // An original's constants are its chunk's, and point at pinned objects.
+    if (function->constants != function->chunk.constants.values) {
+      for (int i = 0; i < function->chunk.constants.count; i++)
+        gcVisitValue(gc, &function->constants[i]);
+    }
+    break;
+  }
+  case OBJ_NATIVE: {
+    ObjNative *native = (ObjNative *)object;
+    native->name = (ObjString *)compacted(gc, (Obj *)native->name);
+    break;
+  }
+  case OBJ_CLOSURE: {
+    ObjClosure *closure = (ObjClosure *)object;
+    closure->function =
+        (ObjFunction *)compacted(gc, (Obj *)closure->function);
+    for (int i = 0; i < closure->upvalueCount; i++)
+      closure->upvalues[i] =
+          (ObjUpvalue *)compacted(gc, (Obj *)closure->upvalues[i]);
+    break;
+  }
+  case OBJ_UPVALUE:
+    gcVisitValue(gc, &((ObjUpvalue *)object)->closed);
+    break;
+  }
+}
+
+// Cells of the pinned objects, whose pages are kept.
+typedef struct PinnedCells {
+  char **cells;
+  int count;
+  int capacity;
+} PinnedCells;
+
+static void pinCell(GC *gc, PinnedCells *pinned, void *cell) {
+  if (pinned->count + 1 > pinned->capacity) {
+    int oldCapacity = pinned->capacity;
+    pinned->capacity = GROW_CAPACITY(oldCapacity);
+    pinned->cells = GROW_ARRAY(gc, MEM_GC, char *, pinned->cells, oldCapacity,
+                               pinned->capacity);
+  }
+  pinned->cells[pinned->count++] = cell;
+}
+
+static void pinObject(GC *gc, PinnedCells *pinned, Obj *object) {
+  if (object->pinned)
+    return;
+  object->pinned = true;
+  pinCell(gc, pinned, object);
+  if (object->type == OBJ_STRING)
+    pinCell(gc, pinned, ((ObjString *)object)->chars);
+}
+
+// Pins the objects a finalized chunk's constants point at, as they may be
+// shared with other VMs, which read them while this heap is not looking. A
+// function's name is read along with it, so is pinned too. Its constants are
+// its own chunk's, pinned in turn.
+static void pinConstants(GC *gc, PinnedCells *pinned, const Chunk *chunk) {
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (!IS_OBJ(constant))
+      continue;
+
+    pinObject(gc, pinned, AS_OBJ(constant));
+    if (IS_FUNCTION(constant))
+      pinObject(gc, pinned, (Obj *)AS_FUNCTION(constant)->name);
+  }
+}
+
+static int compareCells(const void *a, const void *b) {
+  uintptr_t x = (uintptr_t)(*(char *const *)a);
+  uintptr_t y = (uintptr_t)(*(char *const *)b);
+  return (x > y) - (x < y);
+}
+
+// Moves the pages of the old pool holding a pinned cell into the heap's pool,
+// where the rest of their cells are never handed out again.
+static void keepPinnedPages(GC *gc, Pool *from, PinnedCells *pinned) {
+  if (pinned->count == 0)
+    return;
+  qsort(pinned->cells, pinned->count, sizeof(char *), compareCells);
+
+  PoolPage **page = &from->pages;
+  while (*page != NULL) {
+    uintptr_t start = (uintptr_t)*page;
+    // The first cell at or past the page's start.
+    int low = 0, high = pinned->count;
+    while (low < high) {
+      int middle = low + (high - low) / 2;
+      if ((uintptr_t)pinned->cells[middle] < start)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+    if (low < pinned->count &&
+        (uintptr_t)pinned->cells[low] < start + POOL_PAGE_SIZE) {
+      PoolPage *kept = *page;
+      *page = kept->next;
+      kept->next = gc->pool.pages;
+      gc->pool.pages = kept;
+    } else {
+      page = &(*page)->next;
+    }
+  }
+}
+
+void compactHeap(GC *gc) {
+  if (gc->phase != GC_IDLE)
+    return;
+  bool collecting = gc->collecting;
+  gc->collecting = true;
+  gc->compactPending = false;
+  gc->gcStats.compactions++;
+
+  // Then only the roots, interned strings and old objects point at old ones.
+  collectNursery(gc);
+
+  // The constants of chunks compiled with this heap, and of its functions'
+  // chunks, are never written. Copies of another VM's functions have constants
+  // of their own.
+  PinnedCells pinned = {NULL, 0, 0};
+  for (int i = 0; i < gc->chunkCount; i++)
+    pinConstants(gc, &pinned, gc->chunks[i]);
+  for (Obj *object = gc->objects; object != NULL; object = object->next) {
+    ObjFunction *function = (ObjFunction *)object;
+    if (object->type == OBJ_FUNCTION &&
+        function->constants == function->chunk.constants.values)
+      pinConstants(gc, &pinned, &function->chunk);
+  }
+
+  // Every other object is copied into fresh pages, in the order of the list,
+  // and the old pages are released at once, but for those pinned objects are
+  // in.
+  Pool from = gc->pool;
+  initPool(&gc->pool);
+  Obj *objects = NULL, **tail = &objects;
+  Obj *next;
+  for (Obj *object = gc->objects; object != NULL; object = next) {
+    next = object->next;
+    if (object->pinned) {
+      *tail = object;
+      tail = &object->next;
+      continue;
+    }
+
+    size_t before = gc->stats.bytesAllocated;
+    Obj *copy = copyObject(gc, object);
+    // The copied cells are freed along with the pages they are in.
+    trackAllocation(gc, OBJ_CATEGORY(object->type),
+                    gc->stats.bytesAllocated - before, 0);
+
+    copy->mark = gc->markValue;
+    *tail = copy;
+    tail = &copy->next;
+    object->mark = !gc->markValue;
+    object->next = copy;
+  }
+  *tail = NULL;
+
+  gc->compacting = true;
+  if (gc->visitRoots != NULL)
+    gc->visitRoots(gc, gc->rootContext);
+  if (gc->strings != NULL)
+    compactTable(gc, gc->strings);
+  // Pinned objects only point at pinned ones, so are never written.
+  for (Obj *object = objects; object != NULL; object = object->next) {
+    if (object->pinned)
+      object->pinned = false;
+    else
+      compactObject(gc, object);
+  }
+  gc->compacting = false;
+
+  gc->objects = objects;
+  keepPinnedPages(gc, &from, &pinned);
+  freePool(gc, &from);
+  FREE_ARRAY(gc, MEM_GC, char *, pinned.cells, pinned.capacity);
+#ifdef __GLIBC__
+  // Freed pages are otherwise kept by malloc, and the heap does not shrink.
+  malloc_trim(0);
+#endif
+  gc->collecting = collecting;
+}
+
+// ----- Collection -----
+
+static void collectOld(GC *gc) {
+  markRoots(gc);
+  traceReferences(gc, INFINITY);
+  finishMarking(gc);
+  continueSweep(gc, INFINITY, false);
+}
+
+// Continues the incremental collection in progress until the deadline.
+static void collectSlice(GC *gc, double deadline) {
+  gc->gcStats.slices++;
+
+  if (gc->phase == GC_MARKING && traceReferences(gc, deadline)) {
+    // The stack is not behind a write barrier, so is marked again, along with
+    // whatever is in the nursery.
+    collectNursery(gc);
+    traceReferences(gc, INFINITY);
+    finishMarking(gc);
+  }
+
+  if (gc->phase == GC_SWEEPING)
+    continueSweep(gc, deadline, deadline == INFINITY);
+}
+
+static void recordPause(GC *gc, double start) {
+  GCStats *stats = &gc->gcStats;
+  double pause = now() - start;
+  stats->pauseSeconds += pause;
+  if (pause > stats->maxPauseSeconds)
+    stats->maxPauseSeconds = pause;
+
+  int bucket = 0;
+  while (bucket < GC_PAUSE_BUCKETS - 1 && pause * 1e6 >= (1 << bucket))
+    bucket++;
+  stats->pauseHistogram[bucket]++;
+
+  gc->sliceDebt = 0;
+}
+
+void collectGarbage(GC *gc) {
+  double start = now();
+  gc->collecting = true;
+
+  if (gc->phase != GC_IDLE) {
+    if (gc->nurseryFull)
+      collectNursery(gc);
+    bool finish = gc->stats.bytesAllocated > gc->nextCollection;
+    collectSlice(gc, finish ? INFINITY : start + gc->sliceMicros / 1e6);
+  } else if (gc->stats.bytesAllocated <= gc->nextCollection) {
+    collectNursery(gc);
+  } else if (gc->incremental) {
+    markRoots(gc);
+  } else {
+    collectOld(gc);
+  }
+
+  if (gc->compactPending)
+    compactHeap(gc);
+  gc->collecting = false;
+  recordPause(gc, start);
+}
+
+void collectYoungGarbage(GC *gc) {
+  if (gc->nursery.top == gc->nursery.start && gc->rememberedCount == 0)
+    return;
+
+  double start = now();
+  gc->collecting = true;
+  collectNursery(gc);
+  gc->collecting = false;
+  recordPause(gc, start);
+}
+
+void collectAllGarbage(GC *gc) {
+  double start = now();
+  gc->collecting = true;
+  if (gc->phase != GC_IDLE)
+    collectSlice(gc, INFINITY);
+  collectOld(gc);
+  if (gc->phase != GC_IDLE)
+    collectSlice(gc, INFINITY); // Waits for the helper thread.
+  if (gc->compactPending)
+    compactHeap(gc);
+  gc->collecting = false;
+  recordPause(gc, start);
+}
+
+void printGCStats(GCStats *stats, FILE *file) {
+  fprintf(file, "== garbage collection ==\n");
+  fprintf(file, "%-16s %12zu\n", "minor", stats->minorCollections);
+  fprintf(file, "%-16s %12zu\n", "major", stats->majorCollections);
+  fprintf(file, "%-16s %12zu\n", "slices", stats->slices);
+  fprintf(file, "%-16s %12zu\n", "mark rescans", stats->rescans);
+  fprintf(file, "%-16s %12zu\n", "compactions", stats->compactions);
+  fprintf(file, "%-16s %12zu bytes\n", "promoted", stats->promotedBytes);
+  fprintf(file, "%-16s %12zu\n", "young allocs", stats->youngAllocations);
+  fprintf(file, "%-16s %12.3f ms\n", "total pause", stats->pauseSeconds * 1e3);
+  fprintf(file, "%-16s %12.3f ms\n", "max pause",
+          stats->maxPauseSeconds * 1e3);
+}
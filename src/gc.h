@@ -1,15 +1,317 @@
 #ifndef HYDRO_GC_H
 #define HYDRO_GC_H
 
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memory.h"
+#include "pool.h"
 #include "value.h"
 
-typedef struct GC {
-  Obj *objects; // Intrusive linked list of objects allocated on the heap.
-} GC;
+typedef struct Chunk Chunk;
+typedef struct Table Table;
+
+// Size of the region new objects are bump allocated from.
+#define NURSERY_SIZE (256 * 1024)
+// Objects larger than this skip the nursery, as copying them is not cheap.
+#define NURSERY_MAX_OBJECT (NURSERY_SIZE / 16)
+
+// The old generation is collected once the heap has grown to this size, or
+// to twice the size that survived the last collection of it.
+#define GC_MIN_HEAP (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR 2
+
+// An incremental collection runs a slice every this many bytes allocated.
+#define GC_SLICE_ALLOCATION (64 * 1024)
+// Default time budget of a slice.
+#define GC_SLICE_MICROS 100
+// Pauses are counted in buckets of power of two microseconds.
+#define GC_PAUSE_BUCKETS 16
+
+#ifdef DEBUG_STRESS_GC
+// Small enough for the gray stack to fill up in every collection.
+#define GC_GRAY_LIMIT 4
+#else
+// Entries the gray stack may grow to, past which marking rescans the heap.
+#define GC_GRAY_LIMIT (1 << 24)
+#endif
+
+typedef struct Nursery {
+  char *start; // Allocated on the first young allocation.
+  char *top;   // Where the next object is bumped from.
+  char *end;
+} Nursery;
+
+// A table entry that may hold a young key or value, see tableWriteBarrier.
+typedef struct RememberedEntry {
+  Table *table;
+  ObjString *key;
+} RememberedEntry;
+
+// Progress of a collection of the old generation.
+typedef enum GCPhase {
+  GC_IDLE,
+  GC_MARKING,  // Tracing from the gray objects.
+  GC_SWEEPING, // Freeing the unmarked objects.
+} GCPhase;
+
+typedef struct GCStats {
+  size_t minorCollections;
+  size_t majorCollections;
+  size_t slices;        // Pauses of incremental collections of old.
+  size_t rescans;       // Rescans of the heap as the gray stack was full.
+  size_t compactions;
+  size_t promotedBytes; // Bytes copied out of the nursery.
+  size_t youngAllocations; // Objects and chars bump allocated in the nursery.
+  double pauseSeconds;  // Total time spent collecting.
+  double maxPauseSeconds;
+  // Pauses under 1 << i microseconds, but not under half that. The last
+  // bucket also counts every longer pause.
+  size_t pauseHistogram[GC_PAUSE_BUCKETS];
+} GCStats;
+
+/*
+ * Frees the unmarked objects of a collection on a helper thread, while the
+ * program keeps running. The thread only shares the pool's released cells
+ * with the program, and the heap is told what was freed once it is done.
+ */
+typedef struct Sweeper {
+  pthread_t thread;
+  bool running;     // Started and not yet joined.
+  atomic_bool done; // Set by the thread once every object is swept.
+
+  Pool *pool;
+  Obj *unswept;
+  bool markValue;
+
+  Obj *survivors; // Still marked, in a list to put back in the heap's.
+  Obj *lastSurvivor;
+  size_t freedBytes[MEM_CATEGORY_COUNT];
+  size_t frees;
+} Sweeper;
+
+typedef struct GC GC;
+
+// Visits every root of the heap, see gcVisitValue and gcVisitTable.
+typedef void (*RootVisitor)(GC *gc, void *context);
+
+/*
+ * The heap of a VM. Every allocation for the VM goes through reallocate with
+ * its GC, which accounts for the memory held.
+ *
+ * Objects are generational: new objects are bump allocated in the nursery, and
+ * those still reachable when it fills up are copied into the old generation.
+ * The old generation is a list of objects from the pool, collected with mark
+ * and sweep once the heap has grown enough. Collections only happen at
+ * gcSafepoint, so objects need no protection while they are being created.
+ *
+ * When incremental, the old generation is marked and swept a slice at a time,
+ * between which the program runs. Marking is tri-color: marked objects are
+ * gray until the gray stack is drained, and black after. Stores into tables
+ * and objects mark what they store (see tableWriteBarrier), so no black object
+ * points to a white one, and only the stack is visited again once marking is
+ * done. Either way, sweeping can be left to a helper thread instead (see
+ * Sweeper), and the survivors can be moved together afterwards (see
+ * compactHeap).
+ */
+struct GC {
+  Obj *objects;      // Intrusive linked list of the old generation's objects.
+  MemoryStats stats; // Memory currently held, by what it is used for.
+  Pool pool;         // Cells for objects and small strings.
+
+  Nursery nursery;
+  bool nurseryFull;  // A young allocation did not fit, so collect soon.
+  bool generational; // Allocate new objects in the nursery.
+  bool pretenure;    // Allocate straight into the old generation.
+  size_t nextCollection; // Heap size that triggers a collection of old.
+  size_t heapLimit;      // Bytes allocated past which gcReserve fails.
+  // Where running out of memory unwinds to, see gcOutOfMemory.
+  jmp_buf *outOfMemory;
+  bool collecting; // Allocating for a collection, which must not fail.
+
+  RootVisitor visitRoots;
+  void *rootContext;
+  Table *strings; // Interned strings, removed as they are swept.
+  // Finalized chunks compiled with this heap and not yet freed, whose
+  // constants are roots, see gcAddChunk.
+  const Chunk **chunks;
+  int chunkCount;
+  int chunkCapacity;
+
+  // Old table entries written with young objects since the last collection.
+  RememberedEntry *remembered;
+  int rememberedCount;
+  int rememberedCapacity;
+  // Old objects written with young objects since the last collection.
+  Obj **rememberedObjects;
+  int rememberedObjectCount;
+  int rememberedObjectCapacity;
+
+  // Young strings in the interned strings table.
+  ObjString **youngStrings;
+  int youngStringCount;
+  int youngStringCapacity;
+
+  // Objects marked but not yet traced, during a collection of old.
+  Obj **grayStack;
+  int grayCount;
+  int grayCapacity;
+  int grayLimit;
+  bool grayOverflow; // Marked objects were left off the full gray stack.
+  GCPhase phase;
+  bool markValue;    // Value of an Obj's mark meaning it is marked.
+  bool markTables;   // Visit the entries of root tables.
+  bool incremental;  // Collect the old generation in slices.
+  int sliceMicros;   // Time budget of each slice.
+  size_t sliceDebt;  // Bytes allocated since the last slice.
+  Obj *unswept;      // The old generation's objects not yet swept.
+
+  bool backgroundSweep; // Sweep on a helper thread.
+  Sweeper sweeper;
+  // Interned strings are cleared of unmarked ones before the helper thread
+  // sweeps them, as far as this entry of a table of this capacity.
+  int clearedStrings;
+  int clearedCapacity;
+
+  bool compact;        // Compact after each collection of old.
+  bool compacting;     // Root visitors update slots to moved objects.
+  bool compactPending; // A collection of old finished since compacting.
+
+  GCStats gcStats;
+};
 
 void initGC(GC *gc);
 void freeGC(GC *gc);
 
 void gcAddObject(GC *gc, Obj *object);
 
+/* Keeps the constants of a finalized chunk alive until it is removed, which
+ * freeChunk does. The chunk may be running in other VMs meanwhile, and its
+ * constants are never written, see compactHeap. */
+void gcAddChunk(GC *gc, const Chunk *chunk);
+void gcRemoveChunk(GC *gc, const Chunk *chunk);
+
+/* Called with interned strings found by a lookup. While sweeping, a string
+ * may be unreachable but not yet swept, so is kept for this use. */
+void gcReviveString(GC *gc, ObjString *string);
+
+/* Bump allocates a young object, or returns NULL if it should go in the old
+ * generation instead. */
+void *nurseryAllocate(GC *gc, size_t size);
+
+static inline bool gcInNursery(GC *gc, const void *ptr) {
+  return (const char *)ptr >= gc->nursery.start &&
+         (const char *)ptr < gc->nursery.end;
+}
+
+// Records that a young string was added to the interned strings table.
+void gcRememberYoungString(GC *gc, ObjString *string);
+void gcRememberEntry(GC *gc, Table *table, ObjString *key);
+// Marks the old key and value of a table entry stored while marking.
+void gcMarkEntry(GC *gc, ObjString *key, Value value);
+
+/* Must follow every store into a table visited with gcVisitTable, so its
+ * entries holding young objects are found without scanning the whole table. */
+static inline void tableWriteBarrier(GC *gc, Table *table, ObjString *key,
+                                     Value value) {
+  if (gcInNursery(gc, key) ||
+      (IS_OBJ(value) && gcInNursery(gc, AS_OBJ(value)))) {
+    gcRememberEntry(gc, table, key);
+  } else if (gc->phase == GC_MARKING) {
+    gcMarkEntry(gc, key, value);
+  }
+}
+
+void gcRememberObject(GC *gc, Obj *object);
+// Marks an old value stored into an object while marking.
+void gcMarkValue(GC *gc, Value value);
+
+/* Must follow every store of a value into an object's fields, for objects
+ * which point at others after being made, so old ones holding young objects
+ * are found without scanning the old generation. */
+static inline void objectWriteBarrier(GC *gc, Obj *object, Value value) {
+  if (!IS_OBJ(value))
+    return;
+  if (gcInNursery(gc, AS_OBJ(value))) {
+    if (!gcInNursery(gc, object))
+      gcRememberObject(gc, object);
+  } else if (gc->phase == GC_MARKING) {
+    gcMarkValue(gc, value);
+  }
+}
+
+/* Root visitors call these for each root. A slot holding a young object, or
+ * any object while compacting, is updated to where the object was moved. */
+void gcVisitValue(GC *gc, Value *slot);
+void gcVisitTable(GC *gc, Table *table);
+
+/* Collects the nursery if it is full, and the old generation if the heap is
+ * too big. An incremental collection of old is started or continued by a
+ * slice instead, and finished at once if the heap grows too much meanwhile. */
+void collectGarbage(GC *gc);
+// Collects the nursery, if anything is in it.
+void collectYoungGarbage(GC *gc);
+// Collects the nursery and the old generation, finishing any collection of
+// old in progress first.
+void collectAllGarbage(GC *gc);
+
+/* Copies every old object into fresh pool pages, in the order of the list,
+ * and gives the pages they were in back to the system. Roots, interned strings
+ * and the copies themselves are updated to point at the copies. Only done at a
+ * safepoint, and not during a collection of old. Objects the constants of a
+ * finalized chunk point at are left where they are instead, along with the
+ * pages they are in, as those constants are shared and never written. */
+void compactHeap(GC *gc);
+
+/* Called where collecting is safe: every reachable object is held by a root.
+ * With DEBUG_STRESS_GC, both generations are collected at every one. */
+static inline void gcSafepoint(GC *gc) {
+#ifdef DEBUG_STRESS_GC
+  gc->nextCollection = 0;
+  collectGarbage(gc);
+#else
+  if (gc->nurseryFull || gc->stats.bytesAllocated > gc->nextCollection ||
+      gc->sliceDebt >= GC_SLICE_ALLOCATION)
+    collectGarbage(gc);
+#endif
+}
+
+/* Called at a safepoint before allocating about size bytes. If that would
+ * take the heap past its limit, everything is collected first, and false is
+ * returned if it still would, for the caller to fail instead. */
+static inline bool gcReserve(GC *gc, size_t size) {
+  if (gc->stats.bytesAllocated + size <= gc->heapLimit)
+    return true;
+  collectAllGarbage(gc);
+  return gc->stats.bytesAllocated + size <= gc->heapLimit;
+}
+
+/*
+ * Unwinds to the handler in GC.outOfMemory, after an allocation failed or
+ * would have taken the heap past its limit. Handlers are set by whatever
+ * allocates from the heap on behalf of a program, e.g. interpret and compile,
+ * which free their own memory and run a full collection before failing. The
+ * heap is left whole, as objects are never half made when they allocate.
+ * Without a handler, or while collecting, there is nothing that could be
+ * unwound to, so the process exits instead.
+ */
+_Noreturn void gcOutOfMemory(GC *gc);
+
+/* Called before allocating size more bytes, which fails if that takes the heap
+ * past its limit. Unlike gcReserve, nothing is collected first, as callers are
+ * not at a safepoint. The collector's own bookkeeping and its allocations
+ * while collecting are never limited, as failing those would lose objects. */
+static inline void gcCheckLimit(GC *gc, MemCategory category, size_t size) {
+  if (gc->stats.bytesAllocated + size > gc->heapLimit &&
+      category != MEM_GC && !gc->collecting)
+    gcOutOfMemory(gc);
+}
+
+void printGCStats(GCStats *stats, FILE *file);
+
 #endif
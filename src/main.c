@@ -18,11 +18,16 @@ void runREPL(VM *vm) {
 
   printf("Welcome to Hydrogen, the lightest programming language!\n");
   while (true) {
+    flushOutput(&vm->output);
     printf("> ");
-    if (getline(&line, &n, stdin) != -1) {
-      interpret(vm, line);
+    if (getline(&line, &n, stdin) == -1) {
+      printf("\n");
+      break; // End of input.
     }
+    interpret(vm, line);
   }
+
+  free(line);
 }
 
 const char *readFile(const char *filename) {
@@ -53,7 +58,8 @@ const char *readFile(const char *filename) {
   return buffer;
 }
 
-void runFile(VM *vm, const char *filename) {
+// Returns the exit code for the result of running the file.
+int runFile(VM *vm, const char *filename) {
   char *dot = strrchr(filename, '.');
   if (dot == NULL || (strcmp("hydro", dot + 1) != 0)) {
     fprintf(stderr, "File must have .hydro extension.\n");
@@ -65,32 +71,90 @@ void runFile(VM *vm, const char *filename) {
   free((void *)source);
 
   if (result == INTERPRET_COMPILE_ERROR)
-    exit(EX_DATAERR);
+    return EX_DATAERR;
   else if (result == INTERPRET_RUNTIME_ERROR)
-    exit(EX_SOFTWARE);
+    return EX_SOFTWARE;
+  return EXIT_SUCCESS;
 }
 
 void usage() {
   printf("\nUSAGE:\n");
-  printf("\thydro [FILE]\n");
+  printf("\thydro [OPTIONS] [FILE]\n");
   printf("DESCRIPTION\n");
   printf("\tRuns hydrogen FILE which must have .hydro extension. If FILE is "
-         "not provided, runs REPL.\n\n");
+         "not provided, runs REPL.\n");
+  printf("OPTIONS\n");
+  printf("\t--mem-stats\tReport the memory held by the VM and its garbage "
+         "collections on exit.\n");
+  printf("\t--gc-slice=US\tCollect the old generation incrementally, in "
+         "slices of about US microseconds.\n");
+  printf("\t--gc-background-sweep\tFree unreachable objects on a helper "
+         "thread.\n");
+  printf("\t--gc-compact\tMove surviving objects together after each full "
+         "collection.\n");
+  printf("\t--heap-limit=MB\tFail with an out of memory error rather than "
+         "grow the heap past MB megabytes.\n\n");
 }
 
 int main(int argc, char *argv[]) {
+  bool memStats = false;
+  int sliceMicros = 0;
+  bool backgroundSweep = false;
+  bool compact = false;
+  long heapLimit = 0;
+  const char *filename = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--mem-stats") == 0) {
+      memStats = true;
+    } else if (strcmp(argv[i], "--gc-background-sweep") == 0) {
+      backgroundSweep = true;
+    } else if (strcmp(argv[i], "--gc-compact") == 0) {
+      compact = true;
+    } else if (strncmp(argv[i], "--gc-slice=", 11) == 0) {
+      sliceMicros = atoi(argv[i] + 11);
+      if (sliceMicros <= 0) {
+        usage();
+        return EX_USAGE;
+      }
+    } else if (strncmp(argv[i], "--heap-limit=", 13) == 0) {
+      heapLimit = atol(argv[i] + 13);
+      if (heapLimit <= 0) {
+        usage();
+        return EX_USAGE;
+      }
+    } else if (argv[i][0] != '-' && filename == NULL) {
+      filename = argv[i];
+    } else {
+      usage();
+      return EX_USAGE;
+    }
+  }
+
   VM vm;
   initVM(&vm);
+  if (sliceMicros > 0) {
+    vm.gc.incremental = true;
+    vm.gc.sliceMicros = sliceMicros;
+  }
+  vm.gc.backgroundSweep = backgroundSweep;
+  vm.gc.compact = compact;
+  if (heapLimit > 0)
+    vm.gc.heapLimit = (size_t)heapLimit * 1024 * 1024;
 
-  if (argc == 1) {
+  int exitCode = EXIT_SUCCESS;
+  if (filename == NULL) {
     runREPL(&vm);
-  } else if (argc == 2) {
-    runFile(&vm, argv[1]);
   } else {
-    usage();
-    return EX_USAGE;
+    exitCode = runFile(&vm, filename);
+  }
+
+  if (memStats) {
+    MemoryStats stats = vmMemoryStats(&vm);
+    printMemoryStats(&stats, stderr);
+    printGCStats(&vm.gc.gcStats, stderr);
   }
 
   freeVM(&vm);
-  return EXIT_SUCCESS;
+  return exitCode;
 }
@@ -1,17 +1,91 @@
+#include <stdio.h>
 #include <stdlib.h>
 
+#include "gc.h"
 #include "memory.h"
 
-void *reallocate(void *ptr, __attribute__((unused)) size_t oldSize,
+void trackAllocation(GC *gc, MemCategory category, size_t oldSize,
+                     size_t newSize) {
+  MemoryStats *stats = &gc->stats;
+  // Unsigned, so shrinking wraps around to subtract.
+  stats->bytesAllocated += newSize - oldSize;
+  stats->bytes[category] += newSize - oldSize;
+
+  if (newSize == 0) {
+    stats->frees++;
+    return;
+  }
+
+  stats->allocations++;
+  if (stats->bytesAllocated > stats->peakBytesAllocated)
+    stats->peakBytesAllocated = stats->bytesAllocated;
+
+  // An incremental collection keeps pace with the memory being allocated.
+  if (gc->phase != GC_IDLE && newSize > oldSize)
+    gc->sliceDebt += newSize - oldSize;
+}
+
+void *reallocate(GC *gc, MemCategory category, void *ptr, size_t oldSize,
                  size_t newSize) {
   if (newSize == 0) {
+    trackAllocation(gc, category, oldSize, newSize);
     free(ptr);
     return NULL;
   }
 
+  // Failing leaves the memory as it was, and the count of it too.
+  if (newSize > oldSize)
+    gcCheckLimit(gc, category, newSize - oldSize);
   void *result = realloc(ptr, newSize);
   if (result == NULL)
-    exit(EXIT_FAILURE);
+    gcOutOfMemory(gc);
 
+  trackAllocation(gc, category, oldSize, newSize);
   return result;
 }
+
+void moveAllocation(GC *gc, MemCategory from, MemCategory to, size_t size) {
+  gc->stats.bytes[from] -= size;
+  gc->stats.bytes[to] += size;
+}
+
+void initMemoryStats(MemoryStats *stats) {
+  stats->bytesAllocated = 0;
+  stats->peakBytesAllocated = 0;
+  stats->allocations = 0;
+  stats->frees = 0;
+  stats->poolBytes = 0;
+  stats->nurseryBytes = 0;
+  stats->markStackBytes = 0;
+  for (int i = 0; i < MEM_CATEGORY_COUNT; i++)
+    stats->bytes[i] = 0;
+}
+
+static const char *categoryNames[MEM_CATEGORY_COUNT] = {
+    [MEM_OBJ_STRING] = "strings",
+    [MEM_OBJ_FUNCTION] = "functions",
+    [MEM_OBJ_NATIVE] = "natives",
+    [MEM_OBJ_CLOSURE] = "closures",
+    [MEM_OBJ_UPVALUE] = "upvalues",
+    [MEM_CHUNK_CODE] = "bytecode",
+    [MEM_CHUNK_LINES] = "line numbers",
+    [MEM_CONSTANTS] = "constants",
+    [MEM_TABLE] = "tables",
+    [MEM_COMPILER] = "compiler",
+    [MEM_GC] = "collector",
+    [MEM_STACK] = "stack",
+};
+
+void printMemoryStats(MemoryStats *stats, FILE *file) {
+  fprintf(file, "== memory ==\n");
+  for (int i = 0; i < MEM_CATEGORY_COUNT; i++) {
+    fprintf(file, "%-16s %12zu bytes\n", categoryNames[i], stats->bytes[i]);
+  }
+  fprintf(file, "%-16s %12zu bytes\n", "total", stats->bytesAllocated);
+  fprintf(file, "%-16s %12zu bytes\n", "peak", stats->peakBytesAllocated);
+  fprintf(file, "%-16s %12zu bytes\n", "pool pages", stats->poolBytes);
+  fprintf(file, "%-16s %12zu bytes\n", "nursery", stats->nurseryBytes);
+  fprintf(file, "%-16s %12zu bytes\n", "mark stack", stats->markStackBytes);
+  fprintf(file, "%-16s %12zu\n", "allocations", stats->allocations);
+  fprintf(file, "%-16s %12zu\n", "frees", stats->frees);
+}
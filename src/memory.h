@@ -2,19 +2,57 @@
 #define HYDRO_MEMORY_H
 
 #include <stddef.h>
+#include <stdio.h>
 
-#define ALLOCATE(type, count) (type *)reallocate(NULL, 0, sizeof(type) * count)
+typedef struct GC GC;
+
+/*
+ * What an allocation is used for, so the memory held by a VM can be broken
+ * down. Objects have a category per ObjType, declared in the same order.
+ */
+typedef enum MemCategory {
+  MEM_OBJ_STRING,   // ObjString headers and their character arrays.
+  MEM_OBJ_FUNCTION, // ObjFunction headers, but not their chunks.
+  MEM_OBJ_NATIVE,   // ObjNative headers.
+  MEM_OBJ_CLOSURE,  // ObjClosure headers and their arrays of upvalues.
+  MEM_OBJ_UPVALUE,  // ObjUpvalue headers.
+  MEM_CHUNK_CODE,   // Bytecode.
+  MEM_CHUNK_LINES,  // Line numbers of the bytecode.
+  MEM_CONSTANTS,    // Constant values of chunks.
+  MEM_TABLE,        // Hash table entries, e.g. globals and interned strings.
+  MEM_COMPILER,     // Scratch memory of a compilation in progress.
+  MEM_GC,           // Bookkeeping of the garbage collector.
+  MEM_STACK,        // The VM's value stack.
+  MEM_CATEGORY_COUNT
+} MemCategory;
+
+#define MEM_OBJ_FIRST MEM_OBJ_STRING
+
+typedef struct MemoryStats {
+  size_t bytesAllocated;     // Bytes currently held, across all categories.
+  size_t peakBytesAllocated; // Most bytes held at once.
+  size_t allocations;        // Number of allocations, including resizes.
+  size_t frees;
+  size_t bytes[MEM_CATEGORY_COUNT]; // Bytes currently held per category.
+  size_t poolBytes;      // Bytes of pool pages, small allocations are cut from.
+  size_t nurseryBytes;   // Bytes reserved for young objects.
+  size_t markStackBytes; // Bytes of the collector's gray stack.
+} MemoryStats;
+
+#define ALLOCATE(gc, category, type, count)                                    \
+  (type *)reallocate(gc, category, NULL, 0, sizeof(type) * (count))
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
 
-#define GROW_ARRAY(type, ptr, oldCapacity, newCapacity)                        \
-  (type *)reallocate(ptr, sizeof(type) * (oldCapacity),                        \
+#define GROW_ARRAY(gc, category, type, ptr, oldCapacity, newCapacity)          \
+  (type *)reallocate(gc, category, ptr, sizeof(type) * (oldCapacity),          \
                      sizeof(type) * (newCapacity))
 
-#define FREE_ARRAY(type, ptr, oldCapacity)                                     \
-  reallocate(ptr, sizeof(type), oldCapacity)
+#define FREE_ARRAY(gc, category, type, ptr, oldCapacity)                       \
+  reallocate(gc, category, ptr, sizeof(type) * (oldCapacity), 0)
 
-#define FREE(type, ptr) reallocate(ptr, sizeof(type), 0)
+#define FREE(gc, category, type, ptr)                                          \
+  reallocate(gc, category, ptr, sizeof(type), 0)
 
 /*
  * The single function used for dynamic memory management in the Hydrogen
@@ -22,7 +60,22 @@
  * these operations through a simple function, data can be tracked (e.g. keeping
  * a running count of the number of bytes of allocated memory) which the garbage
  * collector can use and make it's implementation more easier.
+ *
+ * The old size must be the size the memory was allocated or last resized with,
+ * so the count of bytes held by the GC's heap stays exact. Growing past the
+ * heap's limit, or without memory left, unwinds as gcOutOfMemory does.
  */
-void *reallocate(void *ptr, size_t oldSize, size_t newSize);
+void *reallocate(GC *gc, MemCategory category, void *ptr, size_t oldSize,
+                 size_t newSize);
+
+// Accounts for memory allocated or freed without reallocate, e.g. by the pool.
+void trackAllocation(GC *gc, MemCategory category, size_t oldSize,
+                     size_t newSize);
+
+// Charges part of an allocation to a different category.
+void moveAllocation(GC *gc, MemCategory from, MemCategory to, size_t size);
+
+void initMemoryStats(MemoryStats *stats);
+void printMemoryStats(MemoryStats *stats, FILE *file);
 
 #endif
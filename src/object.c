@@ -7,26 +7,75 @@
 #include "gc.h"
 #include "memory.h"
 #include "object.h"
+#include "output.h"
 #include "table.h"
 
 // Helper macro so consumer of allocateObject does not have to cast.
-#define ALLOCATE_OBJ(gc, type, objectType)                                     \
-  (type *)allocateObject(gc, sizeof(type), objectType)
+#define ALLOCATE_OBJ(gc, type, objectType, young)                              \
+  (type *)allocateObject(gc, sizeof(type), objectType, young)
 
-static Obj *allocateObject(GC *gc, size_t size, ObjType type) {
-  Obj *object = reallocate(NULL, 0, size);
+static void initObject(Obj *object, ObjType type) {
   object->type = type;
-  gcAddObject(gc, object);
+  object->remembered = false;
+  object->pinned = false;
+}
+
+// Young objects are bump allocated in the nursery when it has room, while old
+// ones come from the pool and join the list of the old generation.
+static Obj *allocateObject(GC *gc, size_t size, ObjType type, bool young) {
+  Obj *object = young ? nurseryAllocate(gc, size) : NULL;
+  if (object != NULL) {
+    object->next = NULL;
+  } else {
+    object = poolAllocate(gc, OBJ_CATEGORY(type), size);
+    gcAddObject(gc, object);
+  }
+
+  initObject(object, type);
   return object;
 }
 
+char *allocateChars(GC *gc, int length) {
+  char *chars = nurseryAllocate(gc, length + 1);
+  if (chars == NULL)
+    chars = POOL_ALLOCATE(gc, MEM_OBJ_STRING, char, length + 1);
+  return chars;
+}
+
+void freeChars(GC *gc, char *chars, int length) {
+  // Young chars are reclaimed with the rest of the nursery.
+  if (!gcInNursery(gc, chars))
+    POOL_FREE_ARRAY(gc, MEM_OBJ_STRING, char, chars, length + 1);
+}
+
 static ObjString *allocateString(GC *gc, Table *strings, char *chars, int n,
                                  uint32_t hash) {
-  ObjString *string = ALLOCATE_OBJ(gc, ObjString, OBJ_STRING);
+  // A string and its chars are in the same generation, so if the nursery
+  // filled up in between, the chars move to the old generation too. They move
+  // before the string is made, which running out of memory then never leaves
+  // without them.
+  ObjString *string = NULL;
+  if (gcInNursery(gc, chars)) {
+    string = nurseryAllocate(gc, sizeof(ObjString));
+    if (string != NULL) {
+      string->obj.next = NULL;
+      initObject(&string->obj, OBJ_STRING);
+    } else {
+      gcCheckLimit(gc, MEM_OBJ_STRING, sizeof(ObjString) + n + 1);
+      char *old = POOL_ALLOCATE(gc, MEM_OBJ_STRING, char, n + 1);
+      memcpy(old, chars, n + 1);
+      chars = old;
+    }
+  }
+  if (string == NULL)
+    string = ALLOCATE_OBJ(gc, ObjString, OBJ_STRING, false);
+
   string->length = n;
   string->chars = chars;
   string->hash = hash;
-  tableSet(strings, string, NIL_VAL); // Using the table as a hash set.
+  tableSet(gc, strings, string, NIL_VAL); // Using the table as a hash set.
+  if (gcInNursery(gc, string))
+    gcRememberYoungString(gc, string);
   return string;
 }
 
@@ -45,7 +94,8 @@ ObjString *takeString(GC *gc, Table *strings, char *chars, int n) {
 
   ObjString *interned = tableFindString(strings, chars, n, hash);
   if (interned != NULL) {
-    FREE_ARRAY(char, chars, n + 1);
+    freeChars(gc, chars, n);
+    gcReviveString(gc, interned);
     return interned;
   }
 
@@ -56,19 +106,99 @@ ObjString *copyString(GC *gc, Table *strings, const char *chars, int n) {
   uint32_t hash = hashString(chars, n);
 
   ObjString *interned = tableFindString(strings, chars, n, hash);
-  if (interned != NULL)
+  if (interned != NULL) {
+    gcReviveString(gc, interned);
     return interned;
+  }
 
-  char *buffer = ALLOCATE(char, n + 1);
+  char *buffer = allocateChars(gc, n);
   memcpy(buffer, chars, n);
   buffer[n] = '\0';
   return allocateString(gc, strings, buffer, n, hash);
 }
 
+ObjFunction *newFunction(GC *gc) {
+  ObjFunction *function = ALLOCATE_OBJ(gc, ObjFunction, OBJ_FUNCTION, false);
+  function->arity = 0;
+  function->name = NULL;
+  initChunk(&function->chunk);
+  function->constants = function->chunk.constants.values;
+  return function;
+}
+
+ObjNative *newNative(GC *gc, ObjString *name, NativeFn function, int arity) {
+  ObjNative *native = ALLOCATE_OBJ(gc, ObjNative, OBJ_NATIVE, false);
+  native->arity = arity;
+  native->name = name;
+  native->function = function;
+  return native;
+}
+
+ObjClosure *newClosure(GC *gc, ObjFunction *function) {
+  int count = function->chunk.upvalueCount;
+  ObjClosure *closure = (ObjClosure *)allocateObject(
+      gc, sizeof(ObjClosure) + sizeof(ObjUpvalue *) * count, OBJ_CLOSURE,
+      true);
+  closure->function = function;
+  closure->upvalueCount = count;
+  for (int i = 0; i < count; i++)
+    closure->upvalues[i] = NULL;
+  return closure;
+}
+
+ObjUpvalue *newUpvalue(GC *gc, Value *slot) {
+  ObjUpvalue *upvalue = ALLOCATE_OBJ(gc, ObjUpvalue, OBJ_UPVALUE, true);
+  upvalue->location = slot;
+  upvalue->closed = NIL_VAL;
+  upvalue->nextOpen = NULL;
+  return upvalue;
+}
+
 void printObject(Value value) {
   switch (AS_OBJ(value)->type) {
   case OBJ_STRING:
     printf("%s", AS_CSTRING(value));
     break;
+  case OBJ_FUNCTION:
+    printf("<fn %s>", AS_FUNCTION(value)->name->chars);
+    break;
+  case OBJ_NATIVE:
+    printf("<native %s>", AS_NATIVE(value)->name->chars);
+    break;
+  case OBJ_CLOSURE:
+    printf("<fn %s>", AS_CLOSURE(value)->function->name->chars);
+    break;
+  case OBJ_UPVALUE:
+    printf("upvalue");
+    break;
+  }
+}
+
+void writeObject(Output *output, Value value) {
+  switch (AS_OBJ(value)->type) {
+  case OBJ_STRING: {
+    ObjString *string = AS_STRING(value);
+    writeOutput(output, string->chars, string->length);
+    break;
+  }
+  case OBJ_FUNCTION:
+  case OBJ_CLOSURE: {
+    ObjString *name = IS_CLOSURE(value) ? AS_CLOSURE(value)->function->name
+                                        : AS_FUNCTION(value)->name;
+    writeOutput(output, "<fn ", 4);
+    writeOutput(output, name->chars, name->length);
+    writeOutput(output, ">", 1);
+    break;
+  }
+  case OBJ_NATIVE: {
+    ObjString *name = AS_NATIVE(value)->name;
+    writeOutput(output, "<native ", 8);
+    writeOutput(output, name->chars, name->length);
+    writeOutput(output, ">", 1);
+    break;
+  }
+  case OBJ_UPVALUE:
+    writeOutput(output, "upvalue", 7);
+    break;
   }
 }
@@ -3,24 +3,46 @@
 
 #include <stdint.h>
 
+#include "chunk.h"
 #include "gc.h"
+#include "output.h"
 #include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
+// Objects are accounted for by type, see MemCategory.
+#define OBJ_CATEGORY(type) ((MemCategory)(MEM_OBJ_FIRST + (type)))
+
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+#define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
+#define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
+#define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
 
 #define AS_STRING(value) ((ObjString *)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString *)AS_OBJ(value))->chars)
+#define AS_FUNCTION(value) ((ObjFunction *)AS_OBJ(value))
+#define AS_NATIVE(value) ((ObjNative *)AS_OBJ(value))
+#define AS_CLOSURE(value) ((ObjClosure *)AS_OBJ(value))
 
 typedef enum ObjType {
   OBJ_STRING,
+  OBJ_FUNCTION,
+  OBJ_NATIVE,
+  OBJ_CLOSURE,
+  OBJ_UPVALUE,
 } ObjType;
 
 struct Obj {
   ObjType type;
-  struct Obj *next; // Next node in the intrusive linked list of objects.
+  bool mark; // Reached while collecting the old generation, see gcAddObject.
+  // Old, and among the objects to scan again, see objectWriteBarrier.
+  bool remembered;
+  // Held by a finalized chunk's constants, so not moved, see compactHeap.
+  bool pinned;
+  // Next node in the old generation's intrusive linked list of objects. Young
+  // objects are not in the list, and use it for their address once promoted.
+  struct Obj *next;
 };
 
 struct ObjString {
@@ -30,12 +52,83 @@ struct ObjString {
   char *chars;
 };
 
+/*
+ * A function declared with `fun`, compiled into its own finalized chunk.
+ * Functions are only made while compiling, and are never changed after.
+ *
+ * A function compiled by another VM is run as a copy in this VM's heap, see
+ * interpretChunk, which shares the original's chunk. The copy has its own
+ * array of the constants as interned by this VM, or NULL if there are none,
+ * while an original's constants are those of its chunk, which it owns.
+ */
+typedef struct ObjFunction {
+  Obj obj;
+  int arity;
+  ObjString *name;
+  Chunk chunk;
+  Value *constants;
+} ObjFunction;
+
+/* A C function called from scripts. It is given its arguments where they are
+ * on the VM's stack, and returns its result. It must not keep the pointer. */
+typedef Value (*NativeFn)(int argCount, Value *args);
+
+// A native function, defined as a global with defineNative.
+typedef struct ObjNative {
+  Obj obj;
+  int arity;
+  ObjString *name;
+  NativeFn function;
+} ObjNative;
+
+/*
+ * A variable captured by a closure. While open, the variable is still a local
+ * on the stack, which location points to. Once its frame returns or its scope
+ * ends, the value is moved into closed, which location then points to. Only
+ * variables captured are ever moved off the stack.
+ */
+typedef struct ObjUpvalue {
+  Obj obj;
+  Value *location;
+  Value closed;
+  // The next open upvalue, for a local lower on the stack, see VM.
+  struct ObjUpvalue *nextOpen;
+} ObjUpvalue;
+
+/* A function with upvalues, along with the variables it captured when it was
+ * made. Functions capturing nothing are called without one. */
+typedef struct ObjClosure {
+  Obj obj;
+  ObjFunction *function;
+  int upvalueCount;
+  ObjUpvalue *upvalues[];
+} ObjClosure;
+
+/* Allocates room for length chars and the terminating NUL, for a string to be
+ * made with takeString. Young strings keep their chars in the nursery. */
+char *allocateChars(GC *gc, int length);
+// Frees chars from allocateChars which were not given to takeString.
+void freeChars(GC *gc, char *chars, int length);
+
 /* Directly takes ownership and creates a from the same memory that chars
- * is using. Use copyString instead if creating a copy is desired. */
+ * is using, which must come from allocateChars. Use copyString instead if
+ * creating a copy is desired. */
 ObjString *takeString(GC *gc, Table *strings, char *chars, int length);
 ObjString *copyString(GC *gc, Table *strings, const char *chars, int length);
 
+/* Creates a function with an empty chunk, to be finalized with its code once
+ * compiled. Functions are never young, as what they are given after is not
+ * remembered by the nursery. */
+ObjFunction *newFunction(GC *gc);
+// Natives are never young either, as they are kept for as long as the VM.
+ObjNative *newNative(GC *gc, ObjString *name, NativeFn function, int arity);
+/* Closures and upvalues start young when the nursery has room. A closure's
+ * upvalues are set by the caller, through objectWriteBarrier. */
+ObjClosure *newClosure(GC *gc, ObjFunction *function);
+ObjUpvalue *newUpvalue(GC *gc, Value *slot);
+
 void printObject(Value value);
+void writeObject(Output *output, Value value);
 
 static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
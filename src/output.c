@@ -0,0 +1,32 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "output.h"
+
+void initOutput(Output *output, FILE *file) {
+  output->file = file;
+  output->length = 0;
+}
+
+void flushOutput(Output *output) {
+  if (output->length > 0) {
+    fwrite(output->buffer, sizeof(char), output->length, output->file);
+    output->length = 0;
+  }
+  fflush(output->file);
+}
+
+void writeOutput(Output *output, const char *chars, int length) {
+  if (output->length + length > OUTPUT_BUFFER_SIZE) {
+    flushOutput(output);
+
+    // Writes too large to buffer go straight to the file.
+    if (length > OUTPUT_BUFFER_SIZE) {
+      fwrite(chars, sizeof(char), length, output->file);
+      return;
+    }
+  }
+
+  memcpy(output->buffer + output->length, chars, length);
+  output->length += length;
+}
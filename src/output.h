@@ -0,0 +1,25 @@
+#ifndef HYDRO_OUTPUT_H
+#define HYDRO_OUTPUT_H
+
+#include <stdio.h>
+
+#define OUTPUT_BUFFER_SIZE 8192
+
+/*
+ * Buffers the output of a program, so printing does not go through stdio's
+ * formatting and locking for every value. The buffer is only written to the
+ * file when it fills up or is explicitly flushed, so the owner must flush it
+ * before exiting, before writing to the file by other means (e.g. the REPL's
+ * prompt), and before reporting errors on another stream.
+ */
+typedef struct Output {
+  FILE *file;
+  int length; // Number of bytes buffered.
+  char buffer[OUTPUT_BUFFER_SIZE];
+} Output;
+
+void initOutput(Output *output, FILE *file);
+void flushOutput(Output *output);
+void writeOutput(Output *output, const char *chars, int length);
+
+#endif
@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "gc.h"
+#include "memory.h"
+#include "pool.h"
+
+static const size_t classSizes[POOL_CLASS_COUNT] = {16,  32,  48,  64,
+                                                    96, 128, 192, 256};
+
+// Size class of each size, in 16 byte steps: sizeToClass[(size + 15) / 16].
+static const uint8_t sizeToClass[POOL_MAX_SIZE / 16 + 1] = {
+    0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+};
+
+// Page headers are padded so cells keep the alignment malloc gives.
+#define PAGE_HEADER_SIZE 16
+_Static_assert(sizeof(PoolPage) <= PAGE_HEADER_SIZE, "Page header too large");
+
+void initPool(Pool *pool) {
+  for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+    pool->classes[i].freeList = NULL;
+    atomic_init(&pool->classes[i].released, NULL);
+    pool->classes[i].bump = NULL;
+    pool->classes[i].end = NULL;
+  }
+  pool->pages = NULL;
+}
+
+void freePool(GC *gc, Pool *pool) {
+  PoolPage *page = pool->pages;
+  while (page != NULL) {
+    PoolPage *next = page->next;
+    free(page);
+    gc->stats.poolBytes -= POOL_PAGE_SIZE;
+    page = next;
+  }
+  initPool(pool);
+}
+
+// Gives the class a fresh page to carve its cells from.
+static void addPage(GC *gc, SizeClass *sizeClass) {
+  PoolPage *page = malloc(POOL_PAGE_SIZE);
+  if (page == NULL)
+    gcOutOfMemory(gc);
+
+  page->next = gc->pool.pages;
+  gc->pool.pages = page;
+  gc->stats.poolBytes += POOL_PAGE_SIZE;
+
+  sizeClass->bump = (char *)page + PAGE_HEADER_SIZE;
+  sizeClass->end = (char *)page + POOL_PAGE_SIZE;
+}
+
+void *poolAllocate(GC *gc, MemCategory category, size_t size) {
+  if (size > POOL_MAX_SIZE)
+    return reallocate(gc, category, NULL, 0, size);
+
+  gcCheckLimit(gc, category, size);
+
+  uint8_t index = sizeToClass[(size + 15) / 16];
+  SizeClass *sizeClass = &gc->pool.classes[index];
+
+  PoolCell *cell = sizeClass->freeList;
+  if (cell == NULL &&
+      atomic_load_explicit(&sizeClass->released, memory_order_relaxed) != NULL)
+    cell = atomic_exchange_explicit(&sizeClass->released, NULL,
+                                    memory_order_acquire);
+  if (cell != NULL) {
+    sizeClass->freeList = cell->next;
+  } else {
+    size_t cellSize = classSizes[index];
+    if (sizeClass->bump == NULL ||
+        sizeClass->end - sizeClass->bump < (ptrdiff_t)cellSize)
+      addPage(gc, sizeClass);
+
+    cell = (PoolCell *)sizeClass->bump;
+    sizeClass->bump += cellSize;
+  }
+
+  trackAllocation(gc, category, 0, size);
+  return cell;
+}
+
+void poolFree(GC *gc, MemCategory category, void *ptr, size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    reallocate(gc, category, ptr, size, 0);
+    return;
+  }
+
+  trackAllocation(gc, category, size, 0);
+
+  SizeClass *sizeClass = &gc->pool.classes[sizeToClass[(size + 15) / 16]];
+  PoolCell *cell = ptr;
+  cell->next = sizeClass->freeList;
+  sizeClass->freeList = cell;
+}
+
+void poolRelease(Pool *pool, void *ptr, size_t size) {
+  if (size > POOL_MAX_SIZE) {
+    free(ptr);
+    return;
+  }
+
+  // Only the allocator takes cells off, and always the whole list at once.
+  SizeClass *sizeClass = &pool->classes[sizeToClass[(size + 15) / 16]];
+  PoolCell *cell = ptr;
+  cell->next = atomic_load_explicit(&sizeClass->released, memory_order_relaxed);
+  while (!atomic_compare_exchange_weak_explicit(&sizeClass->released,
+                                                &cell->next, cell,
+                                                memory_order_release,
+                                                memory_order_relaxed))
+    ;
+}
@@ -0,0 +1,63 @@
+#ifndef HYDRO_POOL_H
+#define HYDRO_POOL_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "memory.h"
+
+/*
+ * A size-class allocator for the small, short-lived allocations of the heap:
+ * object headers and small string buffers. Pages are carved into fixed-size
+ * cells, and freed cells go onto a free list for their class, so allocating
+ * and freeing is a pointer swap instead of a call to malloc. Sizes above
+ * POOL_MAX_SIZE fall through to reallocate.
+ */
+
+#define POOL_PAGE_SIZE (64 * 1024)
+#define POOL_MAX_SIZE 256
+#define POOL_CLASS_COUNT 8
+
+typedef struct PoolCell {
+  struct PoolCell *next;
+} PoolCell;
+
+typedef struct PoolPage {
+  struct PoolPage *next; // Every page of the pool, to release them all.
+} PoolPage;
+
+typedef struct SizeClass {
+  PoolCell *freeList; // Cells freed since they were carved.
+  // Cells freed by poolRelease, taken over once the free list is empty.
+  _Atomic(PoolCell *) released;
+  char *bump; // Next cell never handed out in the newest page.
+  char *end;
+} SizeClass;
+
+typedef struct Pool {
+  SizeClass classes[POOL_CLASS_COUNT];
+  PoolPage *pages;
+} Pool;
+
+#define POOL_ALLOCATE(gc, category, type, count)                               \
+  (type *)poolAllocate(gc, category, sizeof(type) * (count))
+
+#define POOL_FREE_ARRAY(gc, category, type, ptr, count)                        \
+  poolFree(gc, category, ptr, sizeof(type) * (count))
+
+#define POOL_FREE(gc, category, type, ptr)                                     \
+  poolFree(gc, category, ptr, sizeof(type))
+
+void initPool(Pool *pool);
+// Releases every page. Cells still in use become invalid.
+void freePool(GC *gc, Pool *pool);
+
+// The size must be the size the memory was allocated with.
+void *poolAllocate(GC *gc, MemCategory category, size_t size);
+void poolFree(GC *gc, MemCategory category, void *ptr, size_t size);
+
+/* Frees memory from any thread, while another allocates from the pool. The
+ * memory is not accounted for, which is left to the caller. */
+void poolRelease(Pool *pool, void *ptr, size_t size);
+
+#endif
@@ -3,13 +3,41 @@
  * which the language can understand for parsing.
  */
 
-#include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "bytescan.h"
 #include "scanner.h"
 #include "token.h"
 
+// Character classes, looked up through a table indexed by the byte itself
+// rather than the locale-sensitive <ctype.h> functions.
+#define CHAR_ALPHA (1 << 0)
+#define CHAR_DIGIT (1 << 1)
+#define CHAR_SPACE (1 << 2) // Whitespace, including newlines.
+
+static const uint8_t charClasses[256] = {
+    ['a' ... 'z'] = CHAR_ALPHA,
+    ['A' ... 'Z'] = CHAR_ALPHA,
+    ['0' ... '9'] = CHAR_DIGIT,
+    [' '] = CHAR_SPACE,
+    ['\t'] = CHAR_SPACE,
+    ['\r'] = CHAR_SPACE,
+    ['\n'] = CHAR_SPACE,
+};
+
+static inline bool isClass(char c, uint8_t charClass) {
+  return charClasses[(uint8_t)c] & charClass;
+}
+
+const char *const scanErrorMessages[SCAN_ERROR_COUNT] = {
+    [SCAN_ERROR_UNEXPECTED_CHARACTER] = "Unexpected character.",
+    [SCAN_ERROR_UNTERMINATED_STRING] = "Unterminated string.",
+};
+
 void initScanner(Scanner *scanner, const char *source) {
   scanner->start = source;
   scanner->current = source;
@@ -39,25 +67,22 @@ static char match(Scanner *scanner, char expected) {
 
 static void skipWhitespace(Scanner *scanner) {
   while (true) {
-    switch (peek(scanner)) {
-    case ' ':
-    case '\r':
-    case '\t':
-      advance(scanner);
-      break;
-    case '\n':
-      scanner->line++;
-      advance(scanner);
-      break;
-    case '/':
-      if (peekNext(scanner) == '/') {
-        // Inline comments contents are for the remainder of the line.
-        while (peek(scanner) != '\n' && !atEnd(scanner))
-          advance(scanner);
-        break;
+    char c = peek(scanner);
+
+    if (isClass(c, CHAR_SPACE)) {
+      if (!isClass(peekNext(scanner), CHAR_SPACE)) {
+        // A lone separator between tokens is the common case.
+        if (c == '\n')
+          scanner->line++;
+        advance(scanner);
+      } else {
+        // Runs of whitespace, such as indentation, are skipped in bulk.
+        scanner->current = skipBlanks(scanner->current, &scanner->line);
       }
-      return;
-    default:
+    } else if (c == '/' && peekNext(scanner) == '/') {
+      // Inline comments contents are for the remainder of the line.
+      scanner->current = findNewline(scanner->current);
+    } else {
       return;
     }
   }
@@ -69,107 +94,235 @@ static Token createToken(Scanner *scanner, TokenType type) {
   token.start = scanner->start;
   token.length = scanner->current - scanner->start;
   token.line = scanner->line;
+  token.number = 0;
   return token;
 }
 
-static Token createErrorToken(Scanner *scanner, char *message) {
+static Token createErrorToken(Scanner *scanner, ScanError error) {
   Token token;
   token.type = TOKEN_ERROR;
-  token.start = message;
-  token.length = strlen(message);
+  token.start = scanErrorMessages[error];
+  token.length = strlen(token.start);
   token.line = scanner->line;
+  token.number = 0;
   return token;
 }
 
-static Token checkKeyword(Scanner *scanner, int start, int restLength,
-                          const char *rest, TokenType type) {
-  // Pass the length as we know it beforehand, faster than calculating it.
-  bool sameLength = scanner->current - scanner->start == start + restLength;
-  bool match = memcmp(scanner->start + start, rest, restLength) == 0;
-  TokenType resultingType = sameLength && match ? type : TOKEN_IDENTIFIER;
-  return createToken(scanner, resultingType);
+typedef struct Keyword {
+  const char *name;
+  int length;
+  TokenType type;
+} Keyword;
+
+#define KEYWORD_LENGTH_MIN 2
+#define KEYWORD_LENGTH_MAX 7
+#define KEYWORD_SLOTS 32
+
+/*
+ * Perfect hash over the keywords, mixing the first two characters and the
+ * length. The multipliers were picked so that every keyword lands in its own
+ * slot. The slots below are computed by the compiler from this same macro, so
+ * a collision introduced by a new keyword shows up as an overridden
+ * initializer warning at compile time.
+ */
+#define KEYWORD_HASH(c0, c1, length)                                           \
+  (((uint8_t)(c0) * 4 + (uint8_t)(c1) * 3 + (length)) % KEYWORD_SLOTS)
+
+// The leading characters are passed separately as indexing a string literal is
+// not a constant expression usable as an array designator.
+#define KEYWORD(c0, c1, str, tokenType)                                        \
+  [KEYWORD_HASH(c0, c1, sizeof(str) - 1)] = {                                  \
+      .name = str, .length = sizeof(str) - 1, .type = tokenType}
+
+static const Keyword keywords[KEYWORD_SLOTS] = {
+    KEYWORD('a', 'n', "and", TOKEN_AND),
+    KEYWORD('c', 'a', "case", TOKEN_CASE),
+    KEYWORD('c', 'l', "class", TOKEN_CLASS),
+    KEYWORD('d', 'e', "default", TOKEN_DEFAULT),
+    KEYWORD('e', 'l', "else", TOKEN_ELSE),
+    KEYWORD('f', 'a', "false", TOKEN_FALSE),
+    KEYWORD('f', 'o', "for", TOKEN_FOR),
+    KEYWORD('f', 'u', "fun", TOKEN_FUN),
+    KEYWORD('i', 'f', "if", TOKEN_IF),
+    KEYWORD('n', 'i', "nil", TOKEN_NIL),
+    KEYWORD('o', 'r', "or", TOKEN_OR),
+    KEYWORD('p', 'r', "print", TOKEN_PRINT),
+    KEYWORD('r', 'e', "return", TOKEN_RETURN),
+    KEYWORD('s', 'u', "super", TOKEN_SUPER),
+    KEYWORD('s', 'w', "switch", TOKEN_SWITCH),
+    KEYWORD('t', 'h', "this", TOKEN_THIS),
+    KEYWORD('t', 'r', "true", TOKEN_TRUE),
+    KEYWORD('v', 'a', "var", TOKEN_VAR),
+    KEYWORD('w', 'h', "while", TOKEN_WHILE),
+};
+
+#undef KEYWORD
+
+static TokenType identifierType(Scanner *scanner) {
+  int length = scanner->current - scanner->start;
+  if (length < KEYWORD_LENGTH_MIN || length > KEYWORD_LENGTH_MAX)
+    return TOKEN_IDENTIFIER;
+
+  const char *start = scanner->start;
+  const Keyword *keyword = &keywords[KEYWORD_HASH(start[0], start[1], length)];
+
+  // Empty slots have a zero length, so they never match.
+  if (keyword->length == length && memcmp(start, keyword->name, length) == 0)
+    return keyword->type;
+
+  return TOKEN_IDENTIFIER;
 }
 
 static Token createIdentifierOrKeywordToken(Scanner *scanner) {
-  while (isalpha(peek(scanner)) || isdigit(peek(scanner)))
+  while (isClass(peek(scanner), CHAR_ALPHA | CHAR_DIGIT))
     advance(scanner);
 
-  // Check for keyword via a manual trie-like data structure.
-  switch (scanner->start[0]) {
-  case 'a':
-    return checkKeyword(scanner, 1, 2, "nd", TOKEN_AND);
-  case 'c':
-    return checkKeyword(scanner, 1, 4, "lass", TOKEN_CLASS);
-  case 'e':
-    return checkKeyword(scanner, 1, 3, "lse", TOKEN_ELSE);
-  case 'f':
-    if (scanner->current - scanner->start > 1) {
-      switch (scanner->start[1]) {
-      case 'a':
-        return checkKeyword(scanner, 2, 3, "lse", TOKEN_FALSE);
-      case 'o':
-        return checkKeyword(scanner, 2, 1, "r", TOKEN_FOR);
-      case 'u':
-        return checkKeyword(scanner, 2, 1, "n", TOKEN_FUN);
-      }
+  return createToken(scanner, identifierType(scanner));
+}
+
+// Significant digits which always fit in the 64-bit mantissa below.
+#define MANTISSA_DIGITS_MAX 19
+
+// Powers of ten that are exactly representable as doubles.
+static const double exactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+#define EXACT_POWER_OF_TEN_MAX 22
+#define EXACT_INTEGER_MAX (1ull << 53)
+
+// The digits of a number literal, accumulated as they are scanned.
+typedef struct Digits {
+  uint64_t mantissa;  // Significant digits, as long as they fit.
+  int significant;    // Count of significant digits, ignoring leading zeros.
+  int fractionDigits; // Count of digits after the decimal point.
+} Digits;
+
+static inline void addDigit(Digits *digits, char c, bool fraction) {
+  if (digits->significant > 0 || c != '0')
+    digits->significant++;
+  if (digits->significant <= MANTISSA_DIGITS_MAX)
+    digits->mantissa = digits->mantissa * 10 + (c - '0');
+  if (fraction)
+    digits->fractionDigits++;
+}
+
+// Significant digits past which only whether any are nonzero changes how a
+// literal rounds, as no halfway point between two doubles has more.
+#define SLOW_DIGITS_MAX 800
+
+/*
+ * Correctly rounded, but slow. The significant digits are copied into a
+ * terminated buffer for strtod, with the exponent of the decimal point, so it
+ * stops where the literal does (e.g. before "e5"). Digits past the buffer are
+ * replaced with a single 1 if any are nonzero, which rounds the same.
+ */
+static double parseNumberSlow(const char *start, int length) {
+  char text[SLOW_DIGITS_MAX + 2 + 16];
+  int n = 0;
+  long exponent = 0;
+  bool fraction = false, dropped = false;
+
+  for (int i = 0; i < length; i++) {
+    char c = start[i];
+    if (c == '.') {
+      fraction = true;
+      continue;
     }
-    break;
-  case 'i':
-    return checkKeyword(scanner, 1, 1, "f", TOKEN_IF);
-  case 'n':
-    return checkKeyword(scanner, 1, 2, "il", TOKEN_NIL);
-  case 'o':
-    return checkKeyword(scanner, 1, 1, "r", TOKEN_OR);
-  case 'p':
-    return checkKeyword(scanner, 1, 4, "rint", TOKEN_PRINT);
-  case 'r':
-    return checkKeyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
-  case 's':
-    return checkKeyword(scanner, 1, 4, "uper", TOKEN_SUPER);
-  case 't':
-    if (scanner->current - scanner->start > 1) {
-      switch (scanner->start[1]) {
-      case 'h':
-        return checkKeyword(scanner, 2, 2, "is", TOKEN_THIS);
-      case 'r':
-        return checkKeyword(scanner, 2, 2, "ue", TOKEN_TRUE);
-      }
+    // Each digit kept after the point divides by ten, as does each leading
+    // zero there, while each dropped before it multiplies by ten.
+    if (n == 0 && c == '0') {
+      if (fraction)
+        exponent--;
+    } else if (n < SLOW_DIGITS_MAX) {
+      text[n++] = c;
+      if (fraction)
+        exponent--;
+    } else {
+      if (!fraction)
+        exponent++;
+      if (c != '0')
+        dropped = true;
     }
-    break;
-  case 'v':
-    return checkKeyword(scanner, 1, 2, "ar", TOKEN_VAR);
-  case 'w':
-    return checkKeyword(scanner, 1, 4, "hile", TOKEN_WHILE);
   }
 
-  // Unsuccessful checks for keyword must indicate identifiers.
-  return createToken(scanner, TOKEN_IDENTIFIER);
+  if (dropped) {
+    text[n++] = '1';
+    exponent--;
+  }
+  if (n == 0)
+    return 0;
+  snprintf(text + n, sizeof(text) - n, "e%ld", exponent);
+  return strtod(text, NULL);
+}
+
+/*
+ * Converts the digits to a double. When the mantissa and the power of ten are
+ * both exactly representable, a single correctly rounded division gives the
+ * correctly rounded result (Clinger's fast path). Other literals, with more
+ * than 15 or so significant digits, fall back to strtod on the text.
+ */
+static double digitsToNumber(Digits *digits, const char *start, int length) {
+  if (digits->significant > MANTISSA_DIGITS_MAX)
+    return parseNumberSlow(start, length);
+
+  // Trailing fractional zeros do not change the value, e.g. "1.50".
+  while (digits->fractionDigits > 0 && digits->mantissa % 10 == 0 &&
+         digits->mantissa != 0) {
+    digits->mantissa /= 10;
+    digits->fractionDigits--;
+  }
+
+  if (digits->mantissa > EXACT_INTEGER_MAX ||
+      digits->fractionDigits > EXACT_POWER_OF_TEN_MAX)
+    return parseNumberSlow(start, length);
+
+  return (double)digits->mantissa / exactPowersOfTen[digits->fractionDigits];
 }
 
+double parseNumber(const char *start, int length) {
+  Digits digits = {0};
+  bool fraction = false;
+
+  for (int i = 0; i < length; i++) {
+    if (start[i] == '.')
+      fraction = true;
+    else
+      addDigit(&digits, start[i], fraction);
+  }
+
+  return digitsToNumber(&digits, start, length);
+}
+
+// The value is computed from the digits as they are scanned, rather than
+// scanning the text a second time when compiling the literal.
 static Token createNumberToken(Scanner *scanner) {
-  while (isdigit(peek(scanner)))
-    advance(scanner);
+  Digits digits = {0};
+  addDigit(&digits, scanner->start[0], false); // Consumed by scanToken.
+
+  while (isClass(peek(scanner), CHAR_DIGIT))
+    addDigit(&digits, advance(scanner), false);
 
   // Handle fractional part of number.
-  if (peek(scanner) == '.' && isdigit(peekNext(scanner))) {
+  if (peek(scanner) == '.' && isClass(peekNext(scanner), CHAR_DIGIT)) {
+    advance(scanner);
     do {
-      advance(scanner);
-    } while (isdigit(peek(scanner)));
+      addDigit(&digits, advance(scanner), true);
+    } while (isClass(peek(scanner), CHAR_DIGIT));
   }
 
-  return createToken(scanner, TOKEN_NUMBER);
+  Token token = createToken(scanner, TOKEN_NUMBER);
+  token.number = digitsToNumber(&digits, token.start, token.length);
+  return token;
 }
 
 static Token createStringToken(Scanner *scanner) {
-  while (peek(scanner) != '"' && !atEnd(scanner)) {
-    if (peek(scanner) == '\n')
-      scanner->line++; // Multi-line strings are allowed in hydro.
-
-    advance(scanner);
-  }
+  // Multi-line strings are allowed in hydro, so count the newlines passed.
+  scanner->current = findQuote(scanner->current, &scanner->line);
 
   if (atEnd(scanner))
-    return createErrorToken(scanner, "Unterminated string.");
+    return createErrorToken(scanner, SCAN_ERROR_UNTERMINATED_STRING);
 
   advance(scanner); // Consume the closing quote.
   return createToken(scanner, TOKEN_STRING);
@@ -184,9 +337,9 @@ Token scanToken(Scanner *scanner) {
 
   char c = advance(scanner);
 
-  if (isalpha(c))
+  if (isClass(c, CHAR_ALPHA))
     return createIdentifierOrKeywordToken(scanner);
-  if (isdigit(c))
+  if (isClass(c, CHAR_DIGIT))
     return createNumberToken(scanner);
 
   switch (c) {
@@ -200,6 +353,8 @@ Token scanToken(Scanner *scanner) {
     return createToken(scanner, TOKEN_RIGHT_BRACE);
   case ',':
     return createToken(scanner, TOKEN_COMMA);
+  case ':':
+    return createToken(scanner, TOKEN_COLON);
   case '.':
     return createToken(scanner, TOKEN_DOT);
   case ';':
@@ -227,6 +382,6 @@ Token scanToken(Scanner *scanner) {
     return createToken(scanner,
                        match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
   default:
-    return createErrorToken(scanner, "Unexpected character.");
+    return createErrorToken(scanner, SCAN_ERROR_UNEXPECTED_CHARACTER);
   }
 }
@@ -9,7 +9,20 @@ typedef struct Scanner {
   int line;            // Current line the scanner is in the source.
 } Scanner;
 
+// Errors reported by the scanner. A TOKEN_ERROR token's start points to the
+// corresponding message rather than into the source.
+typedef enum ScanError {
+  SCAN_ERROR_UNEXPECTED_CHARACTER,
+  SCAN_ERROR_UNTERMINATED_STRING,
+  SCAN_ERROR_COUNT
+} ScanError;
+
+extern const char *const scanErrorMessages[SCAN_ERROR_COUNT];
+
 void initScanner(Scanner *scanner, const char *source);
 Token scanToken(Scanner *scanner);
 
+/* Returns the value of the number literal, the text of a TOKEN_NUMBER. */
+double parseNumber(const char *start, int length);
+
 #endif
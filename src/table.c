@@ -1,21 +1,20 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "gc.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
-
 void initTable(Table *table) {
   table->count = 0;
   table->capacity = 0;
   table->entries = NULL;
 }
 
-void freeTable(Table *table) {
-  FREE_ARRAY(Entry, table->entries, table->capacity);
+void freeTable(GC *gc, Table *table) {
+  FREE_ARRAY(gc, MEM_TABLE, Entry, table->entries, table->capacity);
   initTable(table);
 }
 
@@ -43,9 +42,9 @@ static Entry *findEntry(Entry *entries, int capacity, ObjString *key) {
   }
 }
 
-static void adjustCapacity(Table *table, int capacity) {
+static void adjustCapacity(GC *gc, Table *table, int capacity) {
   // Initialize every element to be empty bucket
-  Entry *entries = ALLOCATE(Entry, capacity);
+  Entry *entries = ALLOCATE(gc, MEM_TABLE, Entry, capacity);
   for (int i = 0; i < capacity; i++) {
     entries[i].key = NULL;
     entries[i].value = NIL_VAL;
@@ -56,8 +55,8 @@ static void adjustCapacity(Table *table, int capacity) {
   table->count = 0;
   for (int i = 0; i < table->capacity; i++) {
     Entry *entry = &table->entries[i];
-    if (entry == NULL)
-      continue;
+    if (entry->key == NULL)
+      continue; // Empty buckets and tombstones are not carried over.
 
     Entry *dest = findEntry(entries, capacity, entry->key);
     dest->key = entry->key;
@@ -65,7 +64,7 @@ static void adjustCapacity(Table *table, int capacity) {
     table->count++;
   }
 
-  FREE_ARRAY(Entry, table->entries, table->capacity);
+  FREE_ARRAY(gc, MEM_TABLE, Entry, table->entries, table->capacity);
   table->entries = entries;
   table->capacity = capacity;
 }
@@ -82,10 +81,10 @@ bool tableGet(Table *table, ObjString *key, Value *value) {
   return true;
 }
 
-bool tableSet(Table *table, ObjString *key, Value value) {
+bool tableSet(GC *gc, Table *table, ObjString *key, Value value) {
   if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
     int capacity = GROW_CAPACITY(table->capacity);
-    adjustCapacity(table, capacity);
+    adjustCapacity(gc, table, capacity);
   }
 
   Entry *entry = findEntry(table->entries, table->capacity, key);
@@ -113,11 +112,11 @@ bool tableDelete(Table *table, ObjString *key) {
   return true;
 }
 
-void tableAddAll(Table *src, Table *dest) {
+void tableAddAll(GC *gc, Table *src, Table *dest) {
   for (int i = 0; i < src->capacity; i++) {
     Entry *entry = &src->entries[i];
     if (entry->key != NULL) {
-      tableSet(dest, entry->key, entry->value);
+      tableSet(gc, dest, entry->key, entry->value);
     }
   }
 }
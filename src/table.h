@@ -1,10 +1,14 @@
 #ifndef HYDRO_TABLE_H
 #define HYDRO_TABLE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "memory.h"
 #include "value.h"
 
+#define TABLE_MAX_LOAD 0.75
+
 typedef struct Entry {
   ObjString *key;
   Value value;
@@ -17,7 +21,7 @@ typedef struct Table {
 } Table;
 
 void initTable(Table *table);
-void freeTable(Table *table);
+void freeTable(GC *gc, Table *table);
 
 /*
  * If an entry exists in the table for the key, returns true and sets the value
@@ -29,7 +33,14 @@ bool tableGet(Table *table, ObjString *key, Value *value);
  * Adds the given key/value pair, overwriting any values for existing entries.
  * Returns true if a NEW entry was added, otherwise false.
  */
-bool tableSet(Table *table, ObjString *key, Value value);
+bool tableSet(GC *gc, Table *table, ObjString *key, Value value);
+
+// Bytes the next tableSet into the table allocates, for callers to reserve.
+static inline size_t tableGrowth(const Table *table) {
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+    return sizeof(Entry) * GROW_CAPACITY(table->capacity);
+  return 0;
+}
 
 /*
  * Replaces the table entry for the key with a "tombstone" entry, represented
@@ -39,7 +50,7 @@ bool tableSet(Table *table, ObjString *key, Value value);
 bool tableDelete(Table *table, ObjString *key);
 
 /* Copies all table entries from src to dest. */
-void tableAddAll(Table *src, Table *dest);
+void tableAddAll(GC *gc, Table *src, Table *dest);
 
 ObjString *tableFindString(Table *table, const char *chars, int length,
                            uint32_t hash);
@@ -8,6 +8,7 @@ typedef enum TokenType {
   TOKEN_LEFT_BRACE,
   TOKEN_RIGHT_BRACE,
   TOKEN_COMMA,
+  TOKEN_COLON,
   TOKEN_DOT,
   TOKEN_PLUS,
   TOKEN_MINUS,
@@ -27,7 +28,9 @@ typedef enum TokenType {
 
   // Keywords
   TOKEN_AND,
+  TOKEN_CASE,
   TOKEN_CLASS,
+  TOKEN_DEFAULT,
   TOKEN_ELSE,
   TOKEN_FALSE,
   TOKEN_FOR,
@@ -38,6 +41,7 @@ typedef enum TokenType {
   TOKEN_PRINT,
   TOKEN_RETURN,
   TOKEN_SUPER,
+  TOKEN_SWITCH,
   TOKEN_THIS,
   TOKEN_TRUE,
   TOKEN_VAR,
@@ -57,6 +61,7 @@ typedef struct Token {
   const char *start;
   int length;
   int line;
+  double number; // The value of a TOKEN_NUMBER, computed while scanning it.
 } Token;
 
 #endif
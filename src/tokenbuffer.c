@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "scanner.h"
+#include "token.h"
+#include "tokenbuffer.h"
+
+// Number of tokens the scanner thread appends between waking the parser.
+#define PUBLISH_INTERVAL 256
+
+_Static_assert(sizeof(PackedToken) == 16, "PackedToken should be 16 bytes.");
+
+static PackedToken packToken(TokenBuffer *buffer, Token token) {
+  PackedToken packed;
+  packed.type = token.type;
+  packed.length = token.length;
+  packed.line = token.line;
+
+  if (token.type != TOKEN_ERROR) {
+    packed.offset = token.start - buffer->source;
+    return packed;
+  }
+
+  for (int i = 0; i < SCAN_ERROR_COUNT; i++) {
+    if (token.start == scanErrorMessages[i])
+      packed.offset = i;
+  }
+  return packed;
+}
+
+static void publish(TokenBuffer *buffer, int count, bool finished) {
+  if (!buffer->threaded) {
+    atomic_store_explicit(&buffer->count, count, memory_order_relaxed);
+    buffer->finished = finished;
+    return;
+  }
+
+  pthread_mutex_lock(&buffer->lock);
+  atomic_store_explicit(&buffer->count, count, memory_order_release);
+  buffer->finished = finished;
+  pthread_cond_signal(&buffer->scanned);
+  pthread_mutex_unlock(&buffer->lock);
+}
+
+static void scanAll(TokenBuffer *buffer) {
+  Scanner scanner;
+  initScanner(&scanner, buffer->source);
+
+  int count = 0;
+  while (true) {
+    Token token = scanToken(&scanner);
+
+    int block = count / TOKEN_BLOCK_SIZE, slot = count % TOKEN_BLOCK_SIZE;
+    if (slot == 0) {
+      buffer->blocks[block] =
+          ARENA_ALLOCATE(&buffer->arena, PackedToken, TOKEN_BLOCK_SIZE);
+      if (buffer->blocks[block] == NULL) {
+        buffer->outOfMemory = true;
+        break;
+      }
+    }
+
+    buffer->blocks[block][slot] = packToken(buffer, token);
+    count++;
+
+    if (token.type == TOKEN_EOF)
+      break;
+
+    if (count % PUBLISH_INTERVAL == 0)
+      publish(buffer, count, false);
+  }
+
+  publish(buffer, count, true);
+}
+
+static void *scanThread(void *buffer) {
+  scanAll(buffer);
+  return NULL;
+}
+
+void initTokenBuffer(TokenBuffer *buffer, const char *source, bool threaded) {
+  buffer->source = source;
+  buffer->threaded = threaded;
+  buffer->finished = false;
+  buffer->outOfMemory = false;
+  atomic_init(&buffer->count, 0);
+
+  // The arena is not accounted to a GC, as it may be used from the scanner
+  // thread. It only lives for a single compilation.
+  initArena(&buffer->arena, NULL);
+
+  // Every token but EOF consumes at least one character of the source, which
+  // bounds the number of blocks that could be needed.
+  size_t maxTokens = strlen(source) + 1;
+  buffer->blockCount = maxTokens / TOKEN_BLOCK_SIZE + 1;
+  buffer->blocks =
+      ARENA_ALLOCATE(&buffer->arena, PackedToken *, buffer->blockCount);
+  if (buffer->blocks == NULL) {
+    buffer->threaded = false;
+    buffer->outOfMemory = buffer->finished = true;
+    return;
+  }
+
+  if (!threaded) {
+    scanAll(buffer);
+    return;
+  }
+
+  pthread_mutex_init(&buffer->lock, NULL);
+  pthread_cond_init(&buffer->scanned, NULL);
+  if (pthread_create(&buffer->thread, NULL, scanThread, buffer) != 0) {
+    // Scanning up front is always a correct fallback.
+    pthread_mutex_destroy(&buffer->lock);
+    pthread_cond_destroy(&buffer->scanned);
+    buffer->threaded = false;
+    scanAll(buffer);
+  }
+}
+
+void freeTokenBuffer(TokenBuffer *buffer) {
+  if (buffer->threaded) {
+    pthread_join(buffer->thread, NULL);
+    pthread_mutex_destroy(&buffer->lock);
+    pthread_cond_destroy(&buffer->scanned);
+  }
+
+  freeArena(&buffer->arena);
+  buffer->blocks = NULL;
+  buffer->blockCount = 0;
+  atomic_store(&buffer->count, 0);
+}
+
+Token awaitTokenAt(TokenBuffer *buffer, int index) {
+  int count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+
+  if (index >= count && buffer->threaded) {
+    pthread_mutex_lock(&buffer->lock);
+    while (index >= (count = atomic_load(&buffer->count)) && !buffer->finished)
+      pthread_cond_wait(&buffer->scanned, &buffer->lock);
+    pthread_mutex_unlock(&buffer->lock);
+  }
+
+  // Without memory for the rest of the tokens, those scanned are followed by
+  // EOF, and the compiler fails instead.
+  if (index >= count && buffer->outOfMemory) {
+    Token eof = {TOKEN_EOF, "", 0, 0, 0};
+    return eof;
+  }
+
+  // The last token is always EOF, which is repeated for any index beyond it.
+  return unpackToken(buffer, index < count ? index : count - 1);
+}
@@ -0,0 +1,88 @@
+#ifndef HYDRO_TOKENBUFFER_H
+#define HYDRO_TOKENBUFFER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "scanner.h"
+#include "token.h"
+
+// Tokens are stored in fixed-size blocks so that storage already handed out to
+// the parser never moves while the scanner is still appending.
+#define TOKEN_BLOCK_SIZE 4096
+
+/*
+ * A token packed into 16 bytes. Its text is recovered from the source using
+ * the offset, except for TOKEN_ERROR where the offset is the ScanError. There
+ * is no room for the value of a TOKEN_NUMBER, so it is parsed again from the
+ * digits when unpacked.
+ */
+typedef struct PackedToken {
+  uint32_t offset;
+  uint32_t length;
+  uint32_t line;
+  uint8_t type;
+} PackedToken;
+
+/*
+ * The source converted into an array of tokens, in a single pass of the
+ * scanner. Tokens are read back by index, so the parser can look arbitrarily
+ * far ahead of its current position.
+ */
+typedef struct TokenBuffer {
+  const char *source;
+  PackedToken **blocks; // Table of blocks, sized up front from the source.
+  Arena arena;          // Holds the blocks, only used by the scanning thread.
+  int blockCount;
+  atomic_int count; // Number of tokens available to read.
+  bool threaded;    // Whether scanning runs on a separate thread.
+
+  // Only used when threaded, to wait for the scanner thread.
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t scanned;
+  bool finished; // Set once the EOF token has been published.
+  // Set before finishing if a block could not be allocated, which stops
+  // scanning short of EOF.
+  bool outOfMemory;
+} TokenBuffer;
+
+/* Starts scanning the source into the buffer. When threaded, scanning runs on a
+ * separate thread ahead of the reader. Otherwise all of the source is scanned
+ * before returning. */
+void initTokenBuffer(TokenBuffer *buffer, const char *source, bool threaded);
+void freeTokenBuffer(TokenBuffer *buffer);
+
+// Slow path of tokenAt, for tokens the scanner thread may not have reached.
+Token awaitTokenAt(TokenBuffer *buffer, int index);
+
+static inline Token unpackToken(TokenBuffer *buffer, int index) {
+  PackedToken *packed =
+      &buffer->blocks[index / TOKEN_BLOCK_SIZE][index % TOKEN_BLOCK_SIZE];
+
+  Token token;
+  token.type = packed->type;
+  token.length = packed->length;
+  token.line = packed->line;
+  token.start = packed->type == TOKEN_ERROR
+                    ? scanErrorMessages[packed->offset]
+                    : buffer->source + packed->offset;
+  token.number = packed->type == TOKEN_NUMBER
+                     ? parseNumber(token.start, token.length)
+                     : 0;
+  return token;
+}
+
+/* Returns the token at the index, waiting for the scanner thread to reach it
+ * if need be. Indices past the end of the source return the EOF token. Called
+ * for every token the parser consumes, so the common case is inlined. */
+static inline Token tokenAt(TokenBuffer *buffer, int index) {
+  if (index < atomic_load_explicit(&buffer->count, memory_order_acquire))
+    return unpackToken(buffer, index);
+  return awaitTokenAt(buffer, index);
+}
+
+#endif
@@ -1,7 +1,10 @@
+#include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "gc.h"
 #include "memory.h"
 #include "object.h"
 #include "value.h"
@@ -12,24 +15,25 @@ void initValueArray(ValueArray *arr) {
   arr->values = NULL;
 }
 
-static void growValueArray(ValueArray *arr) {
+static void growValueArray(GC *gc, ValueArray *arr) {
   int oldCapacity = arr->capacity;
   int newCapacity = GROW_CAPACITY(oldCapacity);
 
   arr->capacity = newCapacity;
-  arr->values = GROW_ARRAY(Value, arr->values, oldCapacity, newCapacity);
+  arr->values = GROW_ARRAY(gc, MEM_CONSTANTS, Value, arr->values, oldCapacity,
+                           newCapacity);
 }
 
-void appendValueArray(ValueArray *arr, Value value) {
+void appendValueArray(GC *gc, ValueArray *arr, Value value) {
   if (arr->count + 1 > arr->capacity) {
-    growValueArray(arr);
+    growValueArray(gc, arr);
   }
   arr->values[arr->count] = value;
   arr->count++;
 }
 
-void freeValueArray(ValueArray *arr) {
-  FREE_ARRAY(Value, arr->values, arr->capacity);
+void freeValueArray(GC *gc, ValueArray *arr) {
+  FREE_ARRAY(gc, MEM_CONSTANTS, Value, arr->values, arr->capacity);
   initValueArray(arr);
 }
 
@@ -53,10 +57,40 @@ bool valuesEqual(Value a, Value b) {
   }
 }
 
+uint32_t hashValue(Value value) {
+  uint64_t bits = 0;
+  switch (value.type) {
+  case VAL_NUMBER: {
+    double number = AS_NUMBER(value);
+    if (number == 0)
+      number = 0; // -0 equals 0.
+    memcpy(&bits, &number, sizeof(double));
+    break;
+  }
+  case VAL_BOOL:
+    bits = AS_BOOL(value);
+    break;
+  case VAL_NIL:
+    break;
+  case VAL_OBJ:
+    if (IS_STRING(value))
+      return AS_STRING(value)->hash;
+    // Other objects are only equal to themselves.
+    bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+    break;
+  }
+
+  // Mixes the high bits down, so round numbers spread.
+  bits ^= bits >> 33;
+  bits *= 0xff51afd7ed558ccdull;
+  bits ^= bits >> 33;
+  return (uint32_t)bits ^ value.type;
+}
+
 void printValue(Value value) {
   switch (value.type) {
   case VAL_NUMBER:
-    printf("%g", AS_NUMBER(value));
+    printf("%g", AS_NUMBER(value)); // Same format as formatNumber.
     break;
   case VAL_BOOL:
     printf(AS_BOOL(value) ? "true" : "false");
@@ -69,3 +103,168 @@ void printValue(Value value) {
     break;
   }
 }
+
+// "%g" prints 6 significant digits.
+#define SIGNIFICANT_DIGITS 6
+
+static const uint64_t powersOfTen[] = {
+    1ull,
+    10ull,
+    100ull,
+    1000ull,
+    10000ull,
+    100000ull,
+    1000000ull,
+    10000000ull,
+    100000000ull,
+    1000000000ull,
+    10000000000ull,
+    100000000000ull,
+    1000000000000ull,
+    10000000000000ull,
+    100000000000000ull,
+    1000000000000000ull,
+    10000000000000000ull,
+};
+
+#define EXACT_INTEGER_MAX (1ull << 53)
+
+static int countDigits(uint64_t n) {
+  int digits = 1;
+  while (n >= 10) {
+    n /= 10;
+    digits++;
+  }
+  return digits;
+}
+
+// Writes the digits of n, zero padded to at least `width` digits.
+static int writeDigits(char *buffer, uint64_t n, int width) {
+  char digits[20];
+  int count = 0;
+  do {
+    digits[count++] = '0' + n % 10;
+    n /= 10;
+  } while (n > 0 || count < width);
+
+  for (int i = 0; i < count; i++)
+    buffer[i] = digits[count - 1 - i];
+  return count;
+}
+
+/*
+ * Fixed notation, used by "%g" for magnitudes in [1e-4, 1e6). Finds the fewest
+ * fraction digits k such that the decimal r / 10^k converts back to exactly
+ * the same double (both r and 10^k being exact, the division is correctly
+ * rounded). As that decimal has at most 6 significant digits and the double
+ * is the nearest one to it, rounding the double to 6 digits gives the decimal
+ * back, so it is what "%g" prints, trailing zeros already removed. Returns 0
+ * if there is no such decimal, leaving the general case to printf.
+ */
+static int formatFixed(double magnitude, char *buffer) {
+  int maxFractionDigits;
+  if (magnitude >= 1) {
+    maxFractionDigits = SIGNIFICANT_DIGITS - countDigits((uint64_t)magnitude);
+  } else {
+    // Zeros directly after the decimal point are not significant.
+    maxFractionDigits = SIGNIFICANT_DIGITS;
+    for (double scaled = magnitude * 10; scaled < 1; scaled *= 10)
+      maxFractionDigits++;
+  }
+
+  for (int k = 0; k <= maxFractionDigits; k++) {
+    double r = nearbyint(magnitude * powersOfTen[k]);
+    if (r / powersOfTen[k] != magnitude)
+      continue;
+
+    uint64_t digits = (uint64_t)r;
+    int length = writeDigits(buffer, digits / powersOfTen[k], 1);
+    if (k > 0) {
+      buffer[length++] = '.';
+      length += writeDigits(buffer + length, digits % powersOfTen[k], k);
+    }
+    return length;
+  }
+
+  return 0;
+}
+
+/*
+ * Exponent notation for integers of at least 1e6, rounding to 6 significant
+ * digits with ties to even as printf does, e.g. 1234565 is "1.23456e+06".
+ */
+static int formatLargeInteger(uint64_t n, char *buffer) {
+  int exponent = countDigits(n) - 1;
+  uint64_t divisor = powersOfTen[exponent + 1 - SIGNIFICANT_DIGITS];
+  uint64_t mantissa = n / divisor, remainder = n % divisor;
+
+  if (remainder * 2 > divisor || (remainder * 2 == divisor && mantissa % 2))
+    mantissa++;
+  if (mantissa == powersOfTen[SIGNIFICANT_DIGITS]) { // Rounded up to 1000000.
+    mantissa /= 10;
+    exponent++;
+  }
+
+  int fractionDigits = SIGNIFICANT_DIGITS - 1;
+  while (fractionDigits > 0 && mantissa % 10 == 0) {
+    mantissa /= 10;
+    fractionDigits--;
+  }
+
+  int length = writeDigits(buffer, mantissa / powersOfTen[fractionDigits], 1);
+  if (fractionDigits > 0) {
+    buffer[length++] = '.';
+    length += writeDigits(buffer + length, mantissa % powersOfTen[fractionDigits],
+                          fractionDigits);
+  }
+  buffer[length++] = 'e';
+  buffer[length++] = '+';
+  length += writeDigits(buffer + length, exponent, 2);
+  return length;
+}
+
+int formatNumber(double number, char *buffer) {
+  double magnitude = fabs(number);
+  int sign = 0;
+
+  if (signbit(number) && magnitude != 0 && isfinite(number))
+    buffer[sign++] = '-';
+
+  int length = 0;
+  if (magnitude >= 1e-4 && magnitude < 1e6) {
+    length = formatFixed(magnitude, buffer + sign);
+  } else if (magnitude >= 1e6 && magnitude <= EXACT_INTEGER_MAX &&
+             magnitude == floor(magnitude)) {
+    length = formatLargeInteger((uint64_t)magnitude, buffer + sign);
+  }
+
+  // Zero, non-finite values and everything without a fast path.
+  if (length == 0)
+    return snprintf(buffer, NUMBER_FORMAT_MAX, "%g", number);
+
+  buffer[sign + length] = '\0';
+  return sign + length;
+}
+
+void writeValue(Output *output, Value value) {
+  switch (value.type) {
+  case VAL_NUMBER: {
+    char buffer[NUMBER_FORMAT_MAX];
+    int length = formatNumber(AS_NUMBER(value), buffer);
+    writeOutput(output, buffer, length);
+    break;
+  }
+  case VAL_BOOL:
+    if (AS_BOOL(value))
+      writeOutput(output, "true", 4);
+    else
+      writeOutput(output, "false", 5);
+    break;
+  case VAL_NIL:
+    writeOutput(output, "nil", 3);
+    break;
+  case VAL_OBJ:
+    writeObject(output, value);
+    break;
+  }
+}
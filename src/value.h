@@ -3,9 +3,13 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#include "output.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct GC GC;
 
 typedef enum ValueType {
   VAL_BOOL,
@@ -48,11 +52,22 @@ typedef struct ValueArray {
 } ValueArray;
 
 void initValueArray(ValueArray *arr);
-void appendValueArray(ValueArray *arr, Value value);
-void freeValueArray(ValueArray *arr);
+void appendValueArray(GC *gc, ValueArray *arr, Value value);
+void freeValueArray(GC *gc, ValueArray *arr);
 
 bool valuesEqual(Value a, Value b);
+/* Hashes values equal by valuesEqual alike. Strings hash by their contents,
+ * so a hash holds for the same string interned by any VM. Other objects hash
+ * by their address, so a hash only holds until they are moved. */
+uint32_t hashValue(Value value);
 
 void printValue(Value value);
+void writeValue(Output *output, Value value);
+
+// Large enough for any number formatted by formatNumber, including the NUL.
+#define NUMBER_FORMAT_MAX 32
+
+/* Formats the number exactly as printf's "%g" would, returning the length. */
+int formatNumber(double number, char *buffer);
 
 #endif
@@ -0,0 +1,374 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "chunk.h"
+#include "object.h"
+#include "value.h"
+#include "verifier.h"
+
+// Depths of instructions not reached yet, and of the bytes of operands.
+#define UNREACHED -1
+#define NOT_AN_INSTRUCTION -2
+
+typedef struct Verifier {
+  const Chunk *chunk;
+  bool script;  // The script's chunk, whose return pops nothing.
+  int *depths;  // Depth of the stack before each instruction, by offset.
+  int *pending; // Instructions reached but not checked yet.
+  int pendingCount;
+  VerifyError *error;
+} Verifier;
+
+static int readShort(const uint8_t *code) { return (code[0] << 8) | code[1]; }
+
+static bool inCode(const Chunk *chunk, int offset) {
+  return offset >= 0 && offset < chunk->count;
+}
+
+static bool inConstants(const Chunk *chunk, int index) {
+  return index < chunk->constants.count;
+}
+
+static bool isComparison(uint8_t instruction) {
+  return instruction == OP_LT || instruction == OP_LTE ||
+         instruction == OP_GT || instruction == OP_GTE;
+}
+
+// Functions with upvalues are only run as closures, which give them their
+// upvalues, see OP_CLOSURE.
+static const char *checkClosure(const Chunk *chunk, int offset) {
+  const uint8_t *code = &chunk->code[offset];
+  if (!inConstants(chunk, code[1]))
+    return "Constant out of range.";
+  Value constant = chunk->constants.values[code[1]];
+  if (!IS_FUNCTION(constant))
+    return "Closure of a constant not a function.";
+  if (AS_FUNCTION(constant)->chunk.upvalueCount != code[2])
+    return "Closure captures the wrong number of upvalues.";
+
+  for (int i = 0; i < code[2]; i++) {
+    const uint8_t *capture = &code[3 + i * 2];
+    if (capture[0] > 1)
+      return "Unknown capture.";
+    if (capture[0] == 0 && capture[1] >= chunk->upvalueCount)
+      return "Upvalue out of range.";
+  }
+  return NULL;
+}
+
+static const char *checkJumpTable(const Chunk *chunk, int offset, int next) {
+  const uint8_t *code = &chunk->code[offset];
+  if (!inConstants(chunk, code[1]))
+    return "Constant out of range.";
+  if (!IS_NUMBER(chunk->constants.values[code[1]]))
+    return "Lowest case is not a number.";
+
+  int count = readShort(&code[2]);
+  if (!inCode(chunk, next + readShort(&code[4])))
+    return "Jump out of the code.";
+  for (int i = 0; i < count; i++) {
+    if (!inCode(chunk, next + readShort(&code[6 + i * 2])))
+      return "Jump out of the code.";
+  }
+  return NULL;
+}
+
+static const char *checkJumpHash(const Chunk *chunk, int offset, int next) {
+  const uint8_t *code = &chunk->code[offset];
+  int capacity = readShort(&code[1]);
+  if (!inCode(chunk, next + readShort(&code[3])))
+    return "Jump out of the code.";
+
+  bool full = true;
+  for (int i = 0; i < capacity; i++) {
+    const uint8_t *entry = &code[5 + i * 4];
+    int key = readShort(entry);
+    if (key == 0) {
+      full = false;
+      continue;
+    }
+    if (!inConstants(chunk, key - 1))
+      return "Constant out of range.";
+    if (!inCode(chunk, next + readShort(&entry[2])))
+      return "Jump out of the code.";
+  }
+
+  // Probing for a missing case stops at an empty entry.
+  if (capacity > SWITCH_SCAN_MAX &&
+      ((capacity & (capacity - 1)) != 0 || full))
+    return "Hash table can not be probed.";
+  return NULL;
+}
+
+const char *checkInstruction(const Chunk *chunk, int offset) {
+  const uint8_t *code = &chunk->code[offset];
+  if (code[0] >= OP_COUNT)
+    return "Unknown opcode.";
+
+  // The length of a switch's table is read from the operands before it.
+  const OpInfo *info = &opInfo[code[0]];
+  int remaining = chunk->count - offset;
+  if (info->length == 0 &&
+      remaining < (code[0] == OP_JUMP_TABLE  ? 6
+                   : code[0] == OP_CLOSURE ? 3
+                                           : 5))
+    return "Instruction runs past the end.";
+  int next = offset + instructionLength(code);
+  if (next > chunk->count)
+    return "Instruction runs past the end.";
+
+  switch (info->operands) {
+  case OPERANDS_NONE:
+  case OPERAND_LOCAL:
+    return NULL;
+  case OPERAND_ARG_COUNT:
+    // The callee may take over the frame, so nothing else may follow.
+    if (code[0] == OP_TAIL_CALL &&
+        (next == chunk->count || chunk->code[next] != OP_RETURN))
+      return "Tail call not followed by a return.";
+    return NULL;
+  case OPERAND_CONSTANT: {
+    if (!inConstants(chunk, code[1]))
+      return "Constant out of range.";
+    Value constant = chunk->constants.values[code[1]];
+    if (IS_FUNCTION(constant) && AS_FUNCTION(constant)->chunk.upvalueCount > 0)
+      return "Function with upvalues not in a closure.";
+    return NULL;
+  }
+  case OPERAND_UPVALUE:
+    return code[1] < chunk->upvalueCount ? NULL : "Upvalue out of range.";
+  case OPERANDS_CLOSURE:
+    return checkClosure(chunk, offset);
+  case OPERAND_GLOBAL:
+    if (!inConstants(chunk, code[1]))
+      return "Constant out of range.";
+    if (!IS_STRING(chunk->constants.values[code[1]]))
+      return "Global name is not a string.";
+    return NULL;
+  case OPERAND_JUMP:
+    return inCode(chunk, next + readShort(&code[1])) ? NULL
+                                                     : "Jump out of the code.";
+  case OPERAND_LOOP:
+    return inCode(chunk, next - readShort(&code[1])) ? NULL
+                                                     : "Jump out of the code.";
+  case OPERANDS_FOR_RANGE:
+    if (!isComparison(code[3]))
+      return "Unknown comparison.";
+    if (!inConstants(chunk, code[4]))
+      return "Constant out of range.";
+    if (!IS_NUMBER(chunk->constants.values[code[4]]))
+      return "Step is not a number.";
+    return inCode(chunk, next - readShort(&code[5])) ? NULL
+                                                     : "Jump out of the code.";
+  case OPERANDS_JUMP_TABLE:
+    return checkJumpTable(chunk, offset, next);
+  case OPERANDS_JUMP_HASH:
+    return checkJumpHash(chunk, offset, next);
+  }
+  return NULL; // Unreachable.
+}
+
+bool localsInRange(const uint8_t *code, int depth) {
+  switch (opInfo[code[0]].operands) {
+  case OPERAND_LOCAL:
+    return code[1] < depth;
+  case OPERANDS_FOR_RANGE:
+    return code[1] < depth && code[2] < depth; // The variable and bound.
+  case OPERANDS_CLOSURE:
+    // A local function calling itself captures the slot it is pushed into.
+    for (int i = 0; i < code[2]; i++) {
+      const uint8_t *capture = &code[3 + i * 2];
+      if (capture[0] == 1 && capture[1] > depth)
+        return false;
+    }
+    return true;
+  default:
+    return true;
+  }
+}
+
+static bool fail(Verifier *verifier, int offset, const char *message) {
+  verifier->error->chunk = verifier->chunk;
+  verifier->error->offset = offset;
+  verifier->error->message = message;
+  return false;
+}
+
+// Finds where each instruction starts, checking every one on its own.
+static bool decode(Verifier *verifier) {
+  const Chunk *chunk = verifier->chunk;
+  for (int offset = 0; offset < chunk->count; offset++)
+    verifier->depths[offset] = NOT_AN_INSTRUCTION;
+
+  for (int offset = 0; offset < chunk->count;) {
+    const char *message = checkInstruction(chunk, offset);
+    if (message != NULL)
+      return fail(verifier, offset, message);
+
+    verifier->depths[offset] = UNREACHED;
+    offset += instructionLength(&chunk->code[offset]);
+  }
+  return true;
+}
+
+// Continues from the instruction at from to the one at target, which is in
+// the code, with the stack at the given depth.
+static bool reach(Verifier *verifier, int from, int target, int depth) {
+  if (verifier->depths[target] == NOT_AN_INSTRUCTION)
+    return fail(verifier, from, "Jump into an instruction.");
+
+  if (verifier->depths[target] == UNREACHED) {
+    verifier->depths[target] = depth;
+    verifier->pending[verifier->pendingCount++] = target;
+  } else if (verifier->depths[target] != depth) {
+    return fail(verifier, from, "Stack depth differs between paths.");
+  }
+  return true;
+}
+
+// Reaches the cases of a switch's hash table.
+static bool reachCases(Verifier *verifier, int offset, int next, int depth) {
+  const uint8_t *code = &verifier->chunk->code[offset];
+  int capacity = readShort(&code[1]);
+  for (int i = 0; i < capacity; i++) {
+    const uint8_t *entry = &code[5 + i * 4];
+    if (readShort(entry) != 0 &&
+        !reach(verifier, offset, next + readShort(&entry[2]), depth))
+      return false;
+  }
+  return reach(verifier, offset, next + readShort(&code[3]), depth);
+}
+
+// Checks what the instructions from offset on do to the stack, as far as they
+// run in order, and reaches those they jump to.
+static bool verifyFrom(Verifier *verifier, int offset) {
+  const Chunk *chunk = verifier->chunk;
+  while (true) {
+    const uint8_t *code = &chunk->code[offset];
+    const OpInfo *info = &opInfo[code[0]];
+    int next = offset + instructionLength(code);
+
+    int pops = info->pops;
+    if (code[0] == OP_CALL || code[0] == OP_TAIL_CALL)
+      pops += code[1];
+    else if (code[0] == OP_RETURN && verifier->script)
+      pops = 0;
+    int depth = verifier->depths[offset];
+    if (depth < pops)
+      return fail(verifier, offset, "Stack underflow.");
+    if (!localsInRange(code, depth))
+      return fail(verifier, offset, "Local out of range.");
+    depth += info->pushes - pops;
+    if (depth > chunk->maxStackDepth)
+      return fail(verifier, offset, "Stack deeper than its maxStackDepth.");
+
+    switch (info->operands) {
+    case OPERANDS_NONE:
+      if (code[0] == OP_RETURN)
+        return true;
+      break;
+    case OPERAND_CONSTANT:
+    case OPERAND_GLOBAL:
+    case OPERAND_LOCAL:
+    case OPERAND_ARG_COUNT:
+    case OPERAND_UPVALUE:
+    case OPERANDS_CLOSURE:
+      break;
+    case OPERAND_JUMP:
+      if (!reach(verifier, offset, next + readShort(&code[1]), depth))
+        return false;
+      if (code[0] == OP_JUMP)
+        return true;
+      break;
+    case OPERAND_LOOP:
+      return reach(verifier, offset, next - readShort(&code[1]), depth);
+    case OPERANDS_FOR_RANGE:
+      if (!reach(verifier, offset, next - readShort(&code[5]), depth))
+        return false;
+      break;
+    case OPERANDS_JUMP_TABLE: {
+      if (!reach(verifier, offset, next + readShort(&code[4]), depth))
+        return false;
+      int count = readShort(&code[2]);
+      for (int i = 0; i < count; i++) {
+        int target = next + readShort(&code[6 + i * 2]);
+        if (!reach(verifier, offset, target, depth))
+          return false;
+      }
+      return true;
+    }
+    case OPERANDS_JUMP_HASH:
+      return reachCases(verifier, offset, next, depth);
+    }
+
+    if (next == chunk->count)
+      return fail(verifier, offset, "Code runs past the end.");
+    // Carries on with the next instruction, unless it was reached already.
+    if (verifier->depths[next] != UNREACHED)
+      return reach(verifier, offset, next, depth);
+    verifier->depths[next] = depth;
+    offset = next;
+  }
+}
+
+// Starts with the arguments on the stack, for a function's chunk. Nothing is
+// marked until every chunk has passed, see markVerified.
+static bool verifyCode(const Chunk *chunk, int arity, bool script,
+                       VerifyError *error) {
+  Verifier verifier;
+  verifier.chunk = chunk;
+  verifier.script = script;
+  verifier.error = error;
+  if (chunk->count == 0)
+    return fail(&verifier, 0, "No code.");
+  if (script && chunk->upvalueCount > 0)
+    return fail(&verifier, 0, "Script with upvalues.");
+  if (arity > chunk->maxStackDepth)
+    return fail(&verifier, 0, "Stack deeper than its maxStackDepth.");
+
+  verifier.depths = malloc(sizeof(int) * chunk->count);
+  verifier.pending = malloc(sizeof(int) * chunk->count);
+  if (verifier.depths == NULL || verifier.pending == NULL) {
+    free(verifier.depths);
+    free(verifier.pending);
+    return fail(&verifier, 0, "Out of memory.");
+  }
+  verifier.pendingCount = 0;
+
+  bool verified = decode(&verifier) && reach(&verifier, 0, 0, arity);
+  while (verified && verifier.pendingCount > 0)
+    verified =
+        verifyFrom(&verifier, verifier.pending[--verifier.pendingCount]);
+
+  free(verifier.depths);
+  free(verifier.pending);
+  if (!verified)
+    return false;
+
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (IS_FUNCTION(constant)) {
+      ObjFunction *function = AS_FUNCTION(constant);
+      if (!verifyCode(&function->chunk, function->arity, false, error))
+        return false;
+    }
+  }
+  return true;
+}
+
+static void markVerified(Chunk *chunk) {
+  chunk->verified = true;
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (IS_FUNCTION(constant))
+      markVerified(&AS_FUNCTION(constant)->chunk);
+  }
+}
+
+bool verifyChunk(Chunk *chunk, VerifyError *error) {
+  if (!verifyCode(chunk, 0, true, error))
+    return false;
+  markVerified(chunk);
+  return true;
+}
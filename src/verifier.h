@@ -0,0 +1,39 @@
+#ifndef HYDRO_VERIFIER_H
+#define HYDRO_VERIFIER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chunk.h"
+
+// Where and why a chunk failed verification.
+typedef struct VerifyError {
+  const Chunk *chunk; // The script's chunk, or one of its functions'.
+  int offset;         // Of the instruction at fault.
+  const char *message;
+} VerifyError;
+
+/* Checks that a finalized chunk can be run without the VM checking more than
+ * the values it works on: every instruction passes checkInstruction, every
+ * jump lands on an instruction, the stack has the same depth along every path
+ * to an instruction, never goes below its frame or deeper than the chunk's
+ * maxStackDepth, and holds every local read, written or captured. The script
+ * has no upvalues. The chunks of the functions among its constants are checked
+ * too. Only once every chunk passes is each marked verified, which must be done
+ * before the chunk is shared with other VMs. Returns false with the first
+ * problem found in error, leaving every chunk as it was. */
+bool verifyChunk(Chunk *chunk, VerifyError *error);
+
+/* Checks the instruction at an offset in a chunk's code on its own: it is a
+ * known opcode whose operands fit in the code, its constants are in range and
+ * of the type it needs, its upvalues are the chunk's, its jumps land in the
+ * code, and a tail call is followed by a return. Returns what is wrong with
+ * it, or NULL. */
+const char *checkInstruction(const Chunk *chunk, int offset);
+
+/* Checks that the locals read, written or captured by an instruction which
+ * passed checkInstruction are among the depth values of its frame. A closure
+ * may also capture the slot it is pushed into. */
+bool localsInRange(const uint8_t *code, int depth);
+
+#endif
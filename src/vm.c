@@ -1,3 +1,4 @@
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -11,23 +12,127 @@
 #include "memory.h"
 #include "object.h"
 #include "value.h"
+#include "verifier.h"
 #include "vm.h"
 
-void resetStack(VM *vm) { vm->stackTop = vm->stack; }
+// Moves the values of the open upvalues for the slots from last up off the
+// stack, into the upvalues.
+static void closeUpvalues(VM *vm, Value *last) {
+  while (vm->openUpvalues != NULL && vm->openUpvalues->location >= last) {
+    ObjUpvalue *upvalue = vm->openUpvalues;
+    upvalue->closed = *upvalue->location;
+    upvalue->location = &upvalue->closed;
+    objectWriteBarrier(&vm->gc, (Obj *)upvalue, upvalue->closed);
+    vm->openUpvalues = upvalue->nextOpen;
+    upvalue->nextOpen = NULL;
+  }
+}
+
+// Closures kept after an error keep the values they captured.
+void resetStack(VM *vm) {
+  closeUpvalues(vm, vm->stack);
+  vm->stackTop = vm->stack;
+  vm->slots = vm->stack;
+  vm->frameCount = 0;
+}
+
+// Functions being called are held by the stack, just below their frames'
+// slots, and hold their constants. The script's own constants are held by the
+// heap that compiled it, see gcAddChunk.
+static void visitVMRoots(GC *gc, void *context) {
+  VM *vm = context;
+
+  for (Value *slot = vm->stack; slot < vm->stackTop; slot++)
+    gcVisitValue(gc, slot);
+
+  // The list of open upvalues is updated as they move.
+  for (ObjUpvalue **upvalue = &vm->openUpvalues; *upvalue != NULL;
+       upvalue = &(*upvalue)->nextOpen) {
+    Value value = OBJ_VAL(*upvalue);
+    gcVisitValue(gc, &value);
+    *upvalue = (ObjUpvalue *)AS_OBJ(value);
+  }
+
+  // The script's constants as imported from another VM, see interpretChunk.
+  Value *constants = vm->frames[0].constants;
+  if (vm->chunk != NULL && constants != vm->chunk->constants.values) {
+    for (int i = 0; i < vm->chunk->constants.count; i++)
+      gcVisitValue(gc, &constants[i]);
+  }
+
+  gcVisitTable(gc, &vm->globals);
+}
 
 void initVM(VM *vm) {
-  resetStack(vm);
+  vm->chunk = NULL;
+  vm->constants = NULL;
   initGC(&vm->gc);
+  vm->stack = ALLOCATE(&vm->gc, MEM_STACK, Value, STACK_MIN);
+  vm->stackEnd = vm->stack + STACK_MIN;
+  vm->openUpvalues = NULL;
+  resetStack(vm);
   initTable(&vm->strings);
   initTable(&vm->globals);
+  initOutput(&vm->output, stdout);
+
+  vm->gc.visitRoots = visitVMRoots;
+  vm->gc.rootContext = vm;
+  vm->gc.strings = &vm->strings;
 }
 
 void freeVM(VM *vm) {
-  freeTable(&vm->globals);
-  freeTable(&vm->strings);
+  flushOutput(&vm->output);
+  freeTable(&vm->gc, &vm->globals);
+  freeTable(&vm->gc, &vm->strings);
+  FREE_ARRAY(&vm->gc, MEM_STACK, Value, vm->stack, vm->stackEnd - vm->stack);
   freeGC(&vm->gc);
 }
 
+MemoryStats vmMemoryStats(VM *vm) { return vm->gc.stats; }
+
+static inline bool hasStackRoom(VM *vm, Value *base, int depth) {
+  return depth <= vm->stackEnd - base;
+}
+
+/* Grows the stack, if need be, to have room for depth values from base, which
+ * points into it. Returns false if the heap has no room for it. Pointers into
+ * the stack are moved along with it, but base is not. */
+static bool reserveStack(VM *vm, Value *base, int depth) {
+  if (hasStackRoom(vm, base, depth))
+    return true;
+
+  size_t capacity = vm->stackEnd - vm->stack;
+  size_t needed = base - vm->stack + depth, grown = capacity;
+  while (grown < needed)
+    grown *= 2;
+  if (!gcReserve(&vm->gc, (grown - capacity) * sizeof(Value)))
+    return false;
+
+  ptrdiff_t top = vm->stackTop - vm->stack, slots = vm->slots - vm->stack;
+  ptrdiff_t frameSlots[FRAMES_MAX];
+  for (int i = 0; i < vm->frameCount; i++)
+    frameSlots[i] = vm->frames[i].slots - vm->stack;
+  // An open upvalue's closed value is unused, so holds the index of its slot
+  // meanwhile.
+  for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL;
+       upvalue = upvalue->nextOpen)
+    upvalue->closed = NUMBER_VAL(upvalue->location - vm->stack);
+
+  vm->stack =
+      GROW_ARRAY(&vm->gc, MEM_STACK, Value, vm->stack, capacity, grown);
+  vm->stackEnd = vm->stack + grown;
+  vm->stackTop = vm->stack + top;
+  vm->slots = vm->stack + slots;
+  for (int i = 0; i < vm->frameCount; i++)
+    vm->frames[i].slots = vm->stack + frameSlots[i];
+  for (ObjUpvalue *upvalue = vm->openUpvalues; upvalue != NULL;
+       upvalue = upvalue->nextOpen) {
+    upvalue->location = vm->stack + (ptrdiff_t)AS_NUMBER(upvalue->closed);
+    upvalue->closed = NIL_VAL;
+  }
+  return true;
+}
+
 void push(VM *vm, Value value) {
   *vm->stackTop = value;
   vm->stackTop++;
@@ -38,16 +143,54 @@ Value pop(VM *vm) {
   return *vm->stackTop;
 }
 
+void defineNative(VM *vm, const char *name, NativeFn function, int arity) {
+  // Kept as long as the VM, so made old, along with the name it points to.
+  bool pretenure = vm->gc.pretenure;
+  vm->gc.pretenure = true;
+  ObjString *string = copyString(&vm->gc, &vm->strings, name, strlen(name));
+  Value native = OBJ_VAL(newNative(&vm->gc, string, function, arity));
+  vm->gc.pretenure = pretenure;
+
+  tableSet(&vm->gc, &vm->globals, string, native);
+  tableWriteBarrier(&vm->gc, &vm->globals, string, native);
+}
+
+// The function called by a function or closure.
+static inline ObjFunction *calleeFunction(Value callee) {
+  return IS_CLOSURE(callee) ? AS_CLOSURE(callee)->function
+                            : AS_FUNCTION(callee);
+}
+
+// The function of a frame other than the script's. Looked up rather than kept
+// in the frame, as compacting moves it.
+static inline ObjFunction *frameFunction(const CallFrame *frame) {
+  return calleeFunction(frame->slots[-1]);
+}
+
+static inline const Chunk *frameChunk(VM *vm, const CallFrame *frame) {
+  return frame == vm->frames ? vm->chunk : &frameFunction(frame)->chunk;
+}
+
 static void runtimeError(VM *vm, const char *format, ...) {
+  flushOutput(&vm->output); // Keep the program's output before the error.
+
   va_list args;
   va_start(args, format);
   vfprintf(stderr, format, args);
   va_end(args);
   fputs("\n", stderr);
 
-  size_t instructionLineIndex = vm->ip - vm->chunk->code - 1;
-  int line = vm->chunk->lines[instructionLineIndex];
-  fprintf(stderr, "[line %d] in script\n", line);
+  vm->frames[vm->frameCount - 1].ip = vm->ip;
+  for (int i = vm->frameCount - 1; i >= 0; i--) {
+    CallFrame *frame = &vm->frames[i];
+    const Chunk *chunk = frameChunk(vm, frame);
+    size_t instructionLineIndex = frame->ip - chunk->code - 1;
+    fprintf(stderr, "[line %d] in ", chunk->lines[instructionLineIndex]);
+    if (i == 0)
+      fprintf(stderr, "script\n");
+    else
+      fprintf(stderr, "%s()\n", frameFunction(frame)->name->chars);
+  }
   resetStack(vm);
 }
 
@@ -60,16 +203,24 @@ static bool isFalsy(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate(VM *vm) {
-  ObjString *b = AS_STRING(pop(vm)), *a = AS_STRING(pop(vm));
+// Returns false if the heap has no room for the result.
+static bool concatenate(VM *vm) {
+  // Collecting may move the operands, so they are left on the stack until
+  // there is room.
+  int n = AS_STRING(peek(vm))->length + AS_STRING(peekn(vm, 1))->length;
+  if (!gcReserve(&vm->gc,
+                 sizeof(ObjString) + n + 1 + tableGrowth(&vm->strings)))
+    return false;
 
-  int n = a->length + b->length;
-  char *buffer = ALLOCATE(char, n + 1);
+  ObjString *b = AS_STRING(pop(vm)), *a = AS_STRING(pop(vm));
+  char *buffer = allocateChars(&vm->gc, n);
   memcpy(buffer, a->chars, a->length);
   memcpy(buffer + a->length, b->chars, b->length);
   buffer[n] = '\0';
 
   push(vm, OBJ_VAL(takeString(&vm->gc, &vm->strings, buffer, n)));
+  gcSafepoint(&vm->gc);
+  return true;
 }
 
 #ifdef DEBUG_TRACE_EXECUTION
@@ -91,13 +242,167 @@ static void printStack(VM *vm) {
 static inline uint8_t readByte(VM *vm) { return *vm->ip++; }
 
 static inline Value readConstant(VM *vm) {
-  return vm->chunk->constants.values[readByte(vm)];
+  return vm->constants[readByte(vm)];
 }
 
 static inline ObjString *readString(VM *vm) {
   return AS_STRING(readConstant(vm));
 }
 
+static inline uint16_t readShort(VM *vm) {
+  vm->ip += 2;
+  return (uint16_t)((vm->ip[-2] << 8) | vm->ip[-1]);
+}
+
+// Returns the offset of the case of an OP_JUMP_HASH equal to the subject, or
+// the default's offset if there is none.
+static uint16_t findCase(VM *vm, const uint8_t *entries, int capacity,
+                         Value subject, uint16_t defaultOffset) {
+  if (capacity <= SWITCH_SCAN_MAX) {
+    for (const uint8_t *entry = entries; entry < entries + capacity * 4;
+         entry += 4) {
+      int key = (entry[0] << 8) | entry[1];
+      if (valuesEqual(vm->constants[key - 1], subject))
+        return (uint16_t)((entry[2] << 8) | entry[3]);
+    }
+    return defaultOffset;
+  }
+
+  // The table is at most half full, so there is always an empty entry.
+  for (uint32_t index = hashValue(subject) & (capacity - 1);;
+       index = (index + 1) & (capacity - 1)) {
+    const uint8_t *entry = &entries[index * 4];
+    int key = (entry[0] << 8) | entry[1];
+    if (key == 0)
+      return defaultOffset;
+    if (valuesEqual(vm->constants[key - 1], subject))
+      return (uint16_t)((entry[2] << 8) | entry[3]);
+  }
+}
+
+// Pushes a frame for the function, whose arguments are on top of the stack.
+static bool call(VM *vm, ObjFunction *function, int argCount) {
+  if (argCount != function->arity) {
+    runtimeError(vm, "Expected %d arguments but got %d.", function->arity,
+                 argCount);
+    return false;
+  }
+  if (vm->frameCount == FRAMES_MAX) {
+    runtimeError(vm, "Stack overflow.");
+    return false;
+  }
+  // The only check of the stack's room, for everything the function pushes.
+  Value *base = vm->stackTop - argCount;
+  if (!hasStackRoom(vm, base, function->chunk.maxStackDepth)) {
+    if (!reserveStack(vm, base, function->chunk.maxStackDepth)) {
+      runtimeError(vm, "Out of memory.");
+      return false;
+    }
+    function = calleeFunction(peekn(vm, argCount)); // Collecting may move it.
+  }
+
+  vm->frames[vm->frameCount - 1].ip = vm->ip;
+  CallFrame *frame = &vm->frames[vm->frameCount++];
+  frame->constants = function->constants;
+  frame->slots = vm->stackTop - argCount;
+  vm->ip = function->chunk.code;
+  vm->constants = frame->constants;
+  vm->slots = frame->slots;
+  return true;
+}
+
+// Calls a native on its arguments where they are on the stack, without a
+// frame, replacing them and the native with its result.
+static inline bool callNative(VM *vm, ObjNative *native, int argCount) {
+  if (argCount != native->arity) {
+    runtimeError(vm, "Expected %d arguments but got %d.", native->arity,
+                 argCount);
+    return false;
+  }
+  Value result = native->function(argCount, vm->stackTop - argCount);
+  vm->stackTop -= argCount;
+  vm->stackTop[-1] = result;
+  return true;
+}
+
+static bool callValue(VM *vm, Value callee, int argCount) {
+  if (IS_FUNCTION(callee))
+    return call(vm, AS_FUNCTION(callee), argCount);
+  if (IS_CLOSURE(callee))
+    return call(vm, AS_CLOSURE(callee)->function, argCount);
+
+  runtimeError(vm, "Can only call functions.");
+  return false;
+}
+
+/* Calls a function or closure from the tail of the innermost frame, other
+ * than the script's, in that frame: the callee and its arguments are moved
+ * down over the frame's slots, after closing the upvalues of its locals as
+ * returning would. Recursing in tail calls so takes no more frames or stack. */
+static bool tailCall(VM *vm, Value callee, int argCount) {
+  if (!IS_FUNCTION(callee) && !IS_CLOSURE(callee)) {
+    runtimeError(vm, "Can only call functions.");
+    return false;
+  }
+  ObjFunction *function = calleeFunction(callee);
+  if (argCount != function->arity) {
+    runtimeError(vm, "Expected %d arguments but got %d.", function->arity,
+                 argCount);
+    return false;
+  }
+  // Checked before the frame is replaced, so an error is reported in it.
+  int depth = function->chunk.maxStackDepth;
+  if (!hasStackRoom(vm, vm->slots, depth)) {
+    if (!reserveStack(vm, vm->slots, depth)) {
+      runtimeError(vm, "Out of memory.");
+      return false;
+    }
+    function = calleeFunction(peekn(vm, argCount)); // Collecting may move it.
+  }
+
+  closeUpvalues(vm, vm->slots);
+  memmove(vm->slots - 1, vm->stackTop - argCount - 1,
+          sizeof(Value) * (argCount + 1));
+  vm->stackTop = vm->slots + argCount;
+  CallFrame *frame = &vm->frames[vm->frameCount - 1];
+  frame->constants = function->constants;
+  vm->ip = function->chunk.code;
+  vm->constants = frame->constants;
+  return true;
+}
+
+// Returns the open upvalue for the slot, made if there is none yet, so every
+// closure capturing a variable shares its upvalue.
+static ObjUpvalue *captureUpvalue(VM *vm, Value *slot) {
+  ObjUpvalue **link = &vm->openUpvalues;
+  while (*link != NULL && (*link)->location > slot)
+    link = &(*link)->nextOpen;
+  if (*link != NULL && (*link)->location == slot)
+    return *link;
+
+  ObjUpvalue *upvalue = newUpvalue(&vm->gc, slot);
+  upvalue->nextOpen = *link;
+  *link = upvalue;
+  return upvalue;
+}
+
+// Pushes a closure of the function of the OP_CLOSURE at ip, capturing what
+// its operands list. The heap must have room for it and its upvalues.
+static void pushClosure(VM *vm) {
+  ObjFunction *function = AS_FUNCTION(readConstant(vm));
+  int count = readByte(vm);
+  ObjClosure *closure = newClosure(&vm->gc, function);
+  for (int i = 0; i < count; i++) {
+    uint8_t isLocal = readByte(vm), index = readByte(vm);
+    ObjUpvalue *upvalue =
+        isLocal ? captureUpvalue(vm, &vm->slots[index])
+                : AS_CLOSURE(vm->slots[-1])->upvalues[index];
+    closure->upvalues[i] = upvalue;
+    objectWriteBarrier(&vm->gc, (Obj *)closure, OBJ_VAL(upvalue));
+  }
+  push(vm, OBJ_VAL(closure));
+}
+
 static bool binaryOperandsAreNumbers(VM *vm) {
   if (IS_NUMBER(peek(vm)) && IS_NUMBER(peekn(vm, 1)))
     return true;
@@ -106,7 +411,55 @@ static bool binaryOperandsAreNumbers(VM *vm) {
   return false;
 }
 
-static InterpretResult run(VM *vm) {
+// Returns what is wrong with the stack for the instruction at ip, which passed
+// checkInstruction, to run, if anything.
+static const char *checkStack(VM *vm) {
+  const uint8_t *code = vm->ip;
+  const OpInfo *info = &opInfo[code[0]];
+  int pops = info->pops;
+  if (code[0] == OP_CALL || code[0] == OP_TAIL_CALL)
+    pops += code[1];
+  else if (code[0] == OP_RETURN && vm->frameCount == 1)
+    pops = 0;
+
+  int depth = (int)(vm->stackTop - vm->slots);
+  if (depth < pops)
+    return "Stack underflow.";
+  if (!localsInRange(code, depth))
+    return "Local out of range.";
+  if (vm->stackEnd - vm->stackTop < info->pushes - pops)
+    return "Stack deeper than its maxStackDepth.";
+  return NULL;
+}
+
+// Checks the next instruction of code that was not verified, before running
+// it. Reports an error at the instruction if it may not run.
+static bool checkNextInstruction(VM *vm) {
+  const Chunk *chunk = frameChunk(vm, &vm->frames[vm->frameCount - 1]);
+  int offset = (int)(vm->ip - chunk->code);
+  const char *message = offset < chunk->count
+                            ? checkInstruction(chunk, offset)
+                            : "Code runs past the end.";
+  if (message == NULL)
+    message = checkStack(vm);
+  if (message == NULL)
+    return true;
+
+  vm->ip = &chunk->code[offset < chunk->count ? offset + 1 : offset];
+  runtimeError(vm, "Invalid bytecode. %s", message);
+  return false;
+}
+
+// Returned by unchecked running once it calls code that was not verified, to
+// carry on checked.
+#define INTERPRET_UNVERIFIED ((InterpretResult)(INTERPRET_RUNTIME_ERROR + 1))
+
+/* Runs the innermost frame's code, and that of the frames it pushes, until the
+ * script returns. Inlined twice: checked, to run code that was not verified,
+ * and unchecked for verified code, which goes without checking its operands
+ * and the stack. */
+static inline __attribute__((always_inline)) InterpretResult
+runWith(VM *vm, bool checked) {
 #define BINARY_OP(valueType, op)                                               \
   do {                                                                         \
     if (!binaryOperandsAreNumbers(vm))                                         \
@@ -115,11 +468,30 @@ static InterpretResult run(VM *vm) {
     double b = AS_NUMBER(pop(vm)), a = AS_NUMBER(pop(vm));                     \
     push(vm, valueType(a op b));                                               \
   } while (false)
+#define JUMP_UNLESS(condition)                                                 \
+  do {                                                                         \
+    uint16_t offset = readShort(vm);                                           \
+    if (!(condition))                                                          \
+      vm->ip += offset;                                                        \
+  } while (false)
+// Checks the operands before reading the offset, so errors report the line of
+// the jump.
+#define COMPARE_JUMP(op)                                                       \
+  do {                                                                         \
+    if (!binaryOperandsAreNumbers(vm))                                         \
+      return INTERPRET_RUNTIME_ERROR;                                          \
+                                                                               \
+    double b = AS_NUMBER(pop(vm)), a = AS_NUMBER(pop(vm));                     \
+    JUMP_UNLESS(a op b);                                                       \
+  } while (false)
 
   while (true) {
+    if (checked && !checkNextInstruction(vm))
+      return INTERPRET_RUNTIME_ERROR;
 #ifdef DEBUG_TRACE_EXECUTION
+    const Chunk *chunk = frameChunk(vm, &vm->frames[vm->frameCount - 1]);
     printStack(vm);
-    disassembleInstruction(vm->chunk, vm->ip - vm->chunk->code);
+    disassembleInstruction(chunk, vm->ip - chunk->code);
 #endif
 
     uint8_t instruction;
@@ -145,19 +517,24 @@ static InterpretResult run(VM *vm) {
       // Loads value and push onto top of stack which later instructions require
       // this top stack value to be set which the instructions can use.
       uint8_t slot = readByte(vm);
-      push(vm, vm->stack[slot]);
+      push(vm, vm->slots[slot]);
       break;
     }
     case OP_SET_LOCAL: {
       // Set value at the slack slot for the corresponding local variable.
       // Leave value on stack top as assignment is expression itself.
       uint8_t slot = readByte(vm);
-      vm->stack[slot] = peek(vm);
+      vm->slots[slot] = peek(vm);
       break;
     }
     case OP_DEFINE_GLOBAL: {
-      ObjString *name = readString(vm);
-      tableSet(&vm->globals, name, peek(vm));
+      if (!gcReserve(&vm->gc, tableGrowth(&vm->globals))) {
+        runtimeError(vm, "Out of memory.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      ObjString *name = readString(vm); // Collecting may move it.
+      tableSet(&vm->gc, &vm->globals, name, peek(vm));
+      tableWriteBarrier(&vm->gc, &vm->globals, name, peek(vm));
       pop(vm);
       break;
     }
@@ -172,20 +549,27 @@ static InterpretResult run(VM *vm) {
       return INTERPRET_RUNTIME_ERROR;
     }
     case OP_SET_GLOBAL: {
+      if (!gcReserve(&vm->gc, tableGrowth(&vm->globals))) {
+        runtimeError(vm, "Out of memory.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
       ObjString *name = readString(vm);
-      if (tableSet(&vm->globals, name, peek(vm))) {
+      if (tableSet(&vm->gc, &vm->globals, name, peek(vm))) {
         // A new key is inserted if not already existing. Remove it in this
         // invalid case where we are assigning to an undefined variable.
         tableDelete(&vm->globals, name);
         runtimeError(vm, "Undefined variable '%s'.", name->chars);
         return INTERPRET_RUNTIME_ERROR;
       }
+      tableWriteBarrier(&vm->gc, &vm->globals, name, peek(vm));
       break;
     }
     case OP_ADD:
       if (IS_STRING(peek(vm)) && IS_STRING(peekn(vm, 1))) {
-        concatenate(vm);
-        break;
+        if (concatenate(vm))
+          break;
+        runtimeError(vm, "Out of memory.");
+        return INTERPRET_RUNTIME_ERROR;
       }
       if (IS_NUMBER(peek(vm)) && IS_NUMBER(peekn(vm, 1))) {
         double b = AS_NUMBER(pop(vm)), a = AS_NUMBER(pop(vm));
@@ -243,33 +627,347 @@ static InterpretResult run(VM *vm) {
       runtimeError(vm, "Operand to negation must be a number.");
       return INTERPRET_RUNTIME_ERROR;
     case OP_PRINT:
-      printValue(pop(vm));
-      printf("\n");
+      writeValue(&vm->output, pop(vm));
+      writeOutput(&vm->output, "\n", 1);
+#ifdef DEBUG_TRACE_EXECUTION
+      flushOutput(&vm->output); // Keep in order with the trace.
+#endif
+      break;
+    case OP_JUMP: {
+      uint16_t offset = readShort(vm);
+      vm->ip += offset;
+      break;
+    }
+    case OP_JUMP_IF_FALSE:
+      JUMP_UNLESS(!isFalsy(peek(vm)));
+      break;
+    case OP_JUMP_IF_TRUE:
+      JUMP_UNLESS(isFalsy(peek(vm)));
+      break;
+    case OP_JUMP_IF_FALSE_POP:
+      JUMP_UNLESS(!isFalsy(pop(vm)));
+      break;
+    case OP_JUMP_IF_NOT_LT:
+      COMPARE_JUMP(<);
+      break;
+    case OP_JUMP_IF_NOT_LTE:
+      COMPARE_JUMP(<=);
+      break;
+    case OP_JUMP_IF_NOT_EQ: {
+      Value b = pop(vm), a = pop(vm);
+      JUMP_UNLESS(valuesEqual(a, b));
+      break;
+    }
+    case OP_JUMP_IF_NOT_NEQ: {
+      Value b = pop(vm), a = pop(vm);
+      JUMP_UNLESS(!valuesEqual(a, b));
+      break;
+    }
+    case OP_JUMP_IF_NOT_GT:
+      COMPARE_JUMP(>);
+      break;
+    case OP_JUMP_IF_NOT_GTE:
+      COMPARE_JUMP(>=);
+      break;
+    case OP_LOOP: {
+      uint16_t offset = readShort(vm);
+      vm->ip -= offset;
+      break;
+    }
+    case OP_FOR_RANGE: {
+      Value *slot = &vm->slots[readByte(vm)];
+      Value *boundSlot = &vm->slots[readByte(vm)];
+      uint8_t comparison = readByte(vm);
+      double step = AS_NUMBER(readConstant(vm));
+      uint16_t offset = readShort(vm);
+      // The bound may be assigned anything meanwhile, even by a closure.
+      if (!IS_NUMBER(*slot) || !IS_NUMBER(*boundSlot)) {
+        runtimeError(vm, "Operands must be numbers.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+
+      double next = AS_NUMBER(*slot) + step, bound = AS_NUMBER(*boundSlot);
+      *slot = NUMBER_VAL(next);
+      bool more;
+      switch (comparison) {
+      case OP_LT:
+        more = next < bound;
+        break;
+      case OP_LTE:
+        more = next <= bound;
+        break;
+      case OP_GT:
+        more = next > bound;
+        break;
+      default:
+        more = next >= bound;
+        break;
+      }
+      if (more)
+        vm->ip -= offset;
+      break;
+    }
+    case OP_JUMP_TABLE: {
+      Value subject = pop(vm);
+      double lowest = AS_NUMBER(readConstant(vm));
+      uint16_t count = readShort(vm), offset = readShort(vm);
+      const uint8_t *offsets = vm->ip;
+      vm->ip += count * 2;
+      if (IS_NUMBER(subject)) {
+        // Fails for NaN, and for numbers with a fraction once truncated.
+        double index = AS_NUMBER(subject) - lowest;
+        if (index >= 0 && index < count && index == (int)index)
+          offset = (uint16_t)((offsets[(int)index * 2] << 8) |
+                              offsets[(int)index * 2 + 1]);
+      }
+      vm->ip += offset;
+      break;
+    }
+    case OP_JUMP_HASH: {
+      Value subject = pop(vm);
+      uint16_t capacity = readShort(vm), offset = readShort(vm);
+      const uint8_t *entries = vm->ip;
+      vm->ip += capacity * 4;
+      vm->ip += findCase(vm, entries, capacity, subject, offset);
+      break;
+    }
+    case OP_GET_UPVALUE: {
+      ObjUpvalue *upvalue = AS_CLOSURE(vm->slots[-1])->upvalues[readByte(vm)];
+      push(vm, *upvalue->location);
+      break;
+    }
+    case OP_SET_UPVALUE: {
+      ObjUpvalue *upvalue = AS_CLOSURE(vm->slots[-1])->upvalues[readByte(vm)];
+      *upvalue->location = peek(vm);
+      objectWriteBarrier(&vm->gc, (Obj *)upvalue, peek(vm));
+      break;
+    }
+    case OP_CLOSURE: {
+      // At most, a closure and an upvalue for each capture.
+      size_t size = sizeof(ObjClosure) +
+                    vm->ip[1] * (sizeof(ObjUpvalue *) + sizeof(ObjUpvalue));
+      if (!gcReserve(&vm->gc, size)) {
+        runtimeError(vm, "Out of memory.");
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      pushClosure(vm);
+      gcSafepoint(&vm->gc);
+      break;
+    }
+    case OP_CLOSE_UPVALUE:
+      closeUpvalues(vm, vm->stackTop - 1);
+      pop(vm);
+      break;
+    case OP_CALL: {
+      int argCount = readByte(vm);
+      Value callee = peekn(vm, argCount);
+      if (IS_NATIVE(callee)) {
+        if (!callNative(vm, AS_NATIVE(callee), argCount))
+          return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      if (!callValue(vm, callee, argCount))
+        return INTERPRET_RUNTIME_ERROR;
+      if (!checked &&
+          !frameChunk(vm, &vm->frames[vm->frameCount - 1])->verified)
+        return INTERPRET_UNVERIFIED;
+      break;
+    }
+    case OP_TAIL_CALL: {
+      int argCount = readByte(vm);
+      Value callee = peekn(vm, argCount);
+      // A native's result, and that of a call from the script, whose frame
+      // is kept, are returned by the OP_RETURN following.
+      if (IS_NATIVE(callee)) {
+        if (!callNative(vm, AS_NATIVE(callee), argCount))
+          return INTERPRET_RUNTIME_ERROR;
+        break;
+      }
+      if (vm->frameCount == 1 ? !callValue(vm, callee, argCount)
+                              : !tailCall(vm, callee, argCount))
+        return INTERPRET_RUNTIME_ERROR;
+      if (!checked &&
+          !frameChunk(vm, &vm->frames[vm->frameCount - 1])->verified)
+        return INTERPRET_UNVERIFIED;
       break;
+    }
     case OP_RETURN: {
-      return INTERPRET_OK;
+      // The script's frame is left for the next chunk run.
+      if (vm->frameCount == 1)
+        return INTERPRET_OK;
+
+      Value result = pop(vm);
+      closeUpvalues(vm, vm->slots);
+      vm->stackTop = vm->slots - 1;
+      push(vm, result);
+      CallFrame *frame = &vm->frames[--vm->frameCount - 1];
+      vm->ip = frame->ip;
+      vm->constants = frame->constants;
+      vm->slots = frame->slots;
+      break;
     }
+    default:
+      // Checked running stops at an unknown opcode, and verified code has
+      // none, so the switch need not check its range.
+      __builtin_unreachable();
     }
   }
 
 #undef BINARY_OP
+#undef JUMP_UNLESS
+#undef COMPARE_JUMP
+}
+
+static InterpretResult run(VM *vm) { return runWith(vm, false); }
+
+static InterpretResult runChecked(VM *vm) { return runWith(vm, true); }
+
+static Value importConstant(VM *vm, Value constant);
+
+// Returns the function itself if this VM compiled it, or else a copy sharing
+// its chunk, see ObjFunction.
+static ObjFunction *importFunction(VM *vm, ObjFunction *function) {
+  ObjString *name = copyString(&vm->gc, &vm->strings, function->name->chars,
+                               function->name->length);
+  if (name == function->name)
+    return function;
+
+  ObjFunction *copy = newFunction(&vm->gc);
+  copy->arity = function->arity;
+  copy->name = name;
+  // Until its constants are its own, the copy would free the chunk with
+  // itself, so only shares it once they are allocated.
+  int count = function->chunk.constants.count;
+  copy->constants =
+      count > 0 ? ALLOCATE(&vm->gc, MEM_CONSTANTS, Value, count) : NULL;
+  copy->chunk = function->chunk;
+  for (int i = 0; i < count; i++)
+    copy->constants[i] = importConstant(vm, function->constants[i]);
+  return copy;
+}
+
+static Value importConstant(VM *vm, Value constant) {
+  if (IS_STRING(constant)) {
+    ObjString *string = AS_STRING(constant);
+    return OBJ_VAL(
+        copyString(&vm->gc, &vm->strings, string->chars, string->length));
+  }
+  if (IS_FUNCTION(constant))
+    return OBJ_VAL(importFunction(vm, AS_FUNCTION(constant)));
+  return constant;
+}
+
+// Fails what unwound to a handler of gcOutOfMemory, letting go of everything
+// the program held before collecting it all, so the VM can run more code.
+static InterpretResult outOfMemory(VM *vm) {
+  vm->gc.pretenure = false;
+  if (vm->frameCount > 0) {
+    runtimeError(vm, "Out of memory.");
+  } else {
+    flushOutput(&vm->output);
+    fprintf(stderr, "Out of memory.\n");
+    resetStack(vm);
+  }
+  vm->chunk = NULL;
+  collectAllGarbage(&vm->gc);
+  return INTERPRET_RUNTIME_ERROR;
+}
+
+// Runs the script once its constants are imported, into an array of the VM's
+// own if need be, which the caller frees.
+static InterpretResult importAndRun(VM *vm, const Chunk *chunk,
+                                    Value *volatile *constants) {
+  // String constants from another VM's heap are swapped for this VM's own
+  // interned strings, so identity comparisons and global lookups hold, and
+  // functions for copies of them. The chunk's own array is used when every
+  // constant is already this VM's. Like the constants of a chunk compiled
+  // here, the copies are long lived.
+  int count = chunk->constants.count;
+  vm->gc.pretenure = true;
+  for (int i = 0; i < count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (!IS_OBJ(constant))
+      continue;
+
+    Value imported = importConstant(vm, constant);
+    if (AS_OBJ(imported) == AS_OBJ(constant))
+      continue;
+
+    if (*constants == NULL) {
+      *constants = ALLOCATE(&vm->gc, MEM_CONSTANTS, Value, count);
+      memcpy(*constants, chunk->constants.values, sizeof(Value) * count);
+    }
+    (*constants)[i] = imported;
+  }
+  vm->gc.pretenure = false;
+
+  vm->chunk = chunk;
+  vm->ip = chunk->code;
+  vm->constants = *constants != NULL ? *constants : chunk->constants.values;
+  vm->frameCount = 1;
+  vm->frames[0].constants = vm->constants;
+  vm->frames[0].slots = vm->slots;
+
+  InterpretResult result = chunk->verified ? run(vm) : INTERPRET_UNVERIFIED;
+  if (result == INTERPRET_UNVERIFIED)
+    result = runChecked(vm);
+  vm->chunk = NULL;
+  return result;
+}
+
+InterpretResult interpretChunk(VM *vm, const Chunk *chunk) {
+  resetStack(vm);
+  // Only functions are run as closures.
+  if (chunk->upvalueCount > 0) {
+    fprintf(stderr, "Invalid bytecode. Script with upvalues.\n");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+  if (!reserveStack(vm, vm->stack, chunk->maxStackDepth)) {
+    fprintf(stderr, "Out of memory.\n");
+    return INTERPRET_RUNTIME_ERROR;
+  }
+
+  Value *volatile constants = NULL;
+  InterpretResult result;
+  jmp_buf handler, *outer = vm->gc.outOfMemory;
+  vm->gc.outOfMemory = &handler;
+  if (setjmp(handler) == 0)
+    result = importAndRun(vm, chunk, &constants);
+  else
+    result = outOfMemory(vm);
+  vm->gc.outOfMemory = outer;
+
+  if (constants != NULL)
+    FREE_ARRAY(&vm->gc, MEM_CONSTANTS, Value, constants,
+               chunk->constants.count);
+  return result;
 }
 
 InterpretResult interpret(VM *vm, const char *source) {
   Chunk chunk;
   initChunk(&chunk);
 
-  if (!compile(source, &chunk, &vm->gc, &vm->strings)) {
-    freeChunk(&chunk);
-    return INTERPRET_COMPILE_ERROR;
+  // Literals matching strings made by earlier code must not be young.
+  collectYoungGarbage(&vm->gc);
+
+  // Compiling frees its own memory before unwinding to here.
+  jmp_buf handler, *outer = vm->gc.outOfMemory;
+  vm->gc.outOfMemory = &handler;
+  if (setjmp(handler) != 0) {
+    vm->gc.outOfMemory = outer;
+    return outOfMemory(vm);
   }
+  bool compiled = compile(source, &chunk, &vm->gc, &vm->strings);
+  vm->gc.outOfMemory = outer;
 
-  vm->chunk = &chunk;
-  vm->ip = chunk.code;
+  if (!compiled) {
+    freeChunk(&vm->gc, &chunk);
+    return INTERPRET_COMPILE_ERROR;
+  }
 
-  InterpretResult result = run(vm);
+  InterpretResult result = interpretChunk(vm, &chunk);
 
-  freeChunk(vm->chunk);
+  freeChunk(&vm->gc, &chunk);
 
   return result;
 }
@@ -5,31 +5,68 @@
 
 #include "chunk.h"
 #include "gc.h"
+#include "memory.h"
+#include "object.h"
+#include "output.h"
 #include "table.h"
 #include "value.h"
 
-#define STACK_MAX 256
+#define FRAMES_MAX 64
+// Values the stack has room for at first, before growing.
+#define STACK_MIN 256
+
+/*
+ * A call in progress. The frames are contiguous in the VM, as are their
+ * slots on the stack, where the function or closure called is just below the
+ * first.
+ */
+typedef struct CallFrame {
+  const uint8_t *ip; // Where the caller resumes, once this frame calls.
+  Value *constants;  // The function's, as interned by this VM.
+  Value *slots;      // The arguments, then the other locals.
+} CallFrame;
 
 /*
  * The almighty stack-based Virtual Machine that executes the instructions.
- * It has a fixed stack size of STACK_MAX (256).
+ * It has a fixed number of frames, and a stack that grows as calls need. The
+ * stack is only checked for room as each frame is entered, for as many values
+ * as its chunk's maxStackDepth, so pushing needs no check.
  */
 typedef struct VM {
-  uint8_t *ip;  // Pointer to the next instruction to be executed.
-  Chunk *chunk; // Containing the instructions to execute.
-  Value stack[STACK_MAX];
+  // The innermost frame's state, kept here rather than in its CallFrame as
+  // every instruction reads it.
+  const uint8_t *ip; // Pointer to the next instruction to be executed.
+  Value *constants;
+  Value *slots;
+
+  const Chunk *chunk; // The script, while running. Its frame is the first.
+  CallFrame frames[FRAMES_MAX];
+  int frameCount;
+  Value *stack;    // Moves as it grows, along with every pointer into it.
   Value *stackTop; // Points to the element one after the stacks top value.
+  Value *stackEnd;
+  // Upvalues still pointing at locals on the stack, from the highest slot
+  // down. Only these need closing when a frame returns.
+  ObjUpvalue *openUpvalues;
   GC gc;           // Auto-reclaim memory during program execution.
   Table strings;   // The string interning pool.
   Table globals;   // Global variables.
+  Output output;   // Buffered output of print statements, see flushOutput.
 } VM;
 
 void initVM(VM *vm);
 void freeVM(VM *vm);
 
+/* Returns the memory currently held by the VM, broken down by its use. */
+MemoryStats vmMemoryStats(VM *vm);
+
 void push(VM *vm, Value value);
 Value pop(VM *vm);
 
+/* Defines a global of the given name holding a native function, which scripts
+ * call with arity arguments. Calls to it push no frame and allocate nothing. */
+void defineNative(VM *vm, const char *name, NativeFn function, int arity);
+
 typedef enum InterpretResult {
   INTERPRET_OK,
   INTERPRET_COMPILE_ERROR,
@@ -38,4 +75,12 @@ typedef enum InterpretResult {
 
 InterpretResult interpret(VM *vm, const char *source);
 
+/* Runs a finalized chunk, which may have been compiled by another VM. The
+ * chunk is only read, so several VMs can run it at once, but whatever compiled
+ * it must not free it, nor the heap it was compiled with, for as long as this
+ * VM runs it or may still call its functions, which run as copies sharing
+ * their chunks. Code that was not verified, see verifyChunk, runs checking
+ * each instruction before running it. */
+InterpretResult interpretChunk(VM *vm, const Chunk *chunk);
+
 #endif
@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "gc.h"
+#include "utest.h"
+
+UTEST(Arena, allocationsAreAlignedAndDistinct) {
+  Arena arena;
+  initArena(&arena, NULL);
+
+  char *a = arenaAllocate(&arena, 3);
+  char *b = arenaAllocate(&arena, 1);
+  EXPECT_EQ((uintptr_t)a % 16, (uintptr_t)0);
+  EXPECT_EQ((uintptr_t)b % 16, (uintptr_t)0);
+  EXPECT_GE(b, a + 3);
+  EXPECT_EQ(arena.blockCount, (size_t)1);
+
+  // Too large for a regular block, so it gets one of its own.
+  char *large = arenaAllocate(&arena, ARENA_BLOCK_SIZE * 2);
+  memset(large, 0, ARENA_BLOCK_SIZE * 2);
+  EXPECT_EQ(arena.blockCount, (size_t)2);
+
+  freeArena(&arena);
+  EXPECT_EQ(arena.blockCount, (size_t)0);
+}
+
+UTEST(Arena, growsLastAllocationInPlace) {
+  Arena arena;
+  initArena(&arena, NULL);
+
+  int *numbers = ARENA_ALLOCATE(&arena, int, 4);
+  for (int i = 0; i < 4; i++)
+    numbers[i] = i;
+
+  int *grown = ARENA_GROW_ARRAY(&arena, int, numbers, 4, 8);
+  EXPECT_EQ(grown, numbers);
+
+  // Once something else is allocated, growing has to copy.
+  arenaAllocate(&arena, 1);
+  int *copied = ARENA_GROW_ARRAY(&arena, int, grown, 8, 16);
+  EXPECT_NE(copied, grown);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(copied[i], i);
+
+  freeArena(&arena);
+}
+
+UTEST(Arena, accountsBlocksToGC) {
+  GC gc;
+  initGC(&gc);
+  Arena arena;
+  initArena(&arena, &gc);
+
+  arenaAllocate(&arena, 100);
+  EXPECT_EQ(gc.stats.bytes[MEM_COMPILER], (size_t)ARENA_BLOCK_SIZE);
+
+  freeArena(&arena);
+  EXPECT_EQ(gc.stats.bytes[MEM_COMPILER], (size_t)0);
+  freeGC(&gc);
+}
@@ -0,0 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytescan.h"
+#include "utest.h"
+
+#define FUZZ_ITERATIONS 2000
+#define FUZZ_MAX_LENGTH 200
+
+// Random bytes drawn mostly from the characters the kernels stop on or count.
+static void randomSource(char *buffer, int length) {
+  static const char alphabet[] = "  \t\r\n\n\"/abc;";
+  for (int i = 0; i < length; i++) {
+    buffer[i] = alphabet[rand() % (sizeof(alphabet) - 1)];
+  }
+  buffer[length] = '\0';
+}
+
+UTEST(ByteScan, fuzzAgainstScalar) {
+  // Extra room so every start offset within a vector is exercised.
+  char buffer[FUZZ_MAX_LENGTH + 64];
+  srand(1234);
+
+  for (int i = 0; i < FUZZ_ITERATIONS; i++) {
+    int offset = rand() % 32;
+    int length = rand() % FUZZ_MAX_LENGTH;
+    char *source = buffer + offset;
+    randomSource(source, length);
+
+    for (const char *p = source; p <= source + length; p++) {
+      int vectorLines = 0, scalarLines = 0;
+      ASSERT_EQ(skipBlanks(p, &vectorLines),
+                skipBlanksScalar(p, &scalarLines));
+      ASSERT_EQ(vectorLines, scalarLines);
+
+      ASSERT_EQ(findNewline(p), findNewlineScalar(p));
+
+      vectorLines = scalarLines = 0;
+      ASSERT_EQ(findQuote(p, &vectorLines), findQuoteScalar(p, &scalarLines));
+      ASSERT_EQ(vectorLines, scalarLines);
+    }
+  }
+}
+
+UTEST(ByteScan, longRuns) {
+  char buffer[1024];
+
+  // Whitespace spanning many vectors, with a newline in every line of 10.
+  for (int i = 0; i < 1000; i++)
+    buffer[i] = i % 10 == 9 ? '\n' : ' ';
+  buffer[1000] = 'x';
+  buffer[1001] = '\0';
+
+  int lines = 0;
+  ASSERT_EQ(skipBlanks(buffer, &lines), buffer + 1000);
+  ASSERT_EQ(lines, 100);
+
+  // A string body running to the end of the source is unterminated.
+  memset(buffer, 'a', 1000);
+  buffer[500] = '\n';
+  buffer[1000] = '\0';
+
+  lines = 0;
+  ASSERT_EQ(findQuote(buffer, &lines), buffer + 1000);
+  ASSERT_EQ(lines, 1);
+  ASSERT_EQ(findNewline(buffer), buffer + 500);
+}
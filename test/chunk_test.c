@@ -1,49 +1,93 @@
+#include <stdalign.h>
+#include <stdint.h>
+
 #include "chunk.h"
+#include "gc.h"
 #include "utest.h"
 #include "value.h"
 
 struct ChunkTestFixture {
   Chunk chunk;
+  GC gc;
 };
 
 UTEST_F_SETUP(ChunkTestFixture) {
   initChunk(&utest_fixture->chunk);
+  initGC(&utest_fixture->gc);
   ASSERT_TRUE(1);
 }
 
 UTEST_F_TEARDOWN(ChunkTestFixture) {
-  freeChunk(&utest_fixture->chunk);
+  freeChunk(&utest_fixture->gc, &utest_fixture->chunk);
+  freeGC(&utest_fixture->gc);
   ASSERT_TRUE(1);
 }
 
 UTEST_F(ChunkTestFixture, initChunk) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  ASSERT_EQ(chunk.count, 0);
-  ASSERT_EQ(chunk.capacity, 0);
-  ASSERT_EQ(chunk.code, NULL);
+  ASSERT_EQ(chunk->count, 0);
+  ASSERT_EQ(chunk->capacity, 0);
+  ASSERT_EQ(chunk->code, NULL);
 
-  ASSERT_EQ(chunk.constants.count, 0);
-  ASSERT_EQ(chunk.constants.capacity, 0);
-  ASSERT_EQ(chunk.constants.values, NULL);
+  ASSERT_EQ(chunk->constants.count, 0);
+  ASSERT_EQ(chunk->constants.capacity, 0);
+  ASSERT_EQ(chunk->constants.values, NULL);
 }
 
 UTEST_F(ChunkTestFixture, writeChunk) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  writeChunk(&chunk, 69, 1);
+  writeChunk(&utest_fixture->gc, chunk, 69, 1);
 
-  ASSERT_EQ(chunk.code[0], 69);
-  ASSERT_EQ(chunk.count, 1);
-  ASSERT_EQ(chunk.lines[0], 1);
+  ASSERT_EQ(chunk->code[0], 69);
+  ASSERT_EQ(chunk->count, 1);
+  ASSERT_EQ(chunk->lines[0], 1);
 }
 
 UTEST_F(ChunkTestFixture, addConstant) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  int constantIndex = addConstant(&chunk, NUMBER_VAL(69.0));
+  int constantIndex = addConstant(&utest_fixture->gc, chunk, NUMBER_VAL(69.0));
 
   ASSERT_EQ(constantIndex, 0);
-  ASSERT_EQ(chunk.constants.count, 1);
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[0]), 69.0);
+  ASSERT_EQ(chunk->constants.count, 1);
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[0]), 69.0);
+}
+
+UTEST_F(ChunkTestFixture, finalizeChunk) {
+  GC *gc = &utest_fixture->gc;
+  Chunk *chunk = &utest_fixture->chunk;
+  for (int i = 0; i < 13; i++)
+    writeChunk(gc, chunk, (uint8_t)i, i + 100);
+  addConstant(gc, chunk, NUMBER_VAL(6.9));
+  addConstant(gc, chunk, BOOL_VAL(true));
+  size_t before = gc->stats.bytesAllocated;
+
+  Chunk finalized;
+  initChunk(&finalized);
+  finalizeChunk(gc, &finalized, chunk);
+
+  ASSERT_TRUE(finalized.finalized);
+  ASSERT_EQ(finalized.count, 13);
+  ASSERT_EQ(finalized.capacity, 13);
+  ASSERT_EQ(finalized.constants.capacity, 2);
+  for (int i = 0; i < 13; i++) {
+    EXPECT_EQ(finalized.code[i], (uint8_t)i);
+    EXPECT_EQ(finalized.lines[i], i + 100);
+  }
+  EXPECT_EQ(AS_NUMBER(finalized.constants.values[0]), 6.9);
+  EXPECT_TRUE(AS_BOOL(finalized.constants.values[1]));
+
+  // Code, then constants, then lines, all in the one allocation.
+  char *start = (char *)finalized.code;
+  EXPECT_GE((char *)finalized.constants.values, start + 13);
+  EXPECT_EQ((uintptr_t)finalized.constants.values % alignof(Value),
+            (uintptr_t)0);
+  EXPECT_EQ((char *)finalized.lines,
+            (char *)(finalized.constants.values + 2));
+  EXPECT_GT(gc->stats.bytes[MEM_CHUNK_LINES], 13 * sizeof(int));
+
+  freeChunk(gc, &finalized);
+  EXPECT_EQ(gc->stats.bytesAllocated, before);
 }
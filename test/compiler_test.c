@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "compiler.h"
@@ -21,24 +22,24 @@ UTEST_F_SETUP(CompilerTestFixture) {
 }
 
 UTEST_F_TEARDOWN(CompilerTestFixture) {
-  freeTable(&utest_fixture->strings);
+  freeTable(&utest_fixture->gc, &utest_fixture->strings);
+  freeChunk(&utest_fixture->gc, &utest_fixture->chunk);
   freeGC(&utest_fixture->gc);
-  freeChunk(&utest_fixture->chunk);
   ASSERT_TRUE(1);
 }
 
 #define OpCodeTest(source, opcode)                                             \
-  Chunk chunk = utest_fixture->chunk;                                          \
+  Chunk *chunk = &utest_fixture->chunk;                                        \
                                                                                \
   bool result =                                                                \
-      compile(source, &chunk, &utest_fixture->gc, &utest_fixture->strings);    \
+      compile(source, chunk, &utest_fixture->gc, &utest_fixture->strings);     \
                                                                                \
   ASSERT_TRUE(result);                                                         \
-  ASSERT_EQ(chunk.count, 3);                                                   \
+  ASSERT_EQ(chunk->count, 3);                                                  \
                                                                                \
-  ASSERT_EQ(chunk.code[0], opcode);                                            \
-  ASSERT_EQ(chunk.code[1], OP_POP);                                            \
-  ASSERT_EQ(chunk.code[2], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], opcode);                                           \
+  ASSERT_EQ(chunk->code[1], OP_POP);                                           \
+  ASSERT_EQ(chunk->code[2], OP_RETURN);
 
 UTEST_F(CompilerTestFixture, compileTrue) { OpCodeTest("true;", OP_TRUE); }
 
@@ -47,117 +48,117 @@ UTEST_F(CompilerTestFixture, compileFalse) { OpCodeTest("false;", OP_FALSE); }
 UTEST_F(CompilerTestFixture, compileNil) { OpCodeTest("nil;", OP_NIL); }
 
 UTEST_F(CompilerTestFixture, compileBang) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
   bool result =
-      compile("!true;", &chunk, &utest_fixture->gc, &utest_fixture->strings);
+      compile("!true;", chunk, &utest_fixture->gc, &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 4);
+  ASSERT_EQ(chunk->count, 4);
 
-  ASSERT_EQ(chunk.code[0], OP_TRUE);
-  ASSERT_EQ(chunk.code[1], OP_NOT);
-  ASSERT_EQ(chunk.code[2], OP_POP);
-  ASSERT_EQ(chunk.code[3], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_TRUE);
+  ASSERT_EQ(chunk->code[1], OP_NOT);
+  ASSERT_EQ(chunk->code[2], OP_POP);
+  ASSERT_EQ(chunk->code[3], OP_RETURN);
 }
 
 UTEST_F(CompilerTestFixture, compileNumber) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
   bool result =
-      compile("69;", &chunk, &utest_fixture->gc, &utest_fixture->strings);
+      compile("69;", chunk, &utest_fixture->gc, &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 4);
+  ASSERT_EQ(chunk->count, 4);
 
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 0);
-  ASSERT_EQ(chunk.code[2], OP_POP);
-  ASSERT_EQ(chunk.code[3], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 0);
+  ASSERT_EQ(chunk->code[2], OP_POP);
+  ASSERT_EQ(chunk->code[3], OP_RETURN);
 
-  ASSERT_EQ(chunk.constants.count, 1);
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[0]), 69);
+  ASSERT_EQ(chunk->constants.count, 1);
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[0]), 69);
 
-  for (int i = 0; i < chunk.count; i++) {
-    ASSERT_EQ(chunk.lines[i], 1);
+  for (int i = 0; i < chunk->count; i++) {
+    ASSERT_EQ(chunk->lines[i], 1);
   }
 }
 
 UTEST_F(CompilerTestFixture, compileNegation) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
   bool result =
-      compile("-69;", &chunk, &utest_fixture->gc, &utest_fixture->strings);
+      compile("-69;", chunk, &utest_fixture->gc, &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 5);
+  ASSERT_EQ(chunk->count, 5);
 
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 0);
-  ASSERT_EQ(chunk.code[2], OP_NEGATE);
-  ASSERT_EQ(chunk.code[3], OP_POP);
-  ASSERT_EQ(chunk.code[4], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 0);
+  ASSERT_EQ(chunk->code[2], OP_NEGATE);
+  ASSERT_EQ(chunk->code[3], OP_POP);
+  ASSERT_EQ(chunk->code[4], OP_RETURN);
 
-  ASSERT_EQ(chunk.constants.count, 1);
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[0]), 69);
+  ASSERT_EQ(chunk->constants.count, 1);
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[0]), 69);
 
-  for (int i = 0; i < chunk.count; i++) {
-    ASSERT_EQ(chunk.lines[i], 1);
+  for (int i = 0; i < chunk->count; i++) {
+    ASSERT_EQ(chunk->lines[i], 1);
   }
 }
 
 UTEST_F(CompilerTestFixture, compileGrouped) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
   bool result =
-      compile("(69);", &chunk, &utest_fixture->gc, &utest_fixture->strings);
+      compile("(69);", chunk, &utest_fixture->gc, &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 4);
+  ASSERT_EQ(chunk->count, 4);
 
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 0);
-  ASSERT_EQ(chunk.code[2], OP_POP);
-  ASSERT_EQ(chunk.code[3], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 0);
+  ASSERT_EQ(chunk->code[2], OP_POP);
+  ASSERT_EQ(chunk->code[3], OP_RETURN);
 
-  ASSERT_EQ(chunk.constants.count, 1);
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[0]), 69);
+  ASSERT_EQ(chunk->constants.count, 1);
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[0]), 69);
 
-  for (int i = 0; i < chunk.count; i++) {
-    ASSERT_EQ(chunk.lines[i], 1);
+  for (int i = 0; i < chunk->count; i++) {
+    ASSERT_EQ(chunk->lines[i], 1);
   }
 }
 
 #define BinaryExpressionTest(operator, opcode)                                 \
-  Chunk chunk = utest_fixture->chunk;                                          \
+  Chunk *chunk = &utest_fixture->chunk;                                        \
   char source[20];                                                             \
   sprintf(source, "69 %s 420;", operator);                                     \
   source[19] = '\0';                                                           \
                                                                                \
   bool result =                                                                \
-      compile(source, &chunk, &utest_fixture->gc, &utest_fixture->strings);    \
+      compile(source, chunk, &utest_fixture->gc, &utest_fixture->strings);     \
                                                                                \
   ASSERT_TRUE(result);                                                         \
-  ASSERT_EQ(chunk.count, 7);                                                   \
+  ASSERT_EQ(chunk->count, 7);                                                  \
                                                                                \
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);                                       \
-  ASSERT_EQ(chunk.code[1], 0);                                                 \
-  ASSERT_EQ(chunk.code[2], OP_CONSTANT);                                       \
-  ASSERT_EQ(chunk.code[3], 1);                                                 \
-  ASSERT_EQ(chunk.code[4], opcode);                                            \
-  ASSERT_EQ(chunk.code[5], OP_POP);                                            \
-  ASSERT_EQ(chunk.code[6], OP_RETURN);                                         \
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);                                      \
+  ASSERT_EQ(chunk->code[1], 0);                                                \
+  ASSERT_EQ(chunk->code[2], OP_CONSTANT);                                      \
+  ASSERT_EQ(chunk->code[3], 1);                                                \
+  ASSERT_EQ(chunk->code[4], opcode);                                           \
+  ASSERT_EQ(chunk->code[5], OP_POP);                                           \
+  ASSERT_EQ(chunk->code[6], OP_RETURN);                                        \
                                                                                \
-  ASSERT_EQ(chunk.constants.count, 2);                                         \
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[0]), 69);                         \
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[1]), 420);                        \
+  ASSERT_EQ(chunk->constants.count, 2);                                        \
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[0]), 69);                        \
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[1]), 420);                       \
                                                                                \
-  for (int i = 0; i < chunk.count; i++) {                                      \
-    ASSERT_EQ(chunk.lines[i], 1);                                              \
+  for (int i = 0; i < chunk->count; i++) {                                     \
+    ASSERT_EQ(chunk->lines[i], 1);                                             \
   }
 
 UTEST_F(CompilerTestFixture, compilePlus) { BinaryExpressionTest("+", OP_ADD); }
@@ -199,96 +200,398 @@ UTEST_F(CompilerTestFixture, compileGreaterEqual) {
 }
 
 UTEST_F(CompilerTestFixture, compileString) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  bool result = compile("\"Hello, World!\";", &chunk, &utest_fixture->gc,
+  bool result = compile("\"Hello, World!\";", chunk, &utest_fixture->gc,
                         &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 4);
+  ASSERT_EQ(chunk->count, 4);
 
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 0);
-  ASSERT_EQ(chunk.code[2], OP_POP);
-  ASSERT_EQ(chunk.code[3], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 0);
+  ASSERT_EQ(chunk->code[2], OP_POP);
+  ASSERT_EQ(chunk->code[3], OP_RETURN);
 
-  ASSERT_EQ(chunk.constants.count, 1);
-  ASSERT_TRUE(IS_STRING(chunk.constants.values[0]));
-  ASSERT_STREQ(AS_CSTRING(chunk.constants.values[0]), "Hello, World!");
+  ASSERT_EQ(chunk->constants.count, 1);
+  ASSERT_TRUE(IS_STRING(chunk->constants.values[0]));
+  ASSERT_STREQ(AS_CSTRING(chunk->constants.values[0]), "Hello, World!");
 }
 
 UTEST_F(CompilerTestFixture, compilePrint) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  bool result = compile("print \"Hello, World!\";", &chunk, &utest_fixture->gc,
+  bool result = compile("print \"Hello, World!\";", chunk, &utest_fixture->gc,
                         &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 4);
+  ASSERT_EQ(chunk->count, 4);
 
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 0);
-  ASSERT_EQ(chunk.code[2], OP_PRINT);
-  ASSERT_EQ(chunk.code[3], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 0);
+  ASSERT_EQ(chunk->code[2], OP_PRINT);
+  ASSERT_EQ(chunk->code[3], OP_RETURN);
 
-  ASSERT_EQ(chunk.constants.count, 1);
-  ASSERT_TRUE(IS_STRING(chunk.constants.values[0]));
-  ASSERT_STREQ(AS_CSTRING(chunk.constants.values[0]), "Hello, World!");
+  ASSERT_EQ(chunk->constants.count, 1);
+  ASSERT_TRUE(IS_STRING(chunk->constants.values[0]));
+  ASSERT_STREQ(AS_CSTRING(chunk->constants.values[0]), "Hello, World!");
 }
 
 UTEST_F(CompilerTestFixture, compileGlobalVariable) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  bool result = compile("var x = 6.9;", &chunk, &utest_fixture->gc,
+  bool result = compile("var x = 6.9;", chunk, &utest_fixture->gc,
                         &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 5);
+  ASSERT_EQ(chunk->count, 5);
 
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 1);
-  ASSERT_EQ(chunk.code[2], OP_DEFINE_GLOBAL);
-  ASSERT_EQ(chunk.code[3], 0);
-  ASSERT_EQ(chunk.code[4], OP_RETURN);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 1);
+  ASSERT_EQ(chunk->code[2], OP_DEFINE_GLOBAL);
+  ASSERT_EQ(chunk->code[3], 0);
+  ASSERT_EQ(chunk->code[4], OP_RETURN);
 
-  ASSERT_EQ(chunk.constants.count, 2);
-  ASSERT_TRUE(IS_STRING(chunk.constants.values[0]));
-  ASSERT_STREQ(AS_CSTRING(chunk.constants.values[0]), "x");
-  ASSERT_TRUE(IS_NUMBER(chunk.constants.values[1]));
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[1]), 6.9);
+  ASSERT_EQ(chunk->constants.count, 2);
+  ASSERT_TRUE(IS_STRING(chunk->constants.values[0]));
+  ASSERT_STREQ(AS_CSTRING(chunk->constants.values[0]), "x");
+  ASSERT_TRUE(IS_NUMBER(chunk->constants.values[1]));
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[1]), 6.9);
 }
 
 UTEST_F(CompilerTestFixture, compileLocalVariableGetAndSet) {
-  Chunk chunk = utest_fixture->chunk;
+  Chunk *chunk = &utest_fixture->chunk;
 
-  bool result = compile("{ var x = 6.9; x = 4.20; }", &chunk,
+  bool result = compile("{ var x = 6.9; x = 4.20; }", chunk,
                         &utest_fixture->gc, &utest_fixture->strings);
 
   ASSERT_TRUE(result);
 
-  ASSERT_EQ(chunk.count, 9);
-  ASSERT_EQ(chunk.constants.count, 2);
+  ASSERT_EQ(chunk->count, 9);
+  ASSERT_EQ(chunk->constants.count, 2);
 
   // var x = 6.9;
-  ASSERT_EQ(chunk.code[0], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[1], 0);
-  ASSERT_TRUE(IS_NUMBER(chunk.constants.values[0]));
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[0]), 6.9);
+  ASSERT_EQ(chunk->code[0], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[1], 0);
+  ASSERT_TRUE(IS_NUMBER(chunk->constants.values[0]));
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[0]), 6.9);
 
   // x = 4.20
-  ASSERT_EQ(chunk.code[2], OP_CONSTANT);
-  ASSERT_EQ(chunk.code[3], 1);
-  ASSERT_EQ(chunk.code[4], OP_SET_LOCAL);
-  ASSERT_EQ(chunk.code[5], 0);
-  ASSERT_TRUE(IS_NUMBER(chunk.constants.values[1]));
-  ASSERT_EQ(AS_NUMBER(chunk.constants.values[1]), 4.20);
+  ASSERT_EQ(chunk->code[2], OP_CONSTANT);
+  ASSERT_EQ(chunk->code[3], 1);
+  ASSERT_EQ(chunk->code[4], OP_SET_LOCAL);
+  ASSERT_EQ(chunk->code[5], 0);
+  ASSERT_TRUE(IS_NUMBER(chunk->constants.values[1]));
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[1]), 4.20);
 
   // Variable are popped of the stack when exited out of the block scope
-  ASSERT_EQ(chunk.code[6], OP_POP);
-  ASSERT_EQ(chunk.code[7], OP_POP);
+  ASSERT_EQ(chunk->code[6], OP_POP);
+  ASSERT_EQ(chunk->code[7], OP_POP);
 
-  ASSERT_EQ(chunk.code[8], OP_RETURN);
+  ASSERT_EQ(chunk->code[8], OP_RETURN);
+}
+
+// Every scan mode feeds the parser the same tokens, so produces the same code.
+UTEST_F(CompilerTestFixture, scanModes) {
+  const char *source = "var x = 1; { var y = x; print y + 2 >= \"s\"; }";
+  ScanMode modes[] = {SCAN_UPFRONT, SCAN_THREADED};
+
+  Chunk expected = utest_fixture->chunk;
+  ASSERT_TRUE(compileWithScanMode(source, &expected, &utest_fixture->gc,
+                                  &utest_fixture->strings, SCAN_STREAMING));
+
+  for (int i = 0; i < 2; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+
+    ASSERT_TRUE(compileWithScanMode(source, &chunk, &utest_fixture->gc,
+                                    &utest_fixture->strings, modes[i]));
+    ASSERT_EQ(chunk.count, expected.count);
+    ASSERT_EQ(memcmp(chunk.code, expected.code, chunk.count), 0);
+    ASSERT_EQ(memcmp(chunk.lines, expected.lines, sizeof(int) * chunk.count),
+              0);
+
+    freeChunk(&utest_fixture->gc, &chunk);
+  }
+
+  freeChunk(&utest_fixture->gc, &expected);
+}
+
+// Repeated names and literals share a constant, and the chunk is exactly the
+// size of its bytecode once compiled.
+UTEST_F(CompilerTestFixture, constantsAreShared) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  bool result = compile("var x = 1; x = 1; x = 2; print \"x\" + \"x\";", chunk,
+                        &utest_fixture->gc, &utest_fixture->strings);
+  ASSERT_TRUE(result);
+
+  // "x" names the global and is a string literal, which is the same object.
+  ASSERT_EQ(chunk->constants.count, 3);
+  ASSERT_STREQ(AS_CSTRING(chunk->constants.values[0]), "x");
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[1]), 1.0);
+  ASSERT_EQ(AS_NUMBER(chunk->constants.values[2]), 2.0);
+
+  ASSERT_EQ(chunk->capacity, chunk->count);
+  ASSERT_EQ(chunk->constants.capacity, chunk->constants.count);
+  ASSERT_EQ(utest_fixture->gc.stats.bytes[MEM_COMPILER], (size_t)0);
+
+}
+
+UTEST_F(CompilerTestFixture, equalNumbersShareConstant) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("0; -0; 0.0; 1.0; 1;", chunk, &utest_fixture->gc,
+                      &utest_fixture->strings));
+  // -0 is the constant 0 negated at runtime.
+  ASSERT_EQ(chunk->constants.count, 2);
+
+}
+
+// A comparison is fused into the loop's test, so the loop is the test, the
+// body and the jump back.
+UTEST_F(CompilerTestFixture, comparisonIsFusedIntoJump) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("{ var i = 0; while (i < 9) i = i + 1; }", chunk,
+                      &utest_fixture->gc, &utest_fixture->strings));
+
+  uint8_t expected[] = {
+      OP_CONSTANT,       0,     // var i = 0;
+      OP_GET_LOCAL,      0,     // i < 9
+      OP_CONSTANT,       1,     //
+      OP_JUMP_IF_NOT_LT, 0, 11, // Past the loop.
+      OP_GET_LOCAL,      0,     // i = i + 1;
+      OP_CONSTANT,       2,     //
+      OP_ADD,                   //
+      OP_SET_LOCAL,      0,     //
+      OP_POP,                   //
+      OP_LOOP,           0, 18, // Back to the test.
+      OP_POP,                   // The end of the scope.
+      OP_RETURN,
+  };
+  ASSERT_EQ(chunk->count, (int)sizeof(expected));
+  ASSERT_EQ(memcmp(chunk->code, expected, sizeof(expected)), 0);
+
+}
+
+// Where `and` jumps to the jump, the comparison's result is needed there.
+UTEST_F(CompilerTestFixture, comparisonIsNotFusedWhereJumpsLand) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("if (true and 1 < 2) print 1;", chunk,
+                      &utest_fixture->gc, &utest_fixture->strings));
+
+  ASSERT_EQ(chunk->code[0], OP_TRUE);
+  ASSERT_EQ(chunk->code[1], OP_JUMP_IF_FALSE);
+  ASSERT_EQ(chunk->code[9], OP_LT);
+  ASSERT_EQ(chunk->code[10], OP_JUMP_IF_FALSE_POP);
+
+}
+
+// A counting loop steps, tests and jumps back in one instruction, unless its
+// variable is assigned in the body. A local bound is read where it is.
+UTEST_F(CompilerTestFixture, countingLoopIsARange) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("{ for (var i = 0; i < 9; i = i + 1) print i; }", chunk,
+                      &utest_fixture->gc, &utest_fixture->strings));
+
+  uint8_t expected[] = {
+      OP_CONSTANT, 0,                      // var i = 0;
+      OP_CONSTANT, 1,                      // The bound, in a hidden local.
+      OP_GET_LOCAL, 0,                     // i < 9, before the first one.
+      OP_GET_LOCAL, 1,                     //
+      OP_JUMP_IF_NOT_LT, 0, 10,            //
+      OP_GET_LOCAL, 0,                     // print i;
+      OP_PRINT,                            //
+      OP_FOR_RANGE, 0, 1, OP_LT, 2, 0, 10, // i = i + 1, and i < 9 again.
+      OP_POP,                              // The bound and i.
+      OP_POP,                              //
+      OP_RETURN,
+  };
+  ASSERT_EQ(chunk->count, (int)sizeof(expected));
+  ASSERT_EQ(memcmp(chunk->code, expected, sizeof(expected)), 0);
+
+  Chunk assigned;
+  initChunk(&assigned);
+  ASSERT_TRUE(compile("{ for (var i = 0; i < 9; i = i + 1) i = 8; }",
+                      &assigned, &utest_fixture->gc, &utest_fixture->strings));
+  for (int offset = 0; offset < assigned.count; offset++)
+    ASSERT_NE(assigned.code[offset], OP_FOR_RANGE);
+  freeChunk(&utest_fixture->gc, &assigned);
+
+  Chunk local;
+  initChunk(&local);
+  ASSERT_TRUE(compile("{ var n = 9; for (var i = 0; i < n; i = i + 1) n = 8; }",
+                      &local, &utest_fixture->gc, &utest_fixture->strings));
+  ASSERT_EQ(local.code[local.count - 10], OP_FOR_RANGE);
+  EXPECT_EQ(local.code[local.count - 9], 1); // i
+  EXPECT_EQ(local.code[local.count - 8], 0); // n
+  freeChunk(&utest_fixture->gc, &local);
+}
+
+// The switch's jump is inserted before its cases, once they are all known.
+UTEST_F(CompilerTestFixture, denseSwitchIsAJumpTable) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("switch (2) { case 1: print 1; case 2: print 2; }",
+                      chunk, &utest_fixture->gc, &utest_fixture->strings));
+
+  uint8_t expected[] = {
+      OP_CONSTANT, 0,         // The subject, 2.
+      OP_JUMP_TABLE, 1, 0, 2, // Two cases from the lowest, 1.
+      0, 9,                   // No default, so past the cases.
+      0, 0,                   // case 1:
+      0, 6,                   // case 2:
+      OP_CONSTANT, 1,         // print 1;
+      OP_PRINT,               //
+      OP_JUMP, 0, 3,          // Past the other cases.
+      OP_CONSTANT, 0,         // print 2;
+      OP_PRINT,               //
+      OP_RETURN,
+  };
+  ASSERT_EQ(chunk->count, (int)sizeof(expected));
+  ASSERT_EQ(memcmp(chunk->code, expected, sizeof(expected)), 0);
+
+  Chunk sparse;
+  initChunk(&sparse);
+  ASSERT_TRUE(compile("switch (2) { case 1: print 1; case 100: print 2; }",
+                      &sparse, &utest_fixture->gc, &utest_fixture->strings));
+  ASSERT_EQ(sparse.code[2], OP_JUMP_HASH);
+  freeChunk(&utest_fixture->gc, &sparse);
+}
+
+// A function's code is in its own chunk, a constant of the enclosing one, and
+// its parameters are its first locals.
+UTEST_F(CompilerTestFixture, functionHasItsOwnChunk) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("fun add(a, b) { return a + b; } add(1, 2);", chunk,
+                      &utest_fixture->gc, &utest_fixture->strings));
+
+  uint8_t expected[] = {
+      OP_CONSTANT, 1,      // The function.
+      OP_DEFINE_GLOBAL, 0, //
+      OP_GET_GLOBAL, 0,    // add(1, 2);
+      OP_CONSTANT, 2,      //
+      OP_CONSTANT, 3,      //
+      OP_CALL, 2,          //
+      OP_POP,              //
+      OP_RETURN,
+  };
+  ASSERT_EQ(chunk->count, (int)sizeof(expected));
+  ASSERT_EQ(memcmp(chunk->code, expected, sizeof(expected)), 0);
+
+  ASSERT_TRUE(IS_FUNCTION(chunk->constants.values[1]));
+  ObjFunction *function = AS_FUNCTION(chunk->constants.values[1]);
+  ASSERT_EQ(function->arity, 2);
+  ASSERT_STREQ(function->name->chars, "add");
+  ASSERT_TRUE(function->chunk.finalized);
+  ASSERT_EQ(function->constants, function->chunk.constants.values);
+
+  uint8_t body[] = {
+      OP_GET_LOCAL, 0, // return a + b;
+      OP_GET_LOCAL, 1, //
+      OP_ADD,          //
+      OP_RETURN,       //
+      OP_NIL,          // The implicit return at the end.
+      OP_RETURN,
+  };
+  ASSERT_EQ(function->chunk.count, (int)sizeof(body));
+  ASSERT_EQ(memcmp(function->chunk.code, body, sizeof(body)), 0);
+
+  // The call's result replaces the function and its arguments, and the
+  // function's frame starts with its parameters.
+  ASSERT_EQ(chunk->maxStackDepth, 3);
+  ASSERT_EQ(function->chunk.maxStackDepth, 4);
+}
+
+// A function capturing a local is made as a closure of it each time its code
+// runs, and the captured local is closed rather than popped.
+UTEST_F(CompilerTestFixture, closureCapturesLocals) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("{ var x = 1; fun f() { x = x + 1; } var y = 2; }",
+                      chunk, &utest_fixture->gc, &utest_fixture->strings));
+
+  uint8_t expected[] = {
+      OP_CONSTANT, 0,         // var x = 1;
+      OP_CLOSURE,  1, 1, 1, 0, // f, capturing the local x.
+      OP_CONSTANT, 2,         // var y = 2;
+      OP_POP,                 // y
+      OP_POP,                 // f
+      OP_CLOSE_UPVALUE,       // x
+      OP_RETURN,
+  };
+  ASSERT_EQ(chunk->count, (int)sizeof(expected));
+  ASSERT_EQ(memcmp(chunk->code, expected, sizeof(expected)), 0);
+
+  ObjFunction *function = AS_FUNCTION(chunk->constants.values[1]);
+  ASSERT_EQ(function->chunk.upvalueCount, 1);
+  uint8_t body[] = {
+      OP_GET_UPVALUE, 0, // x = x + 1;
+      OP_CONSTANT,    0, //
+      OP_ADD,            //
+      OP_SET_UPVALUE, 0, //
+      OP_POP,            //
+      OP_NIL,            // The implicit return at the end.
+      OP_RETURN,
+  };
+  ASSERT_EQ(function->chunk.count, (int)sizeof(body));
+  ASSERT_EQ(memcmp(function->chunk.code, body, sizeof(body)), 0);
+}
+
+// A call whose result is returned is made in the returning frame, and still
+// followed by the return.
+UTEST_F(CompilerTestFixture, tailCalls) {
+  Chunk *chunk = &utest_fixture->chunk;
+
+  ASSERT_TRUE(compile("fun f(n) { return f(n); }"
+                      "fun g(n) { return -f(n); }"
+                      "fun h(n) { return n and f(n); }",
+                      chunk, &utest_fixture->gc, &utest_fixture->strings));
+
+  ObjFunction *f = AS_FUNCTION(chunk->constants.values[1]);
+  uint8_t body[] = {
+      OP_GET_GLOBAL, 0, // return f(n);
+      OP_GET_LOCAL,  0, //
+      OP_TAIL_CALL,  1, //
+      OP_RETURN,        //
+      OP_NIL,           // The implicit return at the end.
+      OP_RETURN,
+  };
+  ASSERT_EQ(f->chunk.count, (int)sizeof(body));
+  ASSERT_EQ(memcmp(f->chunk.code, body, sizeof(body)), 0);
+
+  // The result is negated after the call returns.
+  ObjFunction *g = AS_FUNCTION(chunk->constants.values[3]);
+  EXPECT_EQ(g->chunk.code[4], OP_CALL);
+  EXPECT_EQ(g->chunk.code[6], OP_NEGATE);
+
+  // The and jumps past the call to the return.
+  ObjFunction *h = AS_FUNCTION(chunk->constants.values[5]);
+  EXPECT_EQ(h->chunk.code[2], OP_JUMP_IF_FALSE);
+  EXPECT_EQ(h->chunk.code[10], OP_TAIL_CALL);
+  EXPECT_EQ(h->chunk.code[12], OP_RETURN);
+}
+
+UTEST_F(CompilerTestFixture, maxStackDepth) {
+  const char *sources[] = {
+      "{ var a = 1; print a + (2 * (3 - a)); }",
+      "while (1 < 2) {} var b = true and false;",
+      "switch (1) { case 1: print 2 + 3; }",
+  };
+  int depths[] = {5, 2, 2};
+  for (int i = 0; i < 3; i++) {
+    Chunk chunk;
+    initChunk(&chunk);
+    ASSERT_TRUE(compile(sources[i], &chunk, &utest_fixture->gc,
+                        &utest_fixture->strings));
+    EXPECT_EQ(chunk.maxStackDepth, depths[i]);
+    freeChunk(&utest_fixture->gc, &chunk);
+  }
 }
@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gc.h"
+#include "object.h"
+#include "table.h"
+#include "utest.h"
+#include "vm.h"
+
+static int countOldObjects(GC *gc) {
+  int count = 0;
+  for (Obj *object = gc->objects; object != NULL; object = object->next)
+    count++;
+  return count;
+}
+
+static bool isInterned(Table *strings, const char *chars) {
+  for (int i = 0; i < strings->capacity; i++) {
+    ObjString *key = strings->entries[i].key;
+    if (key != NULL && strcmp(key->chars, chars) == 0)
+      return true;
+  }
+  return false;
+}
+
+static ObjString *getGlobal(VM *vm, const char *name) {
+  Value value;
+  ObjString *key = copyString(&vm->gc, &vm->strings, name, strlen(name));
+  if (!tableGet(&vm->globals, key, &value) || !IS_STRING(value))
+    return NULL;
+  return AS_STRING(value);
+}
+
+// A script growing a global by concatenation, which leaves a dead string
+// behind for every statement. Every 50 statements the string is kept in
+// another global and started again.
+static char *churnScript(int statements) {
+  static char source[256 * 1024];
+  int length = sprintf(source, "var kept = \"k\"; var t = \"a\";\n");
+  for (int i = 0; i < statements; i++) {
+    length += sprintf(source + length, "t = t + \"%c\";\n", 'a' + i % 26);
+    if (i % 50 == 49)
+      length += sprintf(source + length, "kept = t; t = \"b\";\n");
+  }
+  return source;
+}
+
+// These depend on nothing being collected but what the test collects.
+#ifndef DEBUG_STRESS_GC
+UTEST(GC, youngStringsArePromotedFromRoots) {
+  VM vm;
+  initVM(&vm);
+
+  ASSERT_EQ(interpret(&vm, "var s = \"ab\" + \"cd\";"),
+            (InterpretResult)INTERPRET_OK);
+  ObjString *young = getGlobal(&vm, "s");
+  ASSERT_TRUE(gcInNursery(&vm.gc, young));
+
+  collectGarbage(&vm.gc);
+
+  // The global was remembered, so was moved along with its value.
+  ObjString *promoted = getGlobal(&vm, "s");
+  ASSERT_FALSE(gcInNursery(&vm.gc, promoted));
+  ASSERT_STREQ(promoted->chars, "abcd");
+  ASSERT_EQ(vm.gc.nursery.top, vm.gc.nursery.start);
+  ASSERT_EQ(vm.gc.gcStats.minorCollections, (size_t)1);
+
+  // The interned string is the promoted one, so equality still holds.
+  ASSERT_EQ(copyString(&vm.gc, &vm.strings, "abcd", 4), promoted);
+  ASSERT_EQ(interpret(&vm, "print s == \"ab\" + \"cd\";"),
+            (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(memcmp(vm.output.buffer, "true\n", 5), 0);
+  vm.output.length = 0;
+
+  freeVM(&vm);
+}
+
+UTEST(GC, deadYoungStringsAreNotPromoted) {
+  VM vm;
+  initVM(&vm);
+
+  ASSERT_EQ(interpret(&vm, "\"dead\" + \"young\";"),
+            (InterpretResult)INTERPRET_OK);
+  ASSERT_TRUE(isInterned(&vm.strings, "deadyoung"));
+
+  int before = countOldObjects(&vm.gc);
+  collectGarbage(&vm.gc);
+  ASSERT_FALSE(isInterned(&vm.strings, "deadyoung"));
+  ASSERT_EQ(countOldObjects(&vm.gc), before);
+  ASSERT_EQ(vm.gc.gcStats.promotedBytes, (size_t)0);
+
+  freeVM(&vm);
+}
+#endif
+
+UTEST(GC, unreachableOldStringsAreSwept) {
+  VM vm;
+  initVM(&vm);
+
+  ASSERT_EQ(interpret(&vm, "var s = \"first\" + \"!\";"),
+            (InterpretResult)INTERPRET_OK);
+  collectGarbage(&vm.gc); // Promotes "first!".
+  ASSERT_TRUE(isInterned(&vm.strings, "first!"));
+
+  ASSERT_EQ(interpret(&vm, "s = \"second\";"), (InterpretResult)INTERPRET_OK);
+  collectAllGarbage(&vm.gc);
+
+  // Only the names and literals still in use survive.
+  ASSERT_FALSE(isInterned(&vm.strings, "first!"));
+  ASSERT_FALSE(isInterned(&vm.strings, "first"));
+  ASSERT_TRUE(isInterned(&vm.strings, "second"));
+  ASSERT_TRUE(isInterned(&vm.strings, "s"));
+  ASSERT_EQ(countOldObjects(&vm.gc), 2);
+  ASSERT_STREQ(getGlobal(&vm, "s")->chars, "second");
+
+  freeVM(&vm);
+}
+
+// Collections triggered while running keep every reachable string intact, in
+// both the generational and the plain mark-sweep heap, collected at once or
+// incrementally, swept by the program or in the background, and compacted or
+// not.
+UTEST(GC, collectsWhileRunning) {
+  for (int mode = 0; mode < 16; mode++) {
+    bool generational = mode & 1, incremental = mode & 2;
+    VM vm;
+    initVM(&vm);
+    vm.gc.generational = generational;
+    vm.gc.incremental = incremental;
+    vm.gc.backgroundSweep = mode & 4;
+    vm.gc.compact = mode & 8;
+    vm.gc.sliceMicros = 1;
+    vm.gc.nextCollection = 64 * 1024; // Also collect the old generation.
+
+    ASSERT_EQ(interpret(&vm, churnScript(10000)),
+              (InterpretResult)INTERPRET_OK);
+
+    if (generational)
+      ASSERT_GT(vm.gc.gcStats.minorCollections, (size_t)0);
+    ASSERT_GT(vm.gc.gcStats.majorCollections, (size_t)0);
+    if (incremental)
+      ASSERT_GT(vm.gc.gcStats.slices, (size_t)0);
+
+    // The helper thread may still be sweeping, and compacts once it is done.
+    if (vm.gc.compact) {
+      collectAllGarbage(&vm.gc);
+      ASSERT_GT(vm.gc.gcStats.compactions, (size_t)0);
+    }
+
+    // The last kept string is the 50 letters after "b", ending at 10000.
+    ObjString *kept = getGlobal(&vm, "kept");
+    ASSERT_EQ(kept->length, 51);
+    ASSERT_EQ(kept->chars[0], 'b');
+    ASSERT_EQ(kept->chars[50], 'a' + 9999 % 26);
+    ASSERT_STREQ(getGlobal(&vm, "t")->chars, "b");
+
+    freeVM(&vm);
+    ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+  }
+}
+
+// A function defined by an earlier script is only held by a global, and its
+// chunk outlives the script's, while collections move and free what it makes.
+UTEST(GC, functionsSurviveWhileCalled) {
+  for (int mode = 0; mode < 16; mode++) {
+    VM vm;
+    initVM(&vm);
+    vm.gc.generational = mode & 1;
+    vm.gc.incremental = mode & 2;
+    vm.gc.backgroundSweep = mode & 4;
+    vm.gc.compact = mode & 8;
+    vm.gc.sliceMicros = 1;
+    vm.gc.nextCollection = 64 * 1024;
+
+    ASSERT_EQ(interpret(&vm, "fun grow(t, c) { var u = t + c; return u; }"),
+              (InterpretResult)INTERPRET_OK);
+
+    static char source[128 * 1024];
+    int length = sprintf(source, "var t = \"\";\n");
+    for (int i = 0; i < 3000; i++)
+      length +=
+          sprintf(source + length, "t = grow(t, \"%c\");\n", 'a' + i % 26);
+    ASSERT_EQ(interpret(&vm, source), (InterpretResult)INTERPRET_OK);
+    ASSERT_GT(vm.gc.gcStats.majorCollections, (size_t)0);
+
+    collectAllGarbage(&vm.gc);
+    compactHeap(&vm.gc);
+    ASSERT_EQ(interpret(&vm, "t = grow(t, \"!\");"),
+              (InterpretResult)INTERPRET_OK);
+    ObjString *t = getGlobal(&vm, "t");
+    ASSERT_EQ(t->length, 3001);
+    ASSERT_EQ(t->chars[2999], 'a' + 2999 % 26);
+    ASSERT_EQ(t->chars[3000], '!');
+
+    freeVM(&vm);
+    ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+  }
+}
+
+// Captured strings are held by upvalues, open and closed, which are written
+// long after they are made, while collections move and free what they hold.
+UTEST(GC, upvaluesSurviveWhileCollecting) {
+  for (int mode = 0; mode < 16; mode++) {
+    VM vm;
+    initVM(&vm);
+    vm.gc.generational = mode & 1;
+    vm.gc.incremental = mode & 2;
+    vm.gc.backgroundSweep = mode & 4;
+    vm.gc.compact = mode & 8;
+    vm.gc.sliceMicros = 1;
+    vm.gc.nextCollection = 64 * 1024;
+
+    ASSERT_EQ(
+        interpret(&vm, "var set; var get; var t;\n"
+                       "fun box(s) { fun g() { return s; }"
+                       " fun st(u) { s = u; } set = st; return g; }\n"
+                       "fun junk(s) { fun j() { return s; } return j; }\n"
+                       "get = box(\"\");\n"
+                       "{ var open = \"\"; fun add(c) { open = open + c; }\n"
+                       "  for (var i = 0; i < 3000; i = i + 1) {\n"
+                       "    set(get() + \"x\"); add(\"y\"); junk(\"j\");\n"
+                       "  }\n"
+                       "  t = open; }"),
+        (InterpretResult)INTERPRET_OK);
+    ASSERT_GT(vm.gc.gcStats.majorCollections, (size_t)0);
+
+    collectAllGarbage(&vm.gc);
+    compactHeap(&vm.gc);
+    ASSERT_EQ(interpret(&vm, "set(get() + \"!\"); t = t + get();"),
+              (InterpretResult)INTERPRET_OK);
+    ObjString *t = getGlobal(&vm, "t");
+    ASSERT_EQ(t->length, 3000 + 3001);
+    ASSERT_EQ(t->chars[0], 'y');
+    ASSERT_EQ(t->chars[3000], 'x');
+    ASSERT_EQ(t->chars[6000], '!');
+
+    freeVM(&vm);
+    ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+  }
+}
+
+UTEST(GC, globalsStoredWhileMarkingSurvive) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.incremental = true;
+
+  ASSERT_EQ(interpret(&vm, "var s = \"old\";"), (InterpretResult)INTERPRET_OK);
+  vm.gc.nextCollection = 0;
+  collectGarbage(&vm.gc);
+  ASSERT_EQ(vm.gc.phase, (GCPhase)GC_MARKING);
+
+  // Only the globals reach these strings once the script is done, and the
+  // globals are not visited again, so they must be marked as they are stored.
+  ASSERT_EQ(interpret(&vm, "var t = \"fresh\"; s = \"newer\";"),
+            (InterpretResult)INTERPRET_OK);
+  while (vm.gc.phase != GC_IDLE)
+    collectGarbage(&vm.gc);
+
+  ObjString *t = getGlobal(&vm, "t"), *s = getGlobal(&vm, "s");
+  ASSERT_TRUE(t != NULL && s != NULL);
+  ASSERT_STREQ(t->chars, "fresh");
+  ASSERT_STREQ(s->chars, "newer");
+  ASSERT_TRUE(isInterned(&vm.strings, "fresh"));
+
+  // Overwritten after it was marked, so only the next collection frees it.
+  ASSERT_TRUE(isInterned(&vm.strings, "old"));
+  collectAllGarbage(&vm.gc);
+  ASSERT_FALSE(isInterned(&vm.strings, "old"));
+
+  freeVM(&vm);
+}
+
+UTEST(GC, sweepsInTheBackground) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.backgroundSweep = true;
+
+  ASSERT_EQ(interpret(&vm, "var s = \"kept\";"), (InterpretResult)INTERPRET_OK);
+  vm.gc.pretenure = true;
+  char name[16];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(name, sizeof(name), "dead%d", i);
+    copyString(&vm.gc, &vm.strings, name, strlen(name));
+  }
+  vm.gc.pretenure = false;
+  size_t before = vm.gc.stats.bytesAllocated;
+
+  // Dead strings leave the table at once, but are freed by the thread.
+  vm.gc.nextCollection = 0;
+  collectGarbage(&vm.gc);
+  ASSERT_FALSE(isInterned(&vm.strings, "dead0"));
+  ASSERT_TRUE(isInterned(&vm.strings, "kept"));
+  ASSERT_TRUE(vm.gc.sweeper.running);
+
+  // The program keeps allocating meanwhile, from the same pool.
+  ASSERT_EQ(interpret(&vm, "var t = s + \"!\";"),
+            (InterpretResult)INTERPRET_OK);
+
+  while (vm.gc.phase != GC_IDLE)
+    collectGarbage(&vm.gc);
+  ASSERT_FALSE(vm.gc.sweeper.running);
+  ASSERT_LT(vm.gc.stats.bytesAllocated, before);
+  ASSERT_STREQ(getGlobal(&vm, "s")->chars, "kept");
+  ASSERT_STREQ(getGlobal(&vm, "t")->chars, "kept!");
+
+  freeVM(&vm);
+  ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+}
+
+UTEST(GC, rescansWhenTheGrayStackIsFull) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.grayLimit = 8;
+
+  // Far more globals than fit on the gray stack at once.
+  static char source[8 * 1024];
+  int length = 0;
+  for (int i = 0; i < 100; i++)
+    length += sprintf(source + length, "var g%d = \"v%d\" + \"!\";\n", i, i);
+  ASSERT_EQ(interpret(&vm, source), (InterpretResult)INTERPRET_OK);
+
+  collectAllGarbage(&vm.gc);
+  ASSERT_GT(vm.gc.gcStats.rescans, (size_t)0);
+  ASSERT_EQ(vm.gc.grayCapacity, 8);
+  ASSERT_STREQ(getGlobal(&vm, "g0")->chars, "v0!");
+  ASSERT_STREQ(getGlobal(&vm, "g99")->chars, "v99!");
+
+  freeVM(&vm);
+  ASSERT_EQ(vm.gc.stats.markStackBytes, (size_t)0);
+}
+
+UTEST(GC, compactionMovesSurvivorsTogether) {
+  VM vm;
+  initVM(&vm);
+
+  static char source[8 * 1024];
+  int length = 0;
+  for (int i = 0; i < 100; i++)
+    length += sprintf(source + length, "var g%d = \"v%d\" + \"!\";\n", i, i);
+  ASSERT_EQ(interpret(&vm, source), (InterpretResult)INTERPRET_OK);
+
+  // Dead strings between the survivors leave the pages mostly empty.
+  vm.gc.pretenure = true;
+  char name[16];
+  for (int i = 0; i < 10000; i++) {
+    snprintf(name, sizeof(name), "dead%d", i);
+    copyString(&vm.gc, &vm.strings, name, strlen(name));
+  }
+  vm.gc.pretenure = false;
+  collectAllGarbage(&vm.gc);
+
+  ObjString *before = getGlobal(&vm, "g0");
+  size_t poolBytes = vm.gc.stats.poolBytes;
+  size_t bytes = vm.gc.stats.bytesAllocated;
+  int objects = countOldObjects(&vm.gc);
+  compactHeap(&vm.gc);
+
+  ASSERT_EQ(vm.gc.gcStats.compactions, (size_t)1);
+  ASSERT_LT(vm.gc.stats.poolBytes, poolBytes);
+  ASSERT_EQ(vm.gc.stats.bytesAllocated, bytes);
+  ASSERT_EQ(countOldObjects(&vm.gc), objects);
+
+  // Globals and interned strings point at the copies, so identity holds.
+  ObjString *after = getGlobal(&vm, "g0");
+  ASSERT_TRUE(after != before);
+  ASSERT_STREQ(after->chars, "v0!");
+  ASSERT_STREQ(getGlobal(&vm, "g99")->chars, "v99!");
+  ASSERT_EQ(copyString(&vm.gc, &vm.strings, "v0!", 3), after);
+  ASSERT_EQ(interpret(&vm, "print g0 == \"v0\" + \"!\";"),
+            (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(memcmp(vm.output.buffer, "true\n", 5), 0);
+  vm.output.length = 0;
+
+  freeVM(&vm);
+  ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+}
@@ -0,0 +1,28 @@
+#include "gc.h"
+#include "memory.h"
+#include "utest.h"
+
+UTEST(Memory, accountsPerCategory) {
+  GC gc;
+  initGC(&gc);
+
+  int *code = ALLOCATE(&gc, MEM_CHUNK_CODE, int, 4);
+  EXPECT_EQ(gc.stats.bytes[MEM_CHUNK_CODE], 4 * sizeof(int));
+
+  code = GROW_ARRAY(&gc, MEM_CHUNK_CODE, int, code, 4, 16);
+  double *lines = ALLOCATE(&gc, MEM_CHUNK_LINES, double, 2);
+  EXPECT_EQ(gc.stats.bytes[MEM_CHUNK_CODE], 16 * sizeof(int));
+  EXPECT_EQ(gc.stats.bytes[MEM_CHUNK_LINES], 2 * sizeof(double));
+  EXPECT_EQ(gc.stats.bytesAllocated, 16 * sizeof(int) + 2 * sizeof(double));
+
+  FREE_ARRAY(&gc, MEM_CHUNK_CODE, int, code, 16);
+  FREE_ARRAY(&gc, MEM_CHUNK_LINES, double, lines, 2);
+  EXPECT_EQ(gc.stats.bytesAllocated, (size_t)0);
+  EXPECT_EQ(gc.stats.bytes[MEM_CHUNK_CODE], (size_t)0);
+  EXPECT_EQ(gc.stats.bytes[MEM_CHUNK_LINES], (size_t)0);
+  EXPECT_EQ(gc.stats.peakBytesAllocated, 16 * sizeof(int) + 2 * sizeof(double));
+  EXPECT_EQ(gc.stats.allocations, (size_t)3);
+  EXPECT_EQ(gc.stats.frees, (size_t)2);
+
+  freeGC(&gc);
+}
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "object.h"
 #include "table.h"
 #include "utest.h"
@@ -8,7 +10,8 @@ UTEST(Object, takeString) {
   Table strings;
   initTable(&strings);
 
-  char *str = "Hello, World!";
+  char *str = allocateChars(&gc, 13); // Freed along with the string.
+  memcpy(str, "Hello, World!", 14);
 
   ObjString *result = takeString(&gc, &strings, str, 13);
 
@@ -16,6 +19,9 @@ UTEST(Object, takeString) {
   ASSERT_EQ(str, result->chars); // Same address - directly took ownership of.
   ASSERT_STREQ(result->chars, "Hello, World!");
   ASSERT_EQ(result->obj.type, (ObjType)OBJ_STRING);
+
+  freeTable(&gc, &strings);
+  freeGC(&gc);
 }
 
 UTEST(Object, copyString) {
@@ -32,4 +38,7 @@ UTEST(Object, copyString) {
   ASSERT_NE(str, result->chars); // Not same address (i.e. genuine copy)
   ASSERT_STREQ(result->chars, "Hello, World!");
   ASSERT_EQ(result->obj.type, (ObjType)OBJ_STRING);
+
+  freeTable(&gc, &strings);
+  freeGC(&gc);
 }
@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "output.h"
+#include "utest.h"
+
+static void readAll(FILE *file, char *buffer, size_t size) {
+  rewind(file);
+  size_t n = fread(buffer, sizeof(char), size - 1, file);
+  buffer[n] = '\0';
+}
+
+UTEST(Output, bufferedUntilFlush) {
+  FILE *file = tmpfile();
+  ASSERT_NE(file, NULL);
+
+  Output output;
+  initOutput(&output, file);
+  writeOutput(&output, "Hello, ", 7);
+  writeOutput(&output, "World!", 6);
+
+  char contents[32];
+  readAll(file, contents, sizeof(contents));
+  ASSERT_STREQ(contents, "");
+
+  flushOutput(&output);
+  readAll(file, contents, sizeof(contents));
+  ASSERT_STREQ(contents, "Hello, World!");
+  ASSERT_EQ(output.length, 0);
+
+  fclose(file);
+}
+
+UTEST(Output, flushesWhenFull) {
+  FILE *file = tmpfile();
+  ASSERT_NE(file, NULL);
+
+  static char large[OUTPUT_BUFFER_SIZE * 2 + 1];
+  static char contents[OUTPUT_BUFFER_SIZE * 3 + 16];
+  memset(large, 'x', sizeof(large) - 1);
+
+  Output output;
+  initOutput(&output, file);
+  writeOutput(&output, "ab", 2);
+  writeOutput(&output, large, sizeof(large) - 1); // Larger than the buffer.
+  writeOutput(&output, "cd", 2);
+
+  // Everything before the large write reached the file, in order.
+  ASSERT_EQ(output.length, 2);
+  flushOutput(&output);
+
+  readAll(file, contents, sizeof(contents));
+  ASSERT_EQ(strlen(contents), sizeof(large) - 1 + 4);
+  ASSERT_EQ(memcmp(contents, "abx", 3), 0);
+  ASSERT_STREQ(contents + strlen(contents) - 3, "xcd");
+
+  fclose(file);
+}
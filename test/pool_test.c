@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "gc.h"
+#include "pool.h"
+#include "utest.h"
+
+UTEST(Pool, reusesFreedCells) {
+  GC gc;
+  initGC(&gc);
+
+  char *a = poolAllocate(&gc, MEM_OBJ_STRING, 24);
+  char *b = poolAllocate(&gc, MEM_OBJ_STRING, 24);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(gc.stats.poolBytes, (size_t)POOL_PAGE_SIZE);
+
+  poolFree(&gc, MEM_OBJ_STRING, a, 24);
+  // Any size within the same class takes the freed cell.
+  EXPECT_EQ(poolAllocate(&gc, MEM_OBJ_STRING, 32), a);
+  // A different class carves from its own page.
+  EXPECT_NE(poolAllocate(&gc, MEM_OBJ_STRING, 40), a);
+  EXPECT_EQ(gc.stats.poolBytes, (size_t)POOL_PAGE_SIZE * 2);
+
+  freeGC(&gc);
+  EXPECT_EQ(gc.stats.poolBytes, (size_t)0);
+}
+
+UTEST(Pool, cellsDoNotOverlap) {
+  GC gc;
+  initGC(&gc);
+
+  // Enough cells of every size to span several pages per class.
+  enum { COUNT = 3000 };
+  static char *cells[COUNT];
+  static size_t sizes[COUNT];
+  for (int i = 0; i < COUNT; i++) {
+    sizes[i] = 1 + (i * 37) % POOL_MAX_SIZE;
+    cells[i] = poolAllocate(&gc, MEM_OBJ_STRING, sizes[i]);
+    EXPECT_EQ((uintptr_t)cells[i] % 16, (uintptr_t)0);
+    memset(cells[i], i & 0xff, sizes[i]);
+  }
+  EXPECT_GT(gc.stats.bytes[MEM_OBJ_STRING], (size_t)0);
+
+  for (int i = 0; i < COUNT; i++) {
+    for (size_t j = 0; j < sizes[i]; j++) {
+      if ((uint8_t)cells[i][j] != (i & 0xff)) {
+        ASSERT_TRUE(0);
+      }
+    }
+  }
+
+  for (int i = 0; i < COUNT; i++)
+    poolFree(&gc, MEM_OBJ_STRING, cells[i], sizes[i]);
+  EXPECT_EQ(gc.stats.bytes[MEM_OBJ_STRING], (size_t)0);
+  freeGC(&gc);
+}
+
+UTEST(Pool, largeSizesFallThrough) {
+  GC gc;
+  initGC(&gc);
+
+  char *large = poolAllocate(&gc, MEM_OBJ_STRING, POOL_MAX_SIZE + 1);
+  memset(large, 'x', POOL_MAX_SIZE + 1);
+  EXPECT_EQ(gc.stats.poolBytes, (size_t)0);
+  EXPECT_EQ(gc.stats.bytes[MEM_OBJ_STRING], (size_t)POOL_MAX_SIZE + 1);
+
+  poolFree(&gc, MEM_OBJ_STRING, large, POOL_MAX_SIZE + 1);
+  EXPECT_EQ(gc.stats.bytesAllocated, (size_t)0);
+  freeGC(&gc);
+}
+
+UTEST(Pool, releasedCellsAreReused) {
+  GC gc;
+  initGC(&gc);
+
+  void *first = poolAllocate(&gc, MEM_OBJ_STRING, 24);
+  void *second = poolAllocate(&gc, MEM_OBJ_STRING, 24);
+
+  // Released cells are only reused once the free list is empty.
+  poolRelease(&gc.pool, first, 24);
+  trackAllocation(&gc, MEM_OBJ_STRING, 24, 0);
+  poolFree(&gc, MEM_OBJ_STRING, second, 24);
+  EXPECT_EQ(poolAllocate(&gc, MEM_OBJ_STRING, 24), second);
+  EXPECT_EQ(poolAllocate(&gc, MEM_OBJ_STRING, 24), first);
+  EXPECT_EQ(gc.stats.bytes[MEM_OBJ_STRING], (size_t)48);
+  freeGC(&gc);
+}
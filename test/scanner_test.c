@@ -1,3 +1,6 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "scanner.h"
 #include "token.h"
 #include "utest.h"
@@ -27,6 +30,7 @@ TokenTestCase tokenTestCases[] = {
     {.source = "{", .type = TOKEN_LEFT_BRACE, .len = 1},
     {.source = "}", .type = TOKEN_RIGHT_BRACE, .len = 1},
     {.source = ",", .type = TOKEN_COMMA, .len = 1},
+    {.source = ":", .type = TOKEN_COLON, .len = 1},
     {.source = ".", .type = TOKEN_DOT, .len = 1},
     {.source = "+", .type = TOKEN_PLUS, .len = 1},
     {.source = "-", .type = TOKEN_MINUS, .len = 1},
@@ -46,7 +50,9 @@ TokenTestCase tokenTestCases[] = {
 
     // Keywords
     {.source = "and", .type = TOKEN_AND, .len = 3},
+    {.source = "case", .type = TOKEN_CASE, .len = 4},
     {.source = "class", .type = TOKEN_CLASS, .len = 5},
+    {.source = "default", .type = TOKEN_DEFAULT, .len = 7},
     {.source = "else", .type = TOKEN_ELSE, .len = 4},
     {.source = "false", .type = TOKEN_FALSE, .len = 5},
     {.source = "for", .type = TOKEN_FOR, .len = 3},
@@ -57,6 +63,7 @@ TokenTestCase tokenTestCases[] = {
     {.source = "print", .type = TOKEN_PRINT, .len = 5},
     {.source = "return", .type = TOKEN_RETURN, .len = 6},
     {.source = "super", .type = TOKEN_SUPER, .len = 5},
+    {.source = "switch", .type = TOKEN_SWITCH, .len = 6},
     {.source = "this", .type = TOKEN_THIS, .len = 4},
     {.source = "true", .type = TOKEN_TRUE, .len = 4},
     {.source = "var", .type = TOKEN_VAR, .len = 3},
@@ -66,6 +73,16 @@ TokenTestCase tokenTestCases[] = {
     {.source = "\"myString\"", .type = TOKEN_STRING, .len = 10},
     {.source = "123.45", .type = TOKEN_NUMBER, .len = 6},
     {.source = "myVar", .type = TOKEN_IDENTIFIER, .len = 5},
+
+    // Identifiers which are prefixes, extensions or near misses of keywords.
+    {.source = "an", .type = TOKEN_IDENTIFIER, .len = 2},
+    {.source = "fork", .type = TOKEN_IDENTIFIER, .len = 4},
+    {.source = "classy", .type = TOKEN_IDENTIFIER, .len = 6},
+    {.source = "vat", .type = TOKEN_IDENTIFIER, .len = 3},
+    {.source = "returns", .type = TOKEN_IDENTIFIER, .len = 7},
+    {.source = "defaults", .type = TOKEN_IDENTIFIER, .len = 8},
+    {.source = "x", .type = TOKEN_IDENTIFIER, .len = 1},
+    {.source = "If", .type = TOKEN_IDENTIFIER, .len = 2},
 };
 
 UTEST(Scanner, scanToken) {
@@ -129,3 +146,199 @@ UTEST(Scanner, syntaxErrors) {
   ASSERT_EQ(token.type, (TokenType)TOKEN_ERROR);
   ASSERT_STREQ(token.start, "Unterminated string.");
 }
+
+typedef struct FuzzFragment {
+  const char *source;
+  TokenType type; // TOKEN_EOF for fragments which produce no token.
+  int newlines;
+} FuzzFragment;
+
+FuzzFragment fuzzFragments[] = {
+    {.source = "myVar", .type = TOKEN_IDENTIFIER, .newlines = 0},
+    {.source = "while", .type = TOKEN_WHILE, .newlines = 0},
+    {.source = "12.5", .type = TOKEN_NUMBER, .newlines = 0},
+    {.source = "<=", .type = TOKEN_LESS_EQUAL, .newlines = 0},
+    {.source = "\"\"", .type = TOKEN_STRING, .newlines = 0},
+    {.source = "\"a long string body, well past one vector\"",
+     .type = TOKEN_STRING,
+     .newlines = 0},
+    {.source = "\"multi\nline\n\"", .type = TOKEN_STRING, .newlines = 2},
+    {.source = "// comment \"with a quote\"\n", .type = TOKEN_EOF, .newlines = 1},
+    {.source = "//\n", .type = TOKEN_EOF, .newlines = 1},
+    {.source = "\n", .type = TOKEN_EOF, .newlines = 1},
+    {.source = " \t\r ", .type = TOKEN_EOF, .newlines = 0},
+    {.source = "                                        \n\n    ",
+     .type = TOKEN_EOF,
+     .newlines = 2},
+};
+
+// Scans sources built from random fragments, checking each token against the
+// position and line it was generated at.
+UTEST(Scanner, fuzzFragments) {
+  int n = ARRAY_SIZE(fuzzFragments);
+  char source[4096];
+  srand(4321);
+
+  for (int iteration = 0; iteration < 500; iteration++) {
+    struct {
+      int offset;
+      TokenType type;
+      int line;
+    } expected[128];
+    int expectedCount = 0, length = 0, line = 1;
+
+    while (expectedCount < 100) {
+      FuzzFragment *fragment = &fuzzFragments[rand() % n];
+      if (fragment->type != TOKEN_EOF) {
+        expected[expectedCount].offset = length;
+        expected[expectedCount].type = fragment->type;
+        expected[expectedCount].line = line + fragment->newlines;
+        expectedCount++;
+      }
+
+      // Separate fragments so neighbouring tokens cannot merge.
+      length += sprintf(source + length, "%s ", fragment->source);
+      line += fragment->newlines;
+    }
+
+    Scanner scanner;
+    initScanner(&scanner, source);
+
+    for (int i = 0; i < expectedCount; i++) {
+      Token token = scanToken(&scanner);
+      ASSERT_EQ(token.type, expected[i].type);
+      ASSERT_EQ(token.start - source, expected[i].offset);
+      ASSERT_EQ(token.line, expected[i].line);
+    }
+
+    Token eof = scanToken(&scanner);
+    ASSERT_EQ(eof.type, (TokenType)TOKEN_EOF);
+    ASSERT_EQ(eof.line, line);
+  }
+}
+
+static double strtodToken(Token token) {
+  char text[512];
+  memcpy(text, token.start, token.length);
+  text[token.length] = '\0';
+  return strtod(text, NULL);
+}
+
+// Number literals must convert to exactly the double strtod gives.
+UTEST(Scanner, numberValues) {
+  const char *literals[] = {
+      "0",
+      "0.0",
+      "00012.5000",
+      "1.5",
+      "0.1",
+      "0.3",
+      "123.456",
+      "2.2250738585072014",
+      "4503599627370497.5",
+      "9007199254740991",
+      "9007199254740992",
+      "9007199254740993",
+      "18446744073709551615",
+      "18446744073709551616",
+      "1234567890123456789",
+      "12345678901234567890",
+      "123456789012345678901234567890",
+      "3.141592653589793238462643383279502884197",
+      "0.0000000000000000000001",
+      "0.00000000000000000000001",
+      "0.000000000000000000000000000000000000000001",
+      "1.0000000000000000000000000000000000000000001",
+      "179769313486231570000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000000"
+      "000000000000000000000000000000000000000000000000000000000000000000000"
+      "00000000000000000000000000000000",
+  };
+
+  int n = ARRAY_SIZE(literals);
+  for (int i = 0; i < n; i++) {
+    Scanner scanner;
+    initScanner(&scanner, literals[i]);
+    Token token = scanToken(&scanner);
+
+    ASSERT_EQ(token.type, (TokenType)TOKEN_NUMBER);
+    ASSERT_EQ(token.length, (int)strlen(literals[i]));
+    ASSERT_EQ(token.number, strtodToken(token));
+    ASSERT_EQ(parseNumber(token.start, token.length), token.number);
+  }
+}
+
+// Literals with more digits than parsing keeps, where those dropped still
+// decide how the value rounds: a halfway point between two doubles followed
+// by a far off 1, and a small number with many significant digits.
+UTEST(Scanner, longNumberValues) {
+  static char source[2048];
+
+  for (int i = 0; i < 2; i++) {
+    int length;
+    if (i == 0) {
+      length = sprintf(source, "9007199254740993.");
+      length += sprintf(source + length, "%01000d", 1);
+    } else {
+      length = sprintf(source, "0.%0300d", 0);
+      for (int j = 0; j < 1000; j++)
+        source[length++] = '1' + j % 9;
+      source[length] = '\0';
+    }
+
+    Scanner scanner;
+    initScanner(&scanner, source);
+    Token token = scanToken(&scanner);
+
+    ASSERT_EQ(token.length, length);
+    ASSERT_EQ(token.number, strtod(source, NULL));
+    ASSERT_EQ(parseNumber(token.start, token.length), token.number);
+  }
+}
+
+// Characters strtod would accept, but which are not part of the literal.
+UTEST(Scanner, numberStopsAtLiteralEnd) {
+  Scanner scanner;
+
+  initScanner(&scanner, "1e5");
+  Token token = scanToken(&scanner);
+  ASSERT_EQ(token.length, 1);
+  ASSERT_EQ(token.number, 1.0);
+
+  initScanner(&scanner, "0x10");
+  token = scanToken(&scanner);
+  ASSERT_EQ(token.length, 1);
+  ASSERT_EQ(token.number, 0.0);
+
+  initScanner(&scanner, "2.");
+  token = scanToken(&scanner);
+  ASSERT_EQ(token.length, 1);
+  ASSERT_EQ(token.number, 2.0);
+}
+
+UTEST(Scanner, numberValuesFuzz) {
+  char source[64];
+  srand(2468);
+
+  for (int i = 0; i < 100000; i++) {
+    int integerDigits = 1 + rand() % 20, fractionDigits = rand() % 25;
+    int length = 0;
+
+    for (int j = 0; j < integerDigits; j++)
+      source[length++] = '0' + rand() % 10;
+    if (fractionDigits > 0) {
+      source[length++] = '.';
+      for (int j = 0; j < fractionDigits; j++)
+        source[length++] = '0' + rand() % 10;
+    }
+    source[length] = '\0';
+
+    Scanner scanner;
+    initScanner(&scanner, source);
+    Token token = scanToken(&scanner);
+
+    ASSERT_EQ(token.length, length);
+    ASSERT_EQ(token.number, strtod(source, NULL));
+  }
+}
@@ -28,13 +28,14 @@ UTEST(Table, crudOperations) {
   EXPECT_FALSE(tableDelete(&table, foo));
 
   // Insert foo.
-  EXPECT_TRUE(tableSet(&table, foo, NUMBER_VAL(6.9)));
+  EXPECT_TRUE(tableSet(&gc, &table, foo, NUMBER_VAL(6.9)));
   EXPECT_TRUE(tableGet(&table, foo, &fooVal));
   EXPECT_TRUE(IS_NUMBER(fooVal));
   EXPECT_EQ(AS_NUMBER(fooVal), 6.9);
 
   // Update foo.
-  EXPECT_FALSE(tableSet(&table, foo, NUMBER_VAL(4.2))); // Key not new => false.
+  // Key not new => false.
+  EXPECT_FALSE(tableSet(&gc, &table, foo, NUMBER_VAL(4.2)));
   EXPECT_TRUE(tableGet(&table, foo, &fooVal));
   EXPECT_TRUE(IS_NUMBER(fooVal));
   EXPECT_EQ(AS_NUMBER(fooVal), 4.2);
@@ -43,7 +44,7 @@ UTEST(Table, crudOperations) {
   EXPECT_TRUE(tableDelete(&table, foo));
   EXPECT_FALSE(tableGet(&table, foo, &fooVal));
 
-  freeTable(&table);
-  freeTable(&strings);
+  freeTable(&gc, &table);
+  freeTable(&gc, &strings);
   freeGC(&gc);
 }
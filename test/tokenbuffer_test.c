@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "scanner.h"
+#include "token.h"
+#include "tokenbuffer.h"
+#include "utest.h"
+
+static char *repeatedSource(const char *fragment, int times) {
+  size_t n = strlen(fragment);
+  char *source = malloc(n * times + 1);
+  for (int i = 0; i < times; i++)
+    memcpy(source + i * n, fragment, n);
+  source[n * times] = '\0';
+  return source;
+}
+
+// Checks the buffered tokens are exactly those produced by the scanner.
+static int matchesScanner(TokenBuffer *buffer, const char *source) {
+  Scanner scanner;
+  initScanner(&scanner, source);
+
+  for (int i = 0;; i++) {
+    Token expected = scanToken(&scanner), actual = tokenAt(buffer, i);
+    if (expected.type != actual.type || expected.start != actual.start ||
+        expected.length != actual.length || expected.line != actual.line)
+      return 0;
+    if (expected.type == TOKEN_EOF)
+      return 1;
+  }
+}
+
+UTEST(TokenBuffer, upfront) {
+  // Spans several token blocks.
+  char *source = repeatedSource("var x = \"a\nb\"; { print x >= 1.5; }\n", 2000);
+
+  TokenBuffer buffer;
+  initTokenBuffer(&buffer, source, false);
+  ASSERT_TRUE(matchesScanner(&buffer, source));
+  freeTokenBuffer(&buffer);
+
+  free(source);
+}
+
+UTEST(TokenBuffer, threaded) {
+  char *source = repeatedSource("var x = \"a\nb\"; { print x >= 1.5; }\n", 2000);
+
+  TokenBuffer buffer;
+  initTokenBuffer(&buffer, source, true);
+  ASSERT_TRUE(matchesScanner(&buffer, source));
+  freeTokenBuffer(&buffer);
+
+  free(source);
+}
+
+UTEST(TokenBuffer, lookaheadPastEnd) {
+  TokenBuffer buffer;
+  initTokenBuffer(&buffer, "print", true);
+
+  // Reading far ahead first, before the earlier tokens, is allowed.
+  ASSERT_EQ(tokenAt(&buffer, 100).type, (TokenType)TOKEN_EOF);
+  ASSERT_EQ(tokenAt(&buffer, 0).type, (TokenType)TOKEN_PRINT);
+  ASSERT_EQ(tokenAt(&buffer, 1).type, (TokenType)TOKEN_EOF);
+  ASSERT_EQ(tokenAt(&buffer, 2).type, (TokenType)TOKEN_EOF);
+
+  freeTokenBuffer(&buffer);
+}
+
+UTEST(TokenBuffer, errorTokens) {
+  TokenBuffer buffer;
+  initTokenBuffer(&buffer, "$ \"unterminated", false);
+
+  Token token = tokenAt(&buffer, 0);
+  ASSERT_EQ(token.type, (TokenType)TOKEN_ERROR);
+  ASSERT_STREQ(token.start, "Unexpected character.");
+
+  token = tokenAt(&buffer, 1);
+  ASSERT_EQ(token.type, (TokenType)TOKEN_ERROR);
+  ASSERT_STREQ(token.start, "Unterminated string.");
+
+  freeTokenBuffer(&buffer);
+}
@@ -1,36 +1,45 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "object.h"
 #include "utest.h"
 #include "value.h"
 
 struct ValueTestFixture {
   ValueArray valueArray;
+  GC gc;
 };
 
 UTEST_F_SETUP(ValueTestFixture) {
   initValueArray(&utest_fixture->valueArray);
+  initGC(&utest_fixture->gc);
   ASSERT_TRUE(1);
 }
 
 UTEST_F_TEARDOWN(ValueTestFixture) {
-  freeValueArray(&utest_fixture->valueArray);
+  freeValueArray(&utest_fixture->gc, &utest_fixture->valueArray);
+  freeGC(&utest_fixture->gc);
   ASSERT_TRUE(1);
 }
 
 UTEST_F(ValueTestFixture, initValueArray) {
-  ValueArray valueArray = utest_fixture->valueArray;
+  ValueArray *valueArray = &utest_fixture->valueArray;
 
-  ASSERT_EQ(valueArray.count, 0);
-  ASSERT_EQ(valueArray.capacity, 0);
-  ASSERT_EQ(valueArray.values, NULL);
+  ASSERT_EQ(valueArray->count, 0);
+  ASSERT_EQ(valueArray->capacity, 0);
+  ASSERT_EQ(valueArray->values, NULL);
 }
 
 UTEST_F(ValueTestFixture, appendValueArray) {
-  ValueArray valueArray = utest_fixture->valueArray;
+  ValueArray *valueArray = &utest_fixture->valueArray;
 
-  appendValueArray(&valueArray, NUMBER_VAL(6.9));
+  appendValueArray(&utest_fixture->gc, valueArray, NUMBER_VAL(6.9));
 
-  ASSERT_EQ(valueArray.count, 1);
-  ASSERT_EQ(AS_NUMBER(valueArray.values[0]), 6.9);
+  ASSERT_EQ(valueArray->count, 1);
+  ASSERT_EQ(AS_NUMBER(valueArray->values[0]), 6.9);
 }
 
 UTEST(Value, valuesEqual) {
@@ -63,6 +72,75 @@ UTEST(Value, valuesEqual) {
   b = OBJ_VAL(copyString(&gc, &strings, "Hello", 5));
   EXPECT_TRUE(valuesEqual(a, b));
 
+  freeTable(&gc, &strings);
+  freeGC(&gc);
+}
+
+static void expectFormatMatchesPrintf(int *utest_result, double number) {
+  char expected[64], actual[NUMBER_FORMAT_MAX];
+  snprintf(expected, sizeof(expected), "%g", number);
+
+  int length = formatNumber(number, actual);
+  EXPECT_STREQ(actual, expected);
+  EXPECT_EQ(length, (int)strlen(expected));
+}
+
+UTEST(Value, formatNumber) {
+  double numbers[] = {0,         -0.0,      1,          -1,       0.5,
+                      0.1,       0.3,       1.0 / 3,    2.5,      123456,
+                      -123456,   999999,    999999.4,   999999.5, 1e6,
+                      1234565,   1234575,   9999995,    1e15,     1e16,
+                      9007199254740993.0,   0.0001,     0.00012345,
+                      0.0000999, 1e-5,      12.5e-5,    3.14159265,
+                      1e300,     -1e-300,   INFINITY,   -INFINITY, NAN};
+
+  int n = sizeof(numbers) / sizeof(numbers[0]);
+  for (int i = 0; i < n; i++) {
+    expectFormatMatchesPrintf(utest_result, numbers[i]);
+  }
+}
+
+UTEST(Value, formatNumberFuzz) {
+  srand(1357);
+
+  for (int i = 0; i < 200000; i++) {
+    double number;
+    switch (i % 4) {
+    case 0: // Short decimals, as most programs print.
+      number = (rand() % 2000000 - 1000000) / (double)(1 << (rand() % 12));
+      break;
+    case 1:
+      number = (rand() % 1000000) / pow(10, rand() % 10);
+      break;
+    case 2: // Large integers.
+      number = (double)((uint64_t)rand() * rand() * (rand() % 1000));
+      break;
+    default: // Any magnitude.
+      number = (double)rand() / RAND_MAX * pow(10, rand() % 40 - 20);
+    }
+    expectFormatMatchesPrintf(utest_result, number);
+  }
+}
+
+UTEST(Value, writeValue) {
+  GC gc;
+  initGC(&gc);
+  Table strings;
+  initTable(&strings);
+
+  Output output;
+  initOutput(&output, stdout);
+
+  writeValue(&output, NUMBER_VAL(2.5));
+  writeValue(&output, BOOL_VAL(true));
+  writeValue(&output, BOOL_VAL(false));
+  writeValue(&output, NIL_VAL);
+  writeValue(&output, OBJ_VAL(copyString(&gc, &strings, "str", 3)));
+
+  ASSERT_EQ(output.length, 18);
+  ASSERT_EQ(memcmp(output.buffer, "2.5truefalsenilstr", 18), 0);
+  output.length = 0; // Nothing to flush in the test's output.
+
+  freeTable(&gc, &strings);
   freeGC(&gc);
-  freeTable(&strings);
 }
@@ -0,0 +1,239 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "utest.h"
+#include "value.h"
+#include "verifier.h"
+
+struct VerifierTestFixture {
+  Chunk chunk;
+  GC gc;
+  Table strings;
+};
+
+UTEST_F_SETUP(VerifierTestFixture) {
+  initChunk(&utest_fixture->chunk);
+  initGC(&utest_fixture->gc);
+  initTable(&utest_fixture->strings);
+  ASSERT_TRUE(1);
+}
+
+UTEST_F_TEARDOWN(VerifierTestFixture) {
+  freeTable(&utest_fixture->gc, &utest_fixture->strings);
+  freeChunk(&utest_fixture->gc, &utest_fixture->chunk);
+  freeGC(&utest_fixture->gc);
+  ASSERT_TRUE(1);
+}
+
+UTEST_F(VerifierTestFixture, compiledCodeVerifies) {
+  const char *source =
+      "var g = 1;"
+      "fun add(a, b) { return a + b; }"
+      "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }"
+      "fun outer(x) { fun inner(y) { return y * 2; } return inner(x); }"
+      "fun counter() { var n = 0; fun next() { n = n + 1; return n; }"
+      "  return next; }"
+      "fun nest(a) { fun b() { fun c() { return a; } return c; } return b; }"
+      "{"
+      "  var sum = 0;"
+      "  for (var i = 0; i < 10; i = i + 1) sum = sum + add(i, g);"
+      "  for (var i = 10; i >= 0; i = i - 2) { if (i == 4) sum = -sum; }"
+      "  while (sum > 0 and !false or nil) sum = sum - 7;"
+      "  switch (sum) { case 1: print 1; case 2: print 2; case 3: print 3;"
+      "                 default: print 0; }"
+      "  switch (g) { case 1: print 1; case 100: print 100; case 7: print 7;"
+      "               case 9: print 9; case 50: print 50; case 3: print 3; }"
+      "  print fib(outer(3)) + (g = 2);"
+      "  var x = 1; fun f() { return x; }"
+      "  fun down(n) { if (n > 0) return down(n - 1); return n; }"
+      "  print f() + counter()() + nest(1)()() + down(3);"
+      "}";
+
+  ASSERT_TRUE(compile(source, &utest_fixture->chunk, &utest_fixture->gc,
+                      &utest_fixture->strings));
+
+  // Compiled code is marked verified without running the verifier.
+  ASSERT_TRUE(utest_fixture->chunk.verified);
+  VerifyError error;
+  EXPECT_TRUE(verifyChunk(&utest_fixture->chunk, &error));
+}
+
+// Verifies code written byte by byte, with the constants 1 and "a".
+static bool verifyWritten(GC *gc, Table *strings, const uint8_t *code,
+                          int count, int maxStackDepth, VerifyError *error) {
+  Chunk chunk;
+  initChunk(&chunk);
+  for (int i = 0; i < count; i++)
+    writeChunk(gc, &chunk, code[i], 1);
+  addConstant(gc, &chunk, NUMBER_VAL(1));
+  addConstant(gc, &chunk, OBJ_VAL(copyString(gc, strings, "a", 1)));
+  chunk.maxStackDepth = maxStackDepth;
+
+  bool verified = verifyChunk(&chunk, error);
+  freeChunk(gc, &chunk);
+  return verified;
+}
+
+#define RejectTest(maxStackDepth, expectedOffset, expectedMessage, ...)        \
+  const uint8_t code[] = {__VA_ARGS__};                                        \
+  VerifyError error;                                                           \
+                                                                               \
+  ASSERT_FALSE(verifyWritten(&utest_fixture->gc, &utest_fixture->strings,     \
+                             code, sizeof(code), maxStackDepth, &error));      \
+  EXPECT_EQ(error.offset, expectedOffset);                                     \
+  EXPECT_STREQ(error.message, expectedMessage);
+
+UTEST_F(VerifierTestFixture, acceptsWrittenCode) {
+  const uint8_t code[] = {OP_CONSTANT, 0,  OP_JUMP_IF_FALSE_POP, 0, 5, OP_NIL,
+                          OP_POP,      OP_LOOP, 0, 10, OP_RETURN};
+  VerifyError error;
+
+  EXPECT_TRUE(verifyWritten(&utest_fixture->gc, &utest_fixture->strings, code,
+                            sizeof(code), 1, &error));
+}
+
+UTEST_F(VerifierTestFixture, rejectsUnknownOpcode) {
+  RejectTest(1, 1, "Unknown opcode.", OP_NIL, OP_COUNT, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsTruncatedInstruction) {
+  RejectTest(1, 2, "Instruction runs past the end.", OP_NIL, OP_POP,
+             OP_CONSTANT);
+}
+
+UTEST_F(VerifierTestFixture, rejectsConstantOutOfRange) {
+  RejectTest(1, 0, "Constant out of range.", OP_CONSTANT, 2, OP_POP,
+             OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsGlobalNamedByNumber) {
+  RejectTest(1, 0, "Global name is not a string.", OP_GET_GLOBAL, 0, OP_POP,
+             OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsLocalOutOfRange) {
+  // Reads the slot of the value it pushes.
+  RejectTest(2, 1, "Local out of range.", OP_NIL, OP_GET_LOCAL, 1, OP_POP,
+             OP_POP, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsJumpIntoInstruction) {
+  RejectTest(1, 0, "Jump into an instruction.", OP_JUMP, 0, 1, OP_CONSTANT, 0,
+             OP_POP, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsJumpOutOfCode) {
+  RejectTest(1, 0, "Jump out of the code.", OP_LOOP, 0, 4, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsRunningPastEnd) {
+  RejectTest(1, 1, "Code runs past the end.", OP_NIL, OP_POP);
+}
+
+UTEST_F(VerifierTestFixture, rejectsUnderflow) {
+  RejectTest(1, 0, "Stack underflow.", OP_POP, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsDepthOverMaximum) {
+  RejectTest(1, 1, "Stack deeper than its maxStackDepth.", OP_NIL, OP_NIL,
+             OP_POP, OP_POP, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsDepthDifferingBetweenPaths) {
+  // Skipping the nil leaves the stack a value shallower at the return.
+  RejectTest(1, 4, "Stack depth differs between paths.", OP_TRUE,
+             OP_JUMP_IF_FALSE_POP, 0, 1, OP_NIL, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsUnknownComparison) {
+  RejectTest(2, 2, "Unknown comparison.", OP_NIL, OP_NIL, OP_FOR_RANGE, 0,
+             1, OP_ADD, 0, 0, 7, OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsUpvalueOutOfRange) {
+  // The script has no upvalues.
+  RejectTest(1, 0, "Upvalue out of range.", OP_GET_UPVALUE, 0, OP_POP,
+             OP_RETURN);
+}
+
+UTEST_F(VerifierTestFixture, rejectsTailCallNotReturning) {
+  RejectTest(1, 1, "Tail call not followed by a return.", OP_NIL,
+             OP_TAIL_CALL, 0, OP_POP, OP_NIL, OP_RETURN);
+}
+
+// Finds the first function among a chunk's constants.
+static ObjFunction *functionConstant(const Chunk *chunk) {
+  for (int i = 0; i < chunk->constants.count; i++) {
+    if (IS_FUNCTION(chunk->constants.values[i]))
+      return AS_FUNCTION(chunk->constants.values[i]);
+  }
+  return NULL;
+}
+
+UTEST_F(VerifierTestFixture, rejectsBrokenClosure) {
+  GC *gc = &utest_fixture->gc;
+  Chunk *chunk = &utest_fixture->chunk;
+  ASSERT_TRUE(compile("fun f(a) { fun g() { return a; } return g; }", chunk,
+                      gc, &utest_fixture->strings));
+  ObjFunction *f = functionConstant(chunk);
+  ASSERT_NE(f, NULL);
+  ASSERT_EQ(f->chunk.code[0], OP_CLOSURE);
+  ASSERT_EQ(f->chunk.code[3], 1);
+  VerifyError error;
+
+  // Captures a local past the frame's only one, and the slot g is pushed into.
+  f->chunk.code[4] = 2;
+  ASSERT_FALSE(verifyChunk(chunk, &error));
+  EXPECT_EQ(error.chunk, &f->chunk);
+  EXPECT_EQ(error.offset, 0);
+  EXPECT_STREQ(error.message, "Local out of range.");
+
+  // Shares an upvalue f does not have.
+  f->chunk.code[3] = 0;
+  f->chunk.code[4] = 0;
+  ASSERT_FALSE(verifyChunk(chunk, &error));
+  EXPECT_STREQ(error.message, "Upvalue out of range.");
+
+  // Pushes g, which needs its upvalue, without one.
+  f->chunk.code[0] = OP_CONSTANT;
+  f->chunk.code[2] = OP_NIL;
+  f->chunk.code[3] = OP_POP;
+  f->chunk.code[4] = OP_NIL;
+  ASSERT_FALSE(verifyChunk(chunk, &error));
+  EXPECT_EQ(error.offset, 0);
+  EXPECT_STREQ(error.message, "Function with upvalues not in a closure.");
+}
+
+UTEST_F(VerifierTestFixture, rejectsBrokenFunction) {
+  GC *gc = &utest_fixture->gc;
+  Chunk *chunk = &utest_fixture->chunk;
+  ASSERT_TRUE(compile("fun f(a) { return a; } f(1);", chunk, gc,
+                      &utest_fixture->strings));
+
+  ObjFunction *function = functionConstant(chunk);
+  ASSERT_NE(function, NULL);
+  ASSERT_EQ(function->chunk.code[0], OP_GET_LOCAL);
+  chunk->verified = false;
+  function->chunk.verified = false;
+  VerifyError error;
+  ASSERT_TRUE(verifyChunk(chunk, &error));
+  EXPECT_TRUE(chunk->verified);
+  EXPECT_TRUE(function->chunk.verified);
+
+  // Pops below its frame, which leaves the script unverified too.
+  chunk->verified = false;
+  function->chunk.verified = false;
+  function->chunk.code[0] = OP_POP;
+  function->chunk.code[1] = OP_POP;
+  ASSERT_FALSE(verifyChunk(chunk, &error));
+  EXPECT_FALSE(chunk->verified);
+  EXPECT_FALSE(function->chunk.verified);
+  EXPECT_EQ(error.chunk, &function->chunk);
+  EXPECT_EQ(error.offset, 1);
+  EXPECT_STREQ(error.message, "Stack underflow.");
+}
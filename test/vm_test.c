@@ -1,3 +1,7 @@
+#include <string.h>
+
+#include "compiler.h"
+#include "object.h"
 #include "utest.h"
 #include "vm.h"
 
@@ -52,3 +56,622 @@ UTEST_F(VMTestFixture, localVariable) {
   InterpretResult result = interpret(&utest_fixture->vm, "{ var x = 6.9; x; }");
   ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
 }
+
+UTEST_F(VMTestFixture, printIsBuffered) {
+  InterpretResult result = interpret(
+      &utest_fixture->vm, "print 1.5; print \"a\" + \"b\"; print nil == nil;");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+
+  Output *output = &utest_fixture->vm.output;
+  ASSERT_EQ(output->length, 12);
+  ASSERT_EQ(memcmp(output->buffer, "1.5\nab\ntrue\n", 12), 0);
+  output->length = 0; // Nothing to flush in the test's output.
+}
+
+UTEST(VM, memoryStatsBalance) {
+  VM vm;
+  initVM(&vm);
+  ASSERT_EQ(interpret(&vm, "var a = \"x\" + \"y\"; var b = a + a;"),
+            (InterpretResult)INTERPRET_OK);
+
+  MemoryStats stats = vmMemoryStats(&vm);
+  EXPECT_GT(stats.bytes[MEM_OBJ_STRING], (size_t)0);
+  EXPECT_GT(stats.bytes[MEM_TABLE], (size_t)0);
+  EXPECT_EQ(stats.bytes[MEM_STACK], sizeof(Value) * STACK_MIN);
+
+  size_t sum = 0;
+  for (int i = 0; i < MEM_CATEGORY_COUNT; i++)
+    sum += stats.bytes[i];
+  EXPECT_EQ(sum, stats.bytesAllocated);
+  EXPECT_GE(stats.peakBytesAllocated, stats.bytesAllocated);
+
+  freeVM(&vm);
+  EXPECT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+}
+
+// A chunk compiled by one VM runs in another, with strings interned by the VM
+// running it.
+UTEST(VM, sharedChunk) {
+  VM owner, other;
+  initVM(&owner);
+  initVM(&other);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  ASSERT_TRUE(compile("var s = \"ab\"; print s == \"a\" + \"b\"; print s;",
+                      &chunk, &owner.gc, &owner.strings));
+  ASSERT_TRUE(chunk.finalized);
+
+  VM *vms[] = {&owner, &other, &other};
+  for (int i = 0; i < 3; i++) {
+    Output *output = &vms[i]->output;
+    ASSERT_EQ(interpretChunk(vms[i], &chunk), (InterpretResult)INTERPRET_OK);
+    ASSERT_EQ(output->length, 8);
+    ASSERT_EQ(memcmp(output->buffer, "true\nab\n", 8), 0);
+    output->length = 0;
+  }
+
+  // The other VM has its own copy of the string, in its own heap.
+  ObjString *name = copyString(&other.gc, &other.strings, "s", 1);
+  Value s;
+  ASSERT_TRUE(tableGet(&other.globals, name, &s));
+  ASSERT_NE(AS_OBJ(s), AS_OBJ(chunk.constants.values[1]));
+  ASSERT_EQ(other.gc.stats.bytes[MEM_CONSTANTS], (size_t)0);
+
+  freeChunk(&owner.gc, &chunk);
+  freeVM(&other);
+  freeVM(&owner);
+}
+
+// A script outgrowing the heap's limit fails, and leaves the VM usable.
+UTEST(VM, outOfMemory) {
+  VM vm;
+  initVM(&vm);
+  vm.gc.heapLimit = 1024 * 1024;
+
+  static char source[1024];
+  int length = sprintf(source, "var s = \"0123456789abcdef\";\n");
+  for (int i = 0; i < 30; i++)
+    length += sprintf(source + length, "s = s + s;\n");
+  ASSERT_EQ(interpret(&vm, source), (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  ASSERT_LE(vm.gc.stats.peakBytesAllocated, vm.gc.heapLimit);
+
+  // The global keeps the largest string that fit, until it is cleared.
+  ASSERT_EQ(interpret(&vm, "s = nil; print \"a\" + \"b\";"),
+            (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(memcmp(vm.output.buffer, "ab\n", 3), 0);
+  vm.output.length = 0;
+
+  freeVM(&vm);
+  ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+}
+
+// Defining globals fails once their table has no room to grow, and leaves the
+// VM usable, with the globals defined so far.
+UTEST(VM, outOfMemoryGrowingGlobals) {
+  VM vm;
+  initVM(&vm);
+
+  static char source[4096];
+  int length = 0;
+  for (int i = 0; i < 200; i++)
+    length += sprintf(source + length, "var g%d;\n", i);
+  Chunk chunk;
+  initChunk(&chunk);
+  ASSERT_TRUE(compile(source, &chunk, &vm.gc, &vm.strings));
+
+  // Room for anything but the table growing.
+  vm.gc.heapLimit = vm.gc.stats.bytesAllocated + 4096;
+  ASSERT_EQ(interpretChunk(&vm, &chunk),
+            (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  ASSERT_LE(vm.gc.stats.bytesAllocated, vm.gc.heapLimit);
+  freeChunk(&vm.gc, &chunk);
+
+  vm.gc.heapLimit = SIZE_MAX;
+  ASSERT_EQ(interpret(&vm, "var after = \"ok\"; print g0; print after;"),
+            (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(memcmp(vm.output.buffer, "nil\nok\n", 7), 0);
+  vm.output.length = 0;
+
+  freeVM(&vm);
+  ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+}
+
+// Interning another VM's strings fails once the heap has no room for them, and
+// what was imported so far is let go.
+UTEST(VM, outOfMemoryInterningStrings) {
+  VM owner, vm;
+  initVM(&owner);
+  initVM(&vm);
+
+  static char source[32 * 1024];
+  int length = 0;
+  for (int i = 0; i < 100; i++)
+    length += sprintf(source + length, "var s%d = \"%0200d\";\n", i, i);
+  Chunk chunk;
+  initChunk(&chunk);
+  ASSERT_TRUE(compile(source, &chunk, &owner.gc, &owner.strings));
+
+  size_t strings = vm.gc.stats.bytes[MEM_OBJ_STRING];
+  vm.gc.heapLimit = vm.gc.stats.bytesAllocated + 8 * 1024;
+  ASSERT_EQ(interpretChunk(&vm, &chunk),
+            (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  ASSERT_LE(vm.gc.stats.peakBytesAllocated, vm.gc.heapLimit);
+  ASSERT_EQ(vm.gc.stats.bytes[MEM_OBJ_STRING], strings);
+  ASSERT_EQ(vm.gc.stats.bytes[MEM_CONSTANTS], (size_t)0);
+  ASSERT_FALSE(vm.gc.pretenure);
+  ASSERT_TRUE(vm.gc.outOfMemory == NULL);
+
+  vm.gc.heapLimit = SIZE_MAX;
+  ASSERT_EQ(interpretChunk(&vm, &chunk), (InterpretResult)INTERPRET_OK);
+  ObjString *name = copyString(&vm.gc, &vm.strings, "s99", 3);
+  Value s;
+  ASSERT_TRUE(tableGet(&vm.globals, name, &s));
+  ASSERT_EQ(AS_STRING(s)->length, 200);
+
+  freeChunk(&owner.gc, &chunk);
+  freeVM(&vm);
+  freeVM(&owner);
+}
+
+// Compiling past the heap's limit fails as running out of memory does, once
+// the compiler's memory is freed, and leaves the VM usable.
+UTEST(VM, outOfMemoryCompiling) {
+  VM vm;
+  initVM(&vm);
+
+  static char source[32 * 1024];
+  int length = 0;
+  for (int i = 0; i < 100; i++)
+    length += sprintf(source + length, "print \"%0200d\";\n", i);
+
+  size_t strings = vm.gc.stats.bytes[MEM_OBJ_STRING];
+  // Room for the compiler's scratch memory, but not every literal.
+  vm.gc.heapLimit = vm.gc.stats.bytesAllocated + ARENA_BLOCK_SIZE + 8 * 1024;
+  ASSERT_EQ(interpret(&vm, source), (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  ASSERT_LE(vm.gc.stats.peakBytesAllocated, vm.gc.heapLimit);
+  ASSERT_EQ(vm.gc.stats.bytes[MEM_COMPILER], (size_t)0);
+  ASSERT_EQ(vm.gc.stats.bytes[MEM_OBJ_STRING], strings);
+  ASSERT_EQ(vm.output.length, 0);
+  ASSERT_FALSE(vm.gc.pretenure);
+  ASSERT_TRUE(vm.gc.outOfMemory == NULL);
+
+  ASSERT_EQ(interpret(&vm, "print \"ok\";"), (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(memcmp(vm.output.buffer, "ok\n", 3), 0);
+  vm.output.length = 0;
+
+  freeVM(&vm);
+  ASSERT_EQ(vm.gc.stats.bytesAllocated, (size_t)0);
+}
+
+UTEST_F(VMTestFixture, controlFlow) {
+  InterpretResult result = interpret(
+      &utest_fixture->vm,
+      "var sum = 0;\n"
+      "for (var i = 0; i < 10; i = i + 1) {\n"
+      "  if (i == 3 or i >= 8) sum = sum + 100; else sum = sum + i;\n"
+      "}\n"
+      "var j = 0; while (j <= 4 and j != 9) j = j + 1;\n"
+      "print sum; print j; print nil or \"x\"; print false and 1;");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+
+  Output *output = &utest_fixture->vm.output;
+  ASSERT_EQ(output->length, 14);
+  ASSERT_EQ(memcmp(output->buffer, "325\n5\nx\nfalse\n", 14), 0);
+  output->length = 0;
+}
+
+UTEST_F(VMTestFixture, fusedComparisonChecksOperands) {
+  InterpretResult result =
+      interpret(&utest_fixture->vm, "while (\"a\" < 1) print 1;");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_RUNTIME_ERROR);
+}
+
+UTEST_F(VMTestFixture, rangeLoops) {
+  InterpretResult result = interpret(
+      &utest_fixture->vm,
+      "{ var n = 5; var total = 0;\n"
+      "  for (var i = 0; i < n; i = i + 1) total = total + i;\n"
+      "  print total;\n"
+      "  for (var i = 10; i >= 0; i = i - 2.5) print i;\n"
+      "  for (var i = 0; i <= 3; i = i + 1) { if (i == 1) i = 2; print i; }\n"
+      "  for (var i = 0; i < n; i = i + 1) { n = n - 1; print i; }\n"
+      "  for (var i = 5; i < 3; i = i + 1) print 0; }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+
+  const char *expected = "10\n10\n7.5\n5\n2.5\n0\n0\n2\n3\n0\n1\n2\n";
+  Output *output = &utest_fixture->vm.output;
+  ASSERT_EQ(output->length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(output->buffer, expected, strlen(expected)), 0);
+  output->length = 0;
+
+  // The bound is read where it is, so a closure made after the loop, which
+  // the loop calls when run again, assigns it too.
+  result = interpret(
+      &utest_fixture->vm,
+      "var f; { var n = 3; var runs = 0; while (runs < 2) { var count = 0;\n"
+      "  for (var i = 0; i < n; i = i + 1) {\n"
+      "    count = count + 1; if (f != nil) f(); }\n"
+      "  print count; fun shrink() { n = 1; } f = shrink;\n"
+      "  runs = runs + 1; } }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+  expected = "3\n1\n";
+  ASSERT_EQ(output->length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(output->buffer, expected, strlen(expected)), 0);
+  output->length = 0;
+
+  // The bound is checked to be a number before the first iteration, and
+  // each one after.
+  result = interpret(&utest_fixture->vm,
+                     "{ var n = \"9\"; for (var i = 0; i < n; i = i + 1) {} }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  result = interpret(
+      &utest_fixture->vm,
+      "{ var n = 9; for (var i = 0; i < n; i = i + 1) n = \"9\"; }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_RUNTIME_ERROR);
+}
+
+UTEST_F(VMTestFixture, switchStatement) {
+  InterpretResult result = interpret(
+      &utest_fixture->vm,
+      "for (var i = 0; i < 5; i = i + 1) switch (i) {\n"
+      "  case 1: case 2: print \"low\";\n"
+      "  case 4: { var twice = i * 2; print twice; }\n"
+      "  default: print i;\n"
+      "}\n"
+      "switch (\"e\") { case \"a\": print 1; case \"b\": print 2;\n"
+      "  case \"c\": print 3; case \"d\": print 4; case \"e\": print 5;\n"
+      "  case nil: print 6; }\n"
+      "switch (1.5) { case 1: print 1; case 2: print 2; }\n"
+      "switch (-3) { case true: print 1; case -3: print 2; }\n"
+      "switch (7) {} print \"end\";");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+
+  const char *expected = "0\nlow\nlow\n3\n8\n5\n2\nend\n";
+  Output *output = &utest_fixture->vm.output;
+  ASSERT_EQ(output->length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(output->buffer, expected, strlen(expected)), 0);
+  output->length = 0;
+
+  // Subjects of any type are looked up among the cases of a hash table.
+  result = interpret(
+      &utest_fixture->vm,
+      "fun f() {} { var x = 1; fun g() { return x; }\n"
+      "  var subjects = 0; while (subjects < 3) {\n"
+      "    var s = f; if (subjects == 1) s = g; if (subjects == 2) s = \"e\";\n"
+      "    switch (s) { case \"a\": print 1; case \"b\": print 2;\n"
+      "      case \"c\": print 3; case \"d\": print 4; case \"e\": print 5;\n"
+      "      default: print s; }\n"
+      "    subjects = subjects + 1; } }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+  expected = "<fn f>\n<fn g>\n5\n";
+  ASSERT_EQ(output->length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(output->buffer, expected, strlen(expected)), 0);
+  output->length = 0;
+
+  result = interpret(&utest_fixture->vm,
+                     "switch (1) { case 1: print 1; case 1.0: print 2; }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_COMPILE_ERROR);
+  result = interpret(&utest_fixture->vm, "var x; switch (1) { case x: }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_COMPILE_ERROR);
+}
+
+UTEST_F(VMTestFixture, functions) {
+  InterpretResult result = interpret(
+      &utest_fixture->vm,
+      "fun fib(n) { if (n < 2) return n; return fib(n - 1) + fib(n - 2); }\n"
+      "fun sum(a, b, c) { var total = a + b; { var d = c; total = total + d; }"
+      " return total; }\n"
+      "fun nothing() { print \"called\"; }\n"
+      "print fib(15); print sum(1, 2, 3); print nothing(); print nothing;\n"
+      "{ var before = 1; fun twice(x) { return x * 2; }\n"
+      "  print twice(before + 1) + before; }");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+
+  const char *expected = "610\n6\ncalled\nnil\n<fn nothing>\n5\n";
+  Output *output = &utest_fixture->vm.output;
+  ASSERT_EQ(output->length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(output->buffer, expected, strlen(expected)), 0);
+  output->length = 0;
+
+  const char *errors[] = {
+      "fib(1, 2);", "var x = 1; x();", "fun f() { f(); } f();",
+      "fun g() { return nil + 1; } g();"};
+  for (int i = 0; i < 4; i++) {
+    result = interpret(&utest_fixture->vm, errors[i]);
+    EXPECT_EQ(result, (InterpretResult)INTERPRET_RUNTIME_ERROR);
+    // The stack is left empty for the next script.
+    EXPECT_EQ(utest_fixture->vm.stackTop, utest_fixture->vm.stack);
+  }
+
+  result = interpret(&utest_fixture->vm, "return 1;");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_COMPILE_ERROR);
+}
+
+static Value nativeSum(int argCount, Value *args) {
+  double sum = 0;
+  for (int i = 0; i < argCount; i++)
+    sum += AS_NUMBER(args[i]);
+  return NUMBER_VAL(sum);
+}
+
+static Value nativeZero(__attribute__((unused)) int argCount,
+                        __attribute__((unused)) Value *args) {
+  return NUMBER_VAL(0);
+}
+
+UTEST_F(VMTestFixture, natives) {
+  VM *vm = &utest_fixture->vm;
+  defineNative(vm, "sum3", nativeSum, 3);
+  defineNative(vm, "zero", nativeZero, 0);
+
+  InterpretResult result = interpret(
+      vm, "print sum3(1, 2, 3); print zero() + 1;\n"
+          "fun twice(x) { return sum3(x, x, zero()); }\n"
+          "{ var a = 4; print twice(sum3(a, a, 1)) + a; }\n"
+          "var s = sum3; print s; print s(zero(), 10, zero());");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+  // The stack holds only what the script put on it.
+  ASSERT_EQ(vm->stackTop, vm->stack);
+
+  const char *expected = "6\n1\n22\n<native sum3>\n10\n";
+  ASSERT_EQ(vm->output.length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(vm->output.buffer, expected, strlen(expected)), 0);
+  vm->output.length = 0;
+
+  ASSERT_EQ(interpret(vm, "sum3(1, 2);"),
+            (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  EXPECT_EQ(vm->stackTop, vm->stack);
+}
+
+UTEST_F(VMTestFixture, closures) {
+  VM *vm = &utest_fixture->vm;
+  InterpretResult result = interpret(
+      vm,
+      "fun counter() { var n = 0; fun next() { n = n + 1; return n; }"
+      " return next; }\n"
+      "var a = counter(); var b = counter(); a(); print a(); print b();\n"
+      // Closures capturing the same variable share it.
+      "var get;\n"
+      "fun pair() { var v = \"x\"; fun g() { return v; }"
+      " fun set(s) { v = s; } get = g; set(\"y\"); print v; return set; }\n"
+      "pair()(\"z\"); print get();\n"
+      "fun outer(x) { fun middle() { fun inner() { return x; } return inner; }"
+      " return middle; }\n"
+      "print outer(3)()();\n"
+      // A bound assigned by a call is read again each time.
+      "{ var n = 3; fun grow() { n = 5; }"
+      "  for (var i = 0; i < n; i = i + 1) { if (i == 0) grow(); print i; } }\n"
+      "print a;");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(vm->openUpvalues, NULL);
+
+  const char *expected = "2\n1\ny\nz\n3\n0\n1\n2\n3\n4\n<fn next>\n";
+  ASSERT_EQ(vm->output.length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(vm->output.buffer, expected, strlen(expected)), 0);
+  vm->output.length = 0;
+
+  // A variable captured when the error stops the script keeps its value.
+  ASSERT_EQ(interpret(vm, "fun f() { var x = 7; fun g() { return x; } get = g;"
+                          " return nil + 1; } f();"),
+            (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  ASSERT_EQ(vm->openUpvalues, NULL);
+  ASSERT_EQ(interpret(vm, "print get();"), (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(vm->output.length, 2);
+  ASSERT_EQ(memcmp(vm->output.buffer, "7\n", 2), 0);
+  vm->output.length = 0;
+}
+
+// Calls returning their result take over the caller's frame, so recursing in
+// them takes no more frames or stack however deep, closing what the frame's
+// locals captured as they go.
+UTEST_F(VMTestFixture, tailCallsRunInConstantSpace) {
+  VM *vm = &utest_fixture->vm;
+  InterpretResult result = interpret(
+      vm, "fun count(n, total) {"
+          "  if (n == 0) return total; return count(n - 1, total + 1); }\n"
+          "fun even(n) { if (n == 0) return true; return odd(n - 1); }\n"
+          "fun odd(n) { if (n == 0) return false; return even(n - 1); }\n"
+          "fun keep(n, get) { var x = n; fun got() { return x; }"
+          "  if (n == 0) return get(); return keep(n - 1, got); }\n"
+          "print count(1000000, 0) == 1000000;"
+          "print even(1000000); print odd(1000001);"
+          "print keep(1000000, nil);");
+  ASSERT_EQ(result, (InterpretResult)INTERPRET_OK);
+  EXPECT_EQ(vm->stackEnd - vm->stack, STACK_MIN);
+  EXPECT_EQ(vm->openUpvalues, NULL);
+
+  const char *expected = "true\ntrue\ntrue\n1\n";
+  ASSERT_EQ(vm->output.length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(vm->output.buffer, expected, strlen(expected)), 0);
+  vm->output.length = 0;
+
+  // Without one, the frames run out.
+  result = interpret(vm, "fun up(n) { if (n == 0) return 0;"
+                         "  return up(n - 1) + 1; } up(1000);");
+  EXPECT_EQ(result, (InterpretResult)INTERPRET_RUNTIME_ERROR);
+}
+
+// Open upvalues point into the stack, so move with it as it grows.
+UTEST_F(VMTestFixture, upvaluesMoveWithTheStack) {
+  static char source[4 * 1024];
+  int length = sprintf(source, "{ var v = \"before\";"
+                               " fun set(s) { v = s; } fun get() { return v; }"
+                               " fun r(n) {");
+  for (int i = 0; i < 10; i++)
+    length += sprintf(source + length, " var a%d = n;", i);
+  sprintf(source + length, " if (n == 0) { set(\"after\"); return get(); }"
+                           " var s = r(n - 1); return s; }\n"
+                           "  print r(50); print v; }");
+
+  VM *vm = &utest_fixture->vm;
+  ASSERT_EQ(interpret(vm, source), (InterpretResult)INTERPRET_OK);
+  ASSERT_GT(vm->stackEnd - vm->stack, STACK_MIN);
+
+  const char *expected = "after\nafter\n";
+  ASSERT_EQ(vm->output.length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(vm->output.buffer, expected, strlen(expected)), 0);
+  vm->output.length = 0;
+}
+
+// Functions compiled by one VM run in another as copies, with its strings.
+UTEST(VM, sharedChunkWithFunctions) {
+  VM owner, other;
+  initVM(&owner);
+  initVM(&other);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  ASSERT_TRUE(compile("fun greet(name) { return \"hi \" + name; }\n"
+                      "fun twice(name) { return greet(name) + greet(name); }\n"
+                      "print twice(\"a\") == \"hi ahi a\";",
+                      &chunk, &owner.gc, &owner.strings));
+
+  VM *vms[] = {&owner, &other, &other};
+  for (int i = 0; i < 3; i++) {
+    Output *output = &vms[i]->output;
+    ASSERT_EQ(interpretChunk(vms[i], &chunk), (InterpretResult)INTERPRET_OK);
+    ASSERT_EQ(output->length, 5);
+    ASSERT_EQ(memcmp(output->buffer, "true\n", 5), 0);
+    output->length = 0;
+  }
+
+  // Each run of the other VM defined its own copy, in its own heap.
+  ObjString *name = copyString(&other.gc, &other.strings, "greet", 5);
+  Value greet;
+  ASSERT_TRUE(tableGet(&other.globals, name, &greet));
+  ASSERT_TRUE(IS_FUNCTION(greet));
+  ASSERT_EQ(AS_FUNCTION(greet)->name, name);
+  ASSERT_EQ(AS_FUNCTION(greet)->chunk.code,
+            AS_FUNCTION(chunk.constants.values[1])->chunk.code);
+
+  freeVM(&other);
+  freeChunk(&owner.gc, &chunk);
+  freeVM(&owner);
+}
+
+// The first function the chunk declares.
+static ObjFunction *firstFunction(const Chunk *chunk) {
+  for (int i = 0; i < chunk->constants.count; i++) {
+    if (IS_FUNCTION(chunk->constants.values[i]))
+      return AS_FUNCTION(chunk->constants.values[i]);
+  }
+  return NULL;
+}
+
+// A chunk's constants are kept by the heap that compiled it between runs, and
+// are left where they are as that heap is collected and compacted, along with
+// the names of its functions, nested ones included.
+UTEST(VM, sharedChunkOutlivesCollections) {
+  VM owner, other;
+  initVM(&owner);
+  initVM(&other);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  ASSERT_TRUE(compile("fun greet(name) {"
+                      "  fun hi() { return \"hi \"; } return hi() + name; }\n"
+                      "print greet(\"a\");",
+                      &chunk, &owner.gc, &owner.strings));
+  Value constants[UINT8_COUNT];
+  int count = chunk.constants.count;
+  memcpy(constants, chunk.constants.values, sizeof(Value) * count);
+  ObjFunction *greet = firstFunction(&chunk);
+  ObjFunction *hi = firstFunction(&greet->chunk);
+  ASSERT_NE(hi, NULL);
+  ObjString *greetName = greet->name, *hiName = hi->name;
+
+  for (int run = 0; run < 2; run++) {
+    ASSERT_EQ(interpretChunk(&other, &chunk), (InterpretResult)INTERPRET_OK);
+    ASSERT_EQ(other.output.length, 5);
+    ASSERT_EQ(memcmp(other.output.buffer, "hi a\n", 5), 0);
+    other.output.length = 0;
+
+    ASSERT_EQ(interpret(&owner, "var t = \"\";"
+                                "for (var i = 0; i < 3000; i = i + 1)"
+                                "  t = t + \"x\";"
+                                "t = nil;"),
+              (InterpretResult)INTERPRET_OK);
+    collectAllGarbage(&owner.gc);
+    compactHeap(&owner.gc);
+    ASSERT_EQ(memcmp(chunk.constants.values, constants, sizeof(Value) * count),
+              0);
+    ASSERT_EQ(greet->name, greetName);
+    ASSERT_EQ(hi->name, hiName);
+    ASSERT_STREQ(hiName->chars, "hi");
+  }
+
+  ASSERT_EQ(interpretChunk(&owner, &chunk), (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(owner.output.length, 5);
+  ASSERT_EQ(memcmp(owner.output.buffer, "hi a\n", 5), 0);
+  owner.output.length = 0;
+
+  freeVM(&other);
+  freeChunk(&owner.gc, &chunk);
+  freeVM(&owner);
+}
+
+// The stack grows past its first size for a deep expression, and for calls
+// with many locals, keeping the values already on it.
+UTEST_F(VMTestFixture, stackGrows) {
+  static char source[8 * 1024];
+  int length = sprintf(source, "print ");
+  for (int i = 0; i < 600; i++)
+    length += sprintf(source + length, "(1 + ");
+  length += sprintf(source + length, "1");
+  for (int i = 0; i < 600; i++)
+    length += sprintf(source + length, ")");
+  length += sprintf(source + length, ";\nfun r(n) {");
+  for (int i = 0; i < 100; i++)
+    length += sprintf(source + length, " var a%d = n;", i);
+  sprintf(source + length, " if (n == 0) return a99; return r(n - 1) + a0; }\n"
+                           "print r(50);");
+
+  VM *vm = &utest_fixture->vm;
+  ASSERT_EQ(interpret(vm, source), (InterpretResult)INTERPRET_OK);
+  ASSERT_GT(vm->stackEnd - vm->stack, STACK_MIN);
+
+  const char *expected = "601\n1275\n";
+  ASSERT_EQ(vm->output.length, (int)strlen(expected));
+  ASSERT_EQ(memcmp(vm->output.buffer, expected, strlen(expected)), 0);
+  vm->output.length = 0;
+}
+
+// Code that was not verified runs checking each instruction first, and stops
+// at one that may not run.
+UTEST_F(VMTestFixture, unverifiedCodeRunsChecked) {
+  VM *vm = &utest_fixture->vm;
+  Chunk chunk;
+  initChunk(&chunk);
+  ASSERT_TRUE(compile("fun f(a) { return a + 1; }\n"
+                      "{ var x = 1;"
+                      "  for (var i = 0; i < 3; i = i + 1) x = f(x);"
+                      "  print x; }",
+                      &chunk, &vm->gc, &vm->strings));
+  ASSERT_TRUE(chunk.verified);
+  ASSERT_TRUE(firstFunction(&chunk)->chunk.verified);
+
+  chunk.verified = false;
+  ASSERT_EQ(interpretChunk(vm, &chunk), (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(vm->output.length, 2);
+  ASSERT_EQ(memcmp(vm->output.buffer, "4\n", 2), 0);
+  vm->output.length = 0;
+
+  // Verified code carries on checked once it calls code that was not.
+  chunk.verified = true;
+  firstFunction(&chunk)->chunk.verified = false;
+  ASSERT_EQ(interpretChunk(vm, &chunk), (InterpretResult)INTERPRET_OK);
+  ASSERT_EQ(vm->output.length, 2);
+  ASSERT_EQ(memcmp(vm->output.buffer, "4\n", 2), 0);
+  vm->output.length = 0;
+
+  // Reads past its only argument.
+  ObjFunction *f = firstFunction(&chunk);
+  ASSERT_EQ(f->chunk.code[0], OP_GET_LOCAL);
+  f->chunk.code[1] = 1;
+  ASSERT_EQ(interpretChunk(vm, &chunk),
+            (InterpretResult)INTERPRET_RUNTIME_ERROR);
+  ASSERT_EQ(vm->output.length, 0);
+
+  freeChunk(&vm->gc, &chunk);
+}